@@ -0,0 +1,201 @@
+#include "animation_compressor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "glm/gtc/quaternion.hpp"
+
+// Keys within this fraction of a frame from one still count as being on it, float times exported as
+// frame / rate are rarely exact
+constexpr float FRAME_TOLERANCE{ 0.01f };
+
+constexpr uint32_t MAX_TICK{ std::numeric_limits<uint16_t>::max() };
+
+float chooseTimeStep(const std::vector<SourceTrack>& tracks, float end)
+{
+	for (float rate : ANIMATION_FRAME_RATES) {
+		if (end * rate > MAX_TICK) {
+			break;
+		}
+
+		bool onFrames{ true };
+		for (const SourceTrack& track : tracks) {
+			for (float time : track.times) {
+				float frame{ time * rate };
+				if (std::abs(frame - std::round(frame)) > FRAME_TOLERANCE) {
+					onFrames = false;
+					break;
+				}
+			}
+			if (!onFrames) break;
+		}
+
+		if (onFrames) {
+			return 1.0f / rate;
+		}
+	}
+
+	return end > 0.0f ? end / MAX_TICK : 1.0f;
+}
+
+static glm::dquat toQuat(const glm::vec4& v)
+{
+	return glm::normalize(glm::dquat{ v.w, v.x, v.y, v.z });
+}
+
+// Angle between two rotations, or distance between two translations or scales. acos of the dot product loses
+// everything below about 1e-3 radians to rounding, the half angle between the quaternions from atan2 doesn't
+static double keyError(const SourceTrack& track, const glm::vec4& a, const glm::vec4& b)
+{
+	if (track.rotation) {
+		glm::dquat p{ toQuat(a) };
+		glm::dquat q{ toQuat(b) };
+		if (glm::dot(p, q) < 0.0) {
+			q = -q;
+		}
+		return 4.0 * std::atan2(glm::length(p - q), glm::length(p + q));
+	}
+	return glm::distance(glm::dvec3{ a }, glm::dvec3{ b });
+}
+
+// Whether linear interpolation from key first to key last reproduces every key between them within tolerance
+static bool spanFits(const SourceTrack& track, size_t first, size_t last, float tolerance)
+{
+	double duration{ (double)track.times[last] - track.times[first] };
+	if (duration <= 0.0) {
+		return false;
+	}
+
+	for (size_t i = first + 1; i < last; ++i) {
+		double a{ (track.times[i] - track.times[first]) / duration };
+		glm::vec4 interpolated;
+		if (track.rotation) {
+			glm::dquat q{ glm::slerp(toQuat(track.values[first]), toQuat(track.values[last]), a) };
+			interpolated = glm::vec4{ q.x, q.y, q.z, q.w };
+		} else {
+			interpolated = glm::vec4{ glm::mix(glm::dvec4{ track.values[first] }, glm::dvec4{ track.values[last] }, a) };
+		}
+		if (keyError(track, interpolated, track.values[i]) > tolerance) {
+			return false;
+		}
+	}
+	return true;
+}
+
+std::vector<uint32_t> reduceKeyframes(const SourceTrack& track, float tolerance)
+{
+	size_t count{ track.times.size() };
+	std::vector<uint32_t> keep;
+	if (count == 0) {
+		return keep;
+	}
+
+	keep.push_back(0);
+
+	bool constant{ true };
+	for (size_t i = 1; i < count && constant; ++i) {
+		constant = keyError(track, track.values[0], track.values[i]) <= tolerance;
+	}
+	if (constant) {
+		return keep;
+	}
+
+	if (track.interpolation == Interpolation::STEP) {
+		// a step key only matters where the value changes
+		for (size_t i = 1; i < count; ++i) {
+			if (keyError(track, track.values[keep.back()], track.values[i]) > tolerance) {
+				keep.push_back((uint32_t)i);
+			}
+		}
+		return keep;
+	}
+
+	// grow each span until interpolating across it misses one of the keys it skips, then start the next span at the
+	// last key that still fit
+	size_t anchor{ 0 };
+	for (size_t last = 2; last < count; ++last) {
+		if (!spanFits(track, anchor, last, tolerance)) {
+			anchor = last - 1;
+			keep.push_back((uint32_t)anchor);
+		}
+	}
+	keep.push_back((uint32_t)(count - 1));
+
+	return keep;
+}
+
+static void encodeRotation(const glm::vec4& rotation, uint16_t* key)
+{
+	float q[4]{ rotation.x, rotation.y, rotation.z, rotation.w };
+
+	uint32_t largest{ 0 };
+	for (uint32_t i = 1; i < 4; ++i) {
+		if (std::abs(q[i]) > std::abs(q[largest])) {
+			largest = i;
+		}
+	}
+	// q and -q are the same rotation, so the dropped component is always positive
+	float sign{ q[largest] < 0.0f ? -1.0f : 1.0f };
+
+	for (uint32_t i = 0, k = 0; i < 4; ++i) {
+		if (i == largest) continue;
+		float v{ std::clamp(q[i] * sign * 1.41421356f, -1.0f, 1.0f) };
+		key[k++] = (uint16_t)(std::round(v * 16383.0f) + 16383.0f);
+	}
+	key[0] |= (uint16_t)((largest & 1) << 15);
+	key[1] |= (uint16_t)((largest >> 1) << 15);
+}
+
+void encodeTrack(AnimationSampler& sampler, std::vector<uint16_t>& times, std::vector<uint16_t>& keys, const SourceTrack& track,
+	const std::vector<uint32_t>& keep, float timeStep)
+{
+	sampler.interpolation = track.interpolation;
+	sampler.firstKey = (uint32_t)times.size();
+
+	std::vector<uint32_t> kept;
+	kept.reserve(keep.size());
+	for (uint32_t index : keep) {
+		uint16_t tick{ (uint16_t)std::clamp(std::round(track.times[index] / timeStep), 0.0f, (float)MAX_TICK) };
+		if (times.size() > sampler.firstKey && times.back() == tick) {
+			continue;
+		}
+		times.push_back(tick);
+		kept.push_back(index);
+	}
+
+	sampler.keyCount = (uint32_t)kept.size();
+	size_t firstValue{ keys.size() };
+	keys.resize(firstValue + kept.size() * 3);
+	uint16_t* key{ keys.data() + firstValue };
+
+	if (track.rotation) {
+		for (int c = 0; c < 3; ++c) {
+			sampler.rangeMin[c] = 0.0f;
+			sampler.rangeExtent[c] = 0.0f;
+		}
+		for (size_t i = 0; i < kept.size(); ++i) {
+			encodeRotation(track.values[kept[i]], key + i * 3);
+		}
+		return;
+	}
+
+	glm::vec3 min{ std::numeric_limits<float>::max() };
+	glm::vec3 max{ std::numeric_limits<float>::lowest() };
+	for (uint32_t index : kept) {
+		min = glm::min(min, glm::vec3{ track.values[index] });
+		max = glm::max(max, glm::vec3{ track.values[index] });
+	}
+	for (int c = 0; c < 3; ++c) {
+		sampler.rangeMin[c] = min[c];
+		sampler.rangeExtent[c] = max[c] - min[c];
+	}
+
+	for (size_t i = 0; i < kept.size(); ++i) {
+		for (int c = 0; c < 3; ++c) {
+			float extent{ sampler.rangeExtent[c] };
+			float v{ extent > 0.0f ? (track.values[kept[i]][c] - min[c]) / extent : 0.0f };
+			key[i * 3 + c] = (uint16_t)std::round(std::clamp(v, 0.0f, 1.0f) * 65535.0f);
+		}
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "vk_mesh.h"
+
+// Keyframes of one glTF sampler as read from the file, before reduction and quantization. Translations and scales
+// leave w at 0, rotations are normalized
+struct SourceTrack {
+	Interpolation interpolation;
+	bool rotation;
+	std::vector<float> times;
+	std::vector<glm::vec4> values;
+};
+
+// Frame rates the baker tries to put the keys of an animation on, so sampled animations get a tick per frame
+constexpr float ANIMATION_FRAME_RATES[]{ 24.0f, 25.0f, 30.0f, 48.0f, 50.0f, 60.0f, 120.0f, 240.0f };
+
+// Picks the seconds per tick shared by every sampler of an animation ending at end: one frame of the lowest rate in
+// ANIMATION_FRAME_RATES that every key lands on, otherwise the whole animation split into as many ticks as uint16_t holds
+float chooseTimeStep(const std::vector<SourceTrack>& tracks, float end);
+
+// Indices of the keys that have to stay so interpolating between them reproduces every key of the track within
+// tolerance, in radians for rotations and the distance between values for translations and scales.
+// Tracks that never move further than tolerance keep a single key
+std::vector<uint32_t> reduceKeyframes(const SourceTrack& track, float tolerance);
+
+// Quantizes the keep keys of track and appends them to the time and key arrays shared by every sampler of a skeleton,
+// pointing sampler at them. See AnimationSampler for the layout. Keys landing on the same tick as the one before them
+// are dropped
+void encodeTrack(AnimationSampler& sampler, std::vector<uint16_t>& times, std::vector<uint16_t>& keys, const SourceTrack& track,
+	const std::vector<uint32_t>& keep, float timeStep);
@@ -5,17 +5,38 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <limits>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <type_traits>
+#include <initializer_list>
+#include <iterator>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ASSET_BAKER_SSE2 1
+#include <emmintrin.h>
+#else
+#define ASSET_BAKER_SSE2 0
+#endif
 
 #include "json.hpp"
 
 #define STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_RESIZE_IMPLEMENTATION
 #include "stb_image.h"
-#include "stb_image_resize.h"
 
 #include "asset_loader.h"
 #include "texture_asset.h"
 #include "vk_mesh_asset.h"
+#include "asset_archive.h"
+#include "mapped_file.h"
+#include "compression.h"
+#include "mesh_optimizer.h"
+#include "texture_encoder.h"
+#include "mip_generator.h"
+#include "animation_compressor.h"
+#include "job_pool.h"
+#include "bake_manifest.h"
+#include "lz4hc.h"
 
 #define TINYGLTF_IMPLEMENTATION
 #include "tiny_gltf.h"
@@ -28,21 +49,242 @@
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/type_ptr.hpp"
 #include "glm/gtx/string_cast.hpp"
-#include "cereal/archives/binary.hpp"
-#include "cereal/types/vector.hpp"
-#include "cereal/types/string.hpp"
 
 namespace fs = std::filesystem;
 using namespace assets;
 
+// Bumped whenever a change to the baker changes its output for the same inputs and settings,
+// so the bake manifest doesn't skip sources baked by an older version
+constexpr uint32_t BAKER_VERSION{ 9 };
+
+enum class AssetKind {
+	Texture,
+	Mesh
+};
+
+// Tallies stored size and decode time of every blob for each compression mode
+struct CompressionReport {
+	struct Entry {
+		const char* name;
+		CompressionMode mode;
+		int level;
+		uint64_t originalSize;
+		uint64_t storedSize;
+		double decodeMs;
+	};
+
+	std::vector<Entry> entries{
+		{ "None", CompressionMode::None, 0 },
+		{ "LZ4", CompressionMode::LZ4Blocks, 0 },
+		{ "LZ4HC 4", CompressionMode::LZ4HC, 4 },
+		{ "LZ4HC 9", CompressionMode::LZ4HC, 9 },
+		{ "LZ4HC 12", CompressionMode::LZ4HC, LZ4HC_CLEVEL_MAX },
+	};
+
+	// blobs are added from every job thread
+	std::mutex mutex;
+
+	void add(const std::vector<char>& blob);
+	void print() const;
+};
+
+// Dictionary shared by every mesh of the export tree, so a block can reference the byte patterns all models have in common.
+// A new one can only be trained once every mesh of the bake is known, so until then meshes are written uncompressed and
+// finishMeshDictionary compresses them. Meshes left from an earlier bake were compressed with the dictionary on disk, so
+// it is used right away instead unless every source is baked again
+struct MeshDictionary {
+	// whether the dictionary of the previous bake is used
+	bool reuse{ false };
+	// the previous bake's dictionary, empty if it kept none
+	std::vector<char> dictionary;
+
+	// meshes waiting to be compressed, written from every job thread
+	std::mutex mutex;
+	std::vector<fs::path> staged;
+};
+
 struct ConverterState {
 	fs::path asset_path;
 	fs::path export_path;
 
+	// set with -compression-report, compresses every blob with every mode and prints a size vs. decode time table
+	CompressionReport* compressionReport{ nullptr };
+
+	// set with -json-sidecar, writes each asset's metadata next to it as <asset>.json for debugging
+	bool jsonSidecar{ false };
+
+	// set with -float-vertices, keeps mesh vertices as floats instead of quantizing them
+	bool floatVertices{ false };
+
+	// cleared with -no-mesh-optimization, keeps triangles and vertices in the order the glTF exporter wrote them
+	bool optimizeMeshes{ true };
+
+	// cleared with -no-vertex-dedup, keeps vertices that are exact copies of another one
+	bool deduplicateVertices{ true };
+
+	// set with -weld-vertices <epsilon>, also merges vertices whose attributes are all within epsilon of each other,
+	// which for positions is relative to the radius of the mesh
+	float weldEpsilon{ 0.0f };
+
+	// set with -animation-tolerance <error>, how far reduced animation tracks may stray from the keys they replace,
+	// in radians for rotations and in glTF units for translations and scales. 0 keeps every key
+	float animationTolerance{ 0.0001f };
+
+	// set with -meshlets, splits meshes into meshlets the engine culls individually
+	bool meshlets{ false };
+
+	// cleared with -no-lods, only stores the full detail mesh
+	bool lods{ true };
+
+	// cleared with -no-texture-compression, stores textures as RGBA8 instead of block compressing them
+	bool compressTextures{ true };
+
+	// set with -bc1-color-textures, color textures use BC1, or BC3 when they have alpha, instead of the higher quality BC7
+	bool bc1ColorTextures{ false };
+
+	// dictionary of the meshes of the export tree, see MeshDictionary
+	MeshDictionary* meshDictionary{ nullptr };
+
+	// runs every file as a job, and the mip levels and block rows of textures as jobs of their own. Sized with -j
+	JobPool* jobPool{ nullptr };
+
 	fs::path convertToExportRelative(fs::path path) const;
+
+	// version and every setting that changes what the baker writes, stored in the bake manifest
+	nlohmann::json bakerKey() const;
 };
 
-bool convertImage(const fs::path& input, const fs::path& output)
+// Codec and level per asset type. Every mode decodes with the same LZ4 block decoder, so the
+// extra bake time spent on LZ4HC buys smaller files without making loads slower.
+CompressionSettings compressionPolicy(AssetKind kind)
+{
+	CompressionSettings settings{};
+	settings.mode = CompressionMode::LZ4HC;
+
+	switch (kind) {
+	case AssetKind::Texture:
+		// textures are by far the largest assets, and levels above the default get much slower for little gain on them
+		settings.level = LZ4HC_CLEVEL_DEFAULT;
+		break;
+	case AssetKind::Mesh:
+		settings.level = LZ4HC_CLEVEL_MAX;
+		break;
+	}
+
+	return settings;
+}
+
+// Writes an asset with AssetWriter while its blob is produced, so the baker never holds a whole blob. settings is usually
+// compressionPolicy of its kind. With -compression-report the blob is gathered anyway, since the report compresses every
+// blob whole in every mode. metadata is only written out when the JSON sidecar is enabled, the asset itself stores a binary
+// info struct
+class BakedAsset {
+public:
+	bool open(const fs::path& path, const char type[4], const std::vector<char>& info, uint64_t blobSize,
+		const CompressionSettings& settings, const ConverterState& convState);
+
+	bool write(const void* data, size_t size);
+
+	bool close(const nlohmann::json& metadata);
+
+private:
+	AssetWriter _writer;
+	fs::path _path;
+	const ConverterState* _convState{ nullptr };
+	std::vector<char> _reportBlob;
+};
+
+bool BakedAsset::open(const fs::path& path, const char type[4], const std::vector<char>& info, uint64_t blobSize,
+	const CompressionSettings& settings, const ConverterState& convState)
+{
+	_path = path;
+	_convState = &convState;
+	if (convState.compressionReport) {
+		_reportBlob.reserve(blobSize);
+	}
+	return _writer.open(path.string().c_str(), type, info, blobSize, settings);
+}
+
+bool BakedAsset::write(const void* data, size_t size)
+{
+	if (_convState->compressionReport) {
+		_reportBlob.insert(_reportBlob.end(), (const char*)data, (const char*)data + size);
+	}
+
+	if (!_writer.write(data, size)) {
+		std::cout << "Error when writing asset: " << _path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool BakedAsset::close(const nlohmann::json& metadata)
+{
+	if (!_writer.close()) {
+		std::cout << "Error when writing asset: " << _path << std::endl;
+		return false;
+	}
+
+	if (_convState->compressionReport) {
+		_convState->compressionReport->add(_reportBlob);
+		_reportBlob = std::vector<char>{};
+	}
+
+	return !_convState->jsonSidecar || _writer.writeDebugMetadata(metadata);
+}
+
+// What a texture holds, picked from the suffix of its file name like brick_diff.png or brick_nor_gl.png
+enum class TextureRole {
+	Color,
+	Normal,
+	// a single channel such as roughness or ambient occlusion
+	Mask,
+	// anything else, such as several masks packed into one texture
+	Data
+};
+
+TextureRole textureRole(const fs::path& input)
+{
+	std::string stem{ input.stem().generic_string() };
+	auto endsWith = [&](const char* suffix) {
+		size_t length{ strlen(suffix) };
+		return stem.size() >= length && stem.compare(stem.size() - length, length, suffix) == 0;
+	};
+
+	if (endsWith("_diff")) {
+		return TextureRole::Color;
+	}
+	for (const char* suffix : { "_nor", "_nor_gl", "_nor_dx", "_normal" }) {
+		if (endsWith(suffix)) {
+			return TextureRole::Normal;
+		}
+	}
+	for (const char* suffix : { "_rough", "_roughness", "_ao", "_metal", "_metallic", "_spec", "_disp" }) {
+		if (endsWith(suffix)) {
+			return TextureRole::Mask;
+		}
+	}
+	return TextureRole::Data;
+}
+
+// BC7 takes 8 bits per texel and BC1 and BC4 take 4, down from 32 for RGBA8
+TextureFormat blockFormat(TextureRole role, bool hasAlpha, const ConverterState& convState)
+{
+	switch (role) {
+	case TextureRole::Color:
+		if (convState.bc1ColorTextures) {
+			return hasAlpha ? TextureFormat::BC3_SRGB : TextureFormat::BC1_SRGB;
+		}
+		return TextureFormat::BC7_SRGB;
+	case TextureRole::Mask:
+		return TextureFormat::BC4;
+	default:
+		// normal maps keep all three channels, the shaders read z from the texture instead of reconstructing it
+		return TextureFormat::BC7;
+	}
+}
+
+bool convertImage(const fs::path& input, const fs::path& output, const ConverterState& convState)
 {
 	int texWidth, texHeight, texChannels;
 
@@ -61,573 +303,1137 @@ bool convertImage(const fs::path& input, const fs::path& output)
 		return false;
 	}
 
-	int texture_size{ texWidth * texHeight * 4 };
-
 	TextureInfo texinfo;
-	texinfo.originalSize = texture_size;
-
 
-	std::string s{ input.filename().generic_string() };
-	bool colorTexture{ s.size() >= 9 && (s.substr(s.size() - 9, 5) == "_diff") };
+	TextureRole role{ textureRole(input) };
+	bool colorTexture{ role == TextureRole::Color };
 
 	texinfo.textureFormat = colorTexture ? TextureFormat::SRGBA8 : TextureFormat::RGBA8;
 	texinfo.originalFile = input.string();
-
-	auto mipStart{ std::chrono::high_resolution_clock::now() };
-
 	texinfo.width = texWidth;
 	texinfo.height = texHeight;
+	texinfo.miplevels = mipLevelCount(texinfo.width, texinfo.height);
 
-	std::vector<unsigned char> allBuffer;
-
+	if (convState.compressTextures) {
+		bool hasAlpha{ false };
+		for (size_t i = 3; i < (size_t)texWidth * texHeight * 4; i += 4) {
+			hasAlpha |= pixels[i] != 255;
+		}
+		texinfo.textureFormat = blockFormat(role, hasAlpha, convState);
+	}
 
-	size_t allBufferSize{ (size_t)texture_size };
+	size_t uncompressedSize{ 0 };
+	texinfo.originalSize = 0;
 	uint32_t width{ texinfo.width };
 	uint32_t height{ texinfo.height };
-	uint32_t miplevels{ 1 };
+	for (uint32_t level = 0; level < texinfo.miplevels; ++level) {
+		uncompressedSize += (size_t)width * height * 4;
+		texinfo.originalSize += textureLevelSize(texinfo.textureFormat, width, height);
+		width = nextMipSize(width);
+		height = nextMipSize(height);
+	}
 
-	// make mipmaps
-	while (width > 1 || height > 1) {
-		width >>= 1;
-		height >>= 1;
-		allBufferSize += (size_t)width * height * 4;
-		++miplevels;
+	nlohmann::json textureMetadata;
+	textureMetadata["format"] = textureFormatName(texinfo.textureFormat);
+	textureMetadata["original_size"] = texinfo.originalSize;
+	textureMetadata["original_file"] = texinfo.originalFile;
+	textureMetadata["miplevels"] = texinfo.miplevels;
+	textureMetadata["width"] = texinfo.width;
+	textureMetadata["height"] = texinfo.height;
+
+	BakedAsset asset;
+	if (!asset.open(output, "TEXI", packTextureInfo(&texinfo), texinfo.originalSize, compressionPolicy(AssetKind::Texture), convState)) {
+		stbi_image_free(pixels);
+		return false;
 	}
 
-	texinfo.miplevels = miplevels;
-	allBuffer.resize(allBufferSize);
+	// every level is written as soon as it's made, and made from the one above with its rows spread over the job pool, so
+	// only the source image, the next level and one encoded level are held at a time. Color textures are filtered in linear
+	// space, they are stored as sRGB
+	std::vector<unsigned char> levelPixels;
+	std::vector<unsigned char> nextPixels;
+	std::vector<unsigned char> encoded;
+	const unsigned char* current{ pixels };
+	double mipMs{ 0.0 };
+	double encodeMs{ 0.0 };
+
 	width = texinfo.width;
 	height = texinfo.height;
-	size_t mipSize{ (size_t)width * height * 4 };
-	unsigned char* ptr{ allBuffer.data() };
+	for (uint32_t level = 0; level < texinfo.miplevels; ++level) {
+		bool written;
+		if (convState.compressTextures) {
+			auto encodeStart{ std::chrono::high_resolution_clock::now() };
+			encoded.resize(textureLevelSize(texinfo.textureFormat, width, height));
+			compressTextureLevel(encoded.data(), current, width, height, texinfo.textureFormat, *convState.jobPool);
+			encodeMs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - encodeStart).count() / 1000000.0;
+
+			written = asset.write(encoded.data(), encoded.size());
+		} else {
+			written = asset.write(current, (size_t)width * height * 4);
+		}
 
-	memcpy(ptr, pixels, mipSize);
+		if (!written) {
+			stbi_image_free(pixels);
+			return false;
+		}
 
-	while (mipSize > 0) {
-		stbir_resize_uint8(ptr, width, height, 0, ptr + mipSize, width / 2, height / 2, 0, 4);
-		ptr += mipSize;
-		width >>= 1;
-		height >>= 1;
-		mipSize = (size_t)width * height * 4;
+		if (level + 1 < texinfo.miplevels) {
+			auto mipStart{ std::chrono::high_resolution_clock::now() };
+			nextPixels.resize((size_t)nextMipSize(width) * nextMipSize(height) * 4);
+			downsampleLevel(nextPixels.data(), current, width, height, colorTexture, *convState.jobPool);
+			levelPixels.swap(nextPixels);
+			current = levelPixels.data();
+			mipMs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - mipStart).count() / 1000000.0;
+		}
+
+		// the source image is only needed for the first level
+		if (level == 0) {
+			stbi_image_free(pixels);
+			pixels = nullptr;
+		}
+
+		width = nextMipSize(width);
+		height = nextMipSize(height);
 	}
 
-	auto mipEnd{ std::chrono::high_resolution_clock::now() };
-	auto mipDiff{ mipEnd - mipStart };
+	std::cout << "creating mipmaps took " << mipMs << "ms" << std::endl;
+	if (convState.compressTextures) {
+		std::cout << "encoding " << textureFormatName(texinfo.textureFormat) << " took " << encodeMs << "ms, "
+			<< uncompressedSize << " -> " << texinfo.originalSize << " bytes" << std::endl;
+	}
 
-	std::cout << "creating mipmaps took " << std::chrono::duration_cast<std::chrono::nanoseconds>(mipDiff).count() / 1000000.0 << "ms" << std::endl;
+	return asset.close(textureMetadata);
+}
 
-	texinfo.originalSize = allBuffer.size();
-	assets::AssetFile newImage{ assets::packTexture(&texinfo, allBuffer.data()) };
+// Bytes of a glTF buffer, wherever they are
+struct GLTFBuffer {
+	const uint8_t* data;
+	size_t size;
+};
 
-	nlohmann::json textureMetadata;
-	textureMetadata["format"] = "RGBA8";
-	textureMetadata["original_size"] = texinfo.originalSize;
-	textureMetadata["original_file"] = texinfo.originalFile;
-	textureMetadata["miplevels"] = texinfo.miplevels;
-	textureMetadata["width"] = texinfo.width;
-	textureMetadata["height"] = texinfo.height;
+// A parsed glTF and its buffers. tinygltf copies the buffers of a .gltf into the model, while the binary chunk of
+// a .glb is never copied and is read straight from the mapped file, which stays open for as long as this does
+struct GLTFFile {
+	tinygltf::Model model;
+	MappedFile mapping;
+	std::vector<GLTFBuffer> buffers;
+};
 
-	stbi_image_free(pixels);
+// Start of a buffer view, which loadGLTF checked fits in its buffer
+const uint8_t* bufferViewDataGLTF(const GLTFFile& gltf, int bufferViewIndex)
+{
+	const tinygltf::BufferView& bufferView = gltf.model.bufferViews[bufferViewIndex];
+	return gltf.buffers[bufferView.buffer].data + bufferView.byteOffset;
+}
+
+// Elements of an accessor, read in place from its buffer view
+struct AccessorViewGLTF {
+	const uint8_t* data;
+	size_t stride;
+	size_t count;
+};
+
+// Checks an accessor once so its elements can be read without any checks: that it has the expected type and one of
+// the expected component types, and that its last element is inside its buffer view. Prints what is wrong otherwise
+bool viewAccessorGLTF(const GLTFFile& gltf, int accessorIndex, const char* name, int type, std::initializer_list<int> componentTypes, AccessorViewGLTF& view)
+{
+	if (accessorIndex < 0 || (size_t)accessorIndex >= gltf.model.accessors.size()) {
+		std::cout << "ERROR: Missing " << name << " accessor\n";
+		return false;
+	}
+
+	const tinygltf::Accessor& accessor = gltf.model.accessors[accessorIndex];
+	if (accessor.type != type || std::find(componentTypes.begin(), componentTypes.end(), accessor.componentType) == componentTypes.end()) {
+		std::cout << "ERROR: " << name << " accessor type mismatch\n";
+		return false;
+	}
+	if (accessor.bufferView < 0 || accessor.sparse.isSparse) {
+		std::cout << "ERROR: " << name << " accessor without a buffer view or with sparse storage is not supported\n";
+		return false;
+	}
 
-	// will write compression_mode field of textureMetadata, and write that to newImage before saving
-	saveBinaryFile(output.string().c_str(), textureMetadata, newImage);
+	const tinygltf::BufferView& bufferView = gltf.model.bufferViews[accessor.bufferView];
+	size_t elementSize{ (size_t)tinygltf::GetComponentSizeInBytes(accessor.componentType) * tinygltf::GetNumComponentsInType(accessor.type) };
+	size_t stride{ bufferView.byteStride ? bufferView.byteStride : elementSize };
 
+	if (accessor.count > 0 && accessor.byteOffset + stride * (accessor.count - 1) + elementSize > bufferView.byteLength) {
+		std::cout << "ERROR: " << name << " accessor is outside of its buffer view\n";
+		return false;
+	}
+
+	view = { bufferViewDataGLTF(gltf, accessor.bufferView) + accessor.byteOffset, stride, accessor.count };
 	return true;
 }
 
-void unpackBufferGLTF(tinygltf::Model& model, tinygltf::Accessor& accesor, std::vector<uint8_t>& outputBuffer)
+bool viewAttributeGLTF(const GLTFFile& gltf, const tinygltf::Primitive& primitive, const char* name, int type, int componentType, size_t count, AccessorViewGLTF& view)
 {
-	int bufferID = accesor.bufferView;
-	size_t elementSize = tinygltf::GetComponentSizeInBytes(accesor.componentType);
+	auto it = primitive.attributes.find(name);
+	if (!viewAccessorGLTF(gltf, it == primitive.attributes.end() ? -1 : it->second, name, type, { componentType }, view)) {
+		return false;
+	}
+	if (view.count != count) {
+		std::cout << "ERROR: " << name << " has " << view.count << " elements for " << count << " vertices\n";
+		return false;
+	}
+	return true;
+}
 
-	tinygltf::BufferView& bufferView = model.bufferViews[bufferID];
+// Copies an attribute of Size bytes into a vertex. With wide set the source has 16 readable bytes and 16 bytes may be
+// stored, which clobbers the start of the next field in the vertex, so fields have to be written in order
+template <size_t Size>
+inline void copyAttribute(void* destination, const uint8_t* source, bool wide)
+{
+#if ASSET_BAKER_SSE2
+	if (wide) {
+		_mm_storeu_si128((__m128i*)destination, _mm_loadu_si128((const __m128i*)source));
+		return;
+	}
+#endif
+	memcpy(destination, source, Size);
+}
 
-	tinygltf::Buffer& bufferData = (model.buffers[bufferView.buffer]);
+// Gathers every attribute of a primitive straight into its interleaved vertices in one pass. Each vertex takes 16 byte
+// loads and stores when every vec3 attribute has at least 12 bytes after it in its buffer, which holds for all but the
+// last vertex
+template <typename T>
+bool extractVerticesGLTF(const tinygltf::Primitive& primitive, const GLTFFile& gltf, std::vector<T>& _vertices)
+{
+	constexpr bool skinned{ std::is_same_v<T, VertexSkinned> };
 
+	auto positionIt = primitive.attributes.find("POSITION");
+	AccessorViewGLTF position;
+	if (!viewAccessorGLTF(gltf, positionIt == primitive.attributes.end() ? -1 : positionIt->second, "POSITION", TINYGLTF_TYPE_VEC3,
+		{ TINYGLTF_COMPONENT_TYPE_FLOAT }, position)) {
+		return false;
+	}
 
-	uint8_t* dataptr = bufferData.data.data() + accesor.byteOffset + bufferView.byteOffset;
+	size_t count{ position.count };
+	AccessorViewGLTF normal, tangent, uv, joints, weights;
+	if (!viewAttributeGLTF(gltf, primitive, "NORMAL", TINYGLTF_TYPE_VEC3, TINYGLTF_COMPONENT_TYPE_FLOAT, count, normal) ||
+		!viewAttributeGLTF(gltf, primitive, "TANGENT", TINYGLTF_TYPE_VEC4, TINYGLTF_COMPONENT_TYPE_FLOAT, count, tangent) ||
+		!viewAttributeGLTF(gltf, primitive, "TEXCOORD_0", TINYGLTF_TYPE_VEC2, TINYGLTF_COMPONENT_TYPE_FLOAT, count, uv)) {
+		return false;
+	}
+	if constexpr (skinned) {
+		if (!viewAttributeGLTF(gltf, primitive, "JOINTS_0", TINYGLTF_TYPE_VEC4, TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE, count, joints) ||
+			!viewAttributeGLTF(gltf, primitive, "WEIGHTS_0", TINYGLTF_TYPE_VEC4, TINYGLTF_COMPONENT_TYPE_FLOAT, count, weights)) {
+			return false;
+		}
+	}
 
-	int components = tinygltf::GetNumComponentsInType(accesor.type);
+	_vertices.resize(count);
 
-	elementSize *= components;
+	// a 16 byte load of a vec3 reads into the next element, so is only safe while there is one
+	size_t wideCount{ position.stride >= 12 && normal.stride >= 12 && count > 0 ? count - 1 : 0 };
 
-	size_t stride = bufferView.byteStride;
-	if (stride == 0)
-	{
-		stride = elementSize;
+	for (size_t i = 0; i < count; ++i) {
+		bool wide{ i < wideCount };
+		T& vertex = _vertices[i];
+		copyAttribute<12>(&vertex.position, position.data + i * position.stride, wide);
+		copyAttribute<12>(&vertex.normal, normal.data + i * normal.stride, wide);
+		copyAttribute<16>(&vertex.tangent, tangent.data + i * tangent.stride, true);
+		copyAttribute<8>(&vertex.uv, uv.data + i * uv.stride, false);
 
+		if constexpr (skinned) {
+			const uint8_t* jointIndices{ joints.data + i * joints.stride };
+			vertex.jointIndices = glm::vec4{ jointIndices[0], jointIndices[1], jointIndices[2], jointIndices[3] };
+			copyAttribute<16>(&vertex.jointWeights, weights.data + i * weights.stride, true);
+		}
 	}
 
-	outputBuffer.resize(accesor.count * elementSize);
+	return true;
+}
 
-	for (int i = 0; i < accesor.count; i++) {
-		uint8_t* dataindex = dataptr + stride * i;
-		uint8_t* targetptr = outputBuffer.data() + elementSize * i;
+// Reads a primitive's triangles, flipping their winding. Primitives without indices are left empty and skipped
+bool extractIndicesGLTF(const tinygltf::Primitive& primitive, const GLTFFile& gltf, std::vector<uint32_t>& _primindices)
+{
+	if (primitive.indices < 0) {
+		_primindices.clear();
+		return true;
+	}
 
-		memcpy(targetptr, dataindex, elementSize);
+	AccessorViewGLTF indices;
+	if (!viewAccessorGLTF(gltf, primitive.indices, "index", TINYGLTF_TYPE_SCALAR, { TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE,
+		TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT, TINYGLTF_COMPONENT_TYPE_SHORT, TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT }, indices)) {
+		return false;
 	}
-}
 
-// implementation for extractVerticesGLTF. This allows specialization to work properly for skinning
-template <typename T>
-void extractVerticesInternalGLTF(tinygltf::Primitive& primitive, tinygltf::Model& model, std::vector<T>& _vertices)
-{
-	tinygltf::Accessor& pos_accesor = model.accessors[primitive.attributes["POSITION"]];
-	_vertices.resize(pos_accesor.count);
-	std::vector<uint8_t> pos_data;
-	unpackBufferGLTF(model, pos_accesor, pos_data);
-	for (int i = 0; i < _vertices.size(); i++) {
-		if (pos_accesor.type == TINYGLTF_TYPE_VEC3)
-		{
-			if (pos_accesor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT)
-			{
-				float* dtf = (float*)pos_data.data();
-
-				//vec3f 
-				_vertices[i].position[0] = *(dtf + (i * 3) + 0);
-				_vertices[i].position[1] = *(dtf + (i * 3) + 1);
-				_vertices[i].position[2] = *(dtf + (i * 3) + 2);
-			} else {
-				std::cout << "ERROR: Component type mismatch\n";
-				assert(false);
+	size_t triangleCount{ indices.count / 3 };
+	_primindices.resize(triangleCount * 3);
+
+	auto read = [&](auto type) {
+		using Index = decltype(type);
+		for (size_t i = 0; i < triangleCount * 3; i += 3) {
+			Index triangle[3];
+			for (size_t j = 0; j < 3; ++j) {
+				memcpy(&triangle[j], indices.data + (i + j) * indices.stride, sizeof(Index));
 			}
-		} else {
-			std::cout << "ERROR: Accessor type mismatch\n";
-			assert(false);
+			_primindices[i + 0] = (uint32_t)triangle[0];
+			_primindices[i + 1] = (uint32_t)triangle[2];
+			_primindices[i + 2] = (uint32_t)triangle[1];
 		}
+	};
+
+	switch (gltf.model.accessors[primitive.indices].componentType) {
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: read(uint8_t{}); break;
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: read(uint16_t{}); break;
+	case TINYGLTF_COMPONENT_TYPE_SHORT: read(int16_t{}); break;
+	default: read(uint32_t{}); break;
 	}
 
-	tinygltf::Accessor& normal_accesor = model.accessors[primitive.attributes["NORMAL"]];
-	std::vector<uint8_t> normal_data;
-	unpackBufferGLTF(model, normal_accesor, normal_data);
-	for (int i = 0; i < _vertices.size(); i++) {
-		if (normal_accesor.type == TINYGLTF_TYPE_VEC3)
-		{
-			if (normal_accesor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT)
-			{
-				float* dtf = (float*)normal_data.data();
+	return true;
+}
 
-				//vec3f 
-				_vertices[i].normal[0] = *(dtf + (i * 3) + 0);
-				_vertices[i].normal[1] = *(dtf + (i * 3) + 1);
-				_vertices[i].normal[2] = *(dtf + (i * 3) + 2);
-			} else {
-				std::cout << "ERROR: Component type mismatch\n";
-				assert(false);
-			}
-		} else {
-			std::cout << "ERROR: Accessor type mismatch\n";
-			assert(false);
-		}
+std::string calculateMeshNameGLTF(tinygltf::Model& model, int meshIndex, int primitiveIndex)
+{
+	char buffer0[50];
+	char buffer1[50];
+	itoa(meshIndex, buffer0, 10);
+	itoa(primitiveIndex, buffer1, 10);
+
+	std::string meshname = "MESH_" + std::string{ &buffer0[0] } + "_" + model.meshes[meshIndex].name;
+
+	bool multiprim = model.meshes[meshIndex].primitives.size() > 1;
+
+	if (multiprim) {
+		meshname += "_PRIM_" + std::string{ &buffer1[0] };
 	}
 
-	tinygltf::Accessor& tangent_accesor = model.accessors[primitive.attributes["TANGENT"]];
-	std::vector<uint8_t> tangent_data;
-	unpackBufferGLTF(model, tangent_accesor, tangent_data);
-	for (int i = 0; i < _vertices.size(); i++) {
-		if (tangent_accesor.type == TINYGLTF_TYPE_VEC4)
-		{
-			if (tangent_accesor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT)
-			{
-				float* dtf = (float*)tangent_data.data();
+	return meshname;
+}
 
-				_vertices[i].tangent[0] = *(dtf + (i * 4) + 0);
-				_vertices[i].tangent[1] = *(dtf + (i * 4) + 1);
-				_vertices[i].tangent[2] = *(dtf + (i * 4) + 2);
-				_vertices[i].tangent[3] = *(dtf + (i * 4) + 3);
-			} else {
-				std::cout << "ERROR: Component type mismatch\n";
-				assert(false);
-			}
-		} else {
-			std::cout << "ERROR: Accessor type mismatch\n";
-			assert(false);
-		}
+std::string calculateSkeletonNameGLTF()
+{
+	return std::string{ "SKEL" };
+}
+
+// Blocks a dictionary is trained on, and held out blocks it is then tested on with and without it to decide whether to
+// keep it. Going over every block of a large export tree would double its bake time, an even spread of them tells just as well
+constexpr size_t DICTIONARY_TRAINING_BLOCKS{ 64 };
+constexpr size_t DICTIONARY_EVALUATION_BLOCKS{ 16 };
+
+// Meshes are compressed with the previous bake's dictionary, or written uncompressed for finishMeshDictionary
+CompressionSettings meshCompression(const ConverterState& convState)
+{
+	const MeshDictionary& meshDictionary{ *convState.meshDictionary };
+
+	CompressionSettings settings{ compressionPolicy(AssetKind::Mesh) };
+	if (meshDictionary.reuse) {
+		settings.dictionary = meshDictionary.dictionary.empty() ? nullptr : &meshDictionary.dictionary;
+	} else {
+		settings.mode = CompressionMode::None;
 	}
+	return settings;
+}
 
-	tinygltf::Accessor& uv_accesor = model.accessors[primitive.attributes["TEXCOORD_0"]];
-	std::vector<uint8_t> uv_data;
-	unpackBufferGLTF(model, uv_accesor, uv_data);
-	for (int i = 0; i < _vertices.size(); i++) {
-		if (uv_accesor.type == TINYGLTF_TYPE_VEC2)
-		{
-			if (uv_accesor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT)
-			{
-				float* dtf = (float*)uv_data.data();
+// Queues a mesh written with meshCompression for finishMeshDictionary, if it's waiting for a new dictionary
+void stageMesh(const fs::path& path, const ConverterState& convState)
+{
+	MeshDictionary& meshDictionary{ *convState.meshDictionary };
+	if (!meshDictionary.reuse) {
+		std::lock_guard<std::mutex> lock{ meshDictionary.mutex };
+		meshDictionary.staged.push_back(path);
+	}
+}
 
-				//vec3f 
-				_vertices[i].uv[0] = *(dtf + (i * 2) + 0);
-				_vertices[i].uv[1] = *(dtf + (i * 2) + 1);
-			} else {
-				std::cout << "ERROR: Component type mismatch\n";
-				assert(false);
-			}
-		} else {
-			std::cout << "ERROR: Accessor type mismatch\n";
-			assert(false);
-		}
+// Header and info struct of an asset this baker wrote, leaves file at the start of the blob
+static bool readBakedHeader(std::ifstream& file, const fs::path& path, AssetHeader& header, std::vector<char>& info)
+{
+	file.read((char*)&header, sizeof(AssetHeader));
+	if (!file || header.version != ASSET_VERSION) {
+		std::cout << "Error when trying to read asset: " << path << std::endl;
+		return false;
 	}
 
-	return;
+	info.resize(header.infoSize);
+	file.read(info.data(), info.size());
+	return (bool)file;
 }
-// Vertex with tangent attribute
-template <typename T>
-void extractVerticesGLTF(tinygltf::Primitive& primitive, tinygltf::Model& model, std::vector<T>& _vertices)
+
+// Rewrites a staged mesh with the family's compression, copying its blob over in blocks so it's never held whole
+static bool compressStagedMesh(const fs::path& path, const CompressionSettings& settings, const ConverterState& convState)
 {
-	extractVerticesInternalGLTF(primitive, model, _vertices);
+	std::ifstream inFile{ path, std::ios::binary };
+	AssetHeader header;
+	std::vector<char> info;
+	if (!inFile.is_open() || !readBakedHeader(inFile, path, header, info)) {
+		return false;
+	}
+
+	fs::path tempPath{ path.string() + ".tmp" };
+	AssetWriter writer;
+	if (!writer.open(tempPath.string().c_str(), header.type, info, header.blobSize, settings)) {
+		return false;
+	}
+
+	std::vector<char> chunk(COMPRESSION_BLOCK_SIZE);
+	for (uint64_t remaining = header.blobSize; remaining > 0;) {
+		size_t size{ (size_t)std::min<uint64_t>(remaining, chunk.size()) };
+		if (!inFile.read(chunk.data(), size) || !writer.write(chunk.data(), size)) {
+			std::cout << "Error when compressing mesh: " << path << std::endl;
+			return false;
+		}
+		remaining -= size;
+	}
+	inFile.close();
+
+	if (!writer.close()) {
+		std::cout << "Error when writing asset: " << tempPath << std::endl;
+		return false;
+	}
+
+	std::error_code error;
+	fs::rename(tempPath, path, error);
+	if (error) {
+		std::cout << "Error when trying to write file: " << path << " (" << error.message() << ")\n";
+		return false;
+	}
+
+	// the sidecar still names the uncompressed mode the mesh was staged with
+	fs::path sidecarPath{ path.string() + ".json" };
+	if (convState.jsonSidecar) {
+		std::ifstream sidecarIn{ sidecarPath };
+		nlohmann::json sidecar = nlohmann::json::parse(sidecarIn, nullptr, false);
+		sidecarIn.close();
+		if (!sidecar.is_discarded()) {
+			sidecar["compression_mode"] = compressionModeName(writer.header().compressionMode);
+			sidecar["compression_level"] = writer.header().compressionLevel;
+			std::ofstream sidecarOut{ sidecarPath };
+			sidecarOut << sidecar.dump(4);
+		}
+	}
+
+	return true;
 }
 
-// specialization for skinned vertices
-template <>
-void extractVerticesGLTF(tinygltf::Primitive& primitive, tinygltf::Model& model, std::vector<VertexSkinned>& _vertices)
+// Every COMPRESSION_BLOCK_SIZE block of a blob is compressed on its own, so each one starts without any history for LZ4 to
+// match against. Trains a dictionary on blocks of the meshes staged by this bake, keeps it if it makes held out blocks
+// smaller, then compresses the meshes with it. Called once every job is done
+bool finishMeshDictionary(const fs::path& exportPath, bool bakedEverything, const ConverterState& convState)
 {
-	extractVerticesInternalGLTF(primitive, model, _vertices);
+	MeshDictionary& meshDictionary{ *convState.meshDictionary };
+	fs::path dictionaryPath{ exportPath / MESH_DICTIONARY_NAME };
 
-	tinygltf::Accessor& joints_accesor = model.accessors[primitive.attributes["JOINTS_0"]];
-	std::vector<uint8_t> joints_data;
-	unpackBufferGLTF(model, joints_accesor, joints_data);
-	for (int i = 0; i < _vertices.size(); i++) {
-		if (joints_accesor.type == TINYGLTF_TYPE_VEC4)
-		{
-			if (joints_accesor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE)
-			{
-				uint8_t* dtf = (uint8_t*)joints_data.data();
+	if (meshDictionary.reuse) {
+		return true;
+	}
 
-				for (int j = 0; j < 4; ++j) {
-					auto jointIndex{ *(dtf + (i * 4) + j) };
-					//_vertices[i].jointIndices[j] = model.skins[0].joints[jointIndex];
-					_vertices[i].jointIndices[j] = jointIndex;
-				}
+	// a stable order keeps the dictionary the same from one bake to the next
+	std::vector<fs::path>& meshes{ meshDictionary.staged };
+	std::sort(meshes.begin(), meshes.end());
 
-			} else {
-				std::cout << "ERROR: Component type mismatch\n";
-				assert(false);
+	struct Block {
+		size_t mesh;
+		// from the start of the file
+		uint64_t offset;
+		size_t size;
+	};
+	std::vector<Block> blocks;
+	for (size_t i = 0; i < meshes.size(); ++i) {
+		std::ifstream inFile{ meshes[i], std::ios::binary };
+		AssetHeader header;
+		std::vector<char> info;
+		if (!inFile.is_open() || !readBakedHeader(inFile, meshes[i], header, info)) {
+			return false;
+		}
+
+		uint64_t blobStart{ (uint64_t)inFile.tellg() };
+		for (uint64_t offset = 0; offset < header.blobSize; offset += COMPRESSION_BLOCK_SIZE) {
+			blocks.push_back(Block{ i, blobStart + offset, (size_t)std::min<uint64_t>(header.blobSize - offset, COMPRESSION_BLOCK_SIZE) });
+		}
+	}
+
+	auto readBlock = [&](const Block& block, std::vector<char>& data) {
+		std::ifstream inFile{ meshes[block.mesh], std::ios::binary };
+		data.resize(block.size);
+		inFile.seekg(block.offset);
+		return (bool)inFile.read(data.data(), data.size());
+	};
+
+	std::vector<char> dictionary;
+
+	// a single block has nothing to share. Every fifth block of the spread is held out of training for the evaluation
+	if (blocks.size() > 1) {
+		std::vector<std::vector<char>> samples;
+		std::vector<std::vector<char>> heldOut;
+		size_t sampleSize{ 0 };
+		size_t stride{ std::max(blocks.size() / (DICTIONARY_TRAINING_BLOCKS + DICTIONARY_EVALUATION_BLOCKS), (size_t)1) };
+		for (size_t i = 0, picked = 0; i < blocks.size(); i += stride, ++picked) {
+			std::vector<char>& data{ picked % 5 == 1 ? heldOut.emplace_back() : samples.emplace_back() };
+			if (!readBlock(blocks[i], data)) {
+				std::cout << "Error when trying to read file: " << meshes[blocks[i].mesh] << std::endl;
+				return false;
+			}
+			if (picked % 5 != 1) {
+				sampleSize += data.size();
 			}
+		}
+
+		// a dictionary much larger than a small fraction of its samples costs more to store than it saves
+		dictionary = trainDictionary(samples, std::min(COMPRESSION_DICTIONARY_SIZE, sampleSize / 32));
+
+		// keep the dictionary only if the tree's meshes shrink, counting the dictionary itself
+		int level{ compressionPolicy(AssetKind::Mesh).level };
+		double sizeWithout{ 0.0 };
+		double sizeWith{ 0.0 };
+		std::vector<char> compressed;
+		for (const std::vector<char>& block : heldOut) {
+			if (dictionary.empty()) {
+				break;
+			}
+			sizeWithout += compressBlocks(block.data(), block.size(), compressed, level).sizeOut;
+			sizeWith += compressBlocks(block.data(), block.size(), compressed, level, dictionary.data(), dictionary.size()).sizeOut;
+		}
+
+		double scale{ !heldOut.empty() ? (double)blocks.size() / heldOut.size() : 0.0 };
+		if (dictionary.empty() || heldOut.empty() || sizeWith * scale + dictionary.size() >= sizeWithout * scale) {
+			dictionary.clear();
 		} else {
-			std::cout << "ERROR: Accessor type mismatch\n";
-			assert(false);
+			std::cout << "Trained " << dictionary.size() << " byte mesh dictionary on " << samples.size() << " of " << blocks.size()
+				<< " blocks, " << sizeWithout << " -> " << sizeWith << " bytes on " << heldOut.size() << " held out blocks\n";
 		}
 	}
 
-	tinygltf::Accessor& weights_accesor = model.accessors[primitive.attributes["WEIGHTS_0"]];
-	std::vector<uint8_t> weights_data;
-	unpackBufferGLTF(model, weights_accesor, weights_data);
-	for (int i = 0; i < _vertices.size(); i++) {
-		if (weights_accesor.type == TINYGLTF_TYPE_VEC4)
-		{
-			if (weights_accesor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT)
-			{
-				float* dtf = (float*)weights_data.data();
+	if (!dictionary.empty()) {
+		std::ofstream outFile{ dictionaryPath, std::ios::binary };
+		outFile.write(dictionary.data(), dictionary.size());
+		outFile.close();
+		if (outFile.fail()) {
+			std::cout << "Error when trying to write file: " << dictionaryPath << std::endl;
+			return false;
+		}
+	} else if (bakedEverything && fs::exists(dictionaryPath)) {
+		// no mesh uses it anymore, it would still be loaded and packed into the archive
+		std::cout << "Removing stale dictionary " << dictionaryPath << '\n';
+		fs::remove(dictionaryPath);
+	}
+
+	CompressionSettings settings{ compressionPolicy(AssetKind::Mesh) };
+	settings.dictionary = dictionary.empty() ? nullptr : &dictionary;
+
+	std::atomic<bool> failed{ false };
+	convState.jobPool->parallelFor((uint32_t)meshes.size(), 1, [&](uint32_t i) {
+		if (!compressStagedMesh(meshes[i], settings, convState)) {
+			failed = true;
+		}
+	});
+
+	return !failed;
+}
+
+// Merges vertices that are byte for byte the same, then with weldEpsilon above 0 the ones whose attributes are all
+// within it, positions relative to the mesh's radius, keeping the first of each. Exporters split vertices along every
+// seam and between primitives and often never merge them back. Rewrites indices to match, drops the triangles welding
+// collapsed and prints what was left
+template <typename VFormat>
+void deduplicateVertices(std::vector<VFormat>& vertices, std::vector<uint32_t>& indices, float weldEpsilon)
+{
+	size_t originalCount{ vertices.size() };
+	std::vector<uint32_t> remap;
+
+	// unique vertices keep their order, so each moves to an index at or below its own and they can be packed in place
+	auto merge = [&](size_t uniqueCount) {
+		if (uniqueCount == vertices.size()) return;
+
+		size_t written{ 0 };
+		for (size_t i = 0; i < vertices.size(); ++i) {
+			if (remap[i] == written) {
+				vertices[written++] = vertices[i];
+			}
+		}
+		vertices.resize(uniqueCount);
+		remapIndices(indices.data(), indices.size(), remap);
+	};
+
+	merge(generateVertexRemap(remap, vertices.data(), vertices.size(), sizeof(VFormat)));
+	size_t uniqueCount{ vertices.size() };
+	size_t degenerateCount{ 0 };
+
+	float positionTolerance{ calculateBounds(vertices.data(), vertices.size()).radius * weldEpsilon };
+	if (positionTolerance > 0.0f) {
+		// every attribute is floats, positions come first
+		static_assert(sizeof(VFormat) % sizeof(float) == 0);
+		constexpr size_t floatCount{ sizeof(VFormat) / sizeof(float) };
+
+		auto close = [&](const VFormat& a, const VFormat& b) {
+			const float* x{ (const float*)&a };
+			const float* y{ (const float*)&b };
+			for (size_t i = 0; i < floatCount; ++i) {
+				if (std::abs(x[i] - y[i]) > (i < 3 ? positionTolerance : weldEpsilon)) return false;
+			}
+			return true;
+		};
+
+		// vertices kept so far by the grid cell of their position, with cells as large as the tolerance a match can
+		// only be in the same or a neighbouring cell
+		auto cellKey = [](int64_t x, int64_t y, int64_t z) { return (uint64_t)x * 73856093u ^ (uint64_t)y * 19349663u ^ (uint64_t)z * 83492791u; };
+		std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+
+		uint32_t weldedCount{ 0 };
+		for (uint32_t v = 0; v < vertices.size(); ++v) {
+			int64_t cell[3];
+			for (int i = 0; i < 3; ++i) {
+				cell[i] = (int64_t)std::floor(vertices[v].position[i] / positionTolerance);
+			}
+
+			uint32_t match{ UNUSED_VERTEX };
+			for (int64_t dz = -1; dz <= 1 && match == UNUSED_VERTEX; ++dz) {
+				for (int64_t dy = -1; dy <= 1 && match == UNUSED_VERTEX; ++dy) {
+					for (int64_t dx = -1; dx <= 1 && match == UNUSED_VERTEX; ++dx) {
+						auto it = cells.find(cellKey(cell[0] + dx, cell[1] + dy, cell[2] + dz));
+						if (it == cells.end()) continue;
+						for (uint32_t kept : it->second) {
+							if (close(vertices[kept], vertices[v])) {
+								match = kept;
+								break;
+							}
+						}
+					}
+				}
+			}
 
-				_vertices[i].jointWeights[0] = *(dtf + (i * 4) + 0);
-				_vertices[i].jointWeights[1] = *(dtf + (i * 4) + 1);
-				_vertices[i].jointWeights[2] = *(dtf + (i * 4) + 2);
-				_vertices[i].jointWeights[3] = *(dtf + (i * 4) + 3);
+			if (match == UNUSED_VERTEX) {
+				remap[v] = weldedCount++;
+				cells[cellKey(cell[0], cell[1], cell[2])].push_back(v);
 			} else {
-				std::cout << "ERROR: Component type mismatch\n";
-				assert(false);
+				remap[v] = remap[match];
 			}
-		} else {
-			std::cout << "ERROR: Accessor type mismatch\n";
-			assert(false);
 		}
+		merge(weldedCount);
+
+		// welding can merge two corners of a small or thin triangle, which leaves it without any area
+		size_t written{ 0 };
+		for (size_t i = 0; i < indices.size(); i += 3) {
+			uint32_t a{ indices[i + 0] };
+			uint32_t b{ indices[i + 1] };
+			uint32_t c{ indices[i + 2] };
+			if (a == b || b == c || a == c) continue;
+
+			indices[written++] = a;
+			indices[written++] = b;
+			indices[written++] = c;
+		}
+		degenerateCount = (indices.size() - written) / 3;
+		indices.resize(written);
+	}
+
+	std::cout << "Vertices: " << originalCount << " -> " << uniqueCount << " unique";
+	if (weldEpsilon > 0.0f) {
+		std::cout << " -> " << vertices.size() << " welded";
 	}
+	std::cout << " (" << (originalCount ? 100.0 * (originalCount - vertices.size()) / originalCount : 0.0) << "% fewer)";
+	if (degenerateCount > 0) {
+		std::cout << ", dropped " << degenerateCount << " collapsed triangles";
+	}
+	std::cout << '\n';
 }
 
-void extractIndicesGLTF(tinygltf::Primitive& primitive, tinygltf::Model& model, std::vector<uint16_t>& _primindices)
+// Reorders triangles for the post-transform vertex cache, then clusters of them to draw outward facing ones first,
+// and finally the vertices in the order the triangles use them. Prints vertex shading cost before and after
+template <typename VFormat>
+void optimizeMesh(std::vector<VFormat>& vertices, std::vector<uint32_t>& indices)
 {
-	int indexaccesor = primitive.indices;
+	VertexCacheStats before{ analyzeVertexCache(indices.data(), indices.size(), vertices.size()) };
 
-	int indexbuffer = model.accessors[indexaccesor].bufferView;
-	int componentType = model.accessors[indexaccesor].componentType;
-	size_t indexsize = tinygltf::GetComponentSizeInBytes(componentType);
+	std::vector<uint32_t> cacheOrder(indices.size());
+	std::vector<uint32_t> clusters;
+	optimizeVertexCache(cacheOrder.data(), indices.data(), indices.size(), vertices.size(), VERTEX_CACHE_SIZE, &clusters);
 
-	tinygltf::BufferView& indexview = model.bufferViews[indexbuffer];
-	int bufferidx = indexview.buffer;
+	optimizeOverdraw(indices.data(), cacheOrder.data(), cacheOrder.size(), &vertices[0].position[0], vertices.size(), sizeof(VFormat), clusters);
 
-	tinygltf::Buffer& buffindex = (model.buffers[bufferidx]);
+	std::vector<uint32_t> remap;
+	size_t vertexCount{ optimizeVertexFetchRemap(remap, indices.data(), indices.size(), vertices.size()) };
+	remapVertices(vertices, remap, vertexCount);
 
-	uint8_t* dataptr = buffindex.data.data() + indexview.byteOffset;
+	VertexCacheStats after{ analyzeVertexCache(indices.data(), indices.size(), vertices.size()) };
 
-	std::vector<uint8_t> unpackedIndices;
-	unpackBufferGLTF(model, model.accessors[indexaccesor], unpackedIndices);
+	std::cout << "Vertex cache: ACMR " << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr
+		<< ", " << before.transformedVertices << " -> " << after.transformedVertices << " vertex shader invocations\n";
+}
 
-	for (int i = 0; i < model.accessors[indexaccesor].count; i++) {
+// At most this many levels of detail per mesh, including the full mesh
+constexpr uint32_t MAX_MESH_LODS{ 4 };
 
-		uint32_t index;
-		switch (componentType) {
-		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-		{
-			uint16_t* bfr = (uint16_t*)unpackedIndices.data();
-			index = *(bfr + i);
-		}
-		break;
-		case TINYGLTF_COMPONENT_TYPE_SHORT:
-		{
-			int16_t* bfr = (int16_t*)unpackedIndices.data();
-			index = *(bfr + i);
-		}
-		break;
-		default:
-			assert(false);
-		}
+// Largest quadric error a collapse may have while simplifying a level of detail, relative to the mesh's bounding sphere radius
+constexpr float LOD_MAX_RELATIVE_ERROR{ 0.1f };
 
-		_primindices.push_back(index);
-	}
+// Appends lower levels of detail to indices, each with about half the triangles of the previous one. Every level is
+// simplified from the full mesh so its error is measured against it. Stops early once simplification stalls,
+// which happens when most vertices lie on seams
+template <typename VFormat>
+std::vector<MeshLod> generateLods(const std::vector<VFormat>& vertices, std::vector<uint32_t>& indices, const MeshBounds& bounds)
+{
+	size_t fullCount{ indices.size() };
+	std::vector<MeshLod> lods{ MeshLod{ 0, (uint32_t)fullCount, 0.0f } };
+
+	std::vector<uint32_t> simplified(fullCount);
+	std::vector<uint32_t> cacheOrder(fullCount);
+
+	while (lods.size() < MAX_MESH_LODS) {
+		size_t previousCount{ lods.back().indexCount };
+		float error{ 0.0f };
+		size_t count{ simplifyMesh(simplified.data(), indices.data(), fullCount, &vertices[0].position[0], vertices.size(), sizeof(VFormat),
+			previousCount / 6 * 3, bounds.radius * LOD_MAX_RELATIVE_ERROR, &error) };
+
+		// not worth the index memory if it barely has fewer triangles
+		if (count == 0 || count > previousCount * 3 / 4) break;
 
-	for (int i = 0; i < _primindices.size() / 3; i++)
-	{
-		//flip the triangle
+		optimizeVertexCache(cacheOrder.data(), simplified.data(), count, vertices.size());
 
-		std::swap(_primindices[i * 3 + 1], _primindices[i * 3 + 2]);
+		// the engine picks the coarsest level within its error budget, which needs errors to grow with the level
+		lods.push_back(MeshLod{ (uint32_t)indices.size(), (uint32_t)count, std::max(error, lods.back().error) });
+		indices.insert(indices.end(), cacheOrder.begin(), cacheOrder.begin() + count);
 	}
+
+	std::cout << "Levels of detail:";
+	for (const MeshLod& lod : lods) {
+		std::cout << ' ' << lod.indexCount / 3 << " (" << lod.error << ')';
+	}
+	std::cout << " triangles (error)\n";
+
+	return lods;
 }
 
-std::string calculateMeshNameGLTF(tinygltf::Model& model, int meshIndex, int primitiveIndex)
-{
-	char buffer0[50];
-	char buffer1[50];
-	itoa(meshIndex, buffer0, 10);
-	itoa(primitiveIndex, buffer1, 10);
+// Vertices or indices converted per write while streaming a mesh out, so the converted copy stays small
+constexpr size_t MESH_WRITE_BATCH{ 16384 };
 
-	std::string meshname = "MESH_" + std::string{ &buffer0[0] } + "_" + model.meshes[meshIndex].name;
+// Quantized counterpart of VFormat (see VertexQuantized)
+template <typename VFormat>
+using QuantizedVertex = decltype(quantizeVertex(VFormat{}, MeshBounds{}));
+
+// Writes the vertex buffer, quantized unless floatVertices is set, a batch at a time
+template <typename VFormat>
+bool writeVertices(BakedAsset& asset, const std::vector<VFormat>& vertices, const MeshBounds& bounds, bool floatVertices)
+{
+	if (floatVertices) {
+		return asset.write(vertices.data(), vertices.size() * sizeof(VFormat));
+	}
 
-	bool multiprim = model.meshes[meshIndex].primitives.size() > 1;
+	std::vector<QuantizedVertex<VFormat>> batch;
+	batch.reserve(std::min(vertices.size(), MESH_WRITE_BATCH));
+	for (size_t first = 0; first < vertices.size(); first += MESH_WRITE_BATCH) {
+		batch.clear();
+		for (size_t i = first; i < std::min(first + MESH_WRITE_BATCH, vertices.size()); ++i) {
+			batch.push_back(quantizeVertex(vertices[i], bounds));
+		}
+		if (!asset.write(batch.data(), batch.size() * sizeof(batch[0]))) {
+			return false;
+		}
+	}
+	return true;
+}
 
-	if (multiprim) {
-		meshname += "_PRIM_" + std::string{ &buffer1[0] };
+// Writes the index buffer, narrowed to 16 bits a batch at a time unless wideIndices is set
+bool writeIndices(BakedAsset& asset, const std::vector<uint32_t>& indices, bool wideIndices)
+{
+	if (wideIndices) {
+		return asset.write(indices.data(), indices.size() * sizeof(uint32_t));
 	}
 
-	return meshname;
+	std::vector<uint16_t> batch;
+	batch.reserve(std::min(indices.size(), MESH_WRITE_BATCH));
+	for (size_t first = 0; first < indices.size(); first += MESH_WRITE_BATCH) {
+		batch.assign(indices.begin() + first, indices.begin() + std::min(first + MESH_WRITE_BATCH, indices.size()));
+		if (!asset.write(batch.data(), batch.size() * sizeof(uint16_t))) {
+			return false;
+		}
+	}
+	return true;
 }
 
-std::string calculateSkeletonNameGLTF()
+// All primitives of a glTF are packed into one mesh asset named after the file
+std::string calculateModelNameGLTF(const fs::path& input)
 {
-	return std::string{ "SKEL" };
+	return input.stem().string();
 }
 
 template <typename VFormat>
-bool extractMeshesGLTF(tinygltf::Model& model, const fs::path& input, const fs::path& outputFolder, const ConverterState& convState, VertexFormat vertexFormatEnum)
+bool extractMeshesGLTF(GLTFFile& gltf, const fs::path& input, const fs::path& outputFolder, const ConverterState& convState, VertexFormat vertexFormatEnum)
 {
 	/*
 		Note: meshes are what we normally think of as meshes, but primitives do NOT refer to triangles in this case.
 		Primitives are a single mesh broken up into pieces, either to allow a single mesh to have multiple materials
 		or to avoid the limitation of 65535 vertices (for 16-bit indices) for a mesh.
+
+		Every primitive of every mesh becomes a submesh of a single asset, sharing its vertex and index buffers.
 	*/
 
-	tinygltf::Model* glmod = &model;
-	for (auto meshindex = 0; meshindex < model.meshes.size(); ++meshindex) {
+	tinygltf::Model& model = gltf.model;
 
-		auto& glmesh = model.meshes[meshindex];
+	std::vector<VFormat> modelVertices;
+	std::vector<uint32_t> modelIndices;
+	std::vector<Meshlet> meshlets;
+	std::vector<MeshLod> lods;
+	std::vector<Submesh> submeshes;
+	size_t largestSubmesh{ 0 };
 
-		//using Format = assets::Vertex_f32_PNTV;
-		//auto vertexFormatEnum = assets::VertexFormat::PNTV_F32;
+	std::vector<VFormat> _vertices;
+	std::vector<uint32_t> _indices;
 
-		std::vector<VFormat> _vertices;
-		std::vector<uint16_t> _indices;
+	double extractMs{ 0.0 };
+	size_t originalVertexCount{ 0 };
+
+	for (auto meshindex = 0; meshindex < model.meshes.size(); ++meshindex) {
+
+		auto& glmesh = model.meshes[meshindex];
 
 		for (auto primindex = 0; primindex < glmesh.primitives.size(); ++primindex) {
 
 			_vertices.clear();
 			_indices.clear();
 
-			std::string meshname{ calculateMeshNameGLTF(model, meshindex, primindex) };
-
 			tinygltf::Primitive& primitive = glmesh.primitives[primindex];
 
-			extractIndicesGLTF(primitive, model, _indices);
-			extractVerticesGLTF(primitive, model, _vertices);
+			auto extractStart{ std::chrono::high_resolution_clock::now() };
+
+			if (!extractIndicesGLTF(primitive, gltf, _indices)) {
+				return false;
+			}
+			if (_indices.empty()) {
+				continue;
+			}
+			if (!extractVerticesGLTF(primitive, gltf, _vertices)) {
+				return false;
+			}
+
+			extractMs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - extractStart).count() / 1000000.0;
+
+			std::cout << "Submesh " << submeshes.size() << ": " << calculateMeshNameGLTF(model, meshindex, primindex) << '\n';
 
+			originalVertexCount += _vertices.size();
+			if (convState.deduplicateVertices) {
+				deduplicateVertices(_vertices, _indices, convState.weldEpsilon);
+			}
+
+			if (convState.optimizeMeshes) {
+				optimizeMesh(_vertices, _indices);
+			}
+
+			MeshBounds bounds{ calculateBounds(_vertices.data(), _vertices.size()) };
 
-			MeshInfo meshinfo;
-			meshinfo.vertexFormat = vertexFormatEnum;
-			meshinfo.vertexBufferSize = _vertices.size() * sizeof(VFormat);
-			meshinfo.indexBufferSize = _indices.size() * sizeof(uint16_t);
-			meshinfo.indexSize = sizeof(uint16_t);
-			meshinfo.originalFile = input.string();
+			Submesh submesh{};
+			submesh.vertexOffset = (int32_t)modelVertices.size();
+			submesh.materialSlot = primitive.material;
+			for (int i = 0; i < 3; ++i) {
+				submesh.center[i] = bounds.origin[i];
+			}
+			submesh.radius = bounds.radius;
+
+			// indices stay relative to the submesh's first vertex, tables are offset to where the submesh's indices start
+			uint32_t firstIndex{ (uint32_t)modelIndices.size() };
 
-			meshinfo.bounds = calculateBounds(_vertices.data(), _vertices.size());
+			submesh.firstMeshlet = (uint32_t)meshlets.size();
+			// skinned meshes move away from their baked bounds, so the engine never culls their meshlets
+			if (convState.meshlets && !isSkinned(vertexFormatEnum)) {
+				std::vector<Meshlet> submeshMeshlets{ buildMeshlets(_indices.data(), _indices.size(), &_vertices[0].position[0], _vertices.size(), sizeof(VFormat)) };
+				std::cout << "Built " << submeshMeshlets.size() << " meshlets, " << (float)_indices.size() / 3.0f / submeshMeshlets.size() << " triangles per meshlet\n";
+
+				for (Meshlet& meshlet : submeshMeshlets) {
+					meshlet.firstIndex += firstIndex;
+					meshlets.push_back(meshlet);
+				}
+			}
+			submesh.meshletCount = (uint32_t)meshlets.size() - submesh.firstMeshlet;
 
-			assets::AssetFile newFile{ packMesh(&meshinfo, (char*)_vertices.data(), (char*)_indices.data()) };
+			// meshlets only cover the full detail submesh, which comes first in its part of the index buffer
+			std::vector<MeshLod> submeshLods{ MeshLod{ 0, (uint32_t)_indices.size(), 0.0f } };
+			// skinned meshes are simplified in their bind pose, which says nothing about their error once they are animated
+			if (convState.lods && !isSkinned(vertexFormatEnum)) {
+				submeshLods = generateLods(_vertices, _indices, bounds);
+			}
 
-			nlohmann::json metadata;
+			submesh.firstLod = (uint32_t)lods.size();
+			submesh.lodCount = (uint32_t)submeshLods.size();
+			for (MeshLod& lod : submeshLods) {
+				lod.firstIndex += firstIndex;
+				lods.push_back(lod);
+			}
 
-			if (meshinfo.vertexFormat == VertexFormat::DEFAULT) {
-				metadata["vertex_format"] = "DEFAULT";
-			} else if (meshinfo.vertexFormat == VertexFormat::SKINNED) {
-				metadata["vertex_format"] = "SKINNED";
+			largestSubmesh = std::max(largestSubmesh, _vertices.size());
+			// most models are a single primitive, which can be moved instead of copied
+			if (submeshes.empty()) {
+				modelVertices.swap(_vertices);
+				modelIndices.swap(_indices);
+			} else {
+				modelVertices.insert(modelVertices.end(), _vertices.begin(), _vertices.end());
+				modelIndices.insert(modelIndices.end(), _indices.begin(), _indices.end());
 			}
+			submeshes.push_back(submesh);
+		}
+	}
+
+	if (submeshes.empty()) {
+		std::cout << "No triangles in " << input << '\n';
+		return true;
+	}
 
-			metadata["vertex_buffer_size"] = meshinfo.vertexBufferSize;
-			metadata["index_buffer_size"] = meshinfo.indexBufferSize;
-			metadata["index_size"] = meshinfo.indexSize;
-			metadata["original_file"] = meshinfo.originalFile;
+	std::cout << "Reading " << originalVertexCount << " vertices took " << extractMs << "ms\n";
+	if (convState.deduplicateVertices) {
+		std::cout << "Merged " << originalVertexCount << " -> " << modelVertices.size() << " vertices, " << originalVertexCount * sizeof(VFormat)
+			<< " -> " << modelVertices.size() * sizeof(VFormat) << " bytes before quantization\n";
+	}
+
+	// 16-bit indices unless a single submesh has more vertices than they can address
+	bool wideIndices{ largestSubmesh > std::numeric_limits<uint16_t>::max() + 1 };
+
+	MeshInfo meshinfo;
+	meshinfo.vertexFormat = vertexFormatEnum;
+	meshinfo.indexSize = wideIndices ? sizeof(uint32_t) : sizeof(uint16_t);
+	meshinfo.indexBufferSize = modelIndices.size() * meshinfo.indexSize;
+	meshinfo.meshletBufferSize = meshlets.size() * sizeof(Meshlet);
+	meshinfo.lodBufferSize = lods.size() * sizeof(MeshLod);
+	meshinfo.submeshBufferSize = submeshes.size() * sizeof(Submesh);
+	meshinfo.originalFile = input.string();
+
+	// all submeshes are quantized against the model's bounds, since they share the mesh's positionTransform
+	meshinfo.bounds = calculateBounds(modelVertices.data(), modelVertices.size());
+
+	if (convState.floatVertices) {
+		meshinfo.vertexBufferSize = modelVertices.size() * sizeof(VFormat);
+	} else {
+		meshinfo.vertexFormat = vertexFormatEnum == VertexFormat::SKINNED ? VertexFormat::SKINNED_QUANTIZED : VertexFormat::QUANTIZED;
+		meshinfo.vertexBufferSize = modelVertices.size() * sizeof(QuantizedVertex<VFormat>);
+		std::cout << "Quantized " << modelVertices.size() << " vertices, " << modelVertices.size() * sizeof(VFormat) << " -> " << meshinfo.vertexBufferSize << " bytes\n";
+	}
+
+	nlohmann::json metadata;
 
-			std::vector<float> boundsData;
-			boundsData.resize(7);
+	if (meshinfo.vertexFormat == VertexFormat::DEFAULT) {
+		metadata["vertex_format"] = "DEFAULT";
+	} else if (meshinfo.vertexFormat == VertexFormat::SKINNED) {
+		metadata["vertex_format"] = "SKINNED";
+	} else if (meshinfo.vertexFormat == VertexFormat::QUANTIZED) {
+		metadata["vertex_format"] = "QUANTIZED";
+	} else if (meshinfo.vertexFormat == VertexFormat::SKINNED_QUANTIZED) {
+		metadata["vertex_format"] = "SKINNED_QUANTIZED";
+	}
+
+	metadata["vertex_buffer_size"] = meshinfo.vertexBufferSize;
+	metadata["index_buffer_size"] = meshinfo.indexBufferSize;
+	metadata["index_size"] = meshinfo.indexSize;
+	metadata["submesh_count"] = submeshes.size();
+	metadata["meshlet_count"] = meshlets.size();
+	metadata["lod_count"] = lods.size();
+	metadata["original_file"] = meshinfo.originalFile;
 
-			boundsData[0] = meshinfo.bounds.origin[0];
-			boundsData[1] = meshinfo.bounds.origin[1];
-			boundsData[2] = meshinfo.bounds.origin[2];
+	std::vector<float> boundsData;
+	boundsData.resize(7);
 
-			boundsData[3] = meshinfo.bounds.radius;
+	boundsData[0] = meshinfo.bounds.origin[0];
+	boundsData[1] = meshinfo.bounds.origin[1];
+	boundsData[2] = meshinfo.bounds.origin[2];
 
-			boundsData[4] = meshinfo.bounds.extents[0];
-			boundsData[5] = meshinfo.bounds.extents[1];
-			boundsData[6] = meshinfo.bounds.extents[2];
+	boundsData[3] = meshinfo.bounds.radius;
 
-			metadata["bounds"] = boundsData;
+	boundsData[4] = meshinfo.bounds.extents[0];
+	boundsData[5] = meshinfo.bounds.extents[1];
+	boundsData[6] = meshinfo.bounds.extents[2];
 
-			fs::path meshpath = outputFolder / (meshname + ".mesh");
+	metadata["bounds"] = boundsData;
 
-			//save to disk
-			saveBinaryFile(meshpath.string().c_str(), metadata, newFile);
+	fs::path meshpath = outputFolder / (calculateModelNameGLTF(input) + ".mesh");
+
+	// earlier bakes wrote a file per primitive, which the engine would load on top of the packed model, and a dictionary
+	// per model, which the export tree's dictionary replaced
+	for (const auto& file : fs::directory_iterator(outputFolder)) {
+		if ((file.path().extension() == ".mesh" && file.path() != meshpath) || file.path().extension() == ".dict") {
+			std::cout << "Removing stale " << file.path() << '\n';
+			fs::remove(file.path());
 		}
 	}
+
+	// the buffers go to disk one after another as the blob, vertices and indices converted a batch at a time
+	uint64_t blobSize{ (uint64_t)meshinfo.vertexBufferSize + meshinfo.indexBufferSize + meshinfo.meshletBufferSize + meshinfo.lodBufferSize
+		+ meshinfo.submeshBufferSize };
+
+	BakedAsset asset;
+	if (!asset.open(meshpath, "MESH", packMeshInfo(&meshinfo), blobSize, meshCompression(convState), convState)
+		|| !writeVertices(asset, modelVertices, meshinfo.bounds, convState.floatVertices)
+		|| !writeIndices(asset, modelIndices, wideIndices)
+		|| !asset.write(meshlets.data(), meshinfo.meshletBufferSize)
+		|| !asset.write(lods.data(), meshinfo.lodBufferSize)
+		|| !asset.write(submeshes.data(), meshinfo.submeshBufferSize)
+		|| !asset.close(metadata)) {
+		return false;
+	}
+
+	stageMesh(meshpath, convState);
 	return true;
 }
 
-int getSkeletonRootIdx(const std::vector<NodeAsset>& nodes, const std::vector<int>& joints)
+// Topmost joint above the first one, the node the engine starts updating the skin's joint matrices from
+uint32_t getSkeletonRootIdx(const std::vector<int32_t>& parents, const uint32_t* joints, uint32_t jointCount)
 {
-	if (joints.empty()) {
-		std::cout << "Unexpected: joints vector is empty in getSkeletonRootIdx()\n";
-		return -1;
-	}
-
-	std::unordered_set<int> jointsSet{ joints.begin(), joints.end() };
+	std::unordered_set<uint32_t> jointsSet{ joints, joints + jointCount };
 
-	int joint{ joints[0] };
-	int prev{ -1 };
+	int32_t joint{ (int32_t)joints[0] };
+	int32_t prev{ -1 };
 
-	while (jointsSet.find(joint) != jointsSet.end()) {
+	while (joint >= 0 && jointsSet.find(joint) != jointsSet.end()) {
 		prev = joint;
-		joint = nodes[joint].parentIdx;
+		joint = parents[joint];
 	}
 
-	return prev;
+	return (uint32_t)prev;
 }
 
 // from https://github.com/SaschaWillems/Vulkan-glTF-PBR/blob/master/base/VulkanglTFModel.cpp
-void loadSkins(SkeletalAnimationDataAsset& data, tinygltf::Model& gltfModel, int32_t meshNodeIdx)
+bool loadSkins(assets::SkeletonData& data, const GLTFFile& gltf, const std::vector<uint32_t>& nodeIndices)
 {
+	const tinygltf::Model& gltfModel = gltf.model;
 
 	if (gltfModel.skins.size() > 1) {
 		std::cout << "Error: More than one skin not supported yet!\n";
 	}
 
-	for (tinygltf::Skin& source : gltfModel.skins) {
-		SkinAsset newSkin{};
-		newSkin.name = source.name;
-		// turns out, skeletonRootIdx is not mandatory for gltf files so we will calculate it ourself...
-		//newSkin.skeletonRootIdx = source.skeleton;
-		newSkin.meshNodeIdx = meshNodeIdx;
+	// one past the last descendant of every node
+	std::vector<uint32_t> nodeEnds(data.nodes.size());
+	for (size_t i = nodeEnds.size(); i-- > 0;) {
+		nodeEnds[i] = std::max(nodeEnds[i], (uint32_t)i + 1);
+		if (data.parents[i] >= 0) {
+			nodeEnds[data.parents[i]] = std::max(nodeEnds[data.parents[i]], nodeEnds[i]);
+		}
+	}
+
+	for (const tinygltf::Skin& source : gltfModel.skins) {
+		assets::SkeletonSkin newSkin{};
+		newSkin.nameOffset = data.addString(source.name);
+		newSkin.nameLength = (uint32_t)source.name.size();
+		newSkin.firstJoint = (uint32_t)data.joints.size();
 
 		// Find joint nodes
 		for (int jointIndex : source.joints) {
-			if (jointIndex > -1) {
-				newSkin.joints.push_back(jointIndex);
+			if (jointIndex < 0 || (size_t)jointIndex >= nodeIndices.size()) {
+				std::cout << "ERROR: skin joint " << jointIndex << " is not a node\n";
+				return false;
 			}
+			data.joints.push_back(nodeIndices[jointIndex]);
+		}
+		newSkin.jointCount = (uint32_t)source.joints.size();
+
+		if (newSkin.jointCount == 0) {
+			std::cout << "ERROR: skin " << source.name << " has no joints\n";
+			return false;
+		}
+		if (newSkin.jointCount > MAX_NUM_JOINTS) {
+			std::cout << "WARNING: skin " << source.name << " has " << newSkin.jointCount << " joints, only the first " << MAX_NUM_JOINTS << " are animated\n";
 		}
 
-		newSkin.skeletonRootIdx = getSkeletonRootIdx(data.nodes, newSkin.joints);
+		// turns out, skeletonRootIdx is not mandatory for gltf files so we will calculate it ourself...
+		newSkin.root = getSkeletonRootIdx(data.parents, data.joints.data() + newSkin.firstJoint, newSkin.jointCount);
+		newSkin.nodeEnd = nodeEnds[newSkin.root];
 
-		// Get inverse bind matrices from buffer
+		// Get inverse bind matrices from buffer, glTF defaults them to identity
 		if (source.inverseBindMatrices > -1) {
-			const tinygltf::Accessor& accessor = gltfModel.accessors[source.inverseBindMatrices];
-			const tinygltf::BufferView& bufferView = gltfModel.bufferViews[accessor.bufferView];
-			const tinygltf::Buffer& buffer = gltfModel.buffers[bufferView.buffer];
-			newSkin.inverseBindMatrices.resize(accessor.count);
-			memcpy(newSkin.inverseBindMatrices.data(), &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(glm::mat4));
+			AccessorViewGLTF matrices;
+			if (!viewAccessorGLTF(gltf, source.inverseBindMatrices, "inverse bind matrix", TINYGLTF_TYPE_MAT4, { TINYGLTF_COMPONENT_TYPE_FLOAT }, matrices)) {
+				return false;
+			}
+			if (matrices.count != newSkin.jointCount) {
+				std::cout << "ERROR: skin has " << matrices.count << " inverse bind matrices for " << newSkin.jointCount << " joints\n";
+				return false;
+			}
+			for (size_t index = 0; index < matrices.count; index++) {
+				glm::mat4 matrix;
+				memcpy(&matrix, matrices.data + index * matrices.stride, sizeof(glm::mat4));
+				data.inverseBindMatrices.push_back(matrix);
+			}
+		} else {
+			data.inverseBindMatrices.resize(data.joints.size(), glm::mat4(1.0f));
 		}
 
 		data.skins.push_back(newSkin);
 	}
+
+	return true;
 }
 
-void loadAnimations(SkeletalAnimationDataAsset& data, tinygltf::Model& gltfModel)
+// Reads every animation, then drops the keys interpolation can rebuild within convState.animationTolerance and
+// quantizes the rest, see AnimationSampler
+bool loadAnimations(assets::SkeletonData& data, const GLTFFile& gltf, const std::vector<uint32_t>& nodeIndices, const ConverterState& convState)
 {
-	for (tinygltf::Animation& anim : gltfModel.animations) {
+	size_t sourceKeys{ 0 };
+	size_t bakedKeys{ 0 };
+
+	for (const tinygltf::Animation& anim : gltf.model.animations) {
 		Animation animation{};
-		animation.name = anim.name;
-		if (anim.name.empty()) {
-			animation.name = std::to_string(data.animations.size());
-		}
+		animation.start = std::numeric_limits<float>::max();
+		animation.end = std::numeric_limits<float>::min();
+
+		std::string name{ anim.name.empty() ? std::to_string(data.animations.size()) : anim.name };
+		animation.nameOffset = data.addString(name);
+		animation.nameLength = (uint32_t)name.size();
 
 		// Samplers
-		for (auto& samp : anim.samplers) {
-			AnimationSampler sampler{};
+		std::vector<SourceTrack> tracks;
+		for (const auto& samp : anim.samplers) {
+			SourceTrack track{};
+			track.interpolation = Interpolation::LINEAR;
 
-			if (samp.interpolation == "LINEAR") {
-				sampler.interpolation = Interpolation::LINEAR;
-			}
 			if (samp.interpolation == "STEP") {
-				sampler.interpolation = Interpolation::STEP;
-			}
-			if (samp.interpolation == "CUBICSPLINE") {
-				sampler.interpolation = Interpolation::CUBICSPLINE;
+				track.interpolation = Interpolation::STEP;
 			}
 
 			// Read sampler input time values
-			{
-				const tinygltf::Accessor& accessor = gltfModel.accessors[samp.input];
-				const tinygltf::BufferView& bufferView = gltfModel.bufferViews[accessor.bufferView];
-				const tinygltf::Buffer& buffer = gltfModel.buffers[bufferView.buffer];
-
-				assert(accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
+			AccessorViewGLTF input;
+			if (!viewAccessorGLTF(gltf, samp.input, "animation input", TINYGLTF_TYPE_SCALAR, { TINYGLTF_COMPONENT_TYPE_FLOAT }, input)) {
+				return false;
+			}
+			if (input.count == 0) {
+				std::cout << "ERROR: animation input has no keys\n";
+				return false;
+			}
+			for (size_t index = 0; index < input.count; index++) {
+				float time;
+				memcpy(&time, input.data + index * input.stride, sizeof(float));
+				track.times.push_back(time);
 
-				const void* dataPtr = &buffer.data[accessor.byteOffset + bufferView.byteOffset];
-				const float* buf = static_cast<const float*>(dataPtr);
-				for (size_t index = 0; index < accessor.count; index++) {
-					sampler.inputs.push_back(buf[index]);
-				}
+				animation.start = std::min(animation.start, time);
+				animation.end = std::max(animation.end, time);
+			}
 
-				for (auto input : sampler.inputs) {
-					if (input < animation.start) {
-						animation.start = input;
-					};
-					if (input > animation.end) {
-						animation.end = input;
-					}
-				}
+			// Read sampler output T/R/S values
+			AccessorViewGLTF output;
+			int outputType{ samp.output >= 0 && (size_t)samp.output < gltf.model.accessors.size() ? gltf.model.accessors[samp.output].type : -1 };
+			track.rotation = outputType == TINYGLTF_TYPE_VEC4;
+			if (!viewAccessorGLTF(gltf, samp.output, "animation output", track.rotation ? TINYGLTF_TYPE_VEC4 : TINYGLTF_TYPE_VEC3,
+				{ TINYGLTF_COMPONENT_TYPE_FLOAT }, output)) {
+				return false;
 			}
 
-			// Read sampler output T/R/S values 
-			{
-				const tinygltf::Accessor& accessor = gltfModel.accessors[samp.output];
-				const tinygltf::BufferView& bufferView = gltfModel.bufferViews[accessor.bufferView];
-				const tinygltf::Buffer& buffer = gltfModel.buffers[bufferView.buffer];
+			// cubic spline keys hold an in tangent, the value and an out tangent. Only the values are kept and
+			// interpolated linearly, which the keyframe reduction then checks like any other track
+			size_t valueStride{ samp.interpolation == "CUBICSPLINE" ? 3u : 1u };
+			if (output.count != track.times.size() * valueStride) {
+				std::cout << "ERROR: animation output has " << output.count << " values for " << track.times.size() << " keys\n";
+				return false;
+			}
 
-				assert(accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
+			for (size_t index = 0; index < track.times.size(); index++) {
+				const uint8_t* value{ output.data + (index * valueStride + valueStride / 2) * output.stride };
+				glm::vec4 v{ 0.0f };
+				memcpy(&v, value, track.rotation ? sizeof(glm::vec4) : sizeof(glm::vec3));
+				track.values.push_back(track.rotation ? glm::normalize(v) : v);
+			}
 
-				const void* dataPtr = &buffer.data[accessor.byteOffset + bufferView.byteOffset];
+			tracks.push_back(std::move(track));
+		}
 
-				switch (accessor.type) {
-				case TINYGLTF_TYPE_VEC3: {
-					const glm::vec3* buf = static_cast<const glm::vec3*>(dataPtr);
-					for (size_t index = 0; index < accessor.count; index++) {
-						sampler.outputsVec4.push_back(glm::vec4(buf[index], 0.0f));
-					}
-					break;
-				}
-				case TINYGLTF_TYPE_VEC4: {
-					const glm::vec4* buf = static_cast<const glm::vec4*>(dataPtr);
-					for (size_t index = 0; index < accessor.count; index++) {
-						sampler.outputsVec4.push_back(buf[index]);
-					}
-					break;
-				}
-				default: {
-					std::cout << "unknown type" << std::endl;
-					break;
-				}
-				}
-			}
+		animation.timeStep = chooseTimeStep(tracks, animation.end);
+		animation.firstSampler = (uint32_t)data.samplers.size();
+		for (const SourceTrack& track : tracks) {
+			AnimationSampler sampler{};
+			encodeTrack(sampler, data.times, data.keys, track, reduceKeyframes(track, convState.animationTolerance), animation.timeStep);
 
-			animation.samplers.push_back(sampler);
+			sourceKeys += track.times.size();
+			bakedKeys += sampler.keyCount;
+			data.samplers.push_back(sampler);
 		}
+		animation.samplerCount = (uint32_t)tracks.size();
 
 		// Channels
-		for (tinygltf::AnimationChannel& source : anim.channels) {
+		animation.firstChannel = (uint32_t)data.channels.size();
+		for (const tinygltf::AnimationChannel& source : anim.channels) {
 			AnimationChannel channel{};
 
 			if (source.target_path == "rotation") {
@@ -643,100 +1449,317 @@ void loadAnimations(SkeletalAnimationDataAsset& data, tinygltf::Model& gltfModel
 				std::cout << "weights not yet supported, skipping channel\n";
 				continue;
 			}
-			channel.samplerIndex = source.sampler;
-			channel.nodeIdx = source.target_node;
-			if (channel.nodeIdx < 0) {
+			if (source.target_node < 0 || (size_t)source.target_node >= nodeIndices.size() || source.sampler < 0
+				|| (uint32_t)source.sampler >= animation.samplerCount) {
 				continue;
 			}
+			channel.samplerIndex = source.sampler;
+			channel.nodeIdx = nodeIndices[source.target_node];
 
-			animation.channels.push_back(channel);
+			data.channels.push_back(channel);
 		}
+		animation.channelCount = (uint32_t)data.channels.size() - animation.firstChannel;
 
 		data.animations.push_back(animation);
 	}
+
+	// a float time and a vec4 per key before, a tick and three uint16_t after
+	std::cout << "Animation keys: " << sourceKeys << " -> " << bakedKeys << ", " << sourceKeys * (sizeof(float) + sizeof(glm::vec4))
+		<< " -> " << bakedKeys * 4 * sizeof(uint16_t) << " bytes\n";
+
+	return true;
 }
 
-void loadNode(SkeletalAnimationDataAsset& data, const tinygltf::Node& node, const tinygltf::Model& model)
+void loadNode(assets::SkeletonData& data, const tinygltf::Node& node)
 {
-	// parent index is set by caller after all nodes are loaded
-	NodeAsset newNode{};
-	newNode.parentIdx = -1;
-	newNode.name = node.name;
-	//newNode.skinIndex = node.skin;
+	assets::SkeletonNode newNode{};
+	newNode.nameOffset = data.addString(node.name);
+	newNode.nameLength = (uint32_t)node.name.size();
 	newNode.matrix = glm::mat4(1.0f);
-	newNode.mesh = node.mesh;
+	newNode.scale[0] = newNode.scale[1] = newNode.scale[2] = 1.0f;
+	newNode.rotation[3] = 1.0f;
 
-	// Generate local node matrix
-	glm::vec3 translation = glm::vec3(0.0f);
 	if (node.translation.size() == 3) {
-		translation = glm::make_vec3(node.translation.data());
-		newNode.translation = translation;
+		for (int i = 0; i < 3; ++i) newNode.translation[i] = (float)node.translation[i];
 	}
-	glm::mat4 rotation = glm::mat4(1.0f);
 	if (node.rotation.size() == 4) {
-		glm::quat q = glm::make_quat(node.rotation.data());
-		newNode.rotation = glm::mat4(q);
+		for (int i = 0; i < 4; ++i) newNode.rotation[i] = (float)node.rotation[i];
 	}
-	glm::vec3 scale = glm::vec3(1.0f);
 	if (node.scale.size() == 3) {
-		scale = glm::make_vec3(node.scale.data());
-		newNode.scale = scale;
+		for (int i = 0; i < 3; ++i) newNode.scale[i] = (float)node.scale[i];
 	}
 	if (node.matrix.size() == 16) {
 		newNode.matrix = glm::make_mat4x4(node.matrix.data());
 	};
 
-	// Node with children
-	for (int child : node.children) {
-		newNode.children.push_back(child);
+	data.nodes.push_back(newNode);
+}
+
+// Loads the nodes ordered so every node is directly followed by its descendants, which lets the engine update a
+// skeleton with one pass over a range of nodes. nodeIndices is set to where each glTF node ended up
+bool loadNodes(assets::SkeletonData& data, const tinygltf::Model& model, std::vector<uint32_t>& nodeIndices)
+{
+	std::vector<int32_t> gltfParents(model.nodes.size(), -1);
+	for (size_t i = 0; i < model.nodes.size(); ++i) {
+		for (int child : model.nodes[i].children) {
+			if (child < 0 || (size_t)child >= model.nodes.size() || gltfParents[child] >= 0) {
+				std::cout << "ERROR: node " << child << " is not a node or has more than one parent\n";
+				return false;
+			}
+			gltfParents[child] = (int32_t)i;
+		}
 	}
 
-	data.nodes.push_back(newNode);
-	data.linearNodes.push_back(newNode);
+	nodeIndices.assign(model.nodes.size(), 0);
+	std::vector<int32_t> stack;
+	for (size_t i = 0; i < model.nodes.size(); ++i) {
+		if (gltfParents[i] >= 0) continue;
+
+		stack.push_back((int32_t)i);
+		while (!stack.empty()) {
+			int32_t node{ stack.back() };
+			stack.pop_back();
+
+			std::cout << model.nodes[node].name << '\n';
+
+			nodeIndices[node] = (uint32_t)data.nodes.size();
+			data.parents.push_back(gltfParents[node] < 0 ? -1 : (int32_t)nodeIndices[gltfParents[node]]);
+			loadNode(data, model.nodes[node]);
+
+			// pushed in reverse so the children keep their order
+			const std::vector<int>& children{ model.nodes[node].children };
+			for (auto child = children.rbegin(); child != children.rend(); ++child) {
+				stack.push_back(*child);
+			}
+		}
+	}
+
+	// nodes in a cycle never hang off a root
+	if (data.nodes.size() != model.nodes.size()) {
+		std::cout << "ERROR: node hierarchy has a cycle\n";
+		return false;
+	}
+
+	return true;
 }
 
-void extractSkeletalAnimation(tinygltf::Model gltfModel, const fs::path& input, const fs::path& outputFolder)
+bool extractSkeletalAnimation(const GLTFFile& gltf, const fs::path& input, const fs::path& outputFolder, const ConverterState& convState)
 {
-	std::string error;
+	assets::SkeletonData data{};
+	std::vector<uint32_t> nodeIndices;
 
-	SkeletalAnimationDataAsset data{};
+	if (!loadNodes(data, gltf.model, nodeIndices) || !loadAnimations(data, gltf, nodeIndices, convState) || !loadSkins(data, gltf, nodeIndices)) {
+		return false;
+	}
+
+	std::string skelName{ calculateSkeletonNameGLTF() };
+	fs::path skelPath = outputFolder / (skelName + ".skel");
+
+	std::vector<char> file{ assets::packSkeleton(data) };
+	std::ofstream ofs{ skelPath, std::ios::binary };
+	ofs.write(file.data(), file.size());
+	if (!ofs) {
+		std::cout << "ERROR: could not write " << skelPath << '\n';
+		return false;
+	}
 
-	const tinygltf::Scene& scene = gltfModel.scenes[gltfModel.defaultScene > -1 ? gltfModel.defaultScene : 0];
+	return true;
+}
+
+// Every asset made from a glTF goes into a folder of its own
+fs::path outputFolderGLTF(const fs::path& input, const fs::path& output)
+{
+	return output.parent_path() / (input.stem().string() + "_GLTF");
+}
+
+constexpr uint32_t GLB_MAGIC{ 0x46546C67 };      // "glTF"
+constexpr uint32_t GLB_CHUNK_JSON{ 0x4E4F534A }; // "JSON"
+constexpr uint32_t GLB_CHUNK_BIN{ 0x004E4942 };  // "BIN\0"
+
+// Parses the JSON chunk of a mapped .glb. tinygltf would copy the binary chunk into the buffer stored in it, so that
+// buffer is handed to it as a one byte data URI instead and read from the mapping. Images are left out as well,
+// textures are baked from their own files and tinygltf would decode every image embedded in the file
+bool loadGLB(const fs::path& input, GLTFFile& gltf, std::string& err, std::string& warn)
+{
+	if (!gltf.mapping.open(input.string().c_str())) {
+		err = "Failed to map file";
+		return false;
+	}
+	const uint8_t* bytes{ (const uint8_t*)gltf.mapping.data() };
 
-	int32_t meshNodeIdx{ -1 };
-	for (size_t i = 0; i < gltfModel.nodes.size(); ++i) {
+	// magic, version and length of the file, then length and type of the JSON chunk
+	uint32_t header[5];
+	if (gltf.mapping.size() < sizeof(header)) {
+		err = "Too short for glTF binary";
+		return false;
+	}
+	memcpy(header, bytes, sizeof(header));
 
-		std::cout << gltfModel.nodes[i].name << '\n';
+	size_t length{ std::min<size_t>(header[2], gltf.mapping.size()) };
+	size_t jsonLength{ header[3] };
+	if (header[0] != GLB_MAGIC || header[1] != 2 || header[4] != GLB_CHUNK_JSON || sizeof(header) + jsonLength > length) {
+		err = "Invalid glTF binary header";
+		return false;
+	}
 
-		loadNode(data, gltfModel.nodes[i], gltfModel);
-		if (data.nodes.back().mesh > -1) {
-			meshNodeIdx = i;
+	// the binary chunk is optional, it follows the JSON chunk which is padded to 4 bytes
+	const uint8_t* binData{ nullptr };
+	size_t binSize{ 0 };
+	size_t binChunk{ sizeof(header) + ((jsonLength + 3) & ~(size_t)3) };
+	if (binChunk + 8 <= length) {
+		uint32_t chunk[2];
+		memcpy(chunk, bytes + binChunk, sizeof(chunk));
+		if (chunk[1] == GLB_CHUNK_BIN && binChunk + 8 + chunk[0] <= length) {
+			binData = bytes + binChunk + 8;
+			binSize = chunk[0];
 		}
 	}
 
-	// set parent indices for loaded nodes
-	for (int i = 0; i < data.nodes.size(); ++i) {
-		for (int32_t child : data.nodes[i].children) {
-			data.nodes[child].parentIdx = i;
+	const char* jsonBegin{ (const char*)bytes + sizeof(header) };
+	nlohmann::json json = nlohmann::json::parse(jsonBegin, jsonBegin + jsonLength, nullptr, false);
+	if (json.is_discarded() || !json.is_object()) {
+		err = "Invalid JSON chunk";
+		return false;
+	}
+
+	// only the first buffer can be stored in the binary chunk, which it is if it has no uri
+	bool embeddedBuffer{ false };
+	size_t embeddedLength{ 0 };
+	if (json.contains("buffers") && json["buffers"].is_array() && !json["buffers"].empty() && !json["buffers"][0].contains("uri")) {
+		nlohmann::json& buffer = json["buffers"][0];
+		embeddedLength = buffer.value("byteLength", (size_t)0);
+		if (embeddedLength > binSize) {
+			err = "Buffer 0 is larger than the binary chunk";
+			return false;
 		}
+		buffer["uri"] = "data:application/octet-stream;base64,AA==";
+		buffer["byteLength"] = 1;
+		embeddedBuffer = true;
 	}
+	json.erase("images");
 
-	if (gltfModel.animations.size() > 0) {
-		loadAnimations(data, gltfModel);
+	std::string text{ json.dump() };
+	tinygltf::TinyGLTF loader;
+	if (!loader.LoadASCIIFromString(&gltf.model, &err, &warn, text.c_str(), (unsigned int)text.size(), input.parent_path().string())) {
+		return false;
 	}
 
-	loadSkins(data, gltfModel, meshNodeIdx);
+	for (const tinygltf::Buffer& buffer : gltf.model.buffers) {
+		gltf.buffers.push_back({ buffer.data.data(), buffer.data.size() });
+	}
+	if (embeddedBuffer) {
+		gltf.buffers[0] = { binData, embeddedLength };
+	}
 
-	// serialize
-	std::string skelName{ calculateSkeletonNameGLTF() };
-	fs::path skelPath = outputFolder / (skelName + ".skel");
+	return true;
+}
+
+// Loads a .gltf or .glb and checks every buffer view is inside its buffer, so the accessors can be read without
+// checking each of them against the buffer
+bool loadGLTF(const fs::path& input, GLTFFile& gltf)
+{
+	std::string err;
+	std::string warn;
+	bool ret;
+
+	if (input.extension() == ".glb") {
+		ret = loadGLB(input, gltf, err, warn);
+	} else {
+		tinygltf::TinyGLTF loader;
+		ret = loader.LoadASCIIFromFile(&gltf.model, &err, &warn, input.string().c_str());
+		for (const tinygltf::Buffer& buffer : gltf.model.buffers) {
+			gltf.buffers.push_back({ buffer.data.data(), buffer.data.size() });
+		}
+	}
+
+	if (!warn.empty()) {
+		printf("Warn: %s\n", warn.c_str());
+	}
+
+	if (!err.empty()) {
+		printf("Err: %s\n", err.c_str());
+	}
+
+	if (!ret) {
+		printf("Failed to parse glTF\n");
+		return false;
+	}
+
+	for (size_t i = 0; i < gltf.model.bufferViews.size(); ++i) {
+		const tinygltf::BufferView& view = gltf.model.bufferViews[i];
+		if (view.buffer < 0 || (size_t)view.buffer >= gltf.buffers.size() || view.byteOffset + view.byteLength > gltf.buffers[view.buffer].size) {
+			printf("Buffer view %zu is outside of its buffer\n", i);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// externalInputs gets the buffer files the glTF references, which the bake depends on as much as the glTF itself
+bool convertGLTF(const fs::path& input, const fs::path& output, const ConverterState& convState, std::vector<fs::path>& externalInputs)
+{
+	GLTFFile gltf;
+	if (!loadGLTF(input, gltf)) {
+		return false;
+	}
+	tinygltf::Model& model = gltf.model;
+
+	for (const tinygltf::Buffer& buffer : model.buffers) {
+		if (!buffer.uri.empty() && buffer.uri.rfind("data:", 0) != 0) {
+			externalInputs.push_back(input.parent_path() / buffer.uri);
+		}
+	}
+
+	auto folder = outputFolderGLTF(input, output);
+	fs::create_directory(folder);
+
+	// If the mesh is skinned, we must use vertex format which includes skinning data
+	std::cout << "skins: " << model.skins.size() << '\n';
+	if (model.skins.size() == 0) {
+		if (!extractMeshesGLTF<Vertex>(gltf, input, folder, convState, VertexFormat::DEFAULT)) {
+			return false;
+		}
+	} else {
+		if (!extractMeshesGLTF<VertexSkinned>(gltf, input, folder, convState, VertexFormat::SKINNED)) {
+			return false;
+		}
+		if (!extractSkeletalAnimation(gltf, input, folder, convState)) {
+			return false;
+		}
+	}
+
+	//extractMaterialsGLTF(model, input, folder, convState);
+
+	return true;
+}
+
+// Packs every baked asset under export_path into a single archive, named by its path relative to export_path
+bool writeArchive(const fs::path& exportPath)
+{
+	std::vector<fs::path> files;
+	for (auto& p : fs::recursive_directory_iterator(exportPath)) {
+		auto ext{ p.path().extension() };
+		if (ext == ".tx" || ext == ".mesh" || ext == ".skel" || ext == ".dict") {
+			files.push_back(p.path());
+		}
+	}
 
-	{
-		std::ofstream ofs{ skelPath, std::ios::binary };
-		cereal::BinaryOutputArchive oarchive(ofs);
+	// directory iteration order is unspecified, sort so the archive is deterministic
+	std::sort(files.begin(), files.end());
 
-		oarchive(data);
+	assets::ArchiveWriter writer;
+	for (const fs::path& file : files) {
+		std::string name{ file.lexically_relative(exportPath).generic_string() };
+		if (!writer.addFile(name, file.string().c_str())) {
+			return false;
+		}
 	}
+
+	fs::path archivePath{ exportPath / ASSET_ARCHIVE_NAME };
+	std::cout << "Writing " << files.size() << " assets to " << archivePath << '\n';
+
+	return writer.write(archivePath.string().c_str());
 }
 
 int main(int argc, char* argv[])
@@ -758,9 +1781,77 @@ int main(int argc, char* argv[])
 		convstate.asset_path = path;
 		convstate.export_path = exported_dir;
 
+		CompressionReport compressionReport;
+		uint32_t threadCount{ std::max(1u, std::thread::hardware_concurrency()) };
+		// set with -force, bakes every source even if the manifest says it is up to date
+		bool force{ false };
+		for (int i = 2; i < argc; ++i) {
+			std::string arg{ argv[i] };
+			if (std::string{ argv[i] } == "-force") {
+				force = true;
+			} else if (std::string{ argv[i] } == "-compression-report") {
+				convstate.compressionReport = &compressionReport;
+			} else if (std::string{ argv[i] } == "-json-sidecar") {
+				convstate.jsonSidecar = true;
+			} else if (std::string{ argv[i] } == "-float-vertices") {
+				convstate.floatVertices = true;
+			} else if (std::string{ argv[i] } == "-no-mesh-optimization") {
+				convstate.optimizeMeshes = false;
+			} else if (std::string{ argv[i] } == "-no-vertex-dedup") {
+				convstate.deduplicateVertices = false;
+			} else if (std::string{ argv[i] } == "-weld-vertices" && i + 1 < argc) {
+				convstate.weldEpsilon = std::max(0.0f, (float)atof(argv[++i]));
+			} else if (std::string{ argv[i] } == "-animation-tolerance" && i + 1 < argc) {
+				convstate.animationTolerance = std::max(0.0f, (float)atof(argv[++i]));
+			} else if (std::string{ argv[i] } == "-meshlets") {
+				convstate.meshlets = true;
+			} else if (std::string{ argv[i] } == "-no-lods") {
+				convstate.lods = false;
+			} else if (std::string{ argv[i] } == "-no-texture-compression") {
+				convstate.compressTextures = false;
+			} else if (std::string{ argv[i] } == "-bc1-color-textures") {
+				convstate.bc1ColorTextures = true;
+			} else if (arg == "-j" || (arg.size() > 2 && arg.rfind("-j", 0) == 0
+				&& std::all_of(arg.begin() + 2, arg.end(), [](char c) { return c >= '0' && c <= '9'; }))) {
+				// -j <threads> or -j<threads>, -j 1 bakes everything on the main thread
+				std::string count{ arg.size() > 2 ? arg.substr(2) : (i + 1 < argc ? argv[++i] : "") };
+				threadCount = (uint32_t)std::max(1, atoi(count.c_str()));
+			}
+		}
+
+		JobPool pool{ threadCount };
+		convstate.jobPool = &pool;
+
+		fs::create_directories(exported_dir);
+		BakeManifest manifest{ directory, exported_dir };
+		manifest.load(convstate.bakerKey(), force);
+
+		// meshes left from the previous bake were compressed with its dictionary, a new one is only trained when every
+		// source is baked again or there is none yet
+		MeshDictionary meshDictionary;
+		fs::path meshDictionaryPath{ exported_dir / MESH_DICTIONARY_NAME };
+		if (!manifest.bakesEverything() && fs::exists(meshDictionaryPath)) {
+			std::ifstream dictionaryFile{ meshDictionaryPath, std::ios::binary };
+			meshDictionary.dictionary.assign(std::istreambuf_iterator<char>{ dictionaryFile }, std::istreambuf_iterator<char>{});
+			if (!dictionaryFile.is_open() || dictionaryFile.bad()) {
+				std::cout << "Error when trying to read file: " << meshDictionaryPath << std::endl;
+				return -1;
+			}
+			meshDictionary.reuse = true;
+		}
+		convstate.meshDictionary = &meshDictionary;
+
+		// the directory walk and creating output folders stay on this thread, converting each file is a job
+		JobCounter files;
+		std::atomic<bool> failed{ false };
+		std::atomic<uint32_t> bakedCount{ 0 };
+		std::atomic<uint32_t> skippedCount{ 0 };
+
 		for (auto& p : fs::recursive_directory_iterator(directory)) {
 			std::cout << "File: " << p << std::endl;
 
+			fs::path source{ p.path() };
+
 			auto relative = p.path().lexically_proximate(directory);
 
 			auto export_path = exported_dir / relative;
@@ -772,57 +1863,159 @@ int main(int argc, char* argv[])
 			if (p.path().extension() == ".png" || p.path().extension() == ".jpg" || p.path().extension() == ".TGA") {
 				std::cout << "found a texture" << std::endl;
 
-				auto newpath = p.path();
-
 				export_path.replace_extension(".tx");
 
-				convertImage(p.path(), export_path);
+				pool.submit(files, [=, &convstate, &manifest, &failed, &bakedCount, &skippedCount]() {
+					if (manifest.upToDate(source)) {
+						++skippedCount;
+						return;
+					}
+
+					BakeRecord record;
+					if (!manifest.stampInputs({ source }, record.inputs) || !convertImage(source, export_path, convstate)) {
+						manifest.recordFailure(source);
+						failed = true;
+						return;
+					}
+
+					std::string output{ convstate.convertToExportRelative(export_path).generic_string() };
+					record.outputs.push_back(output);
+					if (convstate.jsonSidecar) {
+						record.outputs.push_back(output + ".json");
+					}
+					manifest.record(source, std::move(record));
+					++bakedCount;
+				});
 			}
 
-			if (p.path().extension() == ".gltf") {
+			if (p.path().extension() == ".gltf" || p.path().extension() == ".glb") {
 				std::cout << "found a mesh (gltf)\n";
 
-				tinygltf::Model model;
-				tinygltf::TinyGLTF loader;
-				std::string err;
-				std::string warn;
+				pool.submit(files, [=, &convstate, &manifest, &failed, &bakedCount, &skippedCount]() {
+					if (manifest.upToDate(source)) {
+						++skippedCount;
+						return;
+					}
 
-				bool ret = loader.LoadASCIIFromFile(&model, &err, &warn, p.path().string().c_str());
+					BakeRecord record;
+					std::vector<fs::path> externalInputs;
+					std::vector<BakeInput> externalStamps;
+					if (!manifest.stampInputs({ source }, record.inputs) || !convertGLTF(source, export_path, convstate, externalInputs)) {
+						manifest.recordFailure(source);
+						failed = true;
+						return;
+					}
 
-				if (!warn.empty()) {
-					printf("Warn: %s\n", warn.c_str());
-				}
+					// buffers are only known once the glTF is parsed
+					if (!manifest.stampInputs(externalInputs, externalStamps)) {
+						manifest.recordFailure(source);
+						failed = true;
+						return;
+					}
+					record.inputs.insert(record.inputs.end(), externalStamps.begin(), externalStamps.end());
+					record.outputs.push_back(convstate.convertToExportRelative(outputFolderGLTF(source, export_path)).generic_string());
+					manifest.record(source, std::move(record));
+					++bakedCount;
+				});
+			}
+		}
 
-				if (!err.empty()) {
-					printf("Err: %s\n", err.c_str());
-				}
+		pool.wait(files);
 
-				if (!ret) {
-					printf("Failed to parse glTF\n");
-					return -1;
-				} else {
-					auto folder = export_path.parent_path() / (p.path().stem().string() + "_GLTF");
-					fs::create_directory(folder);
-
-					// If the mesh is skinned, we must use vertex format which includes skinning data
-					std::cout << "skins: " << model.skins.size() << '\n';
-					if (model.skins.size() == 0) {
-						extractMeshesGLTF<Vertex>(model, p.path(), folder, convstate, VertexFormat::DEFAULT);
-					} else {
-						extractMeshesGLTF<VertexSkinned>(model, p.path(), folder, convstate, VertexFormat::SKINNED);
-						extractSkeletalAnimation(model, p.path(), folder);
-					}
+		if (!finishMeshDictionary(exported_dir, manifest.bakesEverything(), convstate)) {
+			failed = true;
+		}
 
-					//extractMaterialsGLTF(model, p.path(), folder, convstate);
-				}
-			}
+		size_t removedCount{ manifest.removeStale() };
+
+		std::cout << "Baked " << bakedCount << " sources, " << skippedCount << " were up to date, removed " << removedCount << '\n';
+
+		// the archive only has to be rewritten if one of the assets in it changed. The manifest is only saved once the
+		// archive is written, otherwise the next run would find every source up to date and keep the old archive
+		if ((bakedCount > 0 || removedCount > 0 || !fs::exists(exported_dir / ASSET_ARCHIVE_NAME)) && !writeArchive(exported_dir)) {
+			std::cout << "Error when writing the asset archive, the bake manifest is not updated\n";
+			failed = true;
+		} else if (!manifest.save()) {
+			failed = true;
+		}
+
+		if (convstate.compressionReport) {
+			compressionReport.print();
+		}
+
+		if (failed) {
+			return -1;
 		}
 	}
 
 	return 0;
 }
 
+void CompressionReport::add(const std::vector<char>& blob)
+{
+	std::vector<char> compressed;
+	std::vector<char> decompressed(blob.size());
+
+	// compress and time every mode first, then take the lock only to add up the results
+	std::vector<std::pair<uint64_t, double>> results;
+	results.reserve(entries.size());
+
+	for (const Entry& entry : entries) {
+		if (entry.mode == CompressionMode::None) {
+			results.push_back({ blob.size(), 0.0 });
+			continue;
+		}
+
+		compressBlocks(blob.data(), blob.size(), compressed, entry.level);
+
+		auto decodeStart{ std::chrono::high_resolution_clock::now() };
+		decompressBlocks(compressed.data(), compressed.size(), decompressed.data(), decompressed.size());
+		auto decodeEnd{ std::chrono::high_resolution_clock::now() };
+
+		results.push_back({ compressed.size(), std::chrono::duration_cast<std::chrono::nanoseconds>(decodeEnd - decodeStart).count() / 1000000.0 });
+	}
+
+	std::lock_guard<std::mutex> lock{ mutex };
+	for (size_t i = 0; i < entries.size(); ++i) {
+		entries[i].originalSize += blob.size();
+		entries[i].storedSize += results[i].first;
+		entries[i].decodeMs += results[i].second;
+	}
+}
+
+void CompressionReport::print() const
+{
+	std::cout << "\nCompression report\n";
+	std::cout << "mode        stored MB   ratio   decode ms   decode MB/s\n";
+
+	for (const Entry& entry : entries) {
+		double storedMB{ entry.storedSize / (1024.0 * 1024.0) };
+		double ratio{ entry.originalSize ? (double)entry.storedSize / entry.originalSize : 1.0 };
+		double throughput{ entry.decodeMs > 0.0 ? (entry.originalSize / (1024.0 * 1024.0)) / (entry.decodeMs / 1000.0) : 0.0 };
+
+		printf("%-10s  %9.2f   %5.3f   %9.2f   %11.1f\n", entry.name, storedMB, ratio, entry.decodeMs, throughput);
+	}
+}
+
 fs::path ConverterState::convertToExportRelative(fs::path path) const
 {
 	return path.lexically_proximate(export_path);
+}
+
+nlohmann::json ConverterState::bakerKey() const
+{
+	nlohmann::json key;
+	key["baker_version"] = BAKER_VERSION;
+	key["asset_version"] = ASSET_VERSION;
+	key["json_sidecar"] = jsonSidecar;
+	key["float_vertices"] = floatVertices;
+	key["optimize_meshes"] = optimizeMeshes;
+	key["deduplicate_vertices"] = deduplicateVertices;
+	key["weld_epsilon"] = weldEpsilon;
+	key["animation_tolerance"] = animationTolerance;
+	key["meshlets"] = meshlets;
+	key["lods"] = lods;
+	key["compress_textures"] = compressTextures;
+	key["bc1_color_textures"] = bc1ColorTextures;
+	return key;
 }
\ No newline at end of file
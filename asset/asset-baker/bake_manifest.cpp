@@ -0,0 +1,273 @@
+#include "bake_manifest.h"
+
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+bool hashFile(const fs::path& path, uint64_t& hash)
+{
+	std::ifstream file{ path, std::ios::binary };
+	if (!file.is_open()) {
+		return false;
+	}
+
+	hash = 14695981039346656037ull;
+	std::vector<char> buffer(1 << 20);
+	while (file) {
+		file.read(buffer.data(), buffer.size());
+		std::streamsize count{ file.gcount() };
+		for (std::streamsize i = 0; i < count; ++i) {
+			hash ^= (uint8_t)buffer[i];
+			hash *= 1099511628211ull;
+		}
+	}
+
+	return true;
+}
+
+BakeManifest::BakeManifest(fs::path assetDirectory, fs::path exportDirectory)
+	: _assetDirectory{ std::move(assetDirectory) }, _exportDirectory{ std::move(exportDirectory) }
+{
+}
+
+void BakeManifest::load(const nlohmann::json& bakerKey, bool force)
+{
+	_bakerKey = bakerKey;
+	_bakeAll = true;
+
+	std::ifstream file{ _exportDirectory / BAKE_MANIFEST_NAME };
+	if (!file.is_open()) {
+		return;
+	}
+
+	nlohmann::json json = nlohmann::json::parse(file, nullptr, false);
+	if (json.is_discarded() || !json.contains("sources")) {
+		std::cout << "Ignoring unreadable bake manifest\n";
+		return;
+	}
+
+	bool sameBaker{ json.contains("baker") && json["baker"] == bakerKey };
+	bool bakeAll{ force || !sameBaker };
+
+	// a manifest with missing or mistyped fields is treated like no manifest at all, rather than trusting part of it
+	std::unordered_map<std::string, BakeRecord> records;
+	try {
+		for (auto& [source, entry] : json.at("sources").items()) {
+			BakeRecord record;
+			for (const nlohmann::json& input : entry.at("inputs")) {
+				record.inputs.push_back({ input.at("path").get<std::string>(), input.at("size").get<uint64_t>(),
+					input.at("modified").get<int64_t>(), input.at("hash").get<uint64_t>() });
+			}
+			for (const nlohmann::json& output : entry.at("outputs")) {
+				record.outputs.push_back(output.get<std::string>());
+
+				// outputs are removed along with their source, so they must not point outside the export directory
+				fs::path outputPath{ record.outputs.back() };
+				if (outputPath.empty() || outputPath.has_root_path()
+					|| std::find(outputPath.begin(), outputPath.end(), "..") != outputPath.end()) {
+					throw std::runtime_error{ "output outside of the export directory" };
+				}
+			}
+
+			// without matching inputs every source is baked again, the outputs are still needed to clean up deleted sources
+			if (bakeAll) {
+				record.inputs.clear();
+			}
+
+			records[source] = std::move(record);
+		}
+	} catch (const std::exception& e) {
+		std::cout << "Ignoring unreadable bake manifest (" << e.what() << ")\n";
+		return;
+	}
+
+	_bakeAll = bakeAll;
+	_records = std::move(records);
+
+	if (!sameBaker && !force) {
+		std::cout << "Baker version or settings changed, baking every source\n";
+	}
+}
+
+bool BakeManifest::save() const
+{
+	nlohmann::json sources = nlohmann::json::object();
+	for (const auto& [source, record] : _records) {
+		nlohmann::json entry;
+		entry["inputs"] = nlohmann::json::array();
+		for (const BakeInput& input : record.inputs) {
+			entry["inputs"].push_back({ { "path", input.path }, { "size", input.size }, { "modified", input.modified }, { "hash", input.hash } });
+		}
+		entry["outputs"] = record.outputs;
+		sources[source] = std::move(entry);
+	}
+
+	nlohmann::json json;
+	json["baker"] = _bakerKey;
+	json["sources"] = std::move(sources);
+
+	// written next to the manifest and renamed over it, so an interrupted bake can't leave half a manifest behind
+	fs::path path{ _exportDirectory / BAKE_MANIFEST_NAME };
+	fs::path tempPath{ path };
+	tempPath += ".tmp";
+	{
+		std::ofstream file{ tempPath };
+		if (!file.is_open()) {
+			std::cout << "Error when trying to write file: " << tempPath << std::endl;
+			return false;
+		}
+		file << json.dump(1, '\t');
+		file.close();
+		if (!file) {
+			std::cout << "Error when trying to write file: " << tempPath << std::endl;
+			return false;
+		}
+	}
+
+	std::error_code error;
+	fs::rename(tempPath, path, error);
+	if (error) {
+		std::cout << "Error when trying to write file: " << path << " (" << error.message() << ")" << std::endl;
+		fs::remove(tempPath, error);
+		return false;
+	}
+	return true;
+}
+
+std::string BakeManifest::relativeSource(const fs::path& source) const
+{
+	return source.lexically_proximate(_assetDirectory).generic_string();
+}
+
+bool BakeManifest::upToDate(const fs::path& source)
+{
+	std::string name{ relativeSource(source) };
+	BakeRecord record;
+	{
+		std::lock_guard<std::mutex> lock{ _mutex };
+		_seen.insert(name);
+
+		auto it{ _records.find(name) };
+		if (it == _records.end()) {
+			return false;
+		}
+		record = it->second;
+	}
+
+	if (record.inputs.empty()) {
+		return false;
+	}
+
+	bool touched{ false };
+	for (BakeInput& input : record.inputs) {
+		fs::path path{ _assetDirectory / input.path };
+		std::error_code error;
+		uint64_t size{ fs::file_size(path, error) };
+		if (error || size != input.size) {
+			return false;
+		}
+
+		int64_t modified{ (int64_t)fs::last_write_time(path, error).time_since_epoch().count() };
+		if (error) {
+			return false;
+		}
+		if (modified == input.modified) {
+			continue;
+		}
+
+		// touched, only a different hash means it needs baking again
+		uint64_t hash;
+		if (!hashFile(path, hash) || hash != input.hash) {
+			return false;
+		}
+		input.modified = modified;
+		touched = true;
+	}
+
+	for (const std::string& output : record.outputs) {
+		if (!fs::exists(_exportDirectory / output)) {
+			return false;
+		}
+	}
+
+	// keep the new modification times so the touched files aren't hashed again next time
+	if (touched) {
+		std::lock_guard<std::mutex> lock{ _mutex };
+		_records[name] = std::move(record);
+	}
+
+	return true;
+}
+
+bool BakeManifest::stampInputs(const std::vector<fs::path>& inputs, std::vector<BakeInput>& stamps) const
+{
+	stamps.clear();
+	for (const fs::path& path : inputs) {
+		BakeInput stamp{};
+		stamp.path = relativeSource(path);
+
+		std::error_code error;
+		stamp.size = fs::file_size(path, error);
+		if (!error) {
+			stamp.modified = (int64_t)fs::last_write_time(path, error).time_since_epoch().count();
+		}
+		if (error || !hashFile(path, stamp.hash)) {
+			std::cout << "Failed to read bake input " << path << '\n';
+			return false;
+		}
+
+		stamps.push_back(std::move(stamp));
+	}
+	return true;
+}
+
+void BakeManifest::record(const fs::path& source, BakeRecord record)
+{
+	std::string name{ relativeSource(source) };
+	std::lock_guard<std::mutex> lock{ _mutex };
+	_seen.insert(name);
+	_records[name] = std::move(record);
+}
+
+void BakeManifest::recordFailure(const fs::path& source)
+{
+	std::string name{ relativeSource(source) };
+	std::lock_guard<std::mutex> lock{ _mutex };
+	_seen.insert(name);
+	_records[name].inputs.clear();
+}
+
+size_t BakeManifest::removeStale()
+{
+	size_t removed{ 0 };
+
+	// sources like brick.png and brick.jpg bake to the same file, keep it while one of them is still around
+	std::unordered_set<std::string> liveOutputs;
+	for (const auto& [source, record] : _records) {
+		if (_seen.count(source)) {
+			liveOutputs.insert(record.outputs.begin(), record.outputs.end());
+		}
+	}
+
+	for (auto it = _records.begin(); it != _records.end();) {
+		if (_seen.count(it->first)) {
+			++it;
+			continue;
+		}
+
+		std::cout << "Removing outputs of deleted source " << it->first << '\n';
+		for (const std::string& output : it->second.outputs) {
+			if (liveOutputs.count(output)) {
+				continue;
+			}
+			std::error_code error;
+			fs::remove_all(_exportDirectory / output, error);
+		}
+
+		it = _records.erase(it);
+		++removed;
+	}
+
+	return removed;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "json.hpp"
+
+namespace fs = std::filesystem;
+
+constexpr const char* BAKE_MANIFEST_NAME{ "bake_manifest.json" };
+
+// One file a bake read. Size and modification time let an unchanged file skip hashing, the hash catches
+// files that were touched or copied over without changing
+struct BakeInput {
+	// relative to the asset directory
+	std::string path;
+	uint64_t size;
+	int64_t modified;
+	uint64_t hash;
+};
+
+struct BakeRecord {
+	// the source file itself comes first, followed by what it references such as the buffers of a glTF
+	std::vector<BakeInput> inputs;
+	// files and folders relative to the export directory
+	std::vector<std::string> outputs;
+};
+
+// 64-bit FNV-1a hash of a file's contents. Returns false if the file can't be read
+bool hashFile(const fs::path& path, uint64_t& hash);
+
+// Records what every source was baked from and into, so a later bake can skip sources whose inputs didn't change
+// and delete the outputs of sources that are gone. Sources are checked and recorded from every job thread
+class BakeManifest {
+public:
+	BakeManifest(fs::path assetDirectory, fs::path exportDirectory);
+
+	// Reads the manifest of the previous bake. Every source is baked again if it was made by another baker
+	// version or with other settings, since those change the output without changing any input, or if force is set
+	void load(const nlohmann::json& bakerKey, bool force);
+	bool save() const;
+
+	// Whether load found no manifest it could use, so every source is baked again
+	bool bakesEverything() const { return _bakeAll; }
+
+	// Whether the inputs of source hash the same as when it was last baked and all its outputs still exist.
+	// Marks source as seen either way
+	bool upToDate(const fs::path& source);
+
+	// Sizes, modification times and hashes of inputs. Stamping before baking means a file that changes during the bake
+	// is baked again next time
+	bool stampInputs(const std::vector<fs::path>& inputs, std::vector<BakeInput>& stamps) const;
+
+	void record(const fs::path& source, BakeRecord record);
+
+	// Makes source bake again next time after its bake failed, whatever the previous bake left behind. Its outputs
+	// are kept so they can still be removed once the source is deleted
+	void recordFailure(const fs::path& source);
+
+	// Deletes the outputs of sources that weren't seen in this bake, returns how many sources were removed
+	size_t removeStale();
+
+private:
+	std::string relativeSource(const fs::path& source) const;
+
+	fs::path _assetDirectory;
+	fs::path _exportDirectory;
+	nlohmann::json _bakerKey;
+	bool _bakeAll{ true };
+
+	std::mutex _mutex;
+	std::unordered_map<std::string, BakeRecord> _records;
+	std::unordered_set<std::string> _seen;
+};
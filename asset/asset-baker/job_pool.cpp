@@ -0,0 +1,149 @@
+#include "job_pool.h"
+
+#include <algorithm>
+
+// The pool a worker thread belongs to and the queue it owns
+static thread_local const JobPool* workerPool{ nullptr };
+static thread_local uint32_t workerQueue{ 0 };
+
+JobPool::JobPool(uint32_t threadCount)
+{
+	threadCount = std::max(1u, threadCount);
+
+	_queues.reserve(threadCount);
+	for (uint32_t i = 0; i < threadCount; ++i) {
+		_queues.push_back(std::make_unique<Queue>());
+	}
+
+	_threads.reserve(threadCount - 1);
+	for (uint32_t i = 0; i < threadCount - 1; ++i) {
+		_threads.emplace_back(&JobPool::workerLoop, this, i);
+	}
+}
+
+JobPool::~JobPool()
+{
+	{
+		std::lock_guard<std::mutex> lock{ _sleepMutex };
+		_stopping = true;
+	}
+	_wake.notify_all();
+
+	for (std::thread& thread : _threads) {
+		thread.join();
+	}
+}
+
+uint32_t JobPool::currentQueue() const
+{
+	return workerPool == this ? workerQueue : (uint32_t)_queues.size() - 1;
+}
+
+void JobPool::submit(JobCounter& counter, std::function<void()> job)
+{
+	++counter.pending;
+
+	// counted under the sleep mutex, so a thread can't miss the wake up between checking for jobs and going to sleep,
+	// and before the job is queued so whoever pops it never takes the count below zero
+	{
+		std::lock_guard<std::mutex> lock{ _sleepMutex };
+		++_queuedJobs;
+	}
+
+	Queue& queue{ *_queues[currentQueue()] };
+	{
+		std::lock_guard<std::mutex> lock{ queue.mutex };
+		queue.jobs.push_back({ std::move(job), &counter });
+	}
+	_wake.notify_one();
+}
+
+bool JobPool::popJob(uint32_t queue, Job& job)
+{
+	{
+		Queue& own{ *_queues[queue] };
+		std::lock_guard<std::mutex> lock{ own.mutex };
+		if (!own.jobs.empty()) {
+			job = std::move(own.jobs.back());
+			own.jobs.pop_back();
+			--_queuedJobs;
+			return true;
+		}
+	}
+
+	for (uint32_t i = 1; i < _queues.size(); ++i) {
+		Queue& victim{ *_queues[(queue + i) % _queues.size()] };
+		std::lock_guard<std::mutex> lock{ victim.mutex };
+		if (!victim.jobs.empty()) {
+			job = std::move(victim.jobs.front());
+			victim.jobs.pop_front();
+			--_queuedJobs;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void JobPool::run(Job& job)
+{
+	job.function();
+
+	if (--job.counter->pending == 0) {
+		std::lock_guard<std::mutex> lock{ _sleepMutex };
+		_wake.notify_all();
+	}
+}
+
+void JobPool::wait(JobCounter& counter)
+{
+	uint32_t queue{ currentQueue() };
+	Job job;
+
+	while (counter.pending > 0) {
+		if (popJob(queue, job)) {
+			run(job);
+			continue;
+		}
+
+		// every remaining job of counter is running on another thread
+		std::unique_lock<std::mutex> lock{ _sleepMutex };
+		_wake.wait(lock, [&]() { return counter.pending == 0 || _queuedJobs > 0; });
+	}
+}
+
+void JobPool::parallelFor(uint32_t count, uint32_t batchSize, const std::function<void(uint32_t)>& body)
+{
+	batchSize = std::max(1u, batchSize);
+
+	JobCounter counter;
+	for (uint32_t first = 0; first < count; first += batchSize) {
+		uint32_t last{ std::min(first + batchSize, count) };
+		submit(counter, [first, last, &body]() {
+			for (uint32_t i = first; i < last; ++i) {
+				body(i);
+			}
+		});
+	}
+	wait(counter);
+}
+
+void JobPool::workerLoop(uint32_t queue)
+{
+	workerPool = this;
+	workerQueue = queue;
+	Job job;
+
+	while (true) {
+		if (popJob(queue, job)) {
+			run(job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock{ _sleepMutex };
+		_wake.wait(lock, [&]() { return _stopping || _queuedJobs > 0; });
+		if (_stopping) {
+			return;
+		}
+	}
+}
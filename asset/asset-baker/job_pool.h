@@ -0,0 +1,67 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Number of unfinished jobs in a group, so whoever submitted them can wait for all of them at once
+struct JobCounter {
+	std::atomic<uint32_t> pending{ 0 };
+};
+
+// Thread pool where every thread has its own queue. A thread runs the jobs it submitted newest first, which keeps the
+// data they share in its cache, and steals the oldest job from another queue once its own is empty, which tends to be
+// the biggest piece of work left. Jobs may submit and wait on more jobs, a waiting thread runs jobs instead of blocking
+class JobPool {
+public:
+	// threadCount includes the thread that waits on jobs, so a pool of 1 runs every job inline inside wait
+	explicit JobPool(uint32_t threadCount);
+
+	// Jobs must have been waited on before the pool is destroyed
+	~JobPool();
+
+	JobPool(const JobPool&) = delete;
+	JobPool& operator=(const JobPool&) = delete;
+
+	void submit(JobCounter& counter, std::function<void()> job);
+
+	// Runs queued jobs until every job submitted with counter has finished
+	void wait(JobCounter& counter);
+
+	// Calls body for every index below count, batchSize consecutive indices per job, and waits for all of them
+	void parallelFor(uint32_t count, uint32_t batchSize, const std::function<void(uint32_t)>& body);
+
+	uint32_t threadCount() const { return (uint32_t)_queues.size(); }
+
+private:
+	struct Job {
+		std::function<void()> function;
+		JobCounter* counter;
+	};
+
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	// Queue of the calling thread. Threads that aren't workers, like main, share the last one
+	uint32_t currentQueue() const;
+
+	bool popJob(uint32_t queue, Job& job);
+	void run(Job& job);
+	void workerLoop(uint32_t queue);
+
+	std::vector<std::unique_ptr<Queue>> _queues;
+	std::vector<std::thread> _threads;
+
+	// idle threads sleep until a job is queued or a counter they wait on reaches zero
+	std::mutex _sleepMutex;
+	std::condition_variable _wake;
+	std::atomic<uint32_t> _queuedJobs{ 0 };
+	bool _stopping{ false };
+};
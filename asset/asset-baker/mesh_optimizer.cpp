@@ -0,0 +1,847 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <cfloat>
+#include <unordered_map>
+
+#include "glm/glm.hpp"
+
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+{
+	// a vertex is in the cache while fewer than cacheSize misses happened since it was last transformed
+	std::vector<uint32_t> cachedAt(vertexCount, 0);
+	uint32_t time{ cacheSize + 1 };
+	uint32_t misses{ 0 };
+
+	for (size_t i = 0; i < indexCount; ++i) {
+		uint32_t v{ indices[i] };
+		if (time - cachedAt[v] > cacheSize) {
+			cachedAt[v] = time++;
+			++misses;
+		}
+	}
+
+	VertexCacheStats stats{};
+	stats.transformedVertices = misses;
+	stats.acmr = indexCount == 0 ? 0.0f : (float)misses / (float)(indexCount / 3);
+	stats.atvr = vertexCount == 0 ? 0.0f : (float)misses / (float)vertexCount;
+	return stats;
+}
+
+// Triangles using each vertex, as offsets into a single array
+struct TriangleAdjacency {
+	std::vector<uint32_t> counts;
+	std::vector<uint32_t> offsets;
+	std::vector<uint32_t> triangles;
+};
+
+static void buildAdjacency(TriangleAdjacency& adjacency, const uint32_t* indices, size_t indexCount, size_t vertexCount)
+{
+	adjacency.counts.assign(vertexCount, 0);
+	adjacency.offsets.resize(vertexCount);
+	adjacency.triangles.resize(indexCount);
+
+	for (size_t i = 0; i < indexCount; ++i) {
+		assert(indices[i] < vertexCount);
+		++adjacency.counts[indices[i]];
+	}
+
+	uint32_t offset{ 0 };
+	for (size_t v = 0; v < vertexCount; ++v) {
+		adjacency.offsets[v] = offset;
+		offset += adjacency.counts[v];
+	}
+
+	std::vector<uint32_t> filled(vertexCount, 0);
+	for (size_t i = 0; i < indexCount; ++i) {
+		uint32_t v{ indices[i] };
+		adjacency.triangles[adjacency.offsets[v] + filled[v]++] = (uint32_t)(i / 3);
+	}
+}
+
+// Most recently emitted vertex that still has triangles left, otherwise the next such vertex in input order
+static int64_t skipDeadEnd(std::vector<uint32_t>& deadEnd, const std::vector<uint32_t>& liveTriangles, size_t& cursor)
+{
+	while (!deadEnd.empty()) {
+		uint32_t v{ deadEnd.back() };
+		deadEnd.pop_back();
+		if (liveTriangles[v] > 0) return v;
+	}
+
+	for (; cursor < liveTriangles.size(); ++cursor) {
+		if (liveTriangles[cursor] > 0) return (int64_t)cursor;
+	}
+
+	return -1;
+}
+
+void optimizeVertexCache(uint32_t* destination, const uint32_t* indices, size_t indexCount, size_t vertexCount,
+	uint32_t cacheSize, std::vector<uint32_t>* clustersOut)
+{
+	assert(indexCount % 3 == 0);
+	size_t triangleCount{ indexCount / 3 };
+
+	TriangleAdjacency adjacency;
+	buildAdjacency(adjacency, indices, indexCount, vertexCount);
+
+	std::vector<uint32_t> liveTriangles{ adjacency.counts };
+	std::vector<uint32_t> cachedAt(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> deadEnd;
+	std::vector<uint32_t> candidates;
+
+	if (clustersOut) clustersOut->clear();
+
+	uint32_t time{ cacheSize + 1 };
+	size_t cursor{ 0 };
+	size_t outputTriangles{ 0 };
+
+	// jumping to a dead end vertex starts from a cold cache, which is where a new cluster begins
+	int64_t fanning{ skipDeadEnd(deadEnd, liveTriangles, cursor) };
+	bool newCluster{ true };
+
+	while (fanning >= 0) {
+		if (newCluster && clustersOut) {
+			clustersOut->push_back((uint32_t)outputTriangles);
+		}
+
+		candidates.clear();
+
+		uint32_t begin{ adjacency.offsets[fanning] };
+		uint32_t end{ begin + adjacency.counts[fanning] };
+		for (uint32_t a = begin; a < end; ++a) {
+			uint32_t t{ adjacency.triangles[a] };
+			if (emitted[t]) continue;
+
+			for (uint32_t k = 0; k < 3; ++k) {
+				uint32_t v{ indices[t * 3 + k] };
+				destination[outputTriangles * 3 + k] = v;
+
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				--liveTriangles[v];
+
+				if (time - cachedAt[v] > cacheSize) {
+					cachedAt[v] = time++;
+				}
+			}
+
+			emitted[t] = true;
+			++outputTriangles;
+		}
+
+		// next fanning vertex is the candidate that will still be in the cache after its remaining triangles are emitted,
+		// preferring the one transformed longest ago
+		int64_t next{ -1 };
+		int64_t bestPriority{ -1 };
+		for (uint32_t v : candidates) {
+			if (liveTriangles[v] == 0) continue;
+
+			int64_t priority{ 0 };
+			if ((int64_t)(time - cachedAt[v]) + 2 * (int64_t)liveTriangles[v] <= (int64_t)cacheSize) {
+				priority = time - cachedAt[v];
+			}
+
+			if (priority > bestPriority) {
+				bestPriority = priority;
+				next = v;
+			}
+		}
+
+		newCluster = next < 0;
+		fanning = next >= 0 ? next : skipDeadEnd(deadEnd, liveTriangles, cursor);
+	}
+
+	assert(outputTriangles == triangleCount);
+}
+
+// Splits the vertex cache optimized clusters further wherever the cluster so far has a low enough ACMR,
+// so the cache warm-up cost of the new cluster is paid back
+static std::vector<uint32_t> splitClusters(const uint32_t* indices, size_t indexCount, size_t vertexCount,
+	const std::vector<uint32_t>& clusters, uint32_t cacheSize, float threshold)
+{
+	size_t triangleCount{ indexCount / 3 };
+	float meshAcmr{ analyzeVertexCache(indices, indexCount, vertexCount, cacheSize).acmr };
+	float maxAcmr{ meshAcmr * threshold };
+
+	std::vector<uint32_t> cachedAt(vertexCount, 0);
+	uint32_t time{ cacheSize + 1 };
+
+	std::vector<uint32_t> result;
+	for (size_t c = 0; c < clusters.size(); ++c) {
+		size_t clusterEnd{ c + 1 < clusters.size() ? clusters[c + 1] : triangleCount };
+
+		// every cluster may end up anywhere in the draw order, so each one starts from a cold cache
+		time += cacheSize + 1;
+		uint32_t misses{ 0 };
+		uint32_t triangles{ 0 };
+		result.push_back(clusters[c]);
+
+		for (size_t t = clusters[c]; t < clusterEnd; ++t) {
+			for (uint32_t k = 0; k < 3; ++k) {
+				uint32_t v{ indices[t * 3 + k] };
+				if (time - cachedAt[v] > cacheSize) {
+					cachedAt[v] = time++;
+					++misses;
+				}
+			}
+			++triangles;
+
+			if (t + 1 < clusterEnd && (float)misses <= maxAcmr * (float)triangles) {
+				time += cacheSize + 1;
+				misses = 0;
+				triangles = 0;
+				result.push_back((uint32_t)(t + 1));
+			}
+		}
+	}
+
+	return result;
+}
+
+void optimizeOverdraw(uint32_t* destination, const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount,
+	size_t positionStride, const std::vector<uint32_t>& clusters, uint32_t cacheSize, float threshold)
+{
+	assert(indexCount % 3 == 0);
+	size_t triangleCount{ indexCount / 3 };
+
+	if (triangleCount == 0) return;
+
+	std::vector<uint32_t> split{ clusters.empty() ? std::vector<uint32_t>{ 0 } : splitClusters(indices, indexCount, vertexCount, clusters, cacheSize, threshold) };
+
+	auto position = [&](uint32_t v) {
+		const float* p{ (const float*)((const char*)positions + v * positionStride) };
+		return glm::vec3{ p[0], p[1], p[2] };
+	};
+
+	// area weighted centroid and normal of each cluster, the cross product's length is twice the triangle's area
+	std::vector<glm::vec3> clusterCentroid(split.size(), glm::vec3{ 0.0f });
+	std::vector<glm::vec3> clusterNormal(split.size(), glm::vec3{ 0.0f });
+	std::vector<float> clusterArea(split.size(), 0.0f);
+	glm::vec3 meshCentroid{ 0.0f };
+	float meshArea{ 0.0f };
+
+	for (size_t c = 0; c < split.size(); ++c) {
+		size_t clusterEnd{ c + 1 < split.size() ? split[c + 1] : triangleCount };
+
+		for (size_t t = split[c]; t < clusterEnd; ++t) {
+			glm::vec3 p0{ position(indices[t * 3 + 0]) };
+			glm::vec3 p1{ position(indices[t * 3 + 1]) };
+			glm::vec3 p2{ position(indices[t * 3 + 2]) };
+
+			glm::vec3 normal{ glm::cross(p1 - p0, p2 - p0) };
+			float area{ glm::length(normal) };
+
+			clusterCentroid[c] += (p0 + p1 + p2) * (area / 3.0f);
+			clusterNormal[c] += normal;
+			clusterArea[c] += area;
+		}
+
+		meshCentroid += clusterCentroid[c];
+		meshArea += clusterArea[c];
+	}
+
+	if (meshArea > 0.0f) meshCentroid /= meshArea;
+
+	std::vector<float> sortKey(split.size());
+	for (size_t c = 0; c < split.size(); ++c) {
+		glm::vec3 centroid{ clusterArea[c] > 0.0f ? clusterCentroid[c] / clusterArea[c] : meshCentroid };
+		float normalLength{ glm::length(clusterNormal[c]) };
+		glm::vec3 normal{ normalLength > 0.0f ? clusterNormal[c] / normalLength : glm::vec3{ 0.0f } };
+
+		sortKey[c] = glm::dot(centroid - meshCentroid, normal);
+	}
+
+	// stable so equal keys keep the vertex cache order and the bake stays deterministic
+	std::vector<uint32_t> order(split.size());
+	for (uint32_t i = 0; i < order.size(); ++i) order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return sortKey[a] > sortKey[b];
+	});
+
+	size_t offset{ 0 };
+	for (uint32_t c : order) {
+		size_t clusterEnd{ c + 1 < split.size() ? split[c + 1] : triangleCount };
+		size_t count{ (clusterEnd - split[c]) * 3 };
+
+		memcpy(destination + offset, indices + split[c] * 3, count * sizeof(uint32_t));
+		offset += count;
+	}
+
+	assert(offset == indexCount);
+}
+
+size_t optimizeVertexFetchRemap(std::vector<uint32_t>& remap, uint32_t* indices, size_t indexCount, size_t vertexCount)
+{
+	remap.assign(vertexCount, UNUSED_VERTEX);
+	uint32_t nextVertex{ 0 };
+
+	for (size_t i = 0; i < indexCount; ++i) {
+		uint32_t& v{ remap[indices[i]] };
+		if (v == UNUSED_VERTEX) {
+			v = nextVertex++;
+		}
+		indices[i] = v;
+	}
+
+	return nextVertex;
+}
+
+size_t generateVertexRemap(std::vector<uint32_t>& remap, const void* keys, size_t vertexCount, size_t keySize)
+{
+	const uint8_t* bytes{ (const uint8_t*)keys };
+	auto key = [&](uint32_t v) { return bytes + v * keySize; };
+
+	// open addressing with linear probing, at most half full so probes stay short
+	size_t tableSize{ 1 };
+	while (tableSize < vertexCount * 2) tableSize *= 2;
+	std::vector<uint32_t> table(tableSize, UNUSED_VERTEX);
+
+	remap.resize(vertexCount);
+	uint32_t uniqueCount{ 0 };
+
+	for (uint32_t v = 0; v < vertexCount; ++v) {
+		// 64-bit FNV-1a
+		uint64_t hash{ 14695981039346656037ull };
+		for (size_t i = 0; i < keySize; ++i) {
+			hash ^= key(v)[i];
+			hash *= 1099511628211ull;
+		}
+
+		size_t slot{ (size_t)(hash ^ (hash >> 32)) & (tableSize - 1) };
+		while (table[slot] != UNUSED_VERTEX && memcmp(key(table[slot]), key(v), keySize) != 0) {
+			slot = (slot + 1) & (tableSize - 1);
+		}
+
+		if (table[slot] == UNUSED_VERTEX) {
+			table[slot] = v;
+			remap[v] = uniqueCount++;
+		} else {
+			remap[v] = remap[table[slot]];
+		}
+	}
+
+	return uniqueCount;
+}
+
+void remapIndices(uint32_t* indices, size_t indexCount, const std::vector<uint32_t>& remap)
+{
+	for (size_t i = 0; i < indexCount; ++i) {
+		indices[i] = remap[indices[i]];
+	}
+}
+
+static void computeMeshletBounds(Meshlet& meshlet, const uint32_t* indices, const float* positions, size_t positionStride)
+{
+	auto position = [&](uint32_t v) {
+		const float* p{ (const float*)((const char*)positions + v * positionStride) };
+		return glm::vec3{ p[0], p[1], p[2] };
+	};
+
+	glm::vec3 min{ std::numeric_limits<float>::max() };
+	glm::vec3 max{ std::numeric_limits<float>::lowest() };
+	for (uint32_t i = 0; i < meshlet.indexCount; ++i) {
+		glm::vec3 p{ position(indices[meshlet.firstIndex + i]) };
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+
+	glm::vec3 center{ (min + max) * 0.5f };
+	float radius2{ 0.0f };
+	for (uint32_t i = 0; i < meshlet.indexCount; ++i) {
+		glm::vec3 offset{ position(indices[meshlet.firstIndex + i]) - center };
+		radius2 = std::max(radius2, glm::dot(offset, offset));
+	}
+
+	// the cone axis is the average of the triangle normals, and the cone spans the normal furthest from it
+	std::vector<glm::vec3> normals;
+	glm::vec3 axis{ 0.0f };
+	for (uint32_t i = 0; i < meshlet.indexCount; i += 3) {
+		glm::vec3 p0{ position(indices[meshlet.firstIndex + i + 0]) };
+		glm::vec3 p1{ position(indices[meshlet.firstIndex + i + 1]) };
+		glm::vec3 p2{ position(indices[meshlet.firstIndex + i + 2]) };
+
+		glm::vec3 normal{ glm::cross(p1 - p0, p2 - p0) };
+		float length{ glm::length(normal) };
+		// degenerate triangles are never rasterized, so they don't constrain the cone
+		if (length <= 0.0f) continue;
+
+		normals.push_back(normal / length);
+		axis += normals.back();
+	}
+
+	float axisLength{ glm::length(axis) };
+	float minDot{ 1.0f };
+	if (axisLength > 0.0f) {
+		axis /= axisLength;
+		for (const glm::vec3& normal : normals) {
+			minDot = std::min(minDot, glm::dot(axis, normal));
+		}
+	}
+
+	for (int i = 0; i < 3; ++i) {
+		meshlet.center[i] = center[i];
+		meshlet.coneAxis[i] = axis[i];
+	}
+	meshlet.radius = std::sqrt(radius2);
+
+	// a cone wider than a hemisphere can't be culled. The test compares against the sine of the cone's half angle
+	// since it has to hold for every point of the bounding sphere, not just the cone's apex
+	meshlet.coneCutoff = (axisLength <= 0.0f || minDot <= 0.0f) ? 1.0f : std::sqrt(1.0f - minDot * minDot);
+}
+
+std::vector<Meshlet> buildMeshlets(const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t positionStride)
+{
+	assert(indexCount % 3 == 0);
+
+	std::vector<Meshlet> meshlets;
+
+	// meshlet each vertex was last added to, so counting a meshlet's unique vertices doesn't need a set
+	std::vector<uint32_t> usedBy(vertexCount, ~0u);
+
+	Meshlet current{};
+	uint32_t vertexCountInMeshlet{ 0 };
+
+	for (size_t i = 0; i < indexCount; i += 3) {
+		uint32_t meshletIndex{ (uint32_t)meshlets.size() };
+
+		uint32_t newVertices{ 0 };
+		for (uint32_t k = 0; k < 3; ++k) {
+			uint32_t v{ indices[i + k] };
+			// count repeated vertices of a degenerate triangle once
+			bool repeated{ (k > 0 && indices[i] == v) || (k > 1 && indices[i + 1] == v) };
+			if (usedBy[v] != meshletIndex && !repeated) ++newVertices;
+		}
+
+		if (current.indexCount / 3 == MAX_MESHLET_TRIANGLES || vertexCountInMeshlet + newVertices > MAX_MESHLET_VERTICES) {
+			computeMeshletBounds(current, indices, positions, positionStride);
+			meshlets.push_back(current);
+
+			current = Meshlet{};
+			current.firstIndex = (uint32_t)i;
+			vertexCountInMeshlet = 0;
+			++meshletIndex;
+		}
+
+		for (uint32_t k = 0; k < 3; ++k) {
+			uint32_t v{ indices[i + k] };
+			if (usedBy[v] != meshletIndex) {
+				usedBy[v] = meshletIndex;
+				++vertexCountInMeshlet;
+			}
+		}
+
+		current.indexCount += 3;
+	}
+
+	if (current.indexCount > 0) {
+		computeMeshletBounds(current, indices, positions, positionStride);
+		meshlets.push_back(current);
+	}
+
+	return meshlets;
+}
+
+// Sum of squared distances to a set of planes, each weighted by its triangle's area. Stored as the upper half of the symmetric 4x4 matrix
+struct Quadric {
+	double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+	double weight;
+
+	Quadric& operator+=(const Quadric& other)
+	{
+		a2 += other.a2; ab += other.ab; ac += other.ac; ad += other.ad;
+		b2 += other.b2; bc += other.bc; bd += other.bd;
+		c2 += other.c2; cd += other.cd;
+		d2 += other.d2;
+		weight += other.weight;
+		return *this;
+	}
+
+	// mean squared distance of p to the planes
+	double error(const glm::vec3& p) const
+	{
+		double x{ p.x }, y{ p.y }, z{ p.z };
+		double sum{ a2 * x * x + 2.0 * ab * x * y + 2.0 * ac * x * z + 2.0 * ad * x
+			+ b2 * y * y + 2.0 * bc * y * z + 2.0 * bd * y
+			+ c2 * z * z + 2.0 * cd * z
+			+ d2 };
+		return weight > 0.0 ? std::max(sum, 0.0) / weight : 0.0;
+	}
+};
+
+static Quadric planeQuadric(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2)
+{
+	glm::dvec3 normal{ glm::cross(p1 - p0, p2 - p0) };
+	double area{ glm::length(normal) };
+
+	Quadric q{};
+	if (area <= 0.0) return q;
+
+	normal /= area;
+	double d{ -glm::dot(normal, glm::dvec3{ p0 }) };
+
+	q.a2 = area * normal.x * normal.x; q.ab = area * normal.x * normal.y; q.ac = area * normal.x * normal.z; q.ad = area * normal.x * d;
+	q.b2 = area * normal.y * normal.y; q.bc = area * normal.y * normal.z; q.bd = area * normal.y * d;
+	q.c2 = area * normal.z * normal.z; q.cd = area * normal.z * d;
+	q.d2 = area * d * d;
+	q.weight = area;
+	return q;
+}
+
+struct Collapse {
+	uint32_t from;
+	uint32_t to;
+	double error;
+};
+
+// Moving from onto to must not turn any remaining triangle of from upside down
+static bool collapseKeepsOrientation(const Collapse& collapse, const std::vector<uint32_t>& triangles, const TriangleAdjacency& adjacency,
+	const std::vector<glm::vec3>& positions)
+{
+	uint32_t begin{ adjacency.offsets[collapse.from] };
+	uint32_t end{ begin + adjacency.counts[collapse.from] };
+
+	for (uint32_t a = begin; a < end; ++a) {
+		const uint32_t* triangle{ &triangles[adjacency.triangles[a] * 3] };
+		if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to) continue;
+
+		glm::vec3 before[3];
+		glm::vec3 after[3];
+		for (int k = 0; k < 3; ++k) {
+			before[k] = positions[triangle[k]];
+			after[k] = triangle[k] == collapse.from ? positions[collapse.to] : before[k];
+		}
+
+		glm::vec3 normalBefore{ glm::cross(before[1] - before[0], before[2] - before[0]) };
+		glm::vec3 normalAfter{ glm::cross(after[1] - after[0], after[2] - after[0]) };
+
+		// also rejects collapses that leave a zero area sliver behind
+		if (glm::dot(normalBefore, normalAfter) <= 0.0f) return false;
+	}
+
+	return true;
+}
+
+// Point of triangle abc closest to p (Ericson, Real-Time Collision Detection 5.1.5)
+static glm::vec3 closestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+	glm::vec3 ab{ b - a };
+	glm::vec3 ac{ c - a };
+	glm::vec3 ap{ p - a };
+	float d1{ glm::dot(ab, ap) };
+	float d2{ glm::dot(ac, ap) };
+	if (d1 <= 0.0f && d2 <= 0.0f) return a;
+
+	glm::vec3 bp{ p - b };
+	float d3{ glm::dot(ab, bp) };
+	float d4{ glm::dot(ac, bp) };
+	if (d3 >= 0.0f && d4 <= d3) return b;
+
+	float vc{ d1 * d4 - d3 * d2 };
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return a + ab * (d1 / (d1 - d3));
+
+	glm::vec3 cp{ p - c };
+	float d5{ glm::dot(ab, cp) };
+	float d6{ glm::dot(ac, cp) };
+	if (d6 >= 0.0f && d5 <= d6) return c;
+
+	float vb{ d5 * d2 - d1 * d6 };
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return a + ac * (d2 / (d2 - d6));
+
+	float va{ d3 * d6 - d5 * d4 };
+	if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+	float denominator{ va + vb + vc };
+	if (denominator <= 0.0f) return a;
+	return a + ab * (vb / denominator) + ac * (vc / denominator);
+}
+
+// Uniform grid over triangles, each listed in every cell its bounding box overlaps, to find the triangles near a point
+class TriangleGrid {
+public:
+	TriangleGrid(const std::vector<uint32_t>& triangles, const std::vector<glm::vec3>& positions)
+		: _triangles{ triangles }, _positions{ positions }
+	{
+		size_t triangleCount{ triangles.size() / 3 };
+		glm::vec3 lower{ FLT_MAX };
+		glm::vec3 upper{ -FLT_MAX };
+		double area{ 0.0 };
+		for (size_t i = 0; i < triangles.size(); i += 3) {
+			const glm::vec3& a{ positions[triangles[i]] };
+			const glm::vec3& b{ positions[triangles[i + 1]] };
+			const glm::vec3& c{ positions[triangles[i + 2]] };
+			lower = glm::min(lower, glm::min(a, glm::min(b, c)));
+			upper = glm::max(upper, glm::max(a, glm::max(b, c)));
+			area += glm::length(glm::cross(b - a, c - a)) * 0.5;
+		}
+
+		// cells about the size of a triangle, but never more cells than a few per triangle
+		_origin = lower;
+		_cellSize = std::max((float)std::sqrt(area / std::max(triangleCount, (size_t)1)), 1e-6f);
+		glm::vec3 extent{ upper - lower };
+		while (cellCount(extent) > triangleCount * 4 + 64) {
+			_cellSize *= 2.0f;
+		}
+		_dims = glm::ivec3{ extent / _cellSize } + 1;
+
+		std::vector<uint32_t> counts((size_t)_dims.x * _dims.y * _dims.z + 1, 0);
+		for (int pass = 0; pass < 2; ++pass) {
+			for (size_t i = 0; i < triangles.size(); i += 3) {
+				glm::ivec3 first, last;
+				triangleCells(i, first, last);
+				for (int z = first.z; z <= last.z; ++z) {
+					for (int y = first.y; y <= last.y; ++y) {
+						for (int x = first.x; x <= last.x; ++x) {
+							size_t cell{ cellIndex(x, y, z) };
+							if (pass == 0) {
+								++counts[cell + 1];
+							} else {
+								_cellTriangles[counts[cell]++] = (uint32_t)(i / 3);
+							}
+						}
+					}
+				}
+			}
+
+			if (pass == 0) {
+				for (size_t c = 1; c < counts.size(); ++c) counts[c] += counts[c - 1];
+				_cellTriangles.resize(counts.back());
+				_cellStart = counts;
+			} else {
+				counts = _cellStart;
+			}
+		}
+	}
+
+	// Squared distance from p to the closest triangle no further away than maxDistance, or maxDistance squared if there is none
+	float nearestDistance2(const glm::vec3& p, float maxDistance) const
+	{
+		glm::ivec3 first{ cellOf(p - maxDistance) };
+		glm::ivec3 last{ cellOf(p + maxDistance) };
+		float nearest2{ maxDistance * maxDistance };
+
+		for (int z = first.z; z <= last.z; ++z) {
+			for (int y = first.y; y <= last.y; ++y) {
+				for (int x = first.x; x <= last.x; ++x) {
+					size_t cell{ cellIndex(x, y, z) };
+					for (uint32_t t = _cellStart[cell]; t < _cellStart[cell + 1]; ++t) {
+						const uint32_t* triangle{ &_triangles[_cellTriangles[t] * 3] };
+						glm::vec3 offset{ p - closestPointOnTriangle(p, _positions[triangle[0]], _positions[triangle[1]], _positions[triangle[2]]) };
+						nearest2 = std::min(nearest2, glm::dot(offset, offset));
+					}
+				}
+			}
+		}
+		return nearest2;
+	}
+
+private:
+	size_t cellCount(const glm::vec3& extent) const
+	{
+		return (size_t)(extent.x / _cellSize + 1) * (size_t)(extent.y / _cellSize + 1) * (size_t)(extent.z / _cellSize + 1);
+	}
+
+	glm::ivec3 cellOf(const glm::vec3& p) const
+	{
+		glm::ivec3 cell{ glm::floor((p - _origin) / _cellSize) };
+		return glm::clamp(cell, glm::ivec3{ 0 }, _dims - 1);
+	}
+
+	size_t cellIndex(int x, int y, int z) const
+	{
+		return ((size_t)z * _dims.y + y) * _dims.x + x;
+	}
+
+	void triangleCells(size_t i, glm::ivec3& first, glm::ivec3& last) const
+	{
+		const glm::vec3& a{ _positions[_triangles[i]] };
+		const glm::vec3& b{ _positions[_triangles[i + 1]] };
+		const glm::vec3& c{ _positions[_triangles[i + 2]] };
+		first = cellOf(glm::min(a, glm::min(b, c)));
+		last = cellOf(glm::max(a, glm::max(b, c)));
+	}
+
+	const std::vector<uint32_t>& _triangles;
+	const std::vector<glm::vec3>& _positions;
+	glm::vec3 _origin;
+	float _cellSize;
+	glm::ivec3 _dims;
+	std::vector<uint32_t> _cellStart;
+	std::vector<uint32_t> _cellTriangles;
+};
+
+// Furthest any vertex of the original mesh is from the simplified triangles. The triangles around the vertex it was
+// collapsed onto give an upper bound, which limits how far the grid has to be searched for a closer triangle
+static float surfaceDistance(const std::vector<uint32_t>& triangles, const std::vector<uint32_t>& collapsedOnto, const std::vector<bool>& used,
+	const std::vector<glm::vec3>& positions)
+{
+	if (triangles.empty()) return 0.0f;
+
+	TriangleAdjacency adjacency;
+	buildAdjacency(adjacency, triangles.data(), triangles.size(), positions.size());
+	TriangleGrid grid{ triangles, positions };
+
+	float largest2{ 0.0f };
+	for (size_t v = 0; v < positions.size(); ++v) {
+		uint32_t target{ collapsedOnto[v] };
+		// vertices still in the mesh lie on its surface
+		if (!used[v] || target == v) continue;
+
+		float bound2{ FLT_MAX };
+		uint32_t begin{ adjacency.offsets[target] };
+		uint32_t end{ begin + adjacency.counts[target] };
+		for (uint32_t a = begin; a < end; ++a) {
+			const uint32_t* triangle{ &triangles[adjacency.triangles[a] * 3] };
+			glm::vec3 offset{ positions[v] - closestPointOnTriangle(positions[v], positions[triangle[0]], positions[triangle[1]], positions[triangle[2]]) };
+			bound2 = std::min(bound2, glm::dot(offset, offset));
+		}
+		if (bound2 <= largest2) continue;
+
+		// no triangle further away than the largest distance so far can change the result
+		float nearest2{ grid.nearestDistance2(positions[v], bound2 == FLT_MAX ? FLT_MAX : std::sqrt(bound2)) };
+		largest2 = std::max(largest2, nearest2);
+	}
+
+	return std::sqrt(largest2);
+}
+
+size_t simplifyMesh(uint32_t* destination, const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount,
+	size_t positionStride, size_t targetIndexCount, float maxError, float* errorOut)
+{
+	assert(indexCount % 3 == 0);
+
+	std::vector<uint32_t> triangles{ indices, indices + indexCount };
+
+	std::vector<glm::vec3> position(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v) {
+		const float* p{ (const float*)((const char*)positions + v * positionStride) };
+		position[v] = glm::vec3{ p[0], p[1], p[2] };
+	}
+
+	std::vector<Quadric> quadrics(vertexCount, Quadric{});
+	for (size_t i = 0; i < indexCount; i += 3) {
+		Quadric q{ planeQuadric(position[indices[i]], position[indices[i + 1]], position[indices[i + 2]]) };
+		for (int k = 0; k < 3; ++k) {
+			quadrics[indices[i + k]] += q;
+		}
+	}
+
+	// an edge used by anything but exactly two triangles is on a border, a seam or a non-manifold part of the mesh
+	std::unordered_map<uint64_t, uint32_t> edgeUses;
+	for (size_t i = 0; i < indexCount; i += 3) {
+		for (int k = 0; k < 3; ++k) {
+			uint32_t a{ indices[i + k] };
+			uint32_t b{ indices[i + (k + 1) % 3] };
+			++edgeUses[((uint64_t)std::min(a, b) << 32) | std::max(a, b)];
+		}
+	}
+
+	std::vector<bool> locked(vertexCount, false);
+	for (const auto& [edge, uses] : edgeUses) {
+		if (uses != 2) {
+			locked[edge >> 32] = true;
+			locked[edge & 0xffffffff] = true;
+		}
+	}
+
+	double maxError2{ (double)maxError * maxError };
+
+	// the vertex each original vertex ended up on, to measure the result against the original positions
+	std::vector<uint32_t> collapsedOnto(vertexCount);
+	std::vector<bool> used(vertexCount, false);
+	for (uint32_t v = 0; v < vertexCount; ++v) collapsedOnto[v] = v;
+	for (size_t i = 0; i < indexCount; ++i) used[indices[i]] = true;
+
+	TriangleAdjacency adjacency;
+	std::vector<Collapse> collapses;
+	std::vector<uint32_t> collapseTo(vertexCount);
+	std::vector<bool> touched(vertexCount);
+
+	// Each pass collapses the cheapest edges whose neighbourhoods don't overlap, so every collapse is checked against the
+	// mesh as it will be once the pass is applied
+	while (triangles.size() > targetIndexCount) {
+		buildAdjacency(adjacency, triangles.data(), triangles.size(), vertexCount);
+
+		collapses.clear();
+		for (size_t i = 0; i < triangles.size(); i += 3) {
+			for (int k = 0; k < 3; ++k) {
+				uint32_t a{ triangles[i + k] };
+				uint32_t b{ triangles[i + (k + 1) % 3] };
+				// interior edges appear once in each direction, only look at them from one side
+				if (a >= b) continue;
+
+				Quadric q{ quadrics[a] };
+				q += quadrics[b];
+
+				Collapse ab{ a, b, locked[a] ? DBL_MAX : q.error(position[b]) };
+				Collapse ba{ b, a, locked[b] ? DBL_MAX : q.error(position[a]) };
+				const Collapse& cheaper{ ab.error <= ba.error ? ab : ba };
+
+				if (cheaper.error <= maxError2) {
+					collapses.push_back(cheaper);
+				}
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) {
+			if (a.error != b.error) return a.error < b.error;
+			return a.from < b.from || (a.from == b.from && a.to < b.to);
+		});
+
+		for (uint32_t v = 0; v < vertexCount; ++v) collapseTo[v] = v;
+		std::fill(touched.begin(), touched.end(), false);
+
+		size_t remainingIndices{ triangles.size() };
+		size_t applied{ 0 };
+
+		for (const Collapse& collapse : collapses) {
+			if (remainingIndices <= targetIndexCount) break;
+			if (touched[collapse.from] || touched[collapse.to]) continue;
+			if (!collapseKeepsOrientation(collapse, triangles, adjacency, position)) continue;
+
+			collapseTo[collapse.from] = collapse.to;
+			quadrics[collapse.to] += quadrics[collapse.from];
+			++applied;
+
+			// every vertex sharing a triangle with from sees that triangle change, so none of them can collapse again this pass
+			uint32_t begin{ adjacency.offsets[collapse.from] };
+			uint32_t end{ begin + adjacency.counts[collapse.from] };
+			for (uint32_t a = begin; a < end; ++a) {
+				const uint32_t* triangle{ &triangles[adjacency.triangles[a] * 3] };
+				for (int k = 0; k < 3; ++k) {
+					touched[triangle[k]] = true;
+				}
+				if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to) {
+					remainingIndices -= 3;
+				}
+			}
+		}
+
+		if (applied == 0) break;
+
+		for (uint32_t& target : collapsedOnto) target = collapseTo[target];
+
+		size_t write{ 0 };
+		for (size_t i = 0; i < triangles.size(); i += 3) {
+			uint32_t a{ collapseTo[triangles[i + 0]] };
+			uint32_t b{ collapseTo[triangles[i + 1]] };
+			uint32_t c{ collapseTo[triangles[i + 2]] };
+
+			if (a == b || b == c || a == c) continue;
+
+			triangles[write++] = a;
+			triangles[write++] = b;
+			triangles[write++] = c;
+		}
+		triangles.resize(write);
+	}
+
+	memcpy(destination, triangles.data(), triangles.size() * sizeof(uint32_t));
+
+	if (errorOut) *errorOut = surfaceDistance(triangles, collapsedOnto, used, position);
+	return triangles.size();
+}
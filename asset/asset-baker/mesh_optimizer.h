@@ -0,0 +1,84 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "vk_mesh.h"
+
+// Post-transform vertex cache size the baker optimizes for and reports against. Modern GPUs don't have a true FIFO
+// cache, but batches of vertices shaded together behave close enough to a small one that this is a good proxy
+constexpr uint32_t VERTEX_CACHE_SIZE{ 16 };
+
+// Cluster ordering may raise the ACMR of the vertex cache optimized order by at most this factor to reduce overdraw
+constexpr float OVERDRAW_THRESHOLD{ 1.05f };
+
+struct VertexCacheStats {
+	// vertex shader invocations when drawing the indices through a FIFO cache
+	uint32_t transformedVertices;
+	// average cache miss ratio, transformed vertices per triangle. 3 is the worst case, about 0.5 the best for a regular grid
+	float acmr;
+	// average transformed vertex ratio, transformed vertices per vertex. 1 means every vertex is shaded exactly once
+	float atvr;
+};
+
+// Simulates drawing indices through a FIFO post-transform cache
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Reorders triangles to reuse recently transformed vertices, using Tipsify (Sander et al. 2007, "Fast Triangle
+// Reordering for Vertex Locality and Reduced Overdraw"). Winding of each triangle is kept.
+// clustersOut receives the first triangle of every run between cache flushes, which optimizeOverdraw reorders
+void optimizeVertexCache(uint32_t* destination, const uint32_t* indices, size_t indexCount, size_t vertexCount,
+	uint32_t cacheSize = VERTEX_CACHE_SIZE, std::vector<uint32_t>* clustersOut = nullptr);
+
+// Splits the output of optimizeVertexCache into clusters small enough that their ACMR stays within threshold times
+// the mesh's, then draws the clusters facing away from the mesh center first, since they are the most likely to occlude the rest.
+// positions points at the first vertex's position, with positionStride bytes between vertices
+void optimizeOverdraw(uint32_t* destination, const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount,
+	size_t positionStride, const std::vector<uint32_t>& clusters, uint32_t cacheSize = VERTEX_CACHE_SIZE, float threshold = OVERDRAW_THRESHOLD);
+
+// Renumbers vertices in the order the indices first reference them, so vertex fetch walks the vertex buffer linearly.
+// Rewrites indices in place and fills remap with the new index of every old vertex, or UNUSED_VERTEX for vertices no
+// triangle references. Returns the new vertex count
+constexpr uint32_t UNUSED_VERTEX{ ~0u };
+size_t optimizeVertexFetchRemap(std::vector<uint32_t>& remap, uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+// Gives every vertex the index of the first vertex with the same key among the unique ones, in the order they first
+// appear, and returns how many are unique. keys holds keySize bytes per vertex, compared byte for byte, which can be
+// the vertices themselves for exact duplicates or their attributes rounded to a grid for welding
+size_t generateVertexRemap(std::vector<uint32_t>& remap, const void* keys, size_t vertexCount, size_t keySize);
+
+// Replaces every index with its entry in remap
+void remapIndices(uint32_t* indices, size_t indexCount, const std::vector<uint32_t>& remap);
+
+// Meshlets are culled one by one at runtime, so they are kept small enough to be mostly entirely on or off screen
+constexpr uint32_t MAX_MESHLET_VERTICES{ 64 };
+constexpr uint32_t MAX_MESHLET_TRIANGLES{ 124 };
+
+// Splits indices into runs of consecutive triangles using at most MAX_MESHLET_VERTICES vertices and MAX_MESHLET_TRIANGLES
+// triangles, and computes the bounding sphere and normal cone of each. The index order isn't changed, so the vertex cache
+// order from optimizeVertexCache carries over and neighbouring triangles end up in the same meshlet
+std::vector<Meshlet> buildMeshlets(const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t positionStride);
+
+// Collapses edges onto one of their endpoints, cheapest first by the quadric error metric (Garland and Heckbert 1997), until
+// at most targetIndexCount indices are left or the next collapse's quadric error would exceed maxError. The quadric error is
+// the root of the area weighted mean squared distance to the planes merged into a vertex, which can be well below the
+// largest distance, so it only ranks and limits collapses.
+// Vertices only ever move onto other vertices, so every level of detail shares the original vertex buffer. Vertices on
+// open edges, which includes seams where vertices are split for their normals or uvs, never move so the mesh can't tear.
+// Returns the index count written to destination, and errorOut gets the furthest any vertex of the original mesh is from
+// the simplified surface
+size_t simplifyMesh(uint32_t* destination, const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount,
+	size_t positionStride, size_t targetIndexCount, float maxError, float* errorOut);
+
+// Moves vertices to the positions given by optimizeVertexFetchRemap, dropping unused ones
+template <typename T>
+void remapVertices(std::vector<T>& vertices, const std::vector<uint32_t>& remap, size_t newVertexCount)
+{
+	std::vector<T> result(newVertexCount);
+	for (size_t i = 0; i < vertices.size(); ++i) {
+		if (remap[i] != UNUSED_VERTEX) {
+			result[remap[i]] = vertices[i];
+		}
+	}
+	vertices = std::move(result);
+}
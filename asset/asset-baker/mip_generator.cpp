@@ -0,0 +1,232 @@
+#include "mip_generator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIP_GENERATOR_SSE2 1
+#include <emmintrin.h>
+#else
+#define MIP_GENERATOR_SSE2 0
+#endif
+
+// Resolution of the linear to sRGB table. Fine enough that every entry rounds to the same byte as the exact
+// conversion would for values near it, even in the darks where sRGB is steepest
+constexpr uint32_t LINEAR_TABLE_SIZE{ 1 << 16 };
+
+// Source texels along one axis that make up a destination texel, weighted by how much of each it covers
+struct MipTaps {
+	uint32_t first;
+	uint32_t count;
+	float weights[3];
+};
+
+struct SrgbTables {
+	// sRGB byte to linear, scaled to 0-255 like the unconverted channels
+	float toLinear[256];
+	// linear in 0-1 at LINEAR_TABLE_SIZE - 1 steps to sRGB byte
+	std::vector<uint8_t> toSrgb;
+};
+
+static const SrgbTables& srgbTables()
+{
+	static const SrgbTables tables{ []() {
+		SrgbTables t;
+		for (uint32_t i = 0; i < 256; ++i) {
+			float c{ i / 255.0f };
+			t.toLinear[i] = 255.0f * (c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f));
+		}
+		t.toSrgb.resize(LINEAR_TABLE_SIZE);
+		for (uint32_t i = 0; i < LINEAR_TABLE_SIZE; ++i) {
+			float l{ (float)i / (LINEAR_TABLE_SIZE - 1) };
+			float c{ l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f };
+			t.toSrgb[i] = (uint8_t)std::min(std::max(c * 255.0f + 0.5f, 0.0f), 255.0f);
+		}
+		return t;
+	}() };
+	return tables;
+}
+
+uint32_t mipLevelCount(uint32_t width, uint32_t height)
+{
+	uint32_t levels{ 1 };
+	while (width > 1 || height > 1) {
+		width = nextMipSize(width);
+		height = nextMipSize(height);
+		++levels;
+	}
+	return levels;
+}
+
+static std::vector<MipTaps> computeTaps(uint32_t size)
+{
+	uint32_t next{ nextMipSize(size) };
+	std::vector<MipTaps> taps(next);
+
+	for (uint32_t x = 0; x < next; ++x) {
+		MipTaps& t{ taps[x] };
+		if (size == 1) {
+			t = { 0, 1, { 1.0f } };
+		} else if (size % 2 == 0) {
+			t = { 2 * x, 2, { 0.5f, 0.5f } };
+		} else {
+			// size = 2 * next + 1, so texel x covers [x * size / next, (x + 1) * size / next) which starts and
+			// ends partway into texels 2x and 2x + 2
+			float inverse{ 1.0f / size };
+			t = { 2 * x, 3, { (next - x) * inverse, next * inverse, (x + 1) * inverse } };
+		}
+	}
+
+	return taps;
+}
+
+#if MIP_GENERATOR_SSE2
+static inline __m128 loadTexel(const uint8_t* texel, bool srgb, const SrgbTables& tables)
+{
+	if (srgb) {
+		return _mm_setr_ps(tables.toLinear[texel[0]], tables.toLinear[texel[1]], tables.toLinear[texel[2]], (float)texel[3]);
+	}
+	int32_t packed;
+	memcpy(&packed, texel, sizeof(packed));
+	const __m128i zero{ _mm_setzero_si128() };
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero));
+}
+
+static inline void storeTexel(uint8_t* texel, __m128 value, bool srgb, const SrgbTables& tables)
+{
+	// every value is a weighted average of bytes, so it is already in range and rounding half up is floor(x + 0.5)
+	if (srgb) {
+		alignas(16) int32_t indices[4];
+		__m128 scaled{ _mm_mul_ps(value, _mm_setr_ps((LINEAR_TABLE_SIZE - 1) / 255.0f, (LINEAR_TABLE_SIZE - 1) / 255.0f, (LINEAR_TABLE_SIZE - 1) / 255.0f, 1.0f)) };
+		_mm_store_si128((__m128i*)indices, _mm_cvttps_epi32(_mm_add_ps(scaled, _mm_set1_ps(0.5f))));
+		texel[0] = tables.toSrgb[std::min<uint32_t>(indices[0], LINEAR_TABLE_SIZE - 1)];
+		texel[1] = tables.toSrgb[std::min<uint32_t>(indices[1], LINEAR_TABLE_SIZE - 1)];
+		texel[2] = tables.toSrgb[std::min<uint32_t>(indices[2], LINEAR_TABLE_SIZE - 1)];
+		texel[3] = (uint8_t)std::min(indices[3], 255);
+		return;
+	}
+	__m128i rounded{ _mm_cvttps_epi32(_mm_add_ps(value, _mm_set1_ps(0.5f))) };
+	rounded = _mm_packs_epi32(rounded, rounded);
+	int32_t packed{ _mm_cvtsi128_si32(_mm_packus_epi16(rounded, rounded)) };
+	memcpy(texel, &packed, sizeof(packed));
+}
+
+// Halves two rows of a linear image into one, four destination texels at a time with 16 bit sums.
+// Returns how many texels it wrote, the rest are left to the general path
+static uint32_t downsampleRowEven(uint8_t* destination, const uint8_t* row0, const uint8_t* row1, uint32_t destinationWidth)
+{
+	const __m128i zero{ _mm_setzero_si128() };
+	const __m128i two{ _mm_set1_epi16(2) };
+
+	// sums a vertical pair of 4 texel groups and then neighbouring texels, giving 2 destination texels as 16 bit values
+	auto halve = [&](__m128i a, __m128i b) {
+		__m128i low{ _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)) };
+		__m128i high{ _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)) };
+		__m128i sum{ _mm_add_epi16(_mm_unpacklo_epi64(low, high), _mm_unpackhi_epi64(low, high)) };
+		return _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+	};
+
+	uint32_t x{ 0 };
+	for (; x + 4 <= destinationWidth; x += 4) {
+		const __m128i* a{ (const __m128i*)(row0 + x * 8) };
+		const __m128i* b{ (const __m128i*)(row1 + x * 8) };
+		__m128i first{ halve(_mm_loadu_si128(a), _mm_loadu_si128(b)) };
+		__m128i second{ halve(_mm_loadu_si128(a + 1), _mm_loadu_si128(b + 1)) };
+		_mm_storeu_si128((__m128i*)(destination + x * 4), _mm_packus_epi16(first, second));
+	}
+	return x;
+}
+#else
+static inline void loadTexel(const uint8_t* texel, bool srgb, const SrgbTables& tables, float out[4])
+{
+	for (uint32_t c = 0; c < 4; ++c) {
+		out[c] = srgb && c < 3 ? tables.toLinear[texel[c]] : (float)texel[c];
+	}
+}
+
+static inline void storeTexel(uint8_t* texel, const float value[4], bool srgb, const SrgbTables& tables)
+{
+	for (uint32_t c = 0; c < 4; ++c) {
+		if (srgb && c < 3) {
+			uint32_t index{ (uint32_t)(value[c] * ((LINEAR_TABLE_SIZE - 1) / 255.0f) + 0.5f) };
+			texel[c] = tables.toSrgb[std::min(index, LINEAR_TABLE_SIZE - 1)];
+		} else {
+			texel[c] = (uint8_t)std::min(value[c] + 0.5f, 255.0f);
+		}
+	}
+}
+#endif
+
+void downsampleLevel(uint8_t* destination, const uint8_t* source, uint32_t width, uint32_t height, bool srgb, JobPool& pool)
+{
+	const uint32_t destinationWidth{ nextMipSize(width) };
+	const uint32_t destinationHeight{ nextMipSize(height) };
+	const std::vector<MipTaps> columns{ computeTaps(width) };
+	const std::vector<MipTaps> rows{ computeTaps(height) };
+	const SrgbTables& tables{ srgbTables() };
+
+	// the integer path sums exactly what the general path does, so both round the same way
+	const bool evenLinear{ !srgb && width % 2 == 0 && height % 2 == 0 };
+	const bool evenSrgb{ srgb && width % 2 == 0 && height % 2 == 0 };
+
+	constexpr uint32_t rowsPerJob{ 16 };
+	pool.parallelFor(destinationHeight, rowsPerJob, [&](uint32_t y) {
+		const MipTaps& rowTaps{ rows[y] };
+		uint8_t* out{ destination + (size_t)y * destinationWidth * 4 };
+		uint32_t x{ 0 };
+
+#if MIP_GENERATOR_SSE2
+		if (evenLinear) {
+			const uint8_t* row0{ source + (size_t)rowTaps.first * width * 4 };
+			x = downsampleRowEven(out, row0, row0 + (size_t)width * 4, destinationWidth);
+		}
+
+		if (evenSrgb) {
+			// halving is exact in floating point, so this sums to the same value as the weighted taps below
+			const uint8_t* row0{ source + (size_t)rowTaps.first * width * 4 };
+			const uint8_t* row1{ row0 + (size_t)width * 4 };
+			for (; x < destinationWidth; ++x) {
+				__m128 top{ _mm_add_ps(loadTexel(row0 + x * 8, true, tables), loadTexel(row0 + x * 8 + 4, true, tables)) };
+				__m128 bottom{ _mm_add_ps(loadTexel(row1 + x * 8, true, tables), loadTexel(row1 + x * 8 + 4, true, tables)) };
+				storeTexel(out + x * 4, _mm_mul_ps(_mm_add_ps(top, bottom), _mm_set1_ps(0.25f)), true, tables);
+			}
+		}
+
+		for (; x < destinationWidth; ++x) {
+			const MipTaps& columnTaps{ columns[x] };
+			__m128 sum{ _mm_setzero_ps() };
+			for (uint32_t j = 0; j < rowTaps.count; ++j) {
+				const uint8_t* row{ source + ((size_t)(rowTaps.first + j) * width + columnTaps.first) * 4 };
+				__m128 rowSum{ _mm_setzero_ps() };
+				for (uint32_t i = 0; i < columnTaps.count; ++i) {
+					rowSum = _mm_add_ps(rowSum, _mm_mul_ps(loadTexel(row + i * 4, srgb, tables), _mm_set1_ps(columnTaps.weights[i])));
+				}
+				sum = _mm_add_ps(sum, _mm_mul_ps(rowSum, _mm_set1_ps(rowTaps.weights[j])));
+			}
+			storeTexel(out + x * 4, sum, srgb, tables);
+		}
+#else
+		for (; x < destinationWidth; ++x) {
+			const MipTaps& columnTaps{ columns[x] };
+			float sum[4]{};
+			for (uint32_t j = 0; j < rowTaps.count; ++j) {
+				const uint8_t* row{ source + ((size_t)(rowTaps.first + j) * width + columnTaps.first) * 4 };
+				float rowSum[4]{};
+				for (uint32_t i = 0; i < columnTaps.count; ++i) {
+					float texel[4];
+					loadTexel(row + i * 4, srgb, tables, texel);
+					for (uint32_t c = 0; c < 4; ++c) {
+						rowSum[c] += texel[c] * columnTaps.weights[i];
+					}
+				}
+				for (uint32_t c = 0; c < 4; ++c) {
+					sum[c] += rowSum[c] * rowTaps.weights[j];
+				}
+			}
+			storeTexel(out + x * 4, sum, srgb, tables);
+		}
+#endif
+	});
+}
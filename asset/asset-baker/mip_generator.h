@@ -0,0 +1,20 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+#include "job_pool.h"
+
+// Side of the next mip level, halved and rounded down but never below 1, like the mip chain of a vulkan image
+inline uint32_t nextMipSize(uint32_t size)
+{
+	return size > 1 ? size / 2 : 1;
+}
+
+// Levels in a full mip chain down to 1x1
+uint32_t mipLevelCount(uint32_t width, uint32_t height);
+
+// Writes the next level of an RGBA8 image, where every texel is the average of the area of the source it covers.
+// An odd side shrinks by more than half, so each texel covers parts of three source texels which are weighted by how
+// much of them it covers, and the level stays centered on the one above. With srgb the color channels are averaged in
+// linear space, since averaging the encoded values darkens every level. Alpha is always linear. Rows are jobs on pool
+void downsampleLevel(uint8_t* destination, const uint8_t* source, uint32_t width, uint32_t height, bool srgb, JobPool& pool);
@@ -0,0 +1,521 @@
+#include "texture_encoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_ENCODER_SSE2 1
+#include <emmintrin.h>
+#else
+#define TEXTURE_ENCODER_SSE2 0
+#endif
+
+using assets::TextureFormat;
+
+// One 4x4 block of texels stored channel by channel, so four texels fill one SSE register
+struct alignas(16) TexelBlock {
+	float channels[4][16];
+};
+
+// Interpolation weights out of 64 for the 4 bit indices of BC7
+static constexpr uint8_t BC7_WEIGHTS[16]{ 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+static void loadBlock(TexelBlock& block, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY)
+{
+	for (uint32_t y = 0; y < 4; ++y) {
+		uint32_t py{ std::min(blockY * 4 + y, height - 1) };
+		for (uint32_t x = 0; x < 4; ++x) {
+			uint32_t px{ std::min(blockX * 4 + x, width - 1) };
+			const uint8_t* texel{ pixels + ((size_t)py * width + px) * 4 };
+			for (uint32_t c = 0; c < 4; ++c) {
+				block.channels[c][y * 4 + x] = texel[c];
+			}
+		}
+	}
+}
+
+// Finds for every texel the closest of levelCount evenly spaced points from endpoint0 to endpoint1, looking only at
+// channelCount channels starting at firstChannel. positions counts up from endpoint0
+static void projectPositions(const TexelBlock& block, const float endpoint0[4], const float endpoint1[4],
+	uint32_t firstChannel, uint32_t channelCount, uint32_t levelCount, uint8_t positions[16])
+{
+	float axis[4]{};
+	float lengthSquared{ 0.0f };
+	for (uint32_t c = firstChannel; c < firstChannel + channelCount; ++c) {
+		axis[c] = endpoint1[c] - endpoint0[c];
+		lengthSquared += axis[c] * axis[c];
+	}
+
+	if (lengthSquared < 1e-6f) {
+		memset(positions, 0, 16);
+		return;
+	}
+
+	// scale the axis so projecting onto it gives the position directly, and fold endpoint0 into the offset
+	float scale{ (float)(levelCount - 1) / lengthSquared };
+	float offset{ 0.5f };
+	for (uint32_t c = firstChannel; c < firstChannel + channelCount; ++c) {
+		axis[c] *= scale;
+		offset -= axis[c] * endpoint0[c];
+	}
+	float maxPosition{ (float)(levelCount - 1) };
+
+#if TEXTURE_ENCODER_SSE2
+	const __m128 zero{ _mm_setzero_ps() };
+	const __m128 maxPositions{ _mm_set1_ps(maxPosition) };
+
+	for (uint32_t i = 0; i < 16; i += 4) {
+		__m128 t{ _mm_set1_ps(offset) };
+		for (uint32_t c = firstChannel; c < firstChannel + channelCount; ++c) {
+			t = _mm_add_ps(t, _mm_mul_ps(_mm_load_ps(&block.channels[c][i]), _mm_set1_ps(axis[c])));
+		}
+		t = _mm_min_ps(_mm_max_ps(t, zero), maxPositions);
+
+		alignas(16) int32_t rounded[4];
+		_mm_store_si128((__m128i*)rounded, _mm_cvttps_epi32(t));
+		for (uint32_t j = 0; j < 4; ++j) {
+			positions[i + j] = (uint8_t)rounded[j];
+		}
+	}
+#else
+	for (uint32_t i = 0; i < 16; ++i) {
+		float t{ offset };
+		for (uint32_t c = firstChannel; c < firstChannel + channelCount; ++c) {
+			t += block.channels[c][i] * axis[c];
+		}
+		positions[i] = (uint8_t)std::min(std::max(t, 0.0f), maxPosition);
+	}
+#endif
+}
+
+// Endpoints at the extents of the texels along their principal axis, which the palette of every BC format lies on
+static void principalEndpoints(const TexelBlock& block, uint32_t channelCount, float endpoint0[4], float endpoint1[4])
+{
+	float mean[4]{};
+	float minimum[4]{ 255.0f, 255.0f, 255.0f, 255.0f };
+	float maximum[4]{};
+	for (uint32_t c = 0; c < channelCount; ++c) {
+		for (uint32_t i = 0; i < 16; ++i) {
+			float v{ block.channels[c][i] };
+			mean[c] += v;
+			minimum[c] = std::min(minimum[c], v);
+			maximum[c] = std::max(maximum[c], v);
+		}
+		mean[c] /= 16.0f;
+	}
+
+	float covariance[4][4]{};
+	for (uint32_t i = 0; i < 16; ++i) {
+		for (uint32_t a = 0; a < channelCount; ++a) {
+			float da{ block.channels[a][i] - mean[a] };
+			for (uint32_t b = a; b < channelCount; ++b) {
+				covariance[a][b] += da * (block.channels[b][i] - mean[b]);
+			}
+		}
+	}
+	for (uint32_t a = 0; a < channelCount; ++a) {
+		for (uint32_t b = 0; b < a; ++b) {
+			covariance[a][b] = covariance[b][a];
+		}
+	}
+
+	// power iteration from the bounding box diagonal, which is usually close to the principal axis already
+	float axis[4]{};
+	float axisLength{ 0.0f };
+	for (uint32_t c = 0; c < channelCount; ++c) {
+		axis[c] = maximum[c] - minimum[c];
+		axisLength = std::max(axisLength, axis[c]);
+	}
+
+	if (axisLength == 0.0f) {
+		for (uint32_t c = 0; c < 4; ++c) {
+			endpoint0[c] = mean[c];
+			endpoint1[c] = mean[c];
+		}
+		return;
+	}
+
+	for (uint32_t iteration = 0; iteration < 8; ++iteration) {
+		float next[4]{};
+		float largest{ 0.0f };
+		for (uint32_t a = 0; a < channelCount; ++a) {
+			for (uint32_t b = 0; b < channelCount; ++b) {
+				next[a] += covariance[a][b] * axis[b];
+			}
+			largest = std::max(largest, std::abs(next[a]));
+		}
+		if (largest == 0.0f) {
+			break;
+		}
+		for (uint32_t c = 0; c < channelCount; ++c) {
+			axis[c] = next[c] / largest;
+		}
+	}
+
+	float lengthSquared{ 0.0f };
+	for (uint32_t c = 0; c < channelCount; ++c) {
+		lengthSquared += axis[c] * axis[c];
+	}
+	float inverseLength{ 1.0f / std::sqrt(lengthSquared) };
+	for (uint32_t c = 0; c < channelCount; ++c) {
+		axis[c] *= inverseLength;
+	}
+
+	float tMin{ 0.0f };
+	float tMax{ 0.0f };
+	for (uint32_t i = 0; i < 16; ++i) {
+		float t{ 0.0f };
+		for (uint32_t c = 0; c < channelCount; ++c) {
+			t += (block.channels[c][i] - mean[c]) * axis[c];
+		}
+		tMin = std::min(tMin, t);
+		tMax = std::max(tMax, t);
+	}
+
+	for (uint32_t c = 0; c < 4; ++c) {
+		endpoint0[c] = c < channelCount ? std::min(std::max(mean[c] + axis[c] * tMin, 0.0f), 255.0f) : 255.0f;
+		endpoint1[c] = c < channelCount ? std::min(std::max(mean[c] + axis[c] * tMax, 0.0f), 255.0f) : 255.0f;
+	}
+}
+
+// Least squares endpoints for the interpolation weight every texel ended up with, which moves the palette off the
+// extents towards where most texels are. Returns false when every texel has the same weight
+static bool fitEndpoints(const TexelBlock& block, uint32_t channelCount, const float weights[16], float endpoint0[4], float endpoint1[4])
+{
+	float aa{ 0.0f };
+	float ab{ 0.0f };
+	float bb{ 0.0f };
+	float ax[4]{};
+	float bx[4]{};
+	for (uint32_t i = 0; i < 16; ++i) {
+		float b{ weights[i] };
+		float a{ 1.0f - b };
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (uint32_t c = 0; c < channelCount; ++c) {
+			ax[c] += a * block.channels[c][i];
+			bx[c] += b * block.channels[c][i];
+		}
+	}
+
+	float determinant{ aa * bb - ab * ab };
+	if (std::abs(determinant) < 1e-6f) {
+		return false;
+	}
+
+	float inverse{ 1.0f / determinant };
+	for (uint32_t c = 0; c < channelCount; ++c) {
+		endpoint0[c] = std::min(std::max((ax[c] * bb - bx[c] * ab) * inverse, 0.0f), 255.0f);
+		endpoint1[c] = std::min(std::max((bx[c] * aa - ax[c] * ab) * inverse, 0.0f), 255.0f);
+	}
+	for (uint32_t c = channelCount; c < 4; ++c) {
+		endpoint0[c] = 255.0f;
+		endpoint1[c] = 255.0f;
+	}
+	return true;
+}
+
+static uint16_t packColor565(const float color[4])
+{
+	uint32_t r{ (uint32_t)(color[0] * (31.0f / 255.0f) + 0.5f) };
+	uint32_t g{ (uint32_t)(color[1] * (63.0f / 255.0f) + 0.5f) };
+	uint32_t b{ (uint32_t)(color[2] * (31.0f / 255.0f) + 0.5f) };
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void unpackColor565(uint16_t packed, float color[4])
+{
+	uint32_t r{ (packed >> 11) & 31u };
+	uint32_t g{ (packed >> 5) & 63u };
+	uint32_t b{ packed & 31u };
+	color[0] = (float)((r << 3) | (r >> 2));
+	color[1] = (float)((g << 2) | (g >> 4));
+	color[2] = (float)((b << 3) | (b >> 2));
+	color[3] = 255.0f;
+}
+
+// Writes the color of a block as BC1 in four color mode and returns its squared error. positions gets how far each
+// texel is from color0 towards color1, in thirds
+static float encodeBC1Endpoints(const TexelBlock& block, const float endpoint0[4], const float endpoint1[4], uint8_t* out, uint8_t positions[16])
+{
+	uint16_t color0{ packColor565(endpoint0) };
+	uint16_t color1{ packColor565(endpoint1) };
+	// color0 > color1 selects four color mode, equal endpoints can only draw a solid block anyway
+	if (color0 < color1) {
+		std::swap(color0, color1);
+	}
+
+	float palette[4][4];
+	unpackColor565(color0, palette[0]);
+	unpackColor565(color1, palette[3]);
+	for (uint32_t c = 0; c < 3; ++c) {
+		palette[1][c] = (2.0f * palette[0][c] + palette[3][c]) / 3.0f;
+		palette[2][c] = (palette[0][c] + 2.0f * palette[3][c]) / 3.0f;
+	}
+
+	if (color0 == color1) {
+		memset(positions, 0, 16);
+	} else {
+		projectPositions(block, palette[0], palette[3], 0, 3, 4, positions);
+	}
+
+	// indices 0 and 1 are the endpoints, 2 and 3 the colors between them
+	static constexpr uint32_t BC1_INDEX[4]{ 0, 2, 3, 1 };
+	uint32_t indices{ 0 };
+	float error{ 0.0f };
+	for (uint32_t i = 0; i < 16; ++i) {
+		indices |= BC1_INDEX[positions[i]] << (2 * i);
+		for (uint32_t c = 0; c < 3; ++c) {
+			float d{ palette[positions[i]][c] - block.channels[c][i] };
+			error += d * d;
+		}
+	}
+
+	out[0] = (uint8_t)(color0 & 0xff);
+	out[1] = (uint8_t)(color0 >> 8);
+	out[2] = (uint8_t)(color1 & 0xff);
+	out[3] = (uint8_t)(color1 >> 8);
+	for (uint32_t i = 0; i < 4; ++i) {
+		out[4 + i] = (uint8_t)(indices >> (8 * i));
+	}
+	return error;
+}
+
+static void encodeBC1(const TexelBlock& block, uint8_t* out)
+{
+	float endpoint0[4];
+	float endpoint1[4];
+	principalEndpoints(block, 3, endpoint0, endpoint1);
+
+	uint8_t positions[16];
+	float error{ encodeBC1Endpoints(block, endpoint0, endpoint1, out, positions) };
+
+	float weights[16];
+	for (uint32_t i = 0; i < 16; ++i) {
+		weights[i] = positions[i] / 3.0f;
+	}
+
+	// positions are relative to color0 as stored, so the refit endpoints keep the same order
+	unpackColor565((uint16_t)(out[0] | (out[1] << 8)), endpoint0);
+	unpackColor565((uint16_t)(out[2] | (out[3] << 8)), endpoint1);
+	if (fitEndpoints(block, 3, weights, endpoint0, endpoint1)) {
+		uint8_t refined[8];
+		if (encodeBC1Endpoints(block, endpoint0, endpoint1, refined, positions) < error) {
+			memcpy(out, refined, sizeof(refined));
+		}
+	}
+}
+
+// BC4 stores one channel with 8 bit endpoints and 3 bit indices
+static void encodeBC4(const TexelBlock& block, uint32_t channel, uint8_t* out)
+{
+	float minimum{ 255.0f };
+	float maximum{ 0.0f };
+	for (uint32_t i = 0; i < 16; ++i) {
+		minimum = std::min(minimum, block.channels[channel][i]);
+		maximum = std::max(maximum, block.channels[channel][i]);
+	}
+
+	// red0 > red1 selects the mode with six values between the endpoints instead of four plus 0 and 1
+	uint8_t red0{ (uint8_t)maximum };
+	uint8_t red1{ (uint8_t)minimum };
+	uint64_t indices{ 0 };
+
+	if (red0 > red1) {
+		float endpoint0[4]{};
+		float endpoint1[4]{};
+		endpoint0[channel] = minimum;
+		endpoint1[channel] = maximum;
+
+		uint8_t positions[16];
+		projectPositions(block, endpoint0, endpoint1, channel, 1, 8, positions);
+
+		for (uint32_t i = 0; i < 16; ++i) {
+			// index 0 is red0, 1 is red1 and 2 to 7 step from red0 down to red1
+			uint32_t p{ positions[i] };
+			uint64_t index{ p == 7 ? 0u : p == 0 ? 1u : 8u - p };
+			indices |= index << (3 * i);
+		}
+	}
+
+	out[0] = red0;
+	out[1] = red1;
+	for (uint32_t i = 0; i < 6; ++i) {
+		out[2 + i] = (uint8_t)(indices >> (8 * i));
+	}
+}
+
+// Appends values to a block starting from its least significant bit, as every BC7 field is laid out
+struct BlockBitWriter {
+	uint8_t* out;
+	uint32_t bit{ 0 };
+
+	void write(uint32_t value, uint32_t bitCount)
+	{
+		for (uint32_t i = 0; i < bitCount; ++i, ++bit) {
+			if ((value >> i) & 1u) {
+				out[bit >> 3] |= (uint8_t)(1u << (bit & 7));
+			}
+		}
+	}
+};
+
+// Rounds an endpoint to 7 bits per channel and the shared lowest bit that lands closer to it
+static void quantizeBC7Endpoint(const float endpoint[4], uint32_t quantized[4], uint32_t& pBit)
+{
+	float bestError{ -1.0f };
+	for (uint32_t p = 0; p < 2; ++p) {
+		uint32_t candidate[4];
+		float error{ 0.0f };
+		for (uint32_t c = 0; c < 4; ++c) {
+			float q{ std::round((endpoint[c] - (float)p) * 0.5f) };
+			candidate[c] = (uint32_t)std::min(std::max(q, 0.0f), 127.0f);
+			float d{ (float)(candidate[c] * 2 + p) - endpoint[c] };
+			error += d * d;
+		}
+		if (bestError < 0.0f || error < bestError) {
+			bestError = error;
+			pBit = p;
+			memcpy(quantized, candidate, sizeof(candidate));
+		}
+	}
+}
+
+// Writes a block as BC7 mode 6, one subset with RGBA endpoints and 4 bit indices, and returns its squared error.
+// positions gets the index of every texel, counting from the endpoint stored first
+static float encodeBC7Endpoints(const TexelBlock& block, const float endpoint0[4], const float endpoint1[4], uint8_t* out, uint8_t positions[16])
+{
+	uint32_t quantized[2][4];
+	uint32_t pBits[2];
+	quantizeBC7Endpoint(endpoint0, quantized[0], pBits[0]);
+	quantizeBC7Endpoint(endpoint1, quantized[1], pBits[1]);
+
+	int32_t colors[2][4];
+	float expanded[2][4];
+	for (uint32_t e = 0; e < 2; ++e) {
+		for (uint32_t c = 0; c < 4; ++c) {
+			colors[e][c] = (int32_t)(quantized[e][c] * 2 + pBits[e]);
+			expanded[e][c] = (float)colors[e][c];
+		}
+	}
+
+	projectPositions(block, expanded[0], expanded[1], 0, 4, 16, positions);
+
+	// the weights are only close to evenly spaced, so the neighbouring index is sometimes closer
+	float error{ 0.0f };
+	for (uint32_t i = 0; i < 16; ++i) {
+		uint32_t first{ positions[i] > 0 ? positions[i] - 1u : 0u };
+		uint32_t last{ std::min(positions[i] + 1u, 15u) };
+		float bestError{ -1.0f };
+		for (uint32_t p = first; p <= last; ++p) {
+			int32_t w{ BC7_WEIGHTS[p] };
+			float texelError{ 0.0f };
+			for (uint32_t c = 0; c < 4; ++c) {
+				int32_t value{ ((64 - w) * colors[0][c] + w * colors[1][c] + 32) >> 6 };
+				float d{ (float)value - block.channels[c][i] };
+				texelError += d * d;
+			}
+			if (bestError < 0.0f || texelError < bestError) {
+				bestError = texelError;
+				positions[i] = (uint8_t)p;
+			}
+		}
+		error += bestError;
+	}
+
+	// the first index has its top bit left out and implied zero, swap the endpoints to make it so
+	if (positions[0] >= 8) {
+		std::swap(quantized[0], quantized[1]);
+		std::swap(pBits[0], pBits[1]);
+		for (uint32_t i = 0; i < 16; ++i) {
+			positions[i] = (uint8_t)(15 - positions[i]);
+		}
+	}
+
+	memset(out, 0, 16);
+	BlockBitWriter writer{ out };
+	writer.write(1u << 6, 7);
+	for (uint32_t c = 0; c < 4; ++c) {
+		writer.write(quantized[0][c], 7);
+		writer.write(quantized[1][c], 7);
+	}
+	writer.write(pBits[0], 1);
+	writer.write(pBits[1], 1);
+	writer.write(positions[0], 3);
+	for (uint32_t i = 1; i < 16; ++i) {
+		writer.write(positions[i], 4);
+	}
+
+	return error;
+}
+
+static void encodeBC7(const TexelBlock& block, uint8_t* out)
+{
+	float endpoint0[4];
+	float endpoint1[4];
+	principalEndpoints(block, 4, endpoint0, endpoint1);
+
+	uint8_t positions[16];
+	float error{ encodeBC7Endpoints(block, endpoint0, endpoint1, out, positions) };
+
+	float weights[16];
+	for (uint32_t i = 0; i < 16; ++i) {
+		weights[i] = BC7_WEIGHTS[positions[i]] / 64.0f;
+	}
+
+	// positions may have been flipped to fix the anchor index, so fit the endpoints in the order they were stored
+	if (fitEndpoints(block, 4, weights, endpoint0, endpoint1)) {
+		uint8_t refined[16];
+		if (encodeBC7Endpoints(block, endpoint0, endpoint1, refined, positions) < error) {
+			memcpy(out, refined, sizeof(refined));
+		}
+	}
+}
+
+static void encodeBlock(const TexelBlock& block, TextureFormat format, uint8_t* out)
+{
+	switch (format) {
+	case TextureFormat::BC1:
+	case TextureFormat::BC1_SRGB:
+		encodeBC1(block, out);
+		break;
+	case TextureFormat::BC3:
+	case TextureFormat::BC3_SRGB:
+		// alpha as a BC4 block followed by the color as BC1, which BC3 always decodes in four color mode
+		encodeBC4(block, 3, out);
+		encodeBC1(block, out + 8);
+		break;
+	case TextureFormat::BC4:
+		encodeBC4(block, 0, out);
+		break;
+	case TextureFormat::BC5:
+		encodeBC4(block, 0, out);
+		encodeBC4(block, 1, out + 8);
+		break;
+	case TextureFormat::BC7:
+	case TextureFormat::BC7_SRGB:
+		encodeBC7(block, out);
+		break;
+	default:
+		break;
+	}
+}
+
+void compressTextureLevel(uint8_t* destination, const uint8_t* pixels, uint32_t width, uint32_t height, TextureFormat format, JobPool& pool)
+{
+	const uint32_t blocksX{ (width + 3) / 4 };
+	const uint32_t blocksY{ (height + 3) / 4 };
+	const size_t blockBytes{ assets::textureLevelSize(format, 4, 4) };
+
+	// rows write to disjoint parts of destination. A few rows per job keep the small mip levels from being mostly overhead
+	constexpr uint32_t rowsPerJob{ 8 };
+	pool.parallelFor(blocksY, rowsPerJob, [&](uint32_t blockY) {
+		TexelBlock block;
+		for (uint32_t blockX = 0; blockX < blocksX; ++blockX) {
+			loadBlock(block, pixels, width, height, blockX, blockY);
+			encodeBlock(block, format, destination + ((size_t)blockY * blocksX + blockX) * blockBytes);
+		}
+	});
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+#include "texture_asset.h"
+#include "job_pool.h"
+
+// Encodes one mip level of an RGBA8 image into 4x4 blocks of format, which must be one of the block compressed formats.
+// Blocks hanging over the right or bottom edge repeat the last column and row, the GPU never samples those texels.
+// destination must hold assets::textureLevelSize(format, width, height) bytes. Rows of blocks are jobs on pool,
+// and every block is encoded on its own so the output doesn't depend on the thread count
+void compressTextureLevel(uint8_t* destination, const uint8_t* pixels, uint32_t width, uint32_t height, assets::TextureFormat format, JobPool& pool);
@@ -0,0 +1,218 @@
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+
+#include "keyframe_index.h"
+
+/*
+	Measures how long RenderObject::updateAnimation takes to find the keys of every sampler of a character, comparing
+
+	scan        the previous path, every key of every sampler is tested each frame
+	cursor      KeyframeIndex::findKey with a cursor per sampler kept from the frame before, as in playback
+	seek        KeyframeIndex::findKey at a random time every frame, so every lookup goes to the buckets
+
+	for clips with 10, 1000 and 10000 keys per sampler. Each character plays its own copy of the clip from a different
+	start time at 60 frames per second, looping. Decoding the keys and skinning are the same on every path and left out,
+	the position between the keys is summed up so the lookup can't be optimized away, and compared between scan and
+	cursor.
+
+	Usage: animation_bench [-characters N] [-samplers N] [-frames N] [-keys 10,1000,10000]
+*/
+
+// Ticks per second of the generated clips, like a clip baked from 120 fps
+constexpr float TIME_STEP{ 1.0f / 120.0f };
+
+constexpr float FRAME_TIME{ 1.0f / 60.0f };
+
+struct Clip {
+	std::vector<std::vector<uint16_t>> times;
+	KeyframeIndex index;
+	float end;
+};
+
+static Clip generateClip(uint32_t samplerCount, uint32_t keyCount)
+{
+	Clip clip{};
+	clip.times.resize(samplerCount);
+
+	// keys 1 to 7 ticks apart, so samplers don't all have keys on the same ticks. Clips with many keys are squeezed
+	// into the ticks a uint16_t holds, like the baker does
+	uint32_t maxGap{ std::min(7u, 65535u / std::max(keyCount, 1u)) };
+	uint32_t state{ 0x12345678u };
+	uint32_t lastTick{ 0 };
+	for (std::vector<uint16_t>& times : clip.times) {
+		uint32_t tick{ 0 };
+		for (uint32_t i = 0; i < keyCount; ++i) {
+			times.push_back((uint16_t)tick);
+			state = state * 1664525u + 1013904223u;
+			tick += 1 + (state >> 16) % maxGap;
+		}
+		lastTick = std::max(lastTick, (uint32_t)times.back());
+	}
+
+	for (const std::vector<uint16_t>& times : clip.times) {
+		clip.index.addSampler(times.data(), (uint32_t)times.size());
+	}
+	clip.end = std::max(lastTick, 1u) * TIME_STEP;
+
+	return clip;
+}
+
+// Interpolation weight between the key and the one after it, as updateAnimation computes it
+static float weight(const uint16_t* times, uint32_t keyCount, uint32_t key, float tick)
+{
+	if (key + 1 < keyCount && tick >= times[key]) {
+		return (tick - times[key]) / (times[key + 1] - times[key]);
+	}
+	return 0.0f;
+}
+
+static uint32_t scanKey(const uint16_t* times, uint32_t keyCount, float tick)
+{
+	uint32_t key{ 0 };
+	for (uint32_t i = 0; i + 1 < keyCount; ++i) {
+		if ((tick >= times[i]) && (tick <= times[i + 1])) {
+			key = i;
+		}
+	}
+	if (keyCount > 1 && tick > times[keyCount - 1]) {
+		key = keyCount - 1;
+	}
+	return key;
+}
+
+// How the lookup finds a key for a sampler at tick, cursor is the character's cursor for the sampler
+enum class Lookup { Scan, Cursor, Seek };
+
+// Nanoseconds per character update. checksum is the sum of the key plus interpolation weight of every lookup, which is
+// the same whichever of two keys a lookup exactly on a key returns
+static double updateCharacters(const Clip& clip, Lookup lookup, uint32_t characterCount, uint32_t frameCount, double& checksum)
+{
+	uint32_t samplerCount{ (uint32_t)clip.times.size() };
+	std::vector<float> characterTimes(characterCount);
+	std::vector<uint32_t> cursors((size_t)characterCount * samplerCount, 0);
+	for (uint32_t i = 0; i < characterCount; ++i) {
+		characterTimes[i] = clip.end * i / characterCount;
+	}
+
+	uint32_t state{ 0x9e3779b9u };
+	double sum{ 0.0 };
+
+	auto start{ std::chrono::steady_clock::now() };
+	for (uint32_t frame = 0; frame < frameCount; ++frame) {
+		for (uint32_t character = 0; character < characterCount; ++character) {
+			float& time{ characterTimes[character] };
+			if (lookup == Lookup::Seek) {
+				state = state * 1664525u + 1013904223u;
+				time = clip.end * (float)(state >> 8) / 16777216.0f;
+			} else {
+				time += FRAME_TIME;
+				if (time > clip.end) {
+					time -= clip.end;
+				}
+			}
+			float tick{ time / TIME_STEP };
+
+			uint32_t* characterCursors{ &cursors[(size_t)character * samplerCount] };
+			for (uint32_t s = 0; s < samplerCount; ++s) {
+				const uint16_t* times{ clip.times[s].data() };
+				uint32_t keyCount{ (uint32_t)clip.times[s].size() };
+				uint32_t key{ lookup == Lookup::Scan ? scanKey(times, keyCount, tick) : clip.index.findKey(s, tick, characterCursors[s]) };
+				sum += key + weight(times, keyCount, key, tick);
+			}
+		}
+	}
+	auto end{ std::chrono::steady_clock::now() };
+
+	checksum = sum;
+	return std::chrono::duration<double, std::nano>(end - start).count() / ((double)characterCount * frameCount);
+}
+
+// Every lookup of findKey, from any cursor, has to land where the scan does
+static bool verifyLookups(const Clip& clip)
+{
+	uint32_t state{ 0x2545f491u };
+	for (uint32_t s = 0; s < clip.times.size(); ++s) {
+		const uint16_t* times{ clip.times[s].data() };
+		uint32_t keyCount{ (uint32_t)clip.times[s].size() };
+		for (uint32_t i = 0; i < 1000; ++i) {
+			state = state * 1664525u + 1013904223u;
+			float tick{ (clip.end / TIME_STEP + 2.0f) * (float)(state >> 8) / 16777216.0f - 1.0f };
+			// land exactly on keys as well
+			if (i % 4 == 0) {
+				tick = times[(state >> 4) % keyCount];
+			}
+			uint32_t cursor{ (state >> 12) % (keyCount + 1) };
+
+			uint32_t scan{ scanKey(times, keyCount, tick) };
+			uint32_t found{ clip.index.findKey(s, tick, cursor) };
+			if (scan + weight(times, keyCount, scan, tick) != found + weight(times, keyCount, found, tick) || cursor != found) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t characterCount{ 64 };
+	// translation, rotation and scale of 30 joints
+	uint32_t samplerCount{ 90 };
+	uint32_t frameCount{ 600 };
+	std::vector<uint32_t> keyCounts{ 10, 1000, 10000 };
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg{ argv[i] };
+		if (arg == "-characters" && i + 1 < argc) {
+			characterCount = (uint32_t)std::max(std::atoi(argv[++i]), 1);
+		} else if (arg == "-samplers" && i + 1 < argc) {
+			samplerCount = (uint32_t)std::max(std::atoi(argv[++i]), 1);
+		} else if (arg == "-frames" && i + 1 < argc) {
+			frameCount = (uint32_t)std::max(std::atoi(argv[++i]), 1);
+		} else if (arg == "-keys" && i + 1 < argc) {
+			keyCounts.clear();
+			std::string list{ argv[++i] };
+			for (size_t start = 0; start < list.size();) {
+				size_t end{ std::min(list.find(',', start), list.size()) };
+				keyCounts.push_back((uint32_t)std::max(std::atoi(list.substr(start, end - start).c_str()), 1));
+				start = end + 1;
+			}
+		} else {
+			std::cout << "Usage: animation_bench [-characters N] [-samplers N] [-frames N] [-keys 10,1000,10000]\n";
+			return -1;
+		}
+	}
+
+	std::cout << characterCount << " characters with " << samplerCount << " samplers, " << frameCount << " frames\n";
+	std::cout << "keys       scan us    cursor us  seek us    speedup\n";
+
+	for (uint32_t keyCount : keyCounts) {
+		Clip clip{ generateClip(samplerCount, keyCount) };
+		if (!verifyLookups(clip)) {
+			std::cout << "KeyframeIndex found different keys than the scan for " << keyCount << " keys\n";
+			return -1;
+		}
+
+		double scanChecksum, cursorChecksum, seekChecksum;
+		double scan{ updateCharacters(clip, Lookup::Scan, characterCount, frameCount, scanChecksum) };
+		double cursor{ updateCharacters(clip, Lookup::Cursor, characterCount, frameCount, cursorChecksum) };
+		double seek{ updateCharacters(clip, Lookup::Seek, characterCount, frameCount, seekChecksum) };
+
+		// both playback paths see the same times, so they have to find the same keys
+		if (std::abs(scanChecksum - cursorChecksum) > 1e-6 * std::max(1.0, std::abs(scanChecksum))) {
+			std::cout << "Cursor lookup found different keys than the scan for " << keyCount << " keys\n";
+			return -1;
+		}
+
+		printf("%-10u %-10.3f %-10.3f %-10.3f %.1fx\n", keyCount, scan / 1000.0, cursor / 1000.0, seek / 1000.0, scan / cursor);
+	}
+
+	return 0;
+}
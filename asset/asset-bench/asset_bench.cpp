@@ -0,0 +1,617 @@
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "json.hpp"
+
+#include "asset_loader.h"
+#include "texture_asset.h"
+#include "compression.h"
+
+/*
+	Measures how fast assetlib loads the assets of a corpus, one stage at a time:
+
+	open        opening the file
+	read        reading the whole file into memory
+	header      viewBinaryFile, which for version 1 assets includes parsing the JSON metadata
+	json        parsing the JSON metadata of a version 1 asset on its own, so it can be told apart from the header
+	decompress  readBlob into a buffer of the uncompressed blob size
+	unpack      reading the type specific info and copying the blob to where it's used, like the engine's staging buffers
+
+	Every asset is loaded repeatedly with a warm page cache, then with the file evicted from the cache before each load.
+	When the OS refuses to evict a file, its cold results are marked invalid in the output and with "cold_valid" in the JSON report.
+	Skeletons share their types with the renderer and are used in place, so only their open and read are measured.
+
+	Usage: asset_bench <corpus directory> [-generate] [-iterations N] [-cold-iterations N] [-json report.json]
+*/
+
+namespace fs = std::filesystem;
+using namespace assets;
+
+enum Stage {
+	StageOpen,
+	StageRead,
+	StageHeader,
+	StageJson,
+	StageDecompress,
+	StageUnpack,
+	StageTotal,
+	StageCount
+};
+
+static const char* stageNames[StageCount]{ "open", "read", "header", "json", "decompress", "unpack", "total" };
+
+// Leading fields of MeshInfoBinary. The full struct needs the renderer's vertex types, and smaller info structs
+// are valid (see readInfoStruct), so this is all the benchmark writes and reads
+struct MeshBlobSizes {
+	uint64_t vertexBufferSize;
+	uint64_t indexBufferSize;
+};
+
+struct StageSamples {
+	// microseconds
+	std::vector<double> samples;
+	// bytes the stage produces or consumes, used for its throughput
+	uint64_t bytes{ 0 };
+};
+
+struct AssetResult {
+	std::string name;
+	std::string type;
+	int version{ 0 };
+	CompressionMode compressionMode{ CompressionMode::None };
+	uint64_t fileSize{ 0 };
+	uint64_t blobSize{ 0 };
+	StageSamples warm[StageCount];
+	StageSamples cold[StageCount];
+	// false when the file couldn't be evicted before a cold load, so the cold samples may have hit the page cache
+	bool coldValid{ true };
+};
+
+// Buffers reused between loads so the measurements don't include growing them
+struct LoadBuffers {
+	std::vector<char> file;
+	std::vector<char> blob;
+	std::vector<char> destination;
+};
+
+static double elapsedMicroseconds(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+	return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+// Nearest-rank percentile, p in [0, 1]
+static double percentile(std::vector<double> samples, double p)
+{
+	if (samples.empty()) return 0.0;
+
+	std::sort(samples.begin(), samples.end());
+	size_t rank{ (size_t)std::ceil(p * samples.size()) };
+	return samples[std::min(std::max(rank, (size_t)1), samples.size()) - 1];
+}
+
+// Drops the file's pages from the OS cache so the next read has to go to the disk. Best effort: the OS may ignore it
+static bool evictFromCache(const fs::path& path)
+{
+#ifdef _WIN32
+	// opening a file without buffering makes the cache manager flush and purge what it holds of it
+	HANDLE file{ CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr) };
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	CloseHandle(file);
+	return true;
+#else
+	int fd{ open(path.c_str(), O_RDONLY) };
+	if (fd < 0) {
+		return false;
+	}
+	bool success{ posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0 };
+	close(fd);
+	return success;
+#endif
+}
+
+static bool unpackAsset(const AssetFileView& view, const AssetMetadata& metadata, const char* blob, std::vector<char>& destination)
+{
+	if (memcmp(view.type, "TEXI", 4) == 0) {
+		TextureInfo info{ readTextureInfo(metadata) };
+		if (info.originalSize > view.uncompressedBlobSize) return false;
+
+		destination.resize(info.originalSize);
+		unpackTexture(blob, info.originalSize, destination.data());
+		return true;
+	}
+
+	if (memcmp(view.type, "MESH", 4) == 0) {
+		MeshBlobSizes sizes{};
+		if (!readInfoStruct(metadata, sizes)) {
+			sizes.vertexBufferSize = metadata.json["vertex_buffer_size"];
+			sizes.indexBufferSize = metadata.json["index_buffer_size"];
+		}
+		if (sizes.vertexBufferSize + sizes.indexBufferSize > view.uncompressedBlobSize) return false;
+
+		// same copies as unpackMesh, into one buffer the way uploadMesh lays out its staging buffer
+		destination.resize(sizes.vertexBufferSize + sizes.indexBufferSize);
+		memcpy(destination.data(), blob, sizes.vertexBufferSize);
+		memcpy(destination.data() + sizes.vertexBufferSize, blob + sizes.vertexBufferSize, sizes.indexBufferSize);
+		return true;
+	}
+
+	// unknown asset types are only decompressed
+	return true;
+}
+
+// Loads an asset once, adding the time of each stage to samples
+static bool loadAsset(const fs::path& path, bool headerless, LoadBuffers& buffers, StageSamples* samples)
+{
+	auto start{ std::chrono::steady_clock::now() };
+
+	std::ifstream inFile{ path, std::ios::binary };
+	if (!inFile.is_open()) {
+		std::cout << "Error when trying to read file: " << path << std::endl;
+		return false;
+	}
+	auto opened{ std::chrono::steady_clock::now() };
+
+	inFile.seekg(0, std::ios::end);
+	buffers.file.resize((size_t)inFile.tellg());
+	inFile.seekg(0);
+	inFile.read(buffers.file.data(), buffers.file.size());
+	if (!inFile) return false;
+	auto read{ std::chrono::steady_clock::now() };
+
+	samples[StageOpen].samples.push_back(elapsedMicroseconds(start, opened));
+	samples[StageRead].samples.push_back(elapsedMicroseconds(opened, read));
+
+	if (headerless) {
+		samples[StageTotal].samples.push_back(elapsedMicroseconds(start, read));
+		return true;
+	}
+
+	AssetFileView view{};
+	AssetMetadata metadata;
+	if (!viewBinaryFile(buffers.file.data(), buffers.file.size(), view, metadata)) {
+		std::cout << "Asset file is corrupt: " << path << std::endl;
+		return false;
+	}
+	auto header{ std::chrono::steady_clock::now() };
+
+	if (view.json) {
+		nlohmann::json json = nlohmann::json::parse(view.json, view.json + view.jsonSize);
+	}
+	auto json{ std::chrono::steady_clock::now() };
+
+	buffers.blob.resize(view.uncompressedBlobSize);
+	if (!readBlob(view, metadata.compressionMode, buffers.blob.data())) {
+		std::cout << "Failed to decompress " << path << std::endl;
+		return false;
+	}
+	auto decompressed{ std::chrono::steady_clock::now() };
+
+	if (!unpackAsset(view, metadata, buffers.blob.data(), buffers.destination)) {
+		std::cout << "Asset blob is smaller than its info says: " << path << std::endl;
+		return false;
+	}
+	auto unpacked{ std::chrono::steady_clock::now() };
+
+	samples[StageHeader].samples.push_back(elapsedMicroseconds(read, header));
+	if (view.json) {
+		samples[StageJson].samples.push_back(elapsedMicroseconds(header, json));
+	}
+	samples[StageDecompress].samples.push_back(elapsedMicroseconds(json, decompressed));
+	samples[StageUnpack].samples.push_back(elapsedMicroseconds(decompressed, unpacked));
+	samples[StageTotal].samples.push_back(elapsedMicroseconds(start, unpacked));
+
+	return true;
+}
+
+static bool benchmarkAsset(const fs::path& path, int warmIterations, int coldIterations, AssetResult& result)
+{
+	bool headerless{ path.extension() == ".skel" };
+	result.fileSize = fs::file_size(path);
+
+	if (headerless) {
+		result.type = "SKEL";
+		result.blobSize = result.fileSize;
+	} else {
+		AssetFileView view{};
+		AssetMetadata metadata;
+		if (!mapBinaryFile(path.string().c_str(), view, metadata)) {
+			return false;
+		}
+		result.type = std::string{ view.type, 4 };
+		result.version = view.version;
+		result.compressionMode = metadata.compressionMode;
+		result.blobSize = view.uncompressedBlobSize;
+
+		result.warm[StageJson].bytes = view.jsonSize;
+	}
+
+	result.warm[StageRead].bytes = result.fileSize;
+	result.warm[StageDecompress].bytes = result.blobSize;
+	result.warm[StageUnpack].bytes = result.blobSize;
+	result.warm[StageTotal].bytes = result.blobSize;
+	for (int stage = 0; stage < StageCount; ++stage) {
+		result.cold[stage].bytes = result.warm[stage].bytes;
+	}
+
+	LoadBuffers buffers;
+
+	// untimed load to fault in the buffers and the page cache
+	if (!loadAsset(path, headerless, buffers, result.cold)) {
+		return false;
+	}
+	for (StageSamples& samples : result.cold) {
+		samples.samples.clear();
+	}
+
+	for (int i = 0; i < warmIterations; ++i) {
+		if (!loadAsset(path, headerless, buffers, result.warm)) return false;
+	}
+
+	for (int i = 0; i < coldIterations; ++i) {
+		if (!evictFromCache(path) && result.coldValid) {
+			std::cout << "Could not evict " << path << " from the page cache, its cold loads may be warm" << std::endl;
+			result.coldValid = false;
+		}
+		if (!loadAsset(path, headerless, buffers, result.cold)) return false;
+	}
+
+	return true;
+}
+
+static nlohmann::json stageReport(const StageSamples& stage)
+{
+	nlohmann::json report;
+	double p50{ percentile(stage.samples, 0.5) };
+	report["p50_us"] = p50;
+	report["p99_us"] = percentile(stage.samples, 0.99);
+	if (stage.bytes > 0 && p50 > 0.0) {
+		report["mb_per_s"] = (double)stage.bytes / p50;
+	}
+	return report;
+}
+
+static void printStages(const char* cache, const StageSamples* stages, bool valid)
+{
+	for (int stage = 0; stage < StageCount; ++stage) {
+		if (stages[stage].samples.empty()) continue;
+
+		double p50{ percentile(stages[stage].samples, 0.5) };
+		std::cout << "  " << cache << " " << stageNames[stage]
+			<< "\tp50 " << p50 << " us\tp99 " << percentile(stages[stage].samples, 0.99) << " us";
+		if (stages[stage].bytes > 0 && p50 > 0.0) {
+			std::cout << "\t" << (double)stages[stage].bytes / p50 << " MB/s";
+		}
+		if (!valid) {
+			std::cout << "\t(invalid, not evicted)";
+		}
+		std::cout << "\n";
+	}
+}
+
+/*
+	Corpus generation. Textures are smooth gradients with a little noise and meshes are height field grids,
+	which compress about as well as real baked assets. Each is written in every compression mode, plus a
+	version 1 copy (JSON metadata, LZ4 frame) to compare against the old format.
+*/
+
+static uint32_t hashNoise(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+static std::vector<char> makeTexturePixels(uint32_t size)
+{
+	std::vector<char> pixels((size_t)size * size * 4);
+	for (uint32_t y = 0; y < size; ++y) {
+		for (uint32_t x = 0; x < size; ++x) {
+			size_t i{ ((size_t)y * size + x) * 4 };
+			uint32_t noise{ hashNoise(y * size + x) & 7 };
+			pixels[i + 0] = (char)((x * 255 / size + noise) & 0xff);
+			pixels[i + 1] = (char)((y * 255 / size + noise) & 0xff);
+			pixels[i + 2] = (char)(((x + y) * 127 / size) & 0xff);
+			pixels[i + 3] = (char)255;
+		}
+	}
+	return pixels;
+}
+
+struct BenchVertex {
+	float position[3];
+	float normal[3];
+	float uv[2];
+};
+
+static void makeMeshBuffers(uint32_t gridSize, std::vector<char>& vertexData, std::vector<char>& indexData)
+{
+	std::vector<BenchVertex> vertices((size_t)gridSize * gridSize);
+	for (uint32_t y = 0; y < gridSize; ++y) {
+		for (uint32_t x = 0; x < gridSize; ++x) {
+			BenchVertex& v{ vertices[(size_t)y * gridSize + x] };
+			float u{ (float)x / (gridSize - 1) };
+			float w{ (float)y / (gridSize - 1) };
+			v.position[0] = u;
+			v.position[1] = 0.1f * std::sin(u * 12.0f) * std::cos(w * 9.0f);
+			v.position[2] = w;
+			v.normal[0] = 0.0f;
+			v.normal[1] = 1.0f;
+			v.normal[2] = 0.0f;
+			v.uv[0] = u;
+			v.uv[1] = w;
+		}
+	}
+
+	std::vector<uint32_t> indices;
+	indices.reserve((size_t)(gridSize - 1) * (gridSize - 1) * 6);
+	for (uint32_t y = 0; y + 1 < gridSize; ++y) {
+		for (uint32_t x = 0; x + 1 < gridSize; ++x) {
+			uint32_t i{ y * gridSize + x };
+			indices.insert(indices.end(), { i, i + gridSize, i + 1, i + 1, i + gridSize, i + gridSize + 1 });
+		}
+	}
+
+	vertexData.resize(vertices.size() * sizeof(BenchVertex));
+	memcpy(vertexData.data(), vertices.data(), vertexData.size());
+	indexData.resize(indices.size() * sizeof(uint32_t));
+	memcpy(indexData.data(), indices.data(), indexData.size());
+}
+
+// Writes a version 1 asset: type, version, JSON length, blob length, JSON, then the blob as a single LZ4 frame
+static bool writeLegacyAsset(const fs::path& path, const char type[4], const nlohmann::json& metadata, const std::vector<char>& blob)
+{
+	nlohmann::json json = metadata;
+	json["compression_mode"] = "LZ4";
+	std::string jsonString{ json.dump() };
+
+	std::vector<char> compressed(blob.size());
+	CompressResult_t res{ compressBuffer(blob.data(), compressed.data(), (uint32_t)blob.size()) };
+	if (res.error != 0) {
+		std::cout << "Failed to compress " << path << std::endl;
+		return false;
+	}
+
+	std::ofstream outFile{ path, std::ios::binary | std::ios::out };
+	if (!outFile.is_open()) {
+		std::cout << "Error when trying to write file: " << path << std::endl;
+		return false;
+	}
+
+	uint32_t version{ ASSET_VERSION_JSON };
+	uint32_t jsonLength{ (uint32_t)jsonString.size() };
+	uint32_t blobLength{ (uint32_t)blob.size() };
+	outFile.write(type, 4);
+	outFile.write((const char*)&version, sizeof(uint32_t));
+	outFile.write((const char*)&jsonLength, sizeof(uint32_t));
+	outFile.write((const char*)&blobLength, sizeof(uint32_t));
+	outFile.write(jsonString.data(), jsonString.size());
+	outFile.write(compressed.data(), res.sizeOut);
+
+	return (bool)outFile;
+}
+
+static bool writeInEveryMode(const fs::path& directory, const std::string& name, const char* extension, AssetFile& file,
+	const nlohmann::json& legacyMetadata)
+{
+	const CompressionMode modes[]{ CompressionMode::None, CompressionMode::LZ4Blocks, CompressionMode::LZ4HC };
+	for (CompressionMode mode : modes) {
+		CompressionSettings settings{};
+		settings.mode = mode;
+		// store every blob in the requested mode, even if it doesn't compress well
+		settings.thresholdRatio = 1.0f;
+
+		std::string modeName{ compressionModeName(mode) };
+		std::transform(modeName.begin(), modeName.end(), modeName.begin(), [](char c) { return (char)tolower(c); });
+
+		fs::path path{ directory / (name + "_" + modeName + extension) };
+		if (!saveBinaryFile(path.string().c_str(), file, settings)) return false;
+	}
+
+	return writeLegacyAsset(directory / (name + "_v1_lz4" + extension), file.type, legacyMetadata, file.binaryBlob);
+}
+
+static bool generateCorpus(const fs::path& directory)
+{
+	fs::create_directories(directory);
+
+	for (uint32_t size : { 512u, 2048u }) {
+		std::vector<char> pixels{ makeTexturePixels(size) };
+
+		TextureInfo info{};
+		info.originalSize = pixels.size();
+		info.width = size;
+		info.height = size;
+		info.textureFormat = TextureFormat::RGBA8;
+		info.miplevels = 1;
+		AssetFile file{ packTexture(&info, pixels.data()) };
+
+		nlohmann::json metadata;
+		metadata["format"] = "RGBA8";
+		metadata["width"] = size;
+		metadata["height"] = size;
+		metadata["miplevels"] = 1;
+		metadata["original_size"] = pixels.size();
+		metadata["original_file"] = "generated";
+
+		if (!writeInEveryMode(directory, "texture_" + std::to_string(size), ".tx", file, metadata)) return false;
+	}
+
+	for (uint32_t gridSize : { 64u, 512u }) {
+		std::vector<char> vertexData;
+		std::vector<char> indexData;
+		makeMeshBuffers(gridSize, vertexData, indexData);
+
+		AssetFile file{};
+		memcpy(file.type, "MESH", 4);
+		file.version = ASSET_VERSION;
+
+		MeshBlobSizes sizes{ vertexData.size(), indexData.size() };
+		file.info.resize(sizeof(MeshBlobSizes));
+		memcpy(file.info.data(), &sizes, sizeof(MeshBlobSizes));
+
+		file.binaryBlob = vertexData;
+		file.binaryBlob.insert(file.binaryBlob.end(), indexData.begin(), indexData.end());
+
+		nlohmann::json metadata;
+		metadata["vertex_buffer_size"] = vertexData.size();
+		metadata["index_buffer_size"] = indexData.size();
+		metadata["index_size"] = sizeof(uint32_t);
+		metadata["bounds"] = { 0.5f, 0.0f, 0.5f, 0.75f, 0.5f, 0.1f, 0.5f };
+		metadata["vertex_format"] = 0;
+		metadata["original_file"] = "generated";
+
+		if (!writeInEveryMode(directory, "mesh_" + std::to_string(gridSize), ".mesh", file, metadata)) return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		std::cout << "Usage: asset_bench <corpus directory> [-generate] [-iterations N] [-cold-iterations N] [-json report.json]\n";
+		return -1;
+	}
+
+	fs::path corpus{ argv[1] };
+	bool generate{ false };
+	int warmIterations{ 20 };
+	int coldIterations{ 5 };
+	std::string reportPath;
+
+	for (int i = 2; i < argc; ++i) {
+		std::string arg{ argv[i] };
+		if (arg == "-generate") {
+			generate = true;
+		} else if (arg == "-iterations" && i + 1 < argc) {
+			warmIterations = std::max(std::atoi(argv[++i]), 1);
+		} else if (arg == "-cold-iterations" && i + 1 < argc) {
+			coldIterations = std::max(std::atoi(argv[++i]), 0);
+		} else if (arg == "-json" && i + 1 < argc) {
+			reportPath = argv[++i];
+		}
+	}
+
+	if (generate && !generateCorpus(corpus)) {
+		std::cout << "Failed to generate the corpus in " << corpus << std::endl;
+		return -1;
+	}
+
+	if (!fs::is_directory(corpus)) {
+		std::cout << "Not a directory: " << corpus << std::endl;
+		return -1;
+	}
+
+	// sorted so reports of the same corpus line up between runs
+	std::vector<fs::path> paths;
+	for (auto& p : fs::recursive_directory_iterator(corpus)) {
+		fs::path extension{ p.path().extension() };
+		if (extension == ".dict") {
+			loadDictionaryFile(p.path().string().c_str());
+		} else if (extension == ".tx" || extension == ".mesh" || extension == ".skel") {
+			paths.push_back(p.path());
+		}
+	}
+	std::sort(paths.begin(), paths.end());
+
+	nlohmann::json report;
+	report["asset_version"] = ASSET_VERSION;
+	report["compression_block_size"] = COMPRESSION_BLOCK_SIZE;
+	report["warm_iterations"] = warmIterations;
+	report["cold_iterations"] = coldIterations;
+	report["assets"] = nlohmann::json::array();
+
+	size_t assetCount{ 0 };
+	uint64_t totalBytes{ 0 };
+	double totalWarmUs{ 0.0 };
+	double totalColdUs{ 0.0 };
+	size_t invalidColdCount{ 0 };
+
+	for (const fs::path& path : paths) {
+		AssetResult result;
+		result.name = path.lexically_proximate(corpus).generic_string();
+
+		if (!benchmarkAsset(path, warmIterations, coldIterations, result)) {
+			std::cout << "Skipping " << result.name << std::endl;
+			continue;
+		}
+
+		std::cout << result.name << " (" << result.type << " v" << result.version << ", "
+			<< compressionModeName(result.compressionMode) << ", " << result.fileSize << " bytes on disk, "
+			<< result.blobSize << " bytes unpacked)\n";
+		printStages("warm", result.warm, true);
+		printStages("cold", result.cold, result.coldValid);
+
+		nlohmann::json asset;
+		asset["name"] = result.name;
+		asset["type"] = result.type;
+		asset["version"] = result.version;
+		asset["compression_mode"] = compressionModeName(result.compressionMode);
+		asset["file_size"] = result.fileSize;
+		asset["blob_size"] = result.blobSize;
+		asset["cold_valid"] = result.coldValid;
+		for (int stage = 0; stage < StageCount; ++stage) {
+			if (!result.warm[stage].samples.empty()) {
+				asset["warm"][stageNames[stage]] = stageReport(result.warm[stage]);
+			}
+			if (!result.cold[stage].samples.empty()) {
+				asset["cold"][stageNames[stage]] = stageReport(result.cold[stage]);
+			}
+		}
+		report["assets"].push_back(asset);
+
+		++assetCount;
+		totalBytes += result.blobSize;
+		totalWarmUs += percentile(result.warm[StageTotal].samples, 0.5);
+		totalColdUs += percentile(result.cold[StageTotal].samples, 0.5);
+		if (!result.coldValid) {
+			++invalidColdCount;
+		}
+	}
+
+	if (totalWarmUs > 0.0) {
+		report["warm_mb_per_s"] = (double)totalBytes / totalWarmUs;
+		std::cout << "\nwarm: " << (double)totalBytes / totalWarmUs << " MB/s over " << assetCount << " assets\n";
+	}
+	if (totalColdUs > 0.0) {
+		report["cold_mb_per_s"] = (double)totalBytes / totalColdUs;
+		report["cold_valid"] = invalidColdCount == 0;
+		std::cout << "cold: " << (double)totalBytes / totalColdUs << " MB/s over " << assetCount << " assets";
+		if (invalidColdCount > 0) {
+			std::cout << " (invalid, " << invalidColdCount << " assets could not be evicted from the page cache)";
+		}
+		std::cout << "\n";
+	}
+
+	if (!reportPath.empty()) {
+		std::ofstream reportFile{ reportPath };
+		if (!reportFile.is_open()) {
+			std::cout << "Error when trying to write file: " << reportPath << std::endl;
+			return -1;
+		}
+		reportFile << report.dump(4);
+	}
+
+	return 0;
+}
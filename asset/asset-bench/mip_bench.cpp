@@ -0,0 +1,153 @@
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <thread>
+
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include "stb_image_resize.h"
+
+#include "mip_generator.h"
+#include "job_pool.h"
+
+/*
+	Measures how long the baker takes to build the mip chain of a texture, comparing
+
+	stbir       the previous path, stbir_resize_uint8 on every level with a Mitchell filter in gamma space
+	box         downsampleLevel with one thread
+	box-jobs    downsampleLevel with every row of a level spread over the job pool
+
+	each for a linear (normal map, mask) and an sRGB (color) texture. The inputs are generated noise with a gradient,
+	so the timing doesn't depend on an image on disk.
+
+	Usage: mip_bench [-iterations N] [-j N] [-sizes 4096,8192]
+*/
+
+struct MipChain {
+	std::vector<uint8_t> buffer;
+	uint32_t levels;
+};
+
+static MipChain allocateChain(uint32_t width, uint32_t height)
+{
+	MipChain chain{};
+	chain.levels = mipLevelCount(width, height);
+
+	size_t size{ 0 };
+	for (uint32_t level = 0; level < chain.levels; ++level) {
+		size += (size_t)width * height * 4;
+		width = nextMipSize(width);
+		height = nextMipSize(height);
+	}
+	chain.buffer.resize(size);
+
+	return chain;
+}
+
+static void fillTexture(uint8_t* pixels, uint32_t width, uint32_t height)
+{
+	uint32_t state{ 0x12345678u };
+	for (uint32_t y = 0; y < height; ++y) {
+		for (uint32_t x = 0; x < width; ++x) {
+			state = state * 1664525u + 1013904223u;
+			uint8_t* texel{ pixels + ((size_t)y * width + x) * 4 };
+			texel[0] = (uint8_t)((x * 255) / width + (state >> 28));
+			texel[1] = (uint8_t)((y * 255) / height + (state >> 24 & 15));
+			texel[2] = (uint8_t)(state >> 16);
+			texel[3] = (uint8_t)(255 - (state >> 29));
+		}
+	}
+}
+
+static void buildChainStbir(MipChain& chain, uint32_t width, uint32_t height)
+{
+	uint8_t* ptr{ chain.buffer.data() };
+	for (uint32_t level = 1; level < chain.levels; ++level) {
+		size_t mipSize{ (size_t)width * height * 4 };
+		uint32_t mipWidth{ nextMipSize(width) };
+		uint32_t mipHeight{ nextMipSize(height) };
+		stbir_resize_uint8(ptr, width, height, 0, ptr + mipSize, mipWidth, mipHeight, 0, 4);
+		ptr += mipSize;
+		width = mipWidth;
+		height = mipHeight;
+	}
+}
+
+static void buildChainBox(MipChain& chain, uint32_t width, uint32_t height, bool srgb, JobPool& pool)
+{
+	uint8_t* ptr{ chain.buffer.data() };
+	for (uint32_t level = 1; level < chain.levels; ++level) {
+		size_t mipSize{ (size_t)width * height * 4 };
+		downsampleLevel(ptr + mipSize, ptr, width, height, srgb, pool);
+		ptr += mipSize;
+		width = nextMipSize(width);
+		height = nextMipSize(height);
+	}
+}
+
+// Fastest of the iterations in milliseconds, the others include noise from the rest of the machine
+template<typename F>
+static double fastestMilliseconds(int iterations, F&& build)
+{
+	double fastest{ 1e30 };
+	for (int i = 0; i < iterations; ++i) {
+		auto start{ std::chrono::steady_clock::now() };
+		build();
+		auto end{ std::chrono::steady_clock::now() };
+		fastest = std::min(fastest, std::chrono::duration<double, std::milli>(end - start).count());
+	}
+	return fastest;
+}
+
+int main(int argc, char* argv[])
+{
+	int iterations{ 3 };
+	uint32_t threads{ std::max(std::thread::hardware_concurrency(), 1u) };
+	std::vector<uint32_t> sizes{ 4096, 8192 };
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg{ argv[i] };
+		if (arg == "-iterations" && i + 1 < argc) {
+			iterations = std::max(std::atoi(argv[++i]), 1);
+		} else if (arg == "-j" && i + 1 < argc) {
+			threads = (uint32_t)std::max(std::atoi(argv[++i]), 1);
+		} else if (arg == "-sizes" && i + 1 < argc) {
+			sizes.clear();
+			std::string list{ argv[++i] };
+			for (size_t start = 0; start < list.size();) {
+				size_t end{ std::min(list.find(',', start), list.size()) };
+				sizes.push_back((uint32_t)std::max(std::atoi(list.substr(start, end - start).c_str()), 1));
+				start = end + 1;
+			}
+		} else {
+			std::cout << "Usage: mip_bench [-iterations N] [-j N] [-sizes 4096,8192]\n";
+			return -1;
+		}
+	}
+
+	JobPool serialPool{ 1 };
+	JobPool pool{ threads };
+
+	std::cout << "size       texture  stbir ms   box ms     box-jobs ms (" << threads << " threads)  speedup\n";
+
+	for (uint32_t size : sizes) {
+		MipChain chain{ allocateChain(size, size) };
+		fillTexture(chain.buffer.data(), size, size);
+
+		double stbir{ fastestMilliseconds(iterations, [&]() { buildChainStbir(chain, size, size); }) };
+
+		for (bool srgb : { false, true }) {
+			double box{ fastestMilliseconds(iterations, [&]() { buildChainBox(chain, size, size, srgb, serialPool); }) };
+			double jobs{ fastestMilliseconds(iterations, [&]() { buildChainBox(chain, size, size, srgb, pool); }) };
+
+			std::string name{ std::to_string(size) + "x" + std::to_string(size) };
+			printf("%-10s %-8s %-10.1f %-10.1f %-29.1f %.1fx\n", name.c_str(), srgb ? "srgb" : "linear", stbir, box, jobs, stbir / jobs);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,159 @@
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "asset_loader.h"
+
+/*
+	Checks that AssetWriter writes a blob of any size in bounded memory, the way the baker streams mip levels and mesh
+	buffers into it. A blob that compresses about as well as a baked texture is generated a chunk at a time and written,
+	and the bench fails if the peak resident memory of the process grew by more than the bound while it was written.
+	With -verify the file is read back and compared afterwards, which needs the whole blob in memory.
+
+	Usage: writer_bench <output file> [-size MB] [-chunk KB] [-mode none|lz4|lz4hc] [-max-growth MB] [-verify]
+*/
+
+namespace fs = std::filesystem;
+using namespace assets;
+
+// Peak resident memory of the process so far, in bytes
+static uint64_t peakResidentBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters{};
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return 0;
+	}
+	return counters.PeakWorkingSetSize;
+#else
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	// kilobytes on Linux
+	return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+// Fills chunk with the part of the blob starting at offset, rows of a smooth gradient with a little noise
+static void fillChunk(std::vector<char>& chunk, uint64_t offset)
+{
+	for (size_t i = 0; i < chunk.size(); ++i) {
+		uint64_t position{ offset + i };
+		uint32_t noise{ (uint32_t)((position * 2654435761u) >> 29) & 3 };
+		chunk[i] = (char)((((position >> 2) & 0xfff) * 255 / 0xfff + noise) & 0xff);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		std::cout << "Usage: writer_bench <output file> [-size MB] [-chunk KB] [-mode none|lz4|lz4hc] [-max-growth MB] [-verify]\n";
+		return -1;
+	}
+
+	fs::path path{ argv[1] };
+	uint64_t sizeMB{ 1024 };
+	size_t chunkKB{ 1024 };
+	uint64_t maxGrowthMB{ 32 };
+	bool verify{ false };
+	CompressionSettings compression{};
+	compression.mode = CompressionMode::LZ4Blocks;
+
+	for (int i = 2; i < argc; ++i) {
+		std::string arg{ argv[i] };
+		if (arg == "-size" && i + 1 < argc) {
+			sizeMB = (uint64_t)std::max(std::atoll(argv[++i]), 1ll);
+		} else if (arg == "-chunk" && i + 1 < argc) {
+			chunkKB = (size_t)std::max(std::atoi(argv[++i]), 1);
+		} else if (arg == "-mode" && i + 1 < argc) {
+			std::string mode{ argv[++i] };
+			compression.mode = mode == "none" ? CompressionMode::None : mode == "lz4hc" ? CompressionMode::LZ4HC : CompressionMode::LZ4Blocks;
+		} else if (arg == "-max-growth" && i + 1 < argc) {
+			maxGrowthMB = (uint64_t)std::max(std::atoll(argv[++i]), 1ll);
+		} else if (arg == "-verify") {
+			verify = true;
+		} else {
+			std::cout << "Usage: writer_bench <output file> [-size MB] [-chunk KB] [-mode none|lz4|lz4hc] [-max-growth MB] [-verify]\n";
+			return -1;
+		}
+	}
+
+	uint64_t blobSize{ sizeMB * 1024 * 1024 };
+	std::vector<char> chunk(chunkKB * 1024);
+	std::vector<char> info(16, 0);
+
+	// the chunk buffer is touched before the baseline, like the baker's level or batch buffer
+	fillChunk(chunk, 0);
+	uint64_t peakBefore{ peakResidentBytes() };
+
+	auto start{ std::chrono::steady_clock::now() };
+
+	AssetWriter writer;
+	if (!writer.open(path.string().c_str(), "TEXI", info, blobSize, compression)) {
+		return -1;
+	}
+	for (uint64_t offset = 0; offset < blobSize; offset += chunk.size()) {
+		chunk.resize((size_t)std::min<uint64_t>(chunk.size(), blobSize - offset));
+		fillChunk(chunk, offset);
+		if (!writer.write(chunk.data(), chunk.size())) {
+			std::cout << "Failed to write " << path << std::endl;
+			return -1;
+		}
+	}
+	if (!writer.close()) {
+		std::cout << "Failed to write " << path << std::endl;
+		return -1;
+	}
+
+	auto end{ std::chrono::steady_clock::now() };
+	uint64_t peakAfter{ peakResidentBytes() };
+
+	double seconds{ std::chrono::duration<double>(end - start).count() };
+	double growthMB{ (double)(peakAfter - peakBefore) / (1024.0 * 1024.0) };
+	std::cout << "Wrote " << sizeMB << " MB with " << compressionModeName(writer.header().compressionMode) << " to " << fs::file_size(path) / (1024 * 1024)
+		<< " MB in " << seconds << " s (" << sizeMB / seconds << " MB/s), peak resident memory grew by " << growthMB << " MB\n";
+
+	if (growthMB > (double)maxGrowthMB) {
+		std::cout << "Peak resident memory grew by more than " << maxGrowthMB << " MB, the writer holds on to the blob\n";
+		return -1;
+	}
+
+	if (verify) {
+		AssetFileView view{};
+		AssetMetadata metadata;
+		std::vector<char> blob(blobSize);
+		if (!mapBinaryFile(path.string().c_str(), view, metadata) || view.uncompressedBlobSize != blobSize
+			|| !readBlob(view, metadata.compressionMode, blob.data())) {
+			std::cout << "Failed to read back " << path << std::endl;
+			return -1;
+		}
+
+		chunk.resize(chunkKB * 1024);
+		for (uint64_t offset = 0; offset < blobSize; offset += chunk.size()) {
+			chunk.resize((size_t)std::min<uint64_t>(chunk.size(), blobSize - offset));
+			fillChunk(chunk, offset);
+			if (memcmp(chunk.data(), blob.data() + offset, chunk.size()) != 0) {
+				std::cout << "Read back a different blob at offset " << offset << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "Read back the same blob\n";
+	}
+
+	return 0;
+}
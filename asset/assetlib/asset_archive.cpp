@@ -0,0 +1,277 @@
+#include "asset_archive.h"
+
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+#include "../tracy/Tracy.hpp"		// CPU profiling
+
+using namespace assets;
+
+static_assert(sizeof(ArchiveHeader) == 16, "ArchiveHeader must match the on-disk layout");
+static_assert(sizeof(ArchiveEntry) == 40, "ArchiveEntry must match the on-disk layout");
+
+uint64_t assets::hashAssetName(const char* name, size_t length)
+{
+	uint64_t hash{ 14695981039346656037ull };
+	for (size_t i = 0; i < length; ++i) {
+		hash ^= (uint8_t)name[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+void ArchiveWriter::addEntry(const std::string& name, const char type[4], CompressionMode compressionMode, std::vector<char>&& data)
+{
+	PendingEntry entry{};
+	entry.name = name;
+	memcpy(entry.type, type, 4);
+	entry.compressionMode = compressionMode;
+	entry.size = data.size();
+	entry.data = std::move(data);
+
+	_entries.push_back(std::move(entry));
+}
+
+bool ArchiveWriter::addFile(const std::string& name, const char* path)
+{
+	PendingEntry entry{};
+	entry.name = name;
+	entry.path = path;
+
+	std::error_code error;
+	entry.size = std::filesystem::file_size(path, error);
+	if (error) {
+		std::cout << "Error when trying to read file: " << path << std::endl;
+		return false;
+	}
+
+	// skeletons have a header of their own and dictionaries are raw bytes, neither has an asset header
+	std::filesystem::path extension{ std::filesystem::path{ path }.extension() };
+	if (extension == ".skel") {
+		memcpy(entry.type, "SKEL", 4);
+		entry.compressionMode = CompressionMode::None;
+	} else if (extension == ".dict") {
+		memcpy(entry.type, "DICT", 4);
+		entry.compressionMode = CompressionMode::None;
+	} else {
+		// mapping only pages in the header, not the blob
+		AssetFileView view{};
+		AssetMetadata metadata;
+		if (!mapBinaryFile(path, view, metadata)) {
+			std::cout << "Asset file is corrupt: " << path << std::endl;
+			return false;
+		}
+		memcpy(entry.type, view.type, 4);
+		entry.compressionMode = metadata.compressionMode;
+	}
+
+	_entries.push_back(std::move(entry));
+	return true;
+}
+
+// Appends the file at path to outFile, failing if it no longer has the size it had when it was added
+static bool copyFile(std::ofstream& outFile, const std::string& path, uint64_t size, std::vector<char>& buffer)
+{
+	std::ifstream inFile{ path, std::ios::binary };
+	if (!inFile.is_open()) {
+		std::cout << "Error when trying to read file: " << path << std::endl;
+		return false;
+	}
+
+	uint64_t copied{ 0 };
+	while (copied < size) {
+		inFile.read(buffer.data(), (std::streamsize)std::min<uint64_t>(buffer.size(), size - copied));
+		std::streamsize count{ inFile.gcount() };
+		if (count <= 0) break;
+		outFile.write(buffer.data(), count);
+		copied += (uint64_t)count;
+	}
+
+	if (copied != size || inFile.peek() != std::ifstream::traits_type::eof()) {
+		std::cout << "File changed while it was written to the archive: " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool ArchiveWriter::write(const char* path)
+{
+	std::vector<ArchiveEntry> toc(_entries.size());
+	std::string stringTable;
+
+	for (size_t i = 0; i < _entries.size(); ++i) {
+		toc[i].nameHash = hashAssetName(_entries[i].name.data(), _entries[i].name.size());
+		toc[i].size = _entries[i].size;
+		memcpy(toc[i].type, _entries[i].type, 4);
+		toc[i].compressionMode = _entries[i].compressionMode;
+		toc[i].nameOffset = (uint32_t)stringTable.size();
+		toc[i].nameLength = (uint32_t)_entries[i].name.size();
+		stringTable += _entries[i].name;
+	}
+
+	// sort the table of contents, remembering which payload each entry refers to
+	std::vector<size_t> order(toc.size());
+	for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return toc[a].nameHash < toc[b].nameHash;
+	});
+
+	for (size_t i = 1; i < order.size(); ++i) {
+		if (toc[order[i - 1]].nameHash == toc[order[i]].nameHash && _entries[order[i - 1]].name == _entries[order[i]].name) {
+			std::cout << "Duplicate archive entry: " << _entries[order[i]].name << std::endl;
+			return false;
+		}
+	}
+
+	ArchiveHeader header{};
+	memcpy(header.type, "PACK", 4);
+	header.version = ARCHIVE_VERSION;
+	header.entryCount = (uint32_t)toc.size();
+	header.stringTableSize = (uint32_t)stringTable.size();
+
+	// payloads are laid out in the order they were added, which keeps entries of the same model together on disk
+	uint64_t offset{ sizeof(ArchiveHeader) + toc.size() * sizeof(ArchiveEntry) + stringTable.size() };
+	for (size_t i = 0; i < toc.size(); ++i) {
+		offset = (offset + ARCHIVE_ALIGNMENT - 1) / ARCHIVE_ALIGNMENT * ARCHIVE_ALIGNMENT;
+		toc[i].offset = offset;
+		offset += toc[i].size;
+	}
+
+	std::vector<ArchiveEntry> sortedToc(toc.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		sortedToc[i] = toc[order[i]];
+	}
+
+	// the archive is written next to the old one and only replaces it once complete, so a crash or a full disk while
+	// writing leaves the previous archive for the engine instead of a truncated one
+	std::string tempPath{ std::string{ path } + ".tmp" };
+
+	std::ofstream outFile;
+	outFile.open(tempPath, std::ios::binary | std::ios::out);
+	if (!outFile.is_open()) {
+		std::cout << "Error when trying to write file: " << tempPath << std::endl;
+		return false;
+	}
+
+	outFile.write((const char*)&header, sizeof(ArchiveHeader));
+	outFile.write((const char*)sortedToc.data(), sortedToc.size() * sizeof(ArchiveEntry));
+	outFile.write(stringTable.data(), stringTable.size());
+
+	const char padding[ARCHIVE_ALIGNMENT]{};
+	uint64_t written{ sizeof(ArchiveHeader) + sortedToc.size() * sizeof(ArchiveEntry) + stringTable.size() };
+	// files are streamed in through one buffer instead of being held in memory until now
+	std::vector<char> buffer(1 << 20);
+	bool copied{ true };
+	for (size_t i = 0; i < _entries.size() && copied; ++i) {
+		outFile.write(padding, toc[i].offset - written);
+		if (_entries[i].path.empty()) {
+			outFile.write(_entries[i].data.data(), _entries[i].data.size());
+		} else {
+			copied = copyFile(outFile, _entries[i].path, _entries[i].size, buffer);
+		}
+		written = toc[i].offset + toc[i].size;
+	}
+
+	outFile.flush();
+	bool good{ copied && outFile.good() };
+	outFile.close();
+
+	std::error_code error;
+	if (!good || outFile.fail()) {
+		std::cout << "Error when writing file: " << tempPath << std::endl;
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+
+	std::filesystem::rename(tempPath, path, error);
+	if (error) {
+		std::cout << "Error when replacing " << path << ": " << error.message() << std::endl;
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+
+	return true;
+}
+
+bool AssetArchive::open(const char* path)
+{
+	ZoneScoped;
+	close();
+
+	if (!_file.open(path)) return false;
+
+	const char* data{ _file.data() };
+	size_t size{ _file.size() };
+
+	ArchiveHeader header{};
+	if (size < sizeof(ArchiveHeader)) {
+		close();
+		return false;
+	}
+	memcpy(&header, data, sizeof(ArchiveHeader));
+
+	if (memcmp(header.type, "PACK", 4) != 0 || header.version != ARCHIVE_VERSION) {
+		std::cout << "Not a supported asset archive: " << path << std::endl;
+		close();
+		return false;
+	}
+
+	size_t tocSize{ (size_t)header.entryCount * sizeof(ArchiveEntry) };
+	if (sizeof(ArchiveHeader) + tocSize + header.stringTableSize > size) {
+		std::cout << "Asset archive is truncated: " << path << std::endl;
+		close();
+		return false;
+	}
+
+	_entries.resize(header.entryCount);
+	memcpy(_entries.data(), data + sizeof(ArchiveHeader), tocSize);
+	_stringTable = data + sizeof(ArchiveHeader) + tocSize;
+
+	for (const ArchiveEntry& entry : _entries) {
+		if (entry.offset + entry.size > size || (uint64_t)entry.nameOffset + entry.nameLength > header.stringTableSize) {
+			std::cout << "Asset archive has an out of range entry: " << path << std::endl;
+			close();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void AssetArchive::close()
+{
+	_file.close();
+	_entries.clear();
+	_stringTable = nullptr;
+}
+
+const ArchiveEntry* AssetArchive::find(const std::string& name) const
+{
+	uint64_t hash{ hashAssetName(name.data(), name.size()) };
+
+	auto it{ std::lower_bound(_entries.begin(), _entries.end(), hash, [](const ArchiveEntry& entry, uint64_t h) {
+		return entry.nameHash < h;
+	}) };
+
+	// step over hash collisions until the name matches
+	for (; it != _entries.end() && it->nameHash == hash; ++it) {
+		if (it->nameLength == name.size() && memcmp(_stringTable + it->nameOffset, name.data(), name.size()) == 0) {
+			return &(*it);
+		}
+	}
+
+	return nullptr;
+}
+
+std::string AssetArchive::entryName(const ArchiveEntry& entry) const
+{
+	return std::string{ _stringTable + entry.nameOffset, entry.nameLength };
+}
+
+bool AssetArchive::viewEntry(const ArchiveEntry& entry, AssetFileView& asset, AssetMetadata& metadataOut) const
+{
+	return viewBinaryFile(entryData(entry), (size_t)entry.size, asset, metadataOut);
+}
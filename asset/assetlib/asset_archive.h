@@ -0,0 +1,103 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "asset_loader.h"
+#include "mapped_file.h"
+
+namespace assets {
+
+	/*
+		Archive layout (all integers little endian):
+
+		ArchiveHeader
+		ArchiveEntry[entryCount]    sorted by nameHash, so entries can be found with a binary search
+		char[stringTableSize]       entry names, not null terminated
+		payloads                    each entry is a complete asset file (.tx, .mesh, .skel, .dict) stored verbatim,
+		                            starting at a multiple of ARCHIVE_ALIGNMENT
+	*/
+
+	constexpr uint32_t ARCHIVE_VERSION{ 1 };
+
+	// alignment of every payload, so skeletons can be used in place out of a mapped archive
+	constexpr uint64_t ARCHIVE_ALIGNMENT{ 16 };
+
+	// file name of the archive the baker writes into the export directory
+	constexpr const char* ASSET_ARCHIVE_NAME{ "assets.pak" };
+
+	struct ArchiveHeader {
+		char type[4]; // "PACK"
+		uint32_t version;
+		uint32_t entryCount;
+		uint32_t stringTableSize;
+	};
+
+	struct ArchiveEntry {
+		uint64_t nameHash;
+		// offset of the payload from the start of the archive
+		uint64_t offset;
+		uint64_t size;
+		// type of the contained asset, e.g. "TEXI", "MESH" or "DICT"
+		char type[4];
+		// compression of the contained asset's binary blob
+		CompressionMode compressionMode;
+		uint32_t nameOffset;
+		uint32_t nameLength;
+	};
+
+	// 64-bit FNV-1a hash of an entry name
+	uint64_t hashAssetName(const char* name, size_t length);
+
+	// Collects assets and writes them out as a single archive
+	class ArchiveWriter {
+	public:
+		void addEntry(const std::string& name, const char type[4], CompressionMode compressionMode, std::vector<char>&& data);
+
+		// Adds path under name. Type and compression mode are read from the asset's header when it has one, the rest of the
+		// file is only read when the archive is written, so the writer never holds more than one file's buffer
+		bool addFile(const std::string& name, const char* path);
+
+		bool write(const char* path);
+
+	private:
+		struct PendingEntry {
+			std::string name;
+			char type[4];
+			CompressionMode compressionMode;
+			uint64_t size;
+			// entries added with addEntry keep their payload in data, those added with addFile are copied from path
+			std::vector<char> data;
+			std::string path;
+		};
+
+		std::vector<PendingEntry> _entries;
+	};
+
+	// Read-only archive backed by a single mapping of the archive file
+	class AssetArchive {
+	public:
+		bool open(const char* path);
+
+		void close();
+
+		bool isOpen() const { return _file.isOpen(); }
+
+		// O(log n) lookup by name, returns nullptr if there is no such entry
+		const ArchiveEntry* find(const std::string& name) const;
+
+		const std::vector<ArchiveEntry>& entries() const { return _entries; }
+
+		std::string entryName(const ArchiveEntry& entry) const;
+
+		const char* entryData(const ArchiveEntry& entry) const { return _file.data() + entry.offset; }
+
+		// Same as mapBinaryFile, with asset pointing into the archive's mapping
+		bool viewEntry(const ArchiveEntry& entry, AssetFileView& asset, AssetMetadata& metadataOut) const;
+
+	private:
+		MappedFile _file;
+		std::vector<ArchiveEntry> _entries;
+		const char* _stringTable{ nullptr };
+	};
+}
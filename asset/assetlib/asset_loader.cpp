@@ -2,69 +2,226 @@
 
 #include <fstream>
 #include <iostream>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
 
 #include "../tracy/Tracy.hpp"		// CPU profiling
 #include "compression.h"
 
 using namespace assets;
 
-bool assets::saveBinaryFile(const char* path, nlohmann::json& metadata, AssetFile& file)
-{
-	//pixel data
-	char* compressedBlob{ new char[file.json.size() + file.binaryBlob.size()] };
+static_assert(sizeof(AssetHeader) == 32, "AssetHeader must match the on-disk layout");
 
-	CompressResult_t res{ compressBuffer(file.binaryBlob.data(), compressedBlob, file.binaryBlob.size()) };
+// header of version 2 assets, which only differs from AssetHeader in its 32-bit blob size
+struct AssetHeaderV2 {
+	char type[4];
+	uint32_t version;
+	uint32_t infoSize;
+	uint32_t blobSize;
+	CompressionMode compressionMode;
+	uint32_t compressionLevel;
+};
 
-	float compressionRatio{ (float)res.sizeOut / (float)res.sizeIn };
-	float thresholdRatio{ 0.8f };
-	bool useCompression{ compressionRatio < thresholdRatio };
+// size of the header of a version 2+ asset, 0 if the version isn't supported
+static size_t assetHeaderSize(uint32_t version)
+{
+	switch (version) {
+	case ASSET_VERSION_BINARY_INFO:
+		return sizeof(AssetHeaderV2);
+	case ASSET_VERSION_BLOB64:
+		return sizeof(AssetHeader);
+	default:
+		return 0;
+	}
+}
 
-	if (useCompression) {
-		std::cout << "Compression ratio (" << compressionRatio << ") < threshold (" << thresholdRatio << "), compressing binary blob\n\n";
-		metadata["compression_mode"] = "LZ4";
+// Reads a version 2 or 3 header into an AssetHeader. data must hold assetHeaderSize(version) bytes
+static void readAssetHeader(const char* data, uint32_t version, AssetHeader& header)
+{
+	if (version == ASSET_VERSION_BINARY_INFO) {
+		AssetHeaderV2 headerV2{};
+		memcpy(&headerV2, data, sizeof(AssetHeaderV2));
+
+		header = AssetHeader{};
+		memcpy(header.type, headerV2.type, 4);
+		header.version = headerV2.version;
+		header.infoSize = headerV2.infoSize;
+		header.compressionMode = headerV2.compressionMode;
+		header.compressionLevel = headerV2.compressionLevel;
+		header.blobSize = headerV2.blobSize;
 	} else {
-		std::cout << "Compression ratio (" << compressionRatio << ") >= threshold (" << thresholdRatio << "), NOT compressing binary blob\n\n";
-		metadata["compression_mode"] = "None";
+		memcpy(&header, data, sizeof(AssetHeader));
+	}
+}
+
+static std::mutex dictionaryMutex;
+static std::unordered_map<uint32_t, std::vector<char>> dictionaries;
+
+uint32_t assets::registerDictionary(std::vector<char>&& dictionary)
+{
+	uint32_t id{ dictionaryId(dictionary.data(), dictionary.size()) };
+
+	std::lock_guard<std::mutex> lock{ dictionaryMutex };
+	dictionaries.emplace(id, std::move(dictionary));
+	return id;
+}
+
+bool assets::loadDictionaryFile(const char* path)
+{
+	std::ifstream inFile{ path, std::ios::binary | std::ios::ate };
+	if (!inFile.is_open()) {
+		std::cout << "Error when trying to read file: " << path << std::endl;
+		return false;
+	}
+
+	std::vector<char> dictionary((size_t)inFile.tellg());
+	inFile.seekg(0);
+	inFile.read(dictionary.data(), dictionary.size());
+
+	registerDictionary(std::move(dictionary));
+	return true;
+}
+
+const std::vector<char>* assets::findDictionary(uint32_t id)
+{
+	std::lock_guard<std::mutex> lock{ dictionaryMutex };
+	auto it{ dictionaries.find(id) };
+	return it != dictionaries.end() ? &it->second : nullptr;
+}
+
+// dictionary a blob needs to be decompressed, false if it isn't registered
+static bool blobDictionary(uint32_t id, const char*& dict, size_t& dictSize)
+{
+	dict = nullptr;
+	dictSize = 0;
+	if (id == 0) return true;
+
+	const std::vector<char>* dictionary{ findDictionary(id) };
+	if (!dictionary) {
+		std::cout << "Missing compression dictionary " << id << std::endl;
+		return false;
 	}
-	file.json = metadata.dump();
 
+	dict = dictionary->data();
+	dictSize = dictionary->size();
+	return true;
+}
 
-	std::ofstream outFile;
-	outFile.open(path, std::ios::binary | std::ios::out);
-	if (!outFile.is_open()) {
+// version 1 assets keep their compression mode in the JSON metadata
+static CompressionMode jsonCompressionMode(const nlohmann::json& metadata)
+{
+	auto it{ metadata.find("compression_mode") };
+	if (it == metadata.end()) {
+		return CompressionMode::None;
+	}
+
+	std::string compressionModeString = *it;
+	return parseCompression(compressionModeString.c_str());
+}
+
+bool AssetWriter::open(const char* path, const char type[4], const std::vector<char>& info, uint64_t blobSize, const CompressionSettings& compression)
+{
+	_path = path;
+	_file.open(path, std::ios::binary | std::ios::out | std::ios::trunc);
+	if (!_file.is_open()) {
 		std::cout << "Error when trying to write file: " << path << std::endl;
+		return false;
 	}
-	outFile.write(file.type, 4);
-	uint32_t version = file.version;
-	//version
-	outFile.write((const char*)&version, sizeof(uint32_t));
 
-	//json length
-	uint32_t length = static_cast<uint32_t>(file.json.size());
-	outFile.write((const char*)&length, sizeof(uint32_t));
+	// the legacy frame mode is only read, new blobs always use the block layout
+	bool highCompression{ compression.mode == CompressionMode::LZ4HC };
 
-	//blob length
-	uint32_t blobLength = static_cast<uint32_t>(file.binaryBlob.size());
-	outFile.write((const char*)&blobLength, sizeof(uint32_t));
+	_header = AssetHeader{};
+	memcpy(_header.type, type, 4);
+	_header.version = ASSET_VERSION;
+	_header.infoSize = static_cast<uint32_t>(info.size());
+	_header.blobSize = blobSize;
+	_header.compressionMode = compression.mode == CompressionMode::None ? CompressionMode::None
+		: highCompression ? CompressionMode::LZ4HC : CompressionMode::LZ4Blocks;
+	_header.compressionLevel = highCompression ? compression.level : 0;
+	const std::vector<char>* dictionary{ _header.compressionMode != CompressionMode::None ? compression.dictionary : nullptr };
+	_header.dictionaryId = dictionary ? dictionaryId(dictionary->data(), dictionary->size()) : 0;
+	_written = 0;
 
-	//json stream
-	outFile.write(file.json.data(), length);
+	_file.write((const char*)&_header, sizeof(AssetHeader));
+	_file.write(info.data(), info.size());
 
+	if (_header.compressionMode != CompressionMode::None) {
+		return _blocks.begin(_file, blobSize, _header.compressionLevel, compression.thresholdRatio,
+			dictionary ? dictionary->data() : nullptr, dictionary ? dictionary->size() : 0);
+	}
+	return (bool)_file;
+}
 
-	if (useCompression) {
-		outFile.write(compressedBlob, res.sizeOut);
-	} else {
-		outFile.write(file.binaryBlob.data(), file.binaryBlob.size());
+bool AssetWriter::write(const void* data, size_t size)
+{
+	if (_written + size > _header.blobSize) {
+		std::cout << "Asset blob is larger than its declared size\n";
+		return false;
 	}
+	_written += size;
 
-	delete[] compressedBlob;
+	if (_header.compressionMode != CompressionMode::None) {
+		return _blocks.write(data, size);
+	}
+
+	_file.write((const char*)data, size);
+	return (bool)_file;
+}
 
-	outFile.close();
+bool AssetWriter::close()
+{
+	bool success{ _written == _header.blobSize };
+
+	if (success && _header.compressionMode != CompressionMode::None) {
+		CompressResult_t res{ _blocks.finish() };
+		success = res.error == 0;
+
+		if (success) {
+			float compressionRatio{ res.sizeIn > 0 ? (float)res.sizeOut / (float)res.sizeIn : 1.0f };
+			std::cout << "Compressed binary blob with " << compressionModeName(_header.compressionMode) << ", ratio (" << compressionRatio << ")\n\n";
+		}
+	}
 
+	_file.close();
+	return success && !_file.fail();
+}
+
+bool AssetWriter::writeDebugMetadata(const nlohmann::json& metadata) const
+{
+	nlohmann::json sidecar = metadata;
+	sidecar["compression_mode"] = compressionModeName(_header.compressionMode);
+	sidecar["compression_level"] = _header.compressionLevel;
+
+	std::string path{ _path + ".json" };
+	std::ofstream jsonFile{ path };
+	jsonFile << sidecar.dump(4);
+	jsonFile.close();
+	if (jsonFile.fail()) {
+		std::cout << "Error when trying to write file: " << path << std::endl;
+		return false;
+	}
 	return true;
 }
 
-bool assets::loadBinaryFile(const char* path, AssetFile& asset, nlohmann::json& metadataOut)
+bool assets::saveBinaryFile(const char* path, AssetFile& file, const CompressionSettings& compression, const nlohmann::json* debugMetadata)
+{
+	AssetWriter writer;
+	if (!writer.open(path, file.type, file.info, file.binaryBlob.size(), compression)) {
+		return false;
+	}
+
+	if (!writer.write(file.binaryBlob.data(), file.binaryBlob.size()) || !writer.close()) {
+		std::cout << "Error when writing asset: " << path << std::endl;
+		return false;
+	}
+	file.version = ASSET_VERSION;
+
+	return !debugMetadata || writer.writeDebugMetadata(*debugMetadata);
+}
+
+bool assets::loadBinaryFile(const char* path, AssetFile& asset, AssetMetadata& metadataOut)
 {
 	std::ifstream inFile;
 	{
@@ -75,30 +232,73 @@ bool assets::loadBinaryFile(const char* path, AssetFile& asset, nlohmann::json&
 	if (!inFile.is_open()) return false;
 
 	inFile.seekg(0);
-	uint32_t bloblen = 0;
+	uint64_t bloblen = 0;
+	uint32_t dictId = 0;
 	{
 		ZoneScopedN("read header");
 		inFile.read(asset.type, 4);
 
 		inFile.read((char*)&asset.version, sizeof(uint32_t));
+		metadataOut.version = asset.version;
 
-		uint32_t jsonlen = 0;
-		inFile.read((char*)&jsonlen, sizeof(uint32_t));
+		if (asset.version == ASSET_VERSION_JSON) {
+			uint32_t jsonlen = 0;
+			inFile.read((char*)&jsonlen, sizeof(uint32_t));
 
-		inFile.read((char*)&bloblen, sizeof(uint32_t));
+			uint32_t bloblen32 = 0;
+			inFile.read((char*)&bloblen32, sizeof(uint32_t));
+			bloblen = bloblen32;
 
-		asset.json.resize(jsonlen);
+			asset.json.resize(jsonlen);
 
-		inFile.read(asset.json.data(), jsonlen);
+			inFile.read(asset.json.data(), jsonlen);
+
+			metadataOut.json = nlohmann::json::parse(asset.json);
+			metadataOut.compressionMode = jsonCompressionMode(metadataOut.json);
+		} else if (size_t headerSize{ assetHeaderSize(asset.version) }) {
+			char headerData[sizeof(AssetHeader)];
+			inFile.seekg(0);
+			inFile.read(headerData, headerSize);
+
+			AssetHeader header{};
+			readAssetHeader(headerData, asset.version, header);
+
+			asset.info.resize(header.infoSize);
+			inFile.read(asset.info.data(), header.infoSize);
+
+			bloblen = header.blobSize;
+			dictId = header.dictionaryId;
+			metadataOut.compressionMode = header.compressionMode;
+			metadataOut.info = asset.info.data();
+			metadataOut.infoSize = asset.info.size();
+		} else {
+			std::cout << "Unsupported asset version " << asset.version << ": " << path << std::endl;
+			return false;
+		}
+
+		if (!inFile) return false;
 
 		asset.binaryBlob.resize(bloblen);
 	}
 
-	metadataOut = nlohmann::json::parse(asset.json);
-	std::string compressionModeString = metadataOut["compression_mode"];
-	CompressionMode compressionMode{ parseCompression(compressionModeString.c_str()) };
+	CompressionMode compressionMode{ metadataOut.compressionMode };
+
+	if (compressionMode == CompressionMode::LZ4Blocks || compressionMode == CompressionMode::LZ4HC) {
+		ZoneScopedN("decompress file");
+		// read the compressed blob in one go, then decompress its blocks in parallel
+		std::streampos blobStart{ inFile.tellg() };
+		inFile.seekg(0, std::ios::end);
+		std::vector<char> compressedBlob((size_t)(inFile.tellg() - blobStart));
+		inFile.seekg(blobStart);
+		inFile.read(compressedBlob.data(), compressedBlob.size());
 
-	if (compressionMode == CompressionMode::LZ4) {
+		const char* dict;
+		size_t dictSize;
+		if (!blobDictionary(dictId, dict, dictSize)
+			|| decompressBlocks(compressedBlob.data(), compressedBlob.size(), asset.binaryBlob.data(), asset.binaryBlob.size(), dict, dictSize) != 0) {
+			return false;
+		}
+	} else if (compressionMode == CompressionMode::LZ4) {
 		ZoneScopedN("decompress file");
 		decompressFile(inFile, asset.binaryBlob.data());
 	} else {
@@ -108,11 +308,127 @@ bool assets::loadBinaryFile(const char* path, AssetFile& asset, nlohmann::json&
 	return true;
 }
 
+bool assets::mapBinaryFile(const char* path, AssetFileView& asset, AssetMetadata& metadataOut)
+{
+	{
+		ZoneScopedN("map file");
+		if (!asset.mapping.open(path)) return false;
+	}
+
+	if (!viewBinaryFile(asset.mapping.data(), asset.mapping.size(), asset, metadataOut)) {
+		std::cout << "Asset file is corrupt: " << path << std::endl;
+		asset.mapping.close();
+		return false;
+	}
+
+	return true;
+}
+
+bool assets::viewBinaryFile(const char* data, size_t size, AssetFileView& asset, AssetMetadata& metadataOut)
+{
+	// type, version, json length, blob length
+	constexpr size_t headerSizeJson{ 4 + 3 * sizeof(uint32_t) };
+	if (size < headerSizeJson) return false;
+
+	ZoneScopedN("read header");
+	memcpy(asset.type, data, 4);
+	memcpy(&asset.version, data + 4, sizeof(uint32_t));
+	metadataOut.version = asset.version;
+
+	if (asset.version == ASSET_VERSION_JSON) {
+		uint32_t jsonlen{};
+		uint32_t bloblen{};
+		memcpy(&jsonlen, data + 8, sizeof(uint32_t));
+		memcpy(&bloblen, data + 12, sizeof(uint32_t));
+
+		if (headerSizeJson + jsonlen > size) return false;
+
+		asset.json = data + headerSizeJson;
+		asset.jsonSize = jsonlen;
+		asset.info = nullptr;
+		asset.infoSize = 0;
+		asset.blob = asset.json + jsonlen;
+		asset.blobSize = size - headerSizeJson - jsonlen;
+		asset.uncompressedBlobSize = bloblen;
+		asset.dictionaryId = 0;
+
+		metadataOut.json = nlohmann::json::parse(asset.json, asset.json + asset.jsonSize);
+		metadataOut.compressionMode = jsonCompressionMode(metadataOut.json);
+	} else if (size_t headerSize{ assetHeaderSize(asset.version) }) {
+		if (size < headerSize) return false;
+
+		AssetHeader header{};
+		readAssetHeader(data, asset.version, header);
+
+		if (headerSize + (size_t)header.infoSize > size) return false;
+
+		asset.json = nullptr;
+		asset.jsonSize = 0;
+		asset.info = data + headerSize;
+		asset.infoSize = header.infoSize;
+		asset.blob = asset.info + header.infoSize;
+		asset.blobSize = size - headerSize - header.infoSize;
+		asset.uncompressedBlobSize = header.blobSize;
+		asset.dictionaryId = header.dictionaryId;
+
+		metadataOut.compressionMode = header.compressionMode;
+		metadataOut.info = asset.info;
+		metadataOut.infoSize = asset.infoSize;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+bool assets::readBlob(const AssetFileView& asset, CompressionMode compressionMode, void* destination)
+{
+	ZoneScopedN("decompress file");
+
+	if (compressionMode == CompressionMode::None) {
+		if (asset.blobSize != asset.uncompressedBlobSize) {
+			return false;
+		}
+		memcpy(destination, asset.blob, asset.blobSize);
+		return true;
+	}
+
+	const char* dict;
+	size_t dictSize;
+	if (!blobDictionary(asset.dictionaryId, dict, dictSize)) {
+		return false;
+	}
+
+	int result{ compressionMode == CompressionMode::LZ4Blocks || compressionMode == CompressionMode::LZ4HC
+		? decompressBlocks(asset.blob, asset.blobSize, destination, asset.uncompressedBlobSize, dict, dictSize)
+		: decompressBuffer(asset.blob, asset.blobSize, destination, asset.uncompressedBlobSize) };
+
+	return result == 0;
+}
+
 assets::CompressionMode assets::parseCompression(const char* f)
 {
 	if (strcmp(f, "LZ4") == 0) {
 		return assets::CompressionMode::LZ4;
+	} else if (strcmp(f, "LZ4_BLOCKS") == 0) {
+		return assets::CompressionMode::LZ4Blocks;
+	} else if (strcmp(f, "LZ4HC") == 0) {
+		return assets::CompressionMode::LZ4HC;
 	} else {
 		return assets::CompressionMode::None;
 	}
 }
+
+const char* assets::compressionModeName(CompressionMode mode)
+{
+	switch (mode) {
+	case CompressionMode::LZ4:
+		return "LZ4";
+	case CompressionMode::LZ4Blocks:
+		return "LZ4_BLOCKS";
+	case CompressionMode::LZ4HC:
+		return "LZ4HC";
+	default:
+		return "None";
+	}
+}
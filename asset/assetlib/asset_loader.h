@@ -1,26 +1,162 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
 
 #include "json.hpp"
+#include "mapped_file.h"
+#include "compression.h"
 
 namespace assets {
+	enum class CompressionMode : uint32_t {
+		None,
+		// single LZ4 frame, only read for assets baked before LZ4Blocks existed
+		LZ4,
+		// independent LZ4 blocks with a block offset table (see compression.h)
+		LZ4Blocks,
+		// same layout as LZ4Blocks, compressed with LZ4HC. Smaller, but decodes just as fast
+		LZ4HC
+	};
+
+	// Version 1 assets store their metadata as a JSON string. Version 2 replaces it with a fixed-layout
+	// info struct (TextureInfoBinary, MeshInfoBinary) so loading metadata is a single copy instead of a parse.
+	// Version 3 widens the blob size to 64 bits; version 2 files are still read.
+	constexpr uint32_t ASSET_VERSION_JSON{ 1 };
+	constexpr uint32_t ASSET_VERSION_BINARY_INFO{ 2 };
+	constexpr uint32_t ASSET_VERSION_BLOB64{ 3 };
+	constexpr uint32_t ASSET_VERSION{ ASSET_VERSION_BLOB64 };
+
+	// Header of version 3 asset files. It is followed by infoSize bytes of info struct, then the blob
+	struct AssetHeader {
+		char type[4];
+		uint32_t version;
+		uint32_t infoSize;
+		CompressionMode compressionMode;
+		uint32_t compressionLevel;
+		// dictionaryId() of the dictionary the blob was compressed with, 0 if none
+		uint32_t dictionaryId;
+		// size of the binary blob once decompressed
+		uint64_t blobSize;
+	};
+
 	struct AssetFile {
 		char type[4];
 		int version;
+		// metadata of version 1 assets
 		std::string json;
+		// info struct of version 2 assets
+		std::vector<char> info;
 		std::vector<char> binaryBlob;
 	};
 
-	enum class CompressionMode : uint32_t {
-		None,
-		LZ4
+	// Read-only view of an asset file that is mapped into memory. json, info and blob point
+	// straight into the mapping, so they are only valid for the lifetime of the view.
+	struct AssetFileView {
+		char type[4];
+		int version;
+		const char* json;
+		size_t jsonSize;
+		const char* info;
+		size_t infoSize;
+		// binary blob as stored on disk (possibly compressed)
+		const char* blob;
+		size_t blobSize;
+		// size of the binary blob once decompressed
+		size_t uncompressedBlobSize;
+		uint32_t dictionaryId;
+		MappedFile mapping;
+	};
+
+	// Metadata shared by every asset type. The type specific part is read with readTextureInfo, readMeshInfo, etc.
+	struct AssetMetadata {
+		int version{ 0 };
+		CompressionMode compressionMode{ CompressionMode::None };
+		// info struct of version 2 assets, points into the AssetFile or mapping it was read from
+		const char* info{ nullptr };
+		size_t infoSize{ 0 };
+		// only parsed for version 1 assets
+		nlohmann::json json;
 	};
 
-	// Writes metadata to file.json
-	bool saveBinaryFile(const char* path, nlohmann::json& metadata, AssetFile& file);
+	// Copies the info struct of a version 2 asset. Returns false for version 1 assets, which only have JSON metadata.
+	// Fields missing from an older, smaller layout are left zeroed.
+	template <typename T>
+	bool readInfoStruct(const AssetMetadata& metadata, T& info)
+	{
+		if (!metadata.info) return false;
+
+		info = T{};
+		memcpy(&info, metadata.info, std::min(metadata.infoSize, sizeof(T)));
+		return true;
+	}
+
+	struct CompressionSettings {
+		CompressionMode mode{ CompressionMode::LZ4Blocks };
+		// LZ4HC level, between LZ4HC_CLEVEL_MIN and LZ4HC_CLEVEL_MAX. Ignored by other modes
+		int level{ 9 };
+		// the blob is stored uncompressed unless compressing it gets below this ratio
+		float thresholdRatio{ 0.8f };
+		// shared dictionary for block modes. It has to be registered with registerDictionary before the asset can be read
+		const std::vector<char>* dictionary{ nullptr };
+	};
 
-	bool loadBinaryFile(const char* path, AssetFile& asset, nlohmann::json& metadataOut);
+	// Dictionaries are shared by a family of assets and stored once (see compression.h). They are registered by
+	// id before any asset that uses them is read, and stay registered for the rest of the program. Returns the id
+	uint32_t registerDictionary(std::vector<char>&& dictionary);
+
+	// Reads a dictionary file written by the baker and registers it
+	bool loadDictionaryFile(const char* path);
+
+	// nullptr if no dictionary with that id was registered
+	const std::vector<char>* findDictionary(uint32_t id);
+
+	// Dictionary the baker trains on the meshes of an export directory, written to its root
+	constexpr const char* MESH_DICTIONARY_NAME{ "meshes.dict" };
+
+	// Writes an asset file while its blob is being produced, compressing it block by block straight to disk.
+	// The writer holds on to about one compression block no matter how large the blob is.
+	class AssetWriter {
+	public:
+		bool open(const char* path, const char type[4], const std::vector<char>& info, uint64_t blobSize, const CompressionSettings& compression = {});
+
+		// Appends the next part of the blob, in chunks of any size
+		bool write(const void* data, size_t size);
+
+		// Fails unless exactly blobSize bytes were written
+		bool close();
+
+		// Writes metadata next to the asset as path.json along with the compression it was written with. It's never read
+		// by the engine but makes baked assets easy to inspect
+		bool writeDebugMetadata(const nlohmann::json& metadata) const;
+
+		const AssetHeader& header() const { return _header; }
+
+	private:
+		std::string _path;
+		std::ofstream _file;
+		BlockStreamWriter _blocks;
+		AssetHeader _header{};
+		uint64_t _written{ 0 };
+	};
+
+	// Writes file as an asset with AssetWriter. If debugMetadata is given it's also written out with writeDebugMetadata
+	bool saveBinaryFile(const char* path, AssetFile& file, const CompressionSettings& compression = {}, const nlohmann::json* debugMetadata = nullptr);
+
+	bool loadBinaryFile(const char* path, AssetFile& asset, AssetMetadata& metadataOut);
+
+	// Same as loadBinaryFile, but maps the file instead of reading it so nothing is allocated or copied
+	bool mapBinaryFile(const char* path, AssetFileView& asset, AssetMetadata& metadataOut);
+
+	// Parses an asset file that is already in memory (e.g. an archive entry). asset.mapping is left untouched
+	bool viewBinaryFile(const char* data, size_t size, AssetFileView& asset, AssetMetadata& metadataOut);
+
+	// Decompresses (or copies) the blob of a mapped asset into destination, which must hold asset.uncompressedBlobSize bytes.
+	// Lets callers decode straight into GPU staging memory without an intermediate buffer.
+	bool readBlob(const AssetFileView& asset, CompressionMode compressionMode, void* destination);
 
 	assets::CompressionMode parseCompression(const char* f);
+
+	const char* compressionModeName(CompressionMode mode);
 }
@@ -8,7 +8,17 @@
 #include <cinttypes>
 #include <fstream>
 #include <iostream>
-
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <unordered_map>
+
+#include "lz4.h"
+#include "lz4hc.h"
 #include "lz4frame.h"
 
 
@@ -342,6 +352,547 @@ int decompressFile(std::ifstream& inFile, void* outBuf)
 }
 
 
+/* @result : 1==error, 0==success */
+int decompressBuffer(const void* inBuf, size_t inBufSize, void* outBuf, size_t outBufSize)
+{
+	assert(inBuf != NULL);
+	assert(outBuf != NULL);
+
+	LZ4F_dctx* dctx;
+	{
+		const size_t dctxStatus = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+		if (LZ4F_isError(dctxStatus)) {
+			printf("LZ4F_dctx creation error: %s\n", LZ4F_getErrorName(dctxStatus));
+			return 1;
+		}
+	}
+
+	/* Since the whole frame is already in memory and outBuf is large enough to hold all of it,
+	 * LZ4F_decompress can write each block straight to its final location without staging it. */
+	const char* srcPtr = (const char*)inBuf;
+	const char* const srcEnd = srcPtr + inBufSize;
+	char* dstPtr = (char*)outBuf;
+	char* const dstEnd = dstPtr + outBufSize;
+	size_t ret = 1;
+
+	while (srcPtr < srcEnd && ret != 0) {
+		size_t srcSize = srcEnd - srcPtr;
+		size_t dstSize = dstEnd - dstPtr;
+		ret = LZ4F_decompress(dctx, dstPtr, &dstSize, srcPtr, &srcSize, NULL);
+		if (LZ4F_isError(ret)) {
+			printf("Decompression error: %s\n", LZ4F_getErrorName(ret));
+			LZ4F_freeDecompressionContext(dctx);
+			return 1;
+		}
+		srcPtr += srcSize;
+		dstPtr += dstSize;
+
+		if (srcSize == 0 && dstSize == 0) {
+			printf("Decompress: output buffer too small (decompressBuffer)\n");
+			LZ4F_freeDecompressionContext(dctx);
+			return 1;
+		}
+	}
+
+	LZ4F_freeDecompressionContext(dctx);
+
+	if (ret != 0) {
+		printf("Decompress: not enough input (decompressBuffer)\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/* ================================================= */
+/*                Block Compression                  */
+/* ================================================= */
+
+/* compressBlockWithDict() :
+ * compresses one block as if dict came right before it. The stream is reset for every block,
+ * so blocks stay independent of each other.
+ * @return : compressed size, 0 on error */
+static int compressBlockWithDict(const char* src, int srcSize, char* dst, int dstCapacity, int hcLevel, const char* dict, size_t dictSize)
+{
+	int compressedSize = 0;
+
+	if (hcLevel > 0) {
+		LZ4_streamHC_t* stream = LZ4_createStreamHC();
+		LZ4_resetStreamHC_fast(stream, hcLevel);
+		LZ4_loadDictHC(stream, dict, (int)dictSize);
+		compressedSize = LZ4_compress_HC_continue(stream, src, dst, srcSize, dstCapacity);
+		LZ4_freeStreamHC(stream);
+	} else {
+		LZ4_stream_t* stream = LZ4_createStream();
+		LZ4_loadDict(stream, dict, (int)dictSize);
+		compressedSize = LZ4_compress_fast_continue(stream, src, dst, srcSize, dstCapacity, 1);
+		LZ4_freeStream(stream);
+	}
+
+	return compressedSize;
+}
+
+/* compressBlock() :
+ * compresses one block into dst, which must hold LZ4_compressBound(srcSize) bytes.
+ * Blocks that don't shrink below srcSize * thresholdRatio are copied as is.
+ * @return : stored size of the block, 0 on error */
+static int compressBlock(const char* src, int srcSize, char* dst, int hcLevel, float thresholdRatio, const char* dict, size_t dictSize)
+{
+	const int dstCapacity = LZ4_compressBound(srcSize);
+
+	int compressedSize = dict != NULL && dictSize > 0
+		? compressBlockWithDict(src, srcSize, dst, dstCapacity, hcLevel, dict, dictSize)
+		: hcLevel > 0
+		? LZ4_compress_HC(src, dst, srcSize, dstCapacity, hcLevel)
+		: LZ4_compress_default(src, dst, srcSize, dstCapacity);
+	if (compressedSize <= 0) {
+		printf("Block compression failed \n");
+		return 0;
+	}
+
+	/* incompressible block, store it as is */
+	if (compressedSize >= srcSize || (float)compressedSize >= (float)srcSize * thresholdRatio) {
+		memcpy(dst, src, srcSize);
+		compressedSize = srcSize;
+	}
+
+	return compressedSize;
+}
+
+/* length of the byte sequences the dictionary is built from, long enough to span a vertex attribute or two */
+constexpr size_t DICTIONARY_SEGMENT_SIZE = 32;
+
+std::vector<char> trainDictionary(const std::vector<std::vector<char>>& samples, size_t maxSize)
+{
+	struct Segment {
+		uint32_t sampleCount;
+		uint32_t lastSample;
+		uint32_t sample;
+		size_t offset;
+	};
+
+	/* count how many samples each segment occurs in, a segment repeated within one sample is already
+	 * cheap to compress and gains nothing from the dictionary */
+	std::unordered_map<uint64_t, Segment> segments;
+	for (uint32_t s = 0; s < (uint32_t)samples.size(); ++s) {
+		const std::vector<char>& sample = samples[s];
+
+		for (size_t offset = 0; offset + DICTIONARY_SEGMENT_SIZE <= sample.size(); offset += DICTIONARY_SEGMENT_SIZE / 2) {
+			uint64_t hash = 14695981039346656037ull;
+			for (size_t i = 0; i < DICTIONARY_SEGMENT_SIZE; ++i) {
+				hash ^= (uint8_t)sample[offset + i];
+				hash *= 1099511628211ull;
+			}
+
+			auto it = segments.find(hash);
+			if (it == segments.end()) {
+				segments.emplace(hash, Segment{ 1, s, s, offset });
+			} else if (it->second.lastSample != s) {
+				++it->second.sampleCount;
+				it->second.lastSample = s;
+			}
+		}
+	}
+
+	std::vector<Segment> shared;
+	for (const auto& entry : segments) {
+		if (entry.second.sampleCount > 1) {
+			shared.push_back(entry.second);
+		}
+	}
+
+	/* most common first, ties broken by position so the dictionary is deterministic */
+	std::sort(shared.begin(), shared.end(), [](const Segment& a, const Segment& b) {
+		if (a.sampleCount != b.sampleCount) return a.sampleCount > b.sampleCount;
+		if (a.sample != b.sample) return a.sample < b.sample;
+		return a.offset < b.offset;
+	});
+
+	const size_t segmentCount = std::min(shared.size(), maxSize / DICTIONARY_SEGMENT_SIZE);
+
+	/* the most common segments go last, closest to the data being compressed */
+	std::vector<char> dict;
+	dict.reserve(segmentCount * DICTIONARY_SEGMENT_SIZE);
+	for (size_t i = segmentCount; i-- > 0;) {
+		const char* segment = samples[shared[i].sample].data() + shared[i].offset;
+		dict.insert(dict.end(), segment, segment + DICTIONARY_SEGMENT_SIZE);
+	}
+
+	return dict;
+}
+
+uint32_t dictionaryId(const void* dict, size_t dictSize)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < dictSize; ++i) {
+		hash ^= ((const uint8_t*)dict)[i];
+		hash *= 16777619u;
+	}
+	return hash != 0 ? hash : 1;
+}
+
+CompressResult_t compressBlocks(const void* inBuf, size_t inBufSize, std::vector<char>& outBuf, int hcLevel,
+	const void* dict, size_t dictSize)
+{
+	assert(inBuf != NULL || inBufSize == 0);
+
+	CompressResult_t result = { 1, 0, 0 };  /* == error (default) */
+
+	const uint32_t blockCount = (uint32_t)((inBufSize + COMPRESSION_BLOCK_SIZE - 1) / COMPRESSION_BLOCK_SIZE);
+	const size_t tableSize = sizeof(BlockTableHeader) + ((size_t)blockCount + 1) * sizeof(uint64_t);
+
+	/* reserve for the worst case so blocks are compressed straight into outBuf */
+	outBuf.resize(tableSize + (size_t)blockCount * LZ4_compressBound(COMPRESSION_BLOCK_SIZE));
+
+	BlockTableHeader header{ COMPRESSION_BLOCK_SIZE, blockCount };
+	memcpy(outBuf.data(), &header, sizeof(BlockTableHeader));
+
+	std::vector<uint64_t> offsets(blockCount + 1);
+	char* const blocks = outBuf.data() + tableSize;
+	uint64_t offset = 0;
+
+	for (uint32_t i = 0; i < blockCount; ++i) {
+		const char* src = (const char*)inBuf + (size_t)i * COMPRESSION_BLOCK_SIZE;
+		const int srcSize = (int)std::min<size_t>(COMPRESSION_BLOCK_SIZE, inBufSize - (size_t)i * COMPRESSION_BLOCK_SIZE);
+
+		const int compressedSize = compressBlock(src, srcSize, blocks + offset, hcLevel, 1.0f, (const char*)dict, dictSize);
+		if (compressedSize == 0) {
+			return result;
+		}
+
+		offsets[i] = offset;
+		offset += compressedSize;
+	}
+	offsets[blockCount] = offset;
+
+	memcpy(outBuf.data() + sizeof(BlockTableHeader), offsets.data(), offsets.size() * sizeof(uint64_t));
+	outBuf.resize(tableSize + offset);
+
+	result.sizeIn = inBufSize;
+	result.sizeOut = outBuf.size();
+	result.error = 0;
+	return result;
+}
+
+bool BlockStreamWriter::begin(std::ostream& out, uint64_t totalSize, int hcLevel, float thresholdRatio,
+	const void* dict, size_t dictSize)
+{
+	const uint64_t blockCount = (totalSize + COMPRESSION_BLOCK_SIZE - 1) / COMPRESSION_BLOCK_SIZE;
+	if (blockCount > UINT32_MAX) {
+		printf("Blob too large for a block table \n");
+		return false;
+	}
+
+	_out = &out;
+	_totalSize = totalSize;
+	_written = 0;
+	_blobOffset = 0;
+	_hcLevel = hcLevel;
+	_thresholdRatio = thresholdRatio;
+	_dict = (const char*)dict;
+	_dictSize = dictSize;
+	_error = false;
+
+	_offsets.clear();
+	_offsets.reserve((size_t)blockCount + 1);
+	_block.clear();
+	_block.reserve(COMPRESSION_BLOCK_SIZE);
+	_compressed.resize(LZ4_compressBound(COMPRESSION_BLOCK_SIZE));
+
+	/* the offset table is written as a placeholder and patched once every block size is known */
+	_tableStart = out.tellp();
+	BlockTableHeader header{ COMPRESSION_BLOCK_SIZE, (uint32_t)blockCount };
+	out.write((const char*)&header, sizeof(BlockTableHeader));
+
+	const uint64_t zero = 0;
+	for (uint64_t i = 0; i < blockCount + 1; ++i) {
+		out.write((const char*)&zero, sizeof(uint64_t));
+	}
+
+	return (bool)out;
+}
+
+bool BlockStreamWriter::write(const void* data, size_t size)
+{
+	if (_error || _written + size > _totalSize) {
+		_error = true;
+		return false;
+	}
+
+	const char* src = (const char*)data;
+	_written += size;
+
+	while (size > 0) {
+		const size_t toCopy = std::min<size_t>(size, COMPRESSION_BLOCK_SIZE - _block.size());
+		_block.insert(_block.end(), src, src + toCopy);
+		src += toCopy;
+		size -= toCopy;
+
+		if (_block.size() == COMPRESSION_BLOCK_SIZE && !flushBlock()) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool BlockStreamWriter::flushBlock()
+{
+	const int compressedSize = compressBlock(_block.data(), (int)_block.size(), _compressed.data(), _hcLevel, _thresholdRatio, _dict, _dictSize);
+	if (compressedSize == 0) {
+		_error = true;
+		return false;
+	}
+
+	_offsets.push_back(_blobOffset);
+	_blobOffset += compressedSize;
+	_out->write(_compressed.data(), compressedSize);
+
+	_block.clear();
+	return (bool)*_out;
+}
+
+CompressResult_t BlockStreamWriter::finish()
+{
+	CompressResult_t result = { 1, 0, 0 };  /* == error (default) */
+
+	if (!_block.empty() && !flushBlock()) {
+		return result;
+	}
+
+	if (_error || _written != _totalSize) {
+		printf("Block stream ended early \n");
+		return result;
+	}
+
+	_offsets.push_back(_blobOffset);
+
+	const std::streampos end = _out->tellp();
+	_out->seekp(_tableStart + (std::streamoff)sizeof(BlockTableHeader));
+	_out->write((const char*)_offsets.data(), _offsets.size() * sizeof(uint64_t));
+	_out->seekp(end);
+
+	if (!*_out) {
+		return result;
+	}
+
+	result.sizeIn = _totalSize;
+	result.sizeOut = sizeof(BlockTableHeader) + _offsets.size() * sizeof(uint64_t) + _blobOffset;
+	result.error = 0;
+	return result;
+}
+
+/* @return : true==error, false==success */
+static bool decompressBlock(const char* blocks, const uint64_t* offsets, uint32_t blockIdx,
+	uint32_t blockSize, char* outBuf, size_t outBufSize, const char* dict, size_t dictSize)
+{
+	const char* src = blocks + offsets[blockIdx];
+	const size_t srcSize = (size_t)(offsets[blockIdx + 1] - offsets[blockIdx]);
+	char* dst = outBuf + (size_t)blockIdx * blockSize;
+	const size_t dstSize = std::min<size_t>(blockSize, outBufSize - (size_t)blockIdx * blockSize);
+
+	if (srcSize == dstSize) {
+		memcpy(dst, src, dstSize);
+		return false;
+	}
+
+	const int decompressedSize = dict != NULL
+		? LZ4_decompress_safe_usingDict(src, dst, (int)srcSize, (int)dstSize, dict, (int)dictSize)
+		: LZ4_decompress_safe(src, dst, (int)srcSize, (int)dstSize);
+	return decompressedSize != (int)dstSize;
+}
+
+/* Threads shared by every decompressBlocks call, started on first use and kept until exit.
+ * Starting threads for every asset costs more than decoding a small one, and loads running on
+ * several threads at once would each start their own and oversubscribe the cores. */
+class DecodePool {
+public:
+	static DecodePool& instance()
+	{
+		static DecodePool pool;
+		return pool;
+	}
+
+	uint32_t threadCount() const { return (uint32_t)_threads.size(); }
+
+	/* runs work on the calling thread and on up to helperCount pool threads, and returns once all of them are done.
+	 * work has to split itself up, the calling thread never waits for a helper that hasn't picked it up yet */
+	void run(uint32_t helperCount, const std::function<void()>& work);
+
+private:
+	struct Batch {
+		const std::function<void()>* work;
+		/* helpers that may still pick the batch up */
+		uint32_t unclaimed;
+		/* helpers running work */
+		uint32_t active;
+	};
+
+	DecodePool();
+	~DecodePool();
+
+	void workerLoop();
+
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::condition_variable _done;
+	std::deque<Batch*> _batches;
+	std::vector<std::thread> _threads;
+	bool _stopping{ false };
+};
+
+DecodePool::DecodePool()
+{
+	/* the calling thread decodes too */
+	const uint32_t count = std::max(1u, std::thread::hardware_concurrency()) - 1;
+	_threads.reserve(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		_threads.emplace_back(&DecodePool::workerLoop, this);
+	}
+}
+
+DecodePool::~DecodePool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_wake.notify_all();
+	for (std::thread& t : _threads) {
+		t.join();
+	}
+}
+
+void DecodePool::run(uint32_t helperCount, const std::function<void()>& work)
+{
+	const uint32_t helpers = std::min(helperCount, threadCount());
+	Batch batch{ &work, helpers, 0 };
+	if (helpers > 0) {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_batches.push_back(&batch);
+		}
+		if (helpers == 1) {
+			_wake.notify_one();
+		} else {
+			_wake.notify_all();
+		}
+	}
+
+	work();
+
+	/* helpers that haven't started by now would find nothing left, only wait for the ones running */
+	std::unique_lock<std::mutex> lock(_mutex);
+	auto it = std::find(_batches.begin(), _batches.end(), &batch);
+	if (it != _batches.end()) {
+		_batches.erase(it);
+	}
+	_done.wait(lock, [&]() { return batch.active == 0; });
+}
+
+void DecodePool::workerLoop()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true) {
+		_wake.wait(lock, [this]() { return _stopping || !_batches.empty(); });
+		if (_stopping) {
+			return;
+		}
+
+		Batch* batch = _batches.front();
+		if (--batch->unclaimed == 0) {
+			_batches.pop_front();
+		}
+		++batch->active;
+
+		lock.unlock();
+		(*batch->work)();
+		lock.lock();
+
+		if (--batch->active == 0) {
+			_done.notify_all();
+		}
+	}
+}
+
+/* @return : 1==error, 0==success */
+int decompressBlocks(const void* inBuf, size_t inBufSize, void* outBuf, size_t outBufSize,
+	const void* dict, size_t dictSize)
+{
+	assert(inBuf != NULL);
+	assert(outBuf != NULL || outBufSize == 0);
+
+	BlockTableHeader header;
+	if (inBufSize < sizeof(BlockTableHeader)) {
+		printf("Decompress: not enough input (decompressBlocks)\n");
+		return 1;
+	}
+	memcpy(&header, inBuf, sizeof(BlockTableHeader));
+
+	const size_t tableSize = sizeof(BlockTableHeader) + ((size_t)header.blockCount + 1) * sizeof(uint64_t);
+	if (header.blockSize == 0 || inBufSize < tableSize
+		|| (uint64_t)header.blockCount * header.blockSize < outBufSize
+		|| (header.blockCount > 0 && (uint64_t)(header.blockCount - 1) * header.blockSize >= outBufSize)) {
+		printf("Decompress: corrupt block table (decompressBlocks)\n");
+		return 1;
+	}
+
+	/* the offset table is 8 byte aligned within the blob, but the blob itself may not be */
+	std::vector<uint64_t> offsets(header.blockCount + 1);
+	memcpy(offsets.data(), (const char*)inBuf + sizeof(BlockTableHeader), offsets.size() * sizeof(uint64_t));
+
+	for (uint32_t i = 0; i < header.blockCount; ++i) {
+		if (offsets[i] > offsets[i + 1]) {
+			printf("Decompress: corrupt block table (decompressBlocks)\n");
+			return 1;
+		}
+	}
+	if (offsets[header.blockCount] > inBufSize - tableSize) {
+		printf("Decompress: not enough input (decompressBlocks)\n");
+		return 1;
+	}
+
+	const char* blocks = (const char*)inBuf + tableSize;
+	char* dst = (char*)outBuf;
+
+	/* small assets aren't worth waking up other threads for */
+	constexpr uint32_t minBlocksPerThread = 2;
+	const uint32_t threadCount = std::min<uint32_t>(DecodePool::instance().threadCount() + 1, header.blockCount / minBlocksPerThread);
+
+	if (threadCount <= 1) {
+		for (uint32_t i = 0; i < header.blockCount; ++i) {
+			if (decompressBlock(blocks, offsets.data(), i, header.blockSize, dst, outBufSize, (const char*)dict, dictSize)) {
+				printf("Decompression error in block %u\n", i);
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	/* each thread claims the next block and decompresses it straight into its slice of outBuf */
+	std::atomic<uint32_t> nextBlock{ 0 };
+	std::atomic<bool> failed{ false };
+
+	const std::function<void()> worker = [&]() {
+		for (uint32_t i = nextBlock++; i < header.blockCount && !failed; i = nextBlock++) {
+			if (decompressBlock(blocks, offsets.data(), i, header.blockSize, dst, outBufSize, (const char*)dict, dictSize)) {
+				failed = true;
+			}
+		}
+	};
+
+	DecodePool::instance().run(threadCount - 1, worker);
+
+	if (failed) {
+		printf("Decompression error (decompressBlocks)\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+
 int compareFiles(FILE* fp0, FILE* fp1)
 {
 	int result = 0;
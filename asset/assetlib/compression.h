@@ -1,5 +1,7 @@
+#pragma once
 #include <cinttypes>
 #include <fstream>
+#include <vector>
 
 struct CompressResult_t {
 	int error;
@@ -12,3 +14,87 @@ CompressResult_t compressBuffer(const void* inBuf, void* outBuf, uint32_t inBufS
 
 // Stream decompress file using LZ4
 int decompressFile(std::ifstream& inFile, void* outBuf);
+
+// Decompress an in-memory LZ4 frame. outBuf must be able to hold the whole decompressed frame
+int decompressBuffer(const void* inBuf, size_t inBufSize, void* outBuf, size_t outBufSize);
+
+
+/*
+	Block compressed blob layout:
+
+	BlockTableHeader
+	uint64_t blockOffsets[blockCount + 1]   offset of each block relative to the first block, the last entry is the end
+	blocks                                  independent raw LZ4 blocks, each decompressing to blockSize bytes
+	                                        (the last block may be shorter). A block whose stored size equals its
+	                                        decompressed size is stored uncompressed.
+
+	Since every block is independent and its destination is known up front, blocks can be decompressed in parallel.
+*/
+
+constexpr uint32_t COMPRESSION_BLOCK_SIZE{ 256 * 1024 };
+
+struct BlockTableHeader {
+	uint32_t blockSize;
+	uint32_t blockCount;
+};
+
+/*
+	Dictionaries:
+
+	Small blobs don't give LZ4 enough history to find matches, so assets of the same family (e.g. all meshes of
+	a model) can share a dictionary. Every block is compressed as if the dictionary came right before it, which
+	keeps blocks independent. A dictionary is plain bytes, identified by dictionaryId() of its contents.
+*/
+
+// LZ4 can only reference the last 64KB of history, anything beyond that in a dictionary is never used
+constexpr size_t COMPRESSION_DICTIONARY_SIZE{ 64 * 1024 };
+
+// Builds a dictionary out of the byte sequences that occur in the most samples. Returns an empty
+// dictionary if the samples have nothing in common
+std::vector<char> trainDictionary(const std::vector<std::vector<char>>& samples, size_t maxSize = COMPRESSION_DICTIONARY_SIZE);
+
+// Never 0, which is reserved for "no dictionary"
+uint32_t dictionaryId(const void* dict, size_t dictSize);
+
+// Compress a buffer into independent LZ4 blocks with a block offset table.
+// hcLevel > 0 compresses with LZ4HC at that level; the output is decoded the same way either way
+CompressResult_t compressBlocks(const void* inBuf, size_t inBufSize, std::vector<char>& outBuf, int hcLevel = 0,
+	const void* dict = nullptr, size_t dictSize = 0);
+
+// Writes a block compressed blob (same layout as compressBlocks) to a stream while the input arrives in chunks.
+// Only one block of input and its compressed output are held in memory, plus the offset table, which is
+// reserved in begin() and patched in finish(). Blocks that don't compress below thresholdRatio are stored as is
+class BlockStreamWriter {
+public:
+	// dict must stay alive until finish()
+	bool begin(std::ostream& out, uint64_t totalSize, int hcLevel = 0, float thresholdRatio = 1.0f,
+		const void* dict = nullptr, size_t dictSize = 0);
+
+	bool write(const void* data, size_t size);
+
+	// Fails unless exactly totalSize bytes were written. Leaves the stream at the end of the blob
+	CompressResult_t finish();
+
+private:
+	bool flushBlock();
+
+	std::ostream* _out{ nullptr };
+	std::streampos _tableStart;
+	std::vector<uint64_t> _offsets;
+	std::vector<char> _block;
+	std::vector<char> _compressed;
+	uint64_t _totalSize{ 0 };
+	uint64_t _written{ 0 };
+	// end of the last flushed block, relative to the first block
+	uint64_t _blobOffset{ 0 };
+	int _hcLevel{ 0 };
+	float _thresholdRatio{ 1.0f };
+	const char* _dict{ nullptr };
+	size_t _dictSize{ 0 };
+	bool _error{ false };
+};
+
+// Decompress a block compressed buffer, fanning the blocks out across a pool of decoding threads shared by every call. outBufSize must be the exact decompressed size.
+// dict must be the dictionary the buffer was compressed with, if any
+int decompressBlocks(const void* inBuf, size_t inBufSize, void* outBuf, size_t outBufSize,
+	const void* dict = nullptr, size_t dictSize = 0);
@@ -0,0 +1,227 @@
+#include "io_service.h"
+
+#include <fstream>
+#include <iostream>
+#include <atomic>
+#include <algorithm>
+#include <exception>
+
+#include "../tracy/Tracy.hpp"		// CPU profiling
+
+using namespace assets;
+
+struct assets::IoRequest {
+	std::vector<IoRead> reads;
+	// data of reads without a caller supplied destination
+	std::vector<std::vector<char>> ownedData;
+	std::vector<size_t> sizes;
+	IoCallback callback;
+
+	std::atomic<bool> finished{ false };
+	std::atomic<bool> success{ false };
+	std::mutex mutex;
+	std::condition_variable done;
+};
+
+bool IoHandle::poll() const
+{
+	return _request->finished.load(std::memory_order_acquire);
+}
+
+bool IoHandle::wait() const
+{
+	std::unique_lock<std::mutex> lock{ _request->mutex };
+	_request->done.wait(lock, [this]() { return _request->finished.load(std::memory_order_acquire); });
+	return _request->success;
+}
+
+bool IoHandle::succeeded() const
+{
+	return _request->success.load(std::memory_order_acquire);
+}
+
+size_t IoHandle::readCount() const
+{
+	return _request->reads.size();
+}
+
+const char* IoHandle::data(size_t i) const
+{
+	const IoRead& read{ _request->reads[i] };
+	if (read.source) return (const char*)read.source;
+	return read.destination ? (const char*)read.destination : _request->ownedData[i].data();
+}
+
+size_t IoHandle::size(size_t i) const
+{
+	return _request->sizes[i];
+}
+
+IoService::IoService(uint32_t threadCount)
+{
+	for (uint32_t i = 0; i < std::max(threadCount, 1u); ++i) {
+		_threads.emplace_back(&IoService::workerLoop, this);
+	}
+}
+
+IoService::~IoService()
+{
+	{
+		std::lock_guard<std::mutex> lock{ _mutex };
+		_stopping = true;
+	}
+	_condition.notify_all();
+
+	for (std::thread& thread : _threads) {
+		thread.join();
+	}
+}
+
+IoHandle IoService::read(IoRead read, IoPriority priority, IoCallback callback)
+{
+	std::vector<IoRead> reads;
+	reads.push_back(std::move(read));
+	return readBatch(std::move(reads), priority, std::move(callback));
+}
+
+IoHandle IoService::readFile(const std::string& path, IoPriority priority, IoCallback callback)
+{
+	IoRead read{};
+	read.path = path;
+	return this->read(std::move(read), priority, std::move(callback));
+}
+
+IoHandle IoService::readBatch(std::vector<IoRead> reads, IoPriority priority, IoCallback callback)
+{
+	IoHandle handle;
+	handle._request = std::make_shared<IoRequest>();
+	handle._request->reads = std::move(reads);
+	handle._request->ownedData.resize(handle._request->reads.size());
+	handle._request->sizes.resize(handle._request->reads.size());
+	handle._request->callback = std::move(callback);
+
+	{
+		std::lock_guard<std::mutex> lock{ _mutex };
+		_queue.push(QueuedRequest{ priority, _sequence++, handle._request });
+	}
+	_condition.notify_one();
+
+	return handle;
+}
+
+// Does one read of a request. file is kept open between reads of the same path
+static bool doRead(IoRequest& request, size_t i, std::ifstream& file, std::string& openPath)
+{
+	IoRead& read{ request.reads[i] };
+
+	if (read.source) {
+		// touching one byte per page is enough for the OS to read the page, and the surrounding ones, into the mapping
+		constexpr size_t pageSize{ 4096 };
+		const volatile char* source{ (const volatile char*)read.source };
+		char sink{ 0 };
+		for (size_t offset = 0; offset < read.size; offset += pageSize) {
+			sink ^= source[offset];
+		}
+		(void)sink;
+		request.sizes[i] = read.size;
+		return true;
+	}
+
+	if (!file.is_open() || openPath != read.path) {
+		file.close();
+		file.clear();
+		file.open(read.path, std::ios::binary);
+		openPath = read.path;
+
+		if (!file.is_open()) {
+			std::cout << "Error when trying to read file: " << read.path << std::endl;
+			return false;
+		}
+	}
+
+	size_t size{ read.size };
+	if (size == 0) {
+		file.seekg(0, std::ios::end);
+		std::streamoff fileSize{ file.tellg() };
+		if (fileSize < 0) {
+			std::cout << "Error when trying to get the size of file: " << read.path << std::endl;
+			file.clear();
+			return false;
+		}
+		if ((uint64_t)fileSize < read.offset) return false;
+		size = (size_t)((uint64_t)fileSize - read.offset);
+	}
+
+	char* destination{ (char*)read.destination };
+	if (!destination) {
+		request.ownedData[i].resize(size);
+		destination = request.ownedData[i].data();
+	}
+
+	file.seekg((std::streamoff)read.offset);
+	file.read(destination, size);
+	request.sizes[i] = (size_t)file.gcount();
+
+	if (request.sizes[i] != size) {
+		file.clear();
+		return false;
+	}
+	return true;
+}
+
+void IoService::workerLoop()
+{
+	std::ifstream file;
+	std::string openPath;
+
+	while (true) {
+		std::shared_ptr<IoRequest> request;
+		{
+			std::unique_lock<std::mutex> lock{ _mutex };
+			_condition.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+
+			if (_queue.empty()) {
+				return;
+			}
+
+			request = _queue.top().request;
+			_queue.pop();
+		}
+
+		bool success{ true };
+		{
+			ZoneScopedN("io request");
+			for (size_t i = 0; i < request->reads.size(); ++i) {
+				// an exception escaping a worker would terminate the process, fail the read instead
+				try {
+					success = doRead(*request, i, file, openPath) && success;
+				} catch (const std::exception& e) {
+					std::cout << "Error when trying to read file: " << request->reads[i].path << " (" << e.what() << ")" << std::endl;
+					file.close();
+					file.clear();
+					openPath.clear();
+					success = false;
+				}
+			}
+		}
+
+		// files may be rewritten between requests, don't hold on to them while idle
+		file.close();
+		openPath.clear();
+
+		request->success.store(success, std::memory_order_release);
+
+		if (request->callback) {
+			IoHandle handle;
+			handle._request = request;
+			// poll() is still false here, but the data and succeeded() are final
+			request->callback(handle);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock{ request->mutex };
+			request->finished.store(true, std::memory_order_release);
+		}
+		request->done.notify_all();
+	}
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdint>
+
+namespace assets {
+
+	enum class IoPriority : uint32_t {
+		High,
+		Normal,
+		Low
+	};
+
+	struct IoRead {
+		std::string path;
+		uint64_t offset{ 0 };
+		// bytes to read, 0 reads up to the end of the file
+		size_t size{ 0 };
+		// caller owned buffer of at least size bytes that must outlive the request. If nullptr the handle owns the data
+		void* destination{ nullptr };
+		// size bytes of an already mapped file to read instead of path. Their pages are faulted in on an I/O thread, so
+		// later accesses don't wait on the disk, and data() points at source. The mapping must outlive the request
+		const void* source{ nullptr };
+	};
+
+	struct IoRequest;
+
+	// Completion handle of a request. Copies refer to the same request, and data owned by the request
+	// stays alive for as long as any handle to it does.
+	class IoHandle {
+	public:
+		bool valid() const { return _request != nullptr; }
+
+		// True once the request has finished, successfully or not
+		bool poll() const;
+
+		// Blocks until the request has finished, returns whether every read succeeded
+		bool wait() const;
+
+		// Only meaningful once poll() is true, or inside the request's callback
+		bool succeeded() const;
+
+		size_t readCount() const;
+
+		// Data and size of the i-th read of the request, only valid once it has finished
+		const char* data(size_t i = 0) const;
+		size_t size(size_t i = 0) const;
+
+	private:
+		friend class IoService;
+		std::shared_ptr<IoRequest> _request;
+	};
+
+	// Runs on the I/O thread that completed the request, before waiters are woken up
+	using IoCallback = std::function<void(const IoHandle&)>;
+
+	// Pool of reader threads fed by a priority queue. Requests of the same priority are served in the order they were made.
+	// Lets the caller keep decompressing and uploading earlier assets while later ones are still being read.
+	class IoService {
+	public:
+		explicit IoService(uint32_t threadCount = 2);
+
+		// Finishes every queued request before returning
+		~IoService();
+
+		IoService(const IoService&) = delete;
+		IoService& operator=(const IoService&) = delete;
+
+		IoHandle read(IoRead read, IoPriority priority = IoPriority::Normal, IoCallback callback = {});
+
+		IoHandle readFile(const std::string& path, IoPriority priority = IoPriority::Normal, IoCallback callback = {});
+
+		// Many small reads as a single request. They are done in order by one thread, which keeps a file open across
+		// consecutive reads from it, so each read doesn't pay for queueing and opening on its own
+		IoHandle readBatch(std::vector<IoRead> reads, IoPriority priority = IoPriority::Normal, IoCallback callback = {});
+
+	private:
+		struct QueuedRequest {
+			IoPriority priority;
+			uint64_t sequence;
+			std::shared_ptr<IoRequest> request;
+
+			// std::priority_queue pops the largest element, so the "largest" is the highest priority and oldest request
+			bool operator<(const QueuedRequest& other) const
+			{
+				if (priority != other.priority) return priority > other.priority;
+				return sequence > other.sequence;
+			}
+		};
+
+		void workerLoop();
+
+		std::priority_queue<QueuedRequest> _queue;
+		std::mutex _mutex;
+		std::condition_variable _condition;
+		std::vector<std::thread> _threads;
+		uint64_t _sequence{ 0 };
+		bool _stopping{ false };
+	};
+}
@@ -0,0 +1,131 @@
+#include "mapped_file.h"
+
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace assets;
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other) {
+		close();
+		std::swap(_data, other._data);
+		std::swap(_size, other._size);
+#ifdef _WIN32
+		std::swap(_file, other._file);
+		std::swap(_mapping, other._mapping);
+#endif
+	}
+	return *this;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const char* path)
+{
+	close();
+
+	HANDLE file{ CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr) };
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER fileSize{};
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping{ CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) };
+	if (!mapping) {
+		CloseHandle(file);
+		return false;
+	}
+
+	void* view{ MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) };
+	if (!view) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	_file = file;
+	_mapping = mapping;
+	_data = static_cast<const char*>(view);
+	_size = static_cast<size_t>(fileSize.QuadPart);
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (_data) UnmapViewOfFile(_data);
+	if (_mapping) CloseHandle(_mapping);
+	if (_file) CloseHandle(_file);
+
+	_data = nullptr;
+	_size = 0;
+	_mapping = nullptr;
+	_file = nullptr;
+}
+
+#else
+
+bool MappedFile::open(const char* path)
+{
+	close();
+
+	int fd{ ::open(path, O_RDONLY) };
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st {};
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+
+	void* view{ mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) };
+	// the mapping keeps its own reference to the file
+	::close(fd);
+
+	if (view == MAP_FAILED) {
+		return false;
+	}
+
+	madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+	_data = static_cast<const char*>(view);
+	_size = (size_t)st.st_size;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (_data) munmap((void*)_data, _size);
+
+	_data = nullptr;
+	_size = 0;
+}
+
+#endif
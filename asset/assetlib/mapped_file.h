@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+
+namespace assets {
+
+	// Read-only memory mapping of a whole file. The mapping is released when the object is destroyed,
+	// so any pointers obtained through data() must not outlive it.
+	class MappedFile {
+	public:
+		MappedFile() = default;
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		MappedFile(MappedFile&& other) noexcept;
+		MappedFile& operator=(MappedFile&& other) noexcept;
+
+		bool open(const char* path);
+
+		void close();
+
+		bool isOpen() const { return _data != nullptr; }
+
+		const char* data() const { return _data; }
+
+		size_t size() const { return _size; }
+
+	private:
+		const char* _data{ nullptr };
+		size_t _size{ 0 };
+#ifdef _WIN32
+		void* _file{ nullptr };
+		void* _mapping{ nullptr };
+#endif
+	};
+}
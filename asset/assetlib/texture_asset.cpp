@@ -6,32 +6,80 @@
 #include "lz4hc.h"
 #include "lz4frame.h"
 
+static const char* const FORMAT_NAMES[]{ "Unknown", "RGBA8", "SRGBA8", "BC1", "BC1_SRGB", "BC3", "BC3_SRGB", "BC4", "BC5", "BC7", "BC7_SRGB" };
+
 assets::TextureFormat parseFormat(const char* f) {
 
-	if (strcmp(f, "RGBA8") == 0) {
-		return assets::TextureFormat::RGBA8;
-	} else if (strcmp(f, "SRGBA8") == 0) {
-		return assets::TextureFormat::SRGBA8;
-	} else {
-		return assets::TextureFormat::Unknown;
+	for (uint32_t i = 1; i < sizeof(FORMAT_NAMES) / sizeof(FORMAT_NAMES[0]); ++i) {
+		if (strcmp(f, FORMAT_NAMES[i]) == 0) {
+			return (assets::TextureFormat)i;
+		}
 	}
+	return assets::TextureFormat::Unknown;
+}
+
+const char* assets::textureFormatName(TextureFormat format)
+{
+	uint32_t i{ (uint32_t)format };
+	return i < sizeof(FORMAT_NAMES) / sizeof(FORMAT_NAMES[0]) ? FORMAT_NAMES[i] : FORMAT_NAMES[0];
+}
+
+bool assets::isBlockCompressed(TextureFormat format)
+{
+	return format >= TextureFormat::BC1 && format <= TextureFormat::BC7_SRGB;
+}
+
+bool assets::isSrgb(TextureFormat format)
+{
+	return format == TextureFormat::SRGBA8 || format == TextureFormat::BC1_SRGB || format == TextureFormat::BC3_SRGB
+		|| format == TextureFormat::BC7_SRGB;
 }
 
-assets::TextureInfo assets::readTextureInfo(nlohmann::json& metadata)
+size_t assets::textureLevelSize(TextureFormat format, uint32_t width, uint32_t height)
+{
+	size_t blocks{ (size_t)((width + 3) / 4) * ((height + 3) / 4) };
+
+	switch (format) {
+	case TextureFormat::BC1:
+	case TextureFormat::BC1_SRGB:
+	case TextureFormat::BC4:
+		return blocks * 8;
+	case TextureFormat::BC3:
+	case TextureFormat::BC3_SRGB:
+	case TextureFormat::BC5:
+	case TextureFormat::BC7:
+	case TextureFormat::BC7_SRGB:
+		return blocks * 16;
+	default:
+		return (size_t)width * height * 4;
+	}
+}
+
+assets::TextureInfo assets::readTextureInfo(const AssetMetadata& metadata)
 {
 	TextureInfo info;
+	info.compressionMode = metadata.compressionMode;
+
+	TextureInfoBinary binaryInfo;
+	if (readInfoStruct(metadata, binaryInfo)) {
+		info.textureFormat = binaryInfo.textureFormat;
+		info.originalSize = binaryInfo.originalSize;
+		info.miplevels = binaryInfo.miplevels;
+		info.width = binaryInfo.width;
+		info.height = binaryInfo.height;
+		return info;
+	}
+
+	const nlohmann::json& json = metadata.json;
 
-	std::string formatString = metadata["format"];
+	std::string formatString = json["format"];
 	info.textureFormat = parseFormat(formatString.c_str());
-	info.originalSize = metadata["original_size"];
+	info.originalSize = json["original_size"];
 	//info.compressedSize = texture_metadata["compressed_size"];
-	info.originalFile = metadata["original_file"];
-	info.miplevels = metadata["miplevels"];
-	info.width = metadata["width"];
-	info.height = metadata["height"];
-
-	std::string compressionMode = metadata["compression_mode"];
-	info.compressionMode = parseCompression(compressionMode.c_str());
+	info.originalFile = json["original_file"];
+	info.miplevels = json["miplevels"];
+	info.width = json["width"];
+	info.height = json["height"];
 
 	return info;
 }
@@ -56,6 +104,20 @@ void assets::unpackTexture(const char* sourcebuffer, size_t sourceSize, void* de
 	memcpy(destination, sourcebuffer, sourceSize);
 }
 
+std::vector<char> assets::packTextureInfo(const TextureInfo* info)
+{
+	TextureInfoBinary binaryInfo{};
+	binaryInfo.originalSize = info->originalSize;
+	binaryInfo.width = info->width;
+	binaryInfo.height = info->height;
+	binaryInfo.textureFormat = info->textureFormat;
+	binaryInfo.miplevels = info->miplevels;
+
+	std::vector<char> data(sizeof(TextureInfoBinary));
+	memcpy(data.data(), &binaryInfo, sizeof(TextureInfoBinary));
+	return data;
+}
+
 assets::AssetFile assets::packTexture(TextureInfo* info, void* pixelData)
 {
 	//core file header
@@ -64,8 +126,9 @@ assets::AssetFile assets::packTexture(TextureInfo* info, void* pixelData)
 	file.type[1] = 'E';
 	file.type[2] = 'X';
 	file.type[3] = 'I';
-	file.version = 1;
+	file.version = ASSET_VERSION;
 
+	file.info = packTextureInfo(info);
 
 	char* pixels = (char*)pixelData;
 	file.binaryBlob.resize(info->originalSize);
@@ -7,7 +7,16 @@ namespace assets {
 	{
 		Unknown = 0,
 		RGBA8,
-		SRGBA8
+		SRGBA8,
+		// block compressed formats, 4x4 texels per block
+		BC1,
+		BC1_SRGB,
+		BC3,
+		BC3_SRGB,
+		BC4,
+		BC5,
+		BC7,
+		BC7_SRGB
 	};
 
 	struct TextureInfo {
@@ -23,10 +32,34 @@ namespace assets {
 		CompressionMode compressionMode;
 	};
 
-	TextureInfo readTextureInfo(nlohmann::json& metadata);
+	// Info struct stored in version 2 texture assets
+	struct TextureInfoBinary {
+		uint64_t originalSize;
+		uint32_t width;
+		uint32_t height;
+		TextureFormat textureFormat;
+		uint32_t miplevels;
+	};
+
+	// name stored in the json metadata of the texture
+	const char* textureFormatName(TextureFormat format);
+
+	bool isBlockCompressed(TextureFormat format);
+
+	// whether the texels are sRGB encoded, which the baker also generated the mips in
+	bool isSrgb(TextureFormat format);
+
+	// bytes taken by one mip level of the given size in texels
+	size_t textureLevelSize(TextureFormat format, uint32_t width, uint32_t height);
+
+	// originalFile is only known for version 1 assets, version 2 keeps it in the debug sidecar
+	TextureInfo readTextureInfo(const AssetMetadata& metadata);
 
 	//void unpackTexture(const char* compressedBuffer, char* destination, size_t compressedSize, size_t dstCapacity);
 	void unpackTexture(const char* sourcebuffer, size_t sourceSize, void* destination);
 
 	AssetFile packTexture(TextureInfo* info, void* pixelData);
+
+	// Info struct of a texture asset, for writing one with AssetWriter as its levels are produced
+	std::vector<char> packTextureInfo(const TextureInfo* info);
 }
\ No newline at end of file
@@ -3,6 +3,9 @@
 #include <cstddef> // offsetof
 #include <iostream>
 #include <algorithm>
+#include <cmath>
+
+#include "glm/gtc/packing.hpp"
 
 
 VertexFormat parseFormat(const char* f) {
@@ -11,23 +14,43 @@ VertexFormat parseFormat(const char* f) {
 		return VertexFormat::DEFAULT;
 	} else if (strcmp(f, "SKINNED") == 0) {
 		return VertexFormat::SKINNED;
+	} else if (strcmp(f, "QUANTIZED") == 0) {
+		return VertexFormat::QUANTIZED;
+	} else if (strcmp(f, "SKINNED_QUANTIZED") == 0) {
+		return VertexFormat::SKINNED_QUANTIZED;
 	} else {
 		return VertexFormat::Unknown;
 	}
 }
 
-assets::MeshInfo assets::readMeshInfo(nlohmann::json& metadata)
+assets::MeshInfo assets::readMeshInfo(const AssetMetadata& metadata)
 {
 	assets::MeshInfo info;
+	info.compressionMode = metadata.compressionMode;
+
+	MeshInfoBinary binaryInfo;
+	if (readInfoStruct(metadata, binaryInfo)) {
+		info.vertexBufferSize = binaryInfo.vertexBufferSize;
+		info.indexBufferSize = binaryInfo.indexBufferSize;
+		info.meshletBufferSize = binaryInfo.meshletBufferSize;
+		info.lodBufferSize = binaryInfo.lodBufferSize;
+		info.submeshBufferSize = binaryInfo.submeshBufferSize;
+		info.indexSize = (char)binaryInfo.indexSize;
+		info.bounds = binaryInfo.bounds;
+		info.vertexFormat = binaryInfo.vertexFormat;
+		return info;
+	}
 
-	info.vertexBufferSize = metadata["vertex_buffer_size"];
-	info.indexBufferSize = metadata["index_buffer_size"];
-	info.indexSize = (uint8_t)metadata["index_size"];
-	info.originalFile = metadata["original_file"];
+	const nlohmann::json& json = metadata.json;
+
+	info.vertexBufferSize = json["vertex_buffer_size"];
+	info.indexBufferSize = json["index_buffer_size"];
+	info.indexSize = (uint8_t)json["index_size"];
+	info.originalFile = json["original_file"];
 
 	std::vector<float> boundsData;
 	boundsData.reserve(7);
-	boundsData = metadata["bounds"].get<std::vector<float>>();
+	boundsData = json["bounds"].get<std::vector<float>>();
 
 	info.bounds.origin[0] = boundsData[0];
 	info.bounds.origin[1] = boundsData[1];
@@ -39,34 +62,144 @@ assets::MeshInfo assets::readMeshInfo(nlohmann::json& metadata)
 	info.bounds.extents[1] = boundsData[5];
 	info.bounds.extents[2] = boundsData[6];
 
-	std::string vertexFormat = metadata["vertex_format"];
+	std::string vertexFormat = json["vertex_format"];
 	info.vertexFormat = parseFormat(vertexFormat.c_str());
 
-	std::string compressionMode = metadata["compression_mode"];
-	info.compressionMode = assets::parseCompression(compressionMode.c_str());
-
 	return info;
 }
 
-void assets::unpackMesh(MeshInfo* info, const char* sourcebuffer, char* vertexBuffer, char* indexBuffer)
+static int16_t quantizeSnorm16(float v)
+{
+	return (int16_t)std::round(std::clamp(v, -1.0f, 1.0f) * 32767.0f);
+}
+
+static int8_t quantizeSnorm8(float v)
+{
+	return (int8_t)std::round(std::clamp(v, -1.0f, 1.0f) * 127.0f);
+}
+
+static void quantizeDirection(const glm::vec3& direction, int8_t out[3])
+{
+	float length{ glm::length(direction) };
+	glm::vec3 n{ length > 0.0f ? direction / length : direction };
+	out[0] = quantizeSnorm8(n.x);
+	out[1] = quantizeSnorm8(n.y);
+	out[2] = quantizeSnorm8(n.z);
+}
+
+// Attributes shared by both quantized layouts
+template <typename Q, typename V>
+static void quantizeCommon(const V& vertex, const MeshBounds& bounds, Q& out)
+{
+	float scale{ positionQuantizationScale(bounds) };
+	for (int i = 0; i < 3; ++i) {
+		out.position[i] = quantizeSnorm16((vertex.position[i] - bounds.origin[i]) / scale);
+	}
+	out.position[3] = 0;
+
+	quantizeDirection(vertex.normal, out.normal);
+	out.normal[3] = 0;
+
+	quantizeDirection(glm::vec3{ vertex.tangent }, out.tangent);
+	out.tangent[3] = vertex.tangent.w < 0.0f ? -127 : 127;
+
+	out.uv[0] = glm::packHalf1x16(vertex.uv.x);
+	out.uv[1] = glm::packHalf1x16(vertex.uv.y);
+}
+
+VertexQuantized assets::quantizeVertex(const Vertex& vertex, const MeshBounds& bounds)
+{
+	VertexQuantized out{};
+	quantizeCommon(vertex, bounds, out);
+	return out;
+}
+
+VertexSkinnedQuantized assets::quantizeVertex(const VertexSkinned& vertex, const MeshBounds& bounds)
+{
+	VertexSkinnedQuantized out{};
+	quantizeCommon(vertex, bounds, out);
+
+	float weightSum{ 0.0f };
+	for (int i = 0; i < 4; ++i) {
+		out.jointIndices[i] = (uint8_t)std::clamp(std::round(vertex.jointIndices[i]), 0.0f, 255.0f);
+		weightSum += std::max(vertex.jointWeights[i], 0.0f);
+	}
+
+	if (weightSum <= 0.0f) {
+		out.jointWeights[0] = 255;
+		return out;
+	}
+
+	// renormalize, then give the rounding error to the largest weight so the weights still sum to exactly 1
+	int quantizedSum{ 0 };
+	int largest{ 0 };
+	for (int i = 0; i < 4; ++i) {
+		float weight{ std::max(vertex.jointWeights[i], 0.0f) / weightSum };
+		out.jointWeights[i] = (uint8_t)std::round(weight * 255.0f);
+		quantizedSum += out.jointWeights[i];
+		if (out.jointWeights[i] > out.jointWeights[largest]) largest = i;
+	}
+	out.jointWeights[largest] = (uint8_t)(out.jointWeights[largest] + 255 - quantizedSum);
+
+	return out;
+}
+
+void assets::unpackMesh(MeshInfo* info, const char* sourcebuffer, char* vertexBuffer, char* indexBuffer, char* meshletBuffer, char* lodBuffer,
+	char* submeshBuffer)
 {
 	//copy vertex buffer
 	memcpy(vertexBuffer, sourcebuffer, info->vertexBufferSize);
 
 	//copy index buffer
 	memcpy(indexBuffer, sourcebuffer + info->vertexBufferSize, info->indexBufferSize);
+
+	//copy meshlets
+	if (meshletBuffer) {
+		memcpy(meshletBuffer, sourcebuffer + info->vertexBufferSize + info->indexBufferSize, info->meshletBufferSize);
+	}
+
+	//copy levels of detail
+	if (lodBuffer) {
+		memcpy(lodBuffer, sourcebuffer + info->vertexBufferSize + info->indexBufferSize + info->meshletBufferSize, info->lodBufferSize);
+	}
+
+	//copy submeshes
+	if (submeshBuffer) {
+		memcpy(submeshBuffer, sourcebuffer + info->vertexBufferSize + info->indexBufferSize + info->meshletBufferSize + info->lodBufferSize,
+			info->submeshBufferSize);
+	}
+}
+
+std::vector<char> assets::packMeshInfo(const MeshInfo* info)
+{
+	MeshInfoBinary binaryInfo{};
+	binaryInfo.vertexBufferSize = info->vertexBufferSize;
+	binaryInfo.indexBufferSize = info->indexBufferSize;
+	binaryInfo.bounds = info->bounds;
+	binaryInfo.vertexFormat = info->vertexFormat;
+	binaryInfo.indexSize = (uint32_t)info->indexSize;
+	binaryInfo.meshletBufferSize = info->meshletBufferSize;
+	binaryInfo.lodBufferSize = info->lodBufferSize;
+	binaryInfo.submeshBufferSize = info->submeshBufferSize;
+
+	std::vector<char> data(sizeof(MeshInfoBinary));
+	memcpy(data.data(), &binaryInfo, sizeof(MeshInfoBinary));
+	return data;
 }
 
-assets::AssetFile assets::packMesh(MeshInfo* info, char* vertexData, char* indexData)
+assets::AssetFile assets::packMesh(MeshInfo* info, char* vertexData, char* indexData, char* meshletData, char* lodData,
+	char* submeshData)
 {
 	assets::AssetFile file;
 	file.type[0] = 'M';
 	file.type[1] = 'E';
 	file.type[2] = 'S';
 	file.type[3] = 'H';
-	file.version = 1;
+	file.version = ASSET_VERSION;
 
-	size_t fullsize = info->vertexBufferSize + info->indexBufferSize;
+	file.info = packMeshInfo(info);
+
+	size_t fullsize = info->vertexBufferSize + info->indexBufferSize + info->meshletBufferSize + info->lodBufferSize + info->submeshBufferSize;
 
 	file.binaryBlob.resize(fullsize);
 
@@ -76,5 +209,158 @@ assets::AssetFile assets::packMesh(MeshInfo* info, char* vertexData, char* index
 	// copy index buffer
 	memcpy(file.binaryBlob.data() + info->vertexBufferSize, indexData, info->indexBufferSize);
 
+	// copy meshlets
+	if (info->meshletBufferSize > 0) {
+		memcpy(file.binaryBlob.data() + info->vertexBufferSize + info->indexBufferSize, meshletData, info->meshletBufferSize);
+	}
+
+	// copy levels of detail
+	if (info->lodBufferSize > 0) {
+		memcpy(file.binaryBlob.data() + info->vertexBufferSize + info->indexBufferSize + info->meshletBufferSize, lodData, info->lodBufferSize);
+	}
+
+	// copy submeshes
+	if (info->submeshBufferSize > 0) {
+		memcpy(file.binaryBlob.data() + info->vertexBufferSize + info->indexBufferSize + info->meshletBufferSize + info->lodBufferSize,
+			submeshData, info->submeshBufferSize);
+	}
+
+	return file;
+}
+
+// Points array at section if it is aligned and holds section.count elements of T inside the file
+template <typename T>
+static bool viewSection(const char* data, size_t size, const assets::SkeletonSection& section, const T*& array)
+{
+	if (section.offset % assets::SKELETON_ALIGNMENT != 0 || section.offset > size || section.count > (size - section.offset) / sizeof(T)) {
+		return false;
+	}
+	array = reinterpret_cast<const T*>(data + section.offset);
+	return true;
+}
+
+static bool rangeInside(uint64_t first, uint64_t count, uint64_t size)
+{
+	return first <= size && count <= size - first;
+}
+
+bool assets::viewSkeleton(const char* data, size_t size, SkeletonView& view)
+{
+	if (reinterpret_cast<uintptr_t>(data) % SKELETON_ALIGNMENT != 0) {
+		std::cout << "Skeleton isn't " << SKELETON_ALIGNMENT << " byte aligned in memory\n";
+		return false;
+	}
+	if (size < sizeof(SkeletonHeader) || memcmp(data, "SKEL", 4) != 0) {
+		std::cout << "Not a skeleton file\n";
+		return false;
+	}
+
+	const SkeletonHeader& header{ *reinterpret_cast<const SkeletonHeader*>(data) };
+	if (header.version != SKELETON_VERSION) {
+		std::cout << "Skeleton version " << header.version << " isn't supported, rebake the model\n";
+		return false;
+	}
+
+	view.header = &header;
+	if (!viewSection(data, size, header.nodes, view.nodes) || !viewSection(data, size, header.parents, view.parents)
+		|| !viewSection(data, size, header.skins, view.skins) || !viewSection(data, size, header.joints, view.joints)
+		|| !viewSection(data, size, header.inverseBindMatrices, view.inverseBindMatrices)
+		|| !viewSection(data, size, header.animations, view.animations) || !viewSection(data, size, header.samplers, view.samplers)
+		|| !viewSection(data, size, header.channels, view.channels) || !viewSection(data, size, header.times, view.times)
+		|| !viewSection(data, size, header.keys, view.keys) || !viewSection(data, size, header.strings, view.strings)
+		|| header.parents.count != header.nodes.count || header.inverseBindMatrices.count != header.joints.count
+		|| header.keys.count != header.times.count * 3) {
+		std::cout << "Skeleton arrays are out of bounds\n";
+		return false;
+	}
+
+	// everything the engine indexes with is checked once here, so animating needs no checks
+	uint64_t nodeCount{ header.nodes.count };
+	for (uint64_t i = 0; i < nodeCount; ++i) {
+		if (view.parents[i] < -1 || view.parents[i] >= (int64_t)i) {
+			std::cout << "Skeleton node " << i << " doesn't come after its parent\n";
+			return false;
+		}
+	}
+
+	for (uint64_t i = 0; i < header.skins.count; ++i) {
+		const SkeletonSkin& skin{ view.skins[i] };
+		bool valid{ skin.root < skin.nodeEnd && skin.nodeEnd <= nodeCount && rangeInside(skin.firstJoint, skin.jointCount, header.joints.count) };
+		for (uint32_t node = skin.root + 1; valid && node < skin.nodeEnd; ++node) {
+			valid = view.parents[node] >= (int32_t)skin.root;
+		}
+		for (uint32_t joint = 0; valid && joint < skin.jointCount; ++joint) {
+			valid = view.joints[skin.firstJoint + joint] < nodeCount;
+		}
+		if (!valid) {
+			std::cout << "Skeleton skin " << i << " is out of bounds\n";
+			return false;
+		}
+	}
+
+	for (uint64_t i = 0; i < header.samplers.count; ++i) {
+		const AnimationSampler& sampler{ view.samplers[i] };
+		if (sampler.keyCount == 0 || !rangeInside(sampler.firstKey, sampler.keyCount, header.times.count)
+			|| sampler.interpolation > Interpolation::CUBICSPLINE) {
+			std::cout << "Animation sampler " << i << " is out of bounds\n";
+			return false;
+		}
+	}
+
+	for (uint64_t i = 0; i < header.animations.count; ++i) {
+		const Animation& animation{ view.animations[i] };
+		bool valid{ rangeInside(animation.nameOffset, animation.nameLength, header.strings.count) && animation.timeStep > 0.0f
+			&& rangeInside(animation.firstSampler, animation.samplerCount, header.samplers.count)
+			&& rangeInside(animation.firstChannel, animation.channelCount, header.channels.count) };
+		for (uint32_t c = 0; valid && c < animation.channelCount; ++c) {
+			const AnimationChannel& channel{ view.channels[animation.firstChannel + c] };
+			valid = channel.path <= AnimationChannel::SCALE && channel.nodeIdx < nodeCount && channel.samplerIndex < animation.samplerCount;
+		}
+		if (!valid) {
+			std::cout << "Animation " << i << " is out of bounds\n";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+uint32_t assets::SkeletonData::addString(const std::string& name)
+{
+	uint32_t offset{ (uint32_t)strings.size() };
+	strings += name;
+	return offset;
+}
+
+// Appends array to file at the next aligned offset, filling in its section of the header
+template <typename T>
+static void appendSection(std::vector<char>& file, assets::SkeletonSection& section, const T* array, size_t count)
+{
+	file.resize((file.size() + assets::SKELETON_ALIGNMENT - 1) / assets::SKELETON_ALIGNMENT * assets::SKELETON_ALIGNMENT);
+	section.offset = file.size();
+	section.count = count;
+	file.insert(file.end(), reinterpret_cast<const char*>(array), reinterpret_cast<const char*>(array + count));
+}
+
+std::vector<char> assets::packSkeleton(const SkeletonData& data)
+{
+	SkeletonHeader header{};
+	memcpy(header.type, "SKEL", 4);
+	header.version = SKELETON_VERSION;
+
+	std::vector<char> file(sizeof(SkeletonHeader));
+	appendSection(file, header.nodes, data.nodes.data(), data.nodes.size());
+	appendSection(file, header.parents, data.parents.data(), data.parents.size());
+	appendSection(file, header.skins, data.skins.data(), data.skins.size());
+	appendSection(file, header.joints, data.joints.data(), data.joints.size());
+	appendSection(file, header.inverseBindMatrices, data.inverseBindMatrices.data(), data.inverseBindMatrices.size());
+	appendSection(file, header.animations, data.animations.data(), data.animations.size());
+	appendSection(file, header.samplers, data.samplers.data(), data.samplers.size());
+	appendSection(file, header.channels, data.channels.data(), data.channels.size());
+	appendSection(file, header.times, data.times.data(), data.times.size());
+	appendSection(file, header.keys, data.keys.data(), data.keys.size());
+	appendSection(file, header.strings, data.strings.data(), data.strings.size());
+
+	memcpy(file.data(), &header, sizeof(SkeletonHeader));
 	return file;
 }
@@ -13,88 +13,126 @@
 #include "asset_loader.h"
 #include "vk_mesh.h"
 
-namespace glm
-{
-
-	template<class Archive> void serialize(Archive& archive, glm::vec2& v) { archive(v.x, v.y); }
-	template<class Archive> void serialize(Archive& archive, glm::vec3& v) { archive(v.x, v.y, v.z); }
-	template<class Archive> void serialize(Archive& archive, glm::vec4& v) { archive(v.x, v.y, v.z, v.w); }
-	template<class Archive> void serialize(Archive& archive, glm::ivec2& v) { archive(v.x, v.y); }
-	template<class Archive> void serialize(Archive& archive, glm::ivec3& v) { archive(v.x, v.y, v.z); }
-	template<class Archive> void serialize(Archive& archive, glm::ivec4& v) { archive(v.x, v.y, v.z, v.w); }
-	template<class Archive> void serialize(Archive& archive, glm::uvec2& v) { archive(v.x, v.y); }
-	template<class Archive> void serialize(Archive& archive, glm::uvec3& v) { archive(v.x, v.y, v.z); }
-	template<class Archive> void serialize(Archive& archive, glm::uvec4& v) { archive(v.x, v.y, v.z, v.w); }
-	template<class Archive> void serialize(Archive& archive, glm::dvec2& v) { archive(v.x, v.y); }
-	template<class Archive> void serialize(Archive& archive, glm::dvec3& v) { archive(v.x, v.y, v.z); }
-	template<class Archive> void serialize(Archive& archive, glm::dvec4& v) { archive(v.x, v.y, v.z, v.w); }
-
-	// glm matrices serialization
-	template<class Archive> void serialize(Archive& archive, glm::mat2& m) { archive(m[0], m[1]); }
-	template<class Archive> void serialize(Archive& archive, glm::dmat2& m) { archive(m[0], m[1]); }
-	template<class Archive> void serialize(Archive& archive, glm::mat3& m) { archive(m[0], m[1], m[2]); }
-	template<class Archive> void serialize(Archive& archive, glm::mat4& m) { archive(m[0], m[1], m[2], m[3]); }
-	template<class Archive> void serialize(Archive& archive, glm::dmat4& m) { archive(m[0], m[1], m[2], m[3]); }
-
-	template<class Archive> void serialize(Archive& archive, glm::quat& q) { archive(q.x, q.y, q.z, q.w); }
-	template<class Archive> void serialize(Archive& archive, glm::dquat& q) { archive(q.x, q.y, q.z, q.w); }
+namespace assets {
 
-}
+	/*
+		Skeleton file layout (.skel). Every array starts at a 16 byte aligned offset given in the header, so a file that
+		is mapped or read to 16 byte aligned memory is used in place:
+
+		SkeletonHeader
+		SkeletonNode[nodes.count]               ordered so the descendants of a node directly follow it, parents first
+		int32_t[parents.count]                  parent of every node, -1 for roots
+		SkeletonSkin[skins.count]
+		uint32_t[joints.count]                  node of every joint of every skin
+		glm::mat4[inverseBindMatrices.count]    inverse bind matrix of every joint
+		Animation[animations.count]
+		AnimationSampler[samplers.count]
+		AnimationChannel[channels.count]
+		uint16_t[times.count]                   key times of every sampler
+		uint16_t[keys.count]                    three per key, see AnimationSampler
+		char[strings.count]                     names, not null terminated
+	*/
+
+	constexpr uint32_t SKELETON_VERSION{ 1 };
+
+	constexpr size_t SKELETON_ALIGNMENT{ 16 };
+
+	struct SkeletonSection {
+		// from the start of the file
+		uint64_t offset;
+		uint64_t count;
+	};
 
-namespace assets {
+	struct SkeletonHeader {
+		char type[4]; // "SKEL"
+		uint32_t version;
+		SkeletonSection nodes;
+		SkeletonSection parents;
+		SkeletonSection skins;
+		SkeletonSection joints;
+		SkeletonSection inverseBindMatrices;
+		SkeletonSection animations;
+		SkeletonSection samplers;
+		SkeletonSection channels;
+		SkeletonSection times;
+		SkeletonSection keys;
+		SkeletonSection strings;
+	};
 
-	// Serializable version of node that we convert glTF files to before compressing and writing to disk
-	struct NodeAsset {
-		int32_t parentIdx;
-		std::vector<int32_t> children;
+	// Rest pose of a node, which the engine copies once to animate it
+	struct SkeletonNode {
 		glm::mat4 matrix;
-		std::string name;
-		int32_t mesh;
-		glm::vec3 translation{};
-		glm::vec3 scale{ 1.0f };
-		glm::quat rotation{};
-		//BoundingBox bvh;
-		//BoundingBox aabb;
-
-		template<class Archive>
-		void serialize(Archive& archive)
-		{
-			archive(parentIdx, children, matrix, name, mesh, translation, scale, rotation); // serialize things by passing them to the archive
-		}
+		float translation[3];
+		float scale[3];
+		// x, y, z, w
+		float rotation[4];
+		uint32_t nameOffset;
+		uint32_t nameLength;
 	};
 
-	struct SkinAsset {
-		std::string name;
-		int32_t skeletonRootIdx{}; // index of node which is root of skeleton
-		int32_t meshNodeIdx{};
-		std::vector<glm::mat4> inverseBindMatrices;
-		std::vector<int32_t> joints; // indices of nodes
+	struct SkeletonSkin {
+		uint32_t nameOffset;
+		uint32_t nameLength;
+		// the skeleton root and one past its last descendant
+		uint32_t root;
+		uint32_t nodeEnd;
+		// range of the joint and inverse bind matrix arrays
+		uint32_t firstJoint;
+		uint32_t jointCount;
+	};
 
-		template<class Archive>
-		void serialize(Archive& archive)
-		{
-			archive(skeletonRootIdx, meshNodeIdx, inverseBindMatrices, joints); // serialize things by passing them to the archive
-		}
+	// Arrays of a skeleton file, pointing into the memory it was viewed in
+	struct SkeletonView {
+		const SkeletonHeader* header;
+		const SkeletonNode* nodes;
+		const int32_t* parents;
+		const SkeletonSkin* skins;
+		const uint32_t* joints;
+		const glm::mat4* inverseBindMatrices;
+		const Animation* animations;
+		const AnimationSampler* samplers;
+		const AnimationChannel* channels;
+		const uint16_t* times;
+		const uint16_t* keys;
+		const char* strings;
 	};
 
-	struct SkeletalAnimationDataAsset {
-		std::vector<NodeAsset> nodes;
-		std::vector<NodeAsset> linearNodes;
-		std::vector<Animation> animations;
-		std::vector<SkinAsset> skins;
+	// Checks the header and that every index in the file is in range, then points view at the arrays. Nothing is
+	// copied, so data has to be SKELETON_ALIGNMENT aligned and outlive view
+	bool viewSkeleton(const char* data, size_t size, SkeletonView& view);
 
-		template<class Archive>
-		void serialize(Archive& archive)
-		{
-			archive(nodes, linearNodes, animations, skins); // serialize things by passing them to the archive
-		}
+	// Arrays of a skeleton file as the baker builds them up, see the layout above
+	struct SkeletonData {
+		std::vector<SkeletonNode> nodes;
+		std::vector<int32_t> parents;
+		std::vector<SkeletonSkin> skins;
+		std::vector<uint32_t> joints;
+		std::vector<glm::mat4> inverseBindMatrices;
+		std::vector<Animation> animations;
+		std::vector<AnimationSampler> samplers;
+		std::vector<AnimationChannel> channels;
+		std::vector<uint16_t> times;
+		std::vector<uint16_t> keys;
+		std::string strings;
+
+		// Appends name to the string table, returning its offset
+		uint32_t addString(const std::string& name);
 	};
 
+	std::vector<char> packSkeleton(const SkeletonData& data);
+
 	struct MeshInfo {
 		// size in bytes
 		uint64_t vertexBufferSize;
 		// size in bytes
 		uint64_t indexBufferSize;
+		// size in bytes of the Meshlet array following the index buffer, 0 if the mesh has no meshlets
+		uint64_t meshletBufferSize{ 0 };
+		// size in bytes of the MeshLod array following the meshlets, 0 if the mesh has no levels of detail
+		uint64_t lodBufferSize{ 0 };
+		// size in bytes of the Submesh array following the levels of detail. 0 for meshes holding a single glTF primitive,
+		// which are drawn as one submesh covering the whole mesh
+		uint64_t submeshBufferSize{ 0 };
 		MeshBounds bounds;
 		VertexFormat vertexFormat;
 		char indexSize;
@@ -102,11 +140,38 @@ namespace assets {
 		assets::CompressionMode compressionMode;
 	};
 
-	MeshInfo readMeshInfo(nlohmann::json& metadata);
+	// Info struct stored in version 2 mesh assets
+	struct MeshInfoBinary {
+		uint64_t vertexBufferSize;
+		uint64_t indexBufferSize;
+		MeshBounds bounds;
+		VertexFormat vertexFormat;
+		uint32_t indexSize;
+		// added after the first version 2 assets, which read it as 0
+		uint64_t meshletBufferSize;
+		uint64_t lodBufferSize;
+		uint64_t submeshBufferSize;
+	};
+
+	// originalFile is only known for version 1 assets, version 2 keeps it in the debug sidecar
+	MeshInfo readMeshInfo(const AssetMetadata& metadata);
+
+	// meshletBuffer, lodBuffer and submeshBuffer may be nullptr to skip them
+	void unpackMesh(MeshInfo* info, const char* sourcebuffer, char* vertexBuffer, char* indexBuffer, char* meshletBuffer = nullptr, char* lodBuffer = nullptr,
+		char* submeshBuffer = nullptr);
+
+	// Converts a vertex to its quantized layout (see VertexQuantized), with the position relative to bounds
+	VertexQuantized quantizeVertex(const Vertex& vertex, const MeshBounds& bounds);
+	VertexSkinnedQuantized quantizeVertex(const VertexSkinned& vertex, const MeshBounds& bounds);
 
-	void unpackMesh(MeshInfo* info, const char* sourcebuffer, char* vertexBuffer, char* indexBuffer);
+	// meshletData, lodData and submeshData hold the info->meshletBufferSize, info->lodBufferSize and info->submeshBufferSize
+	// bytes of Meshlet, MeshLod and Submesh structs, and may be nullptr when their size is 0
+	// Info struct of a mesh asset, for writing one with AssetWriter a buffer at a time. The blob is the vertex, index,
+	// meshlet, lod and submesh buffers one after another
+	std::vector<char> packMeshInfo(const MeshInfo* info);
 
-	assets::AssetFile packMesh(MeshInfo* info, char* vertexData, char* indexData);
+	assets::AssetFile packMesh(MeshInfo* info, char* vertexData, char* indexData, char* meshletData = nullptr, char* lodData = nullptr,
+		char* submeshData = nullptr);
 
 	// Works for any vertex struct with position attribute
 	template <typename T>
@@ -115,7 +180,7 @@ namespace assets {
 		MeshBounds bounds;
 
 		float min[3] = { std::numeric_limits<float>::max(),std::numeric_limits<float>::max(),std::numeric_limits<float>::max() };
-		float max[3] = { std::numeric_limits<float>::min(),std::numeric_limits<float>::min(),std::numeric_limits<float>::min() };
+		float max[3] = { std::numeric_limits<float>::lowest(),std::numeric_limits<float>::lowest(),std::numeric_limits<float>::lowest() };
 
 		for (int i = 0; i < count; i++) {
 			min[0] = std::min(min[0], vertices[i].position[0]);
@@ -0,0 +1,64 @@
+#include "keyframe_index.h"
+
+#include <algorithm>
+
+// Keys the cursor steps forward before a lookup goes to the buckets instead
+constexpr uint32_t CURSOR_STEPS{ 4 };
+
+void KeyframeIndex::addSampler(const uint16_t* times, uint32_t keyCount)
+{
+	SamplerBuckets sampler{};
+	sampler.times = times;
+	sampler.keyCount = keyCount;
+	sampler.firstBucket = (uint32_t)_buckets.size();
+
+	if (keyCount > 1) {
+		// buckets as wide as the smallest power of two that leaves at most one bucket per key
+		uint32_t lastTick{ times[keyCount - 1] };
+		while ((lastTick >> sampler.shift) + 1 > keyCount) {
+			++sampler.shift;
+		}
+		sampler.bucketCount = (lastTick >> sampler.shift) + 1;
+
+		uint32_t key{ 0 };
+		for (uint32_t bucket = 0; bucket < sampler.bucketCount; ++bucket) {
+			uint32_t start{ bucket << sampler.shift };
+			while (key + 1 < keyCount && times[key + 1] <= start) {
+				++key;
+			}
+			_buckets.push_back((uint16_t)key);
+		}
+	}
+
+	_samplers.push_back(sampler);
+}
+
+uint32_t KeyframeIndex::findKey(uint32_t samplerIndex, float tick, uint32_t& cursor) const
+{
+	const SamplerBuckets& sampler{ _samplers[samplerIndex] };
+	const uint16_t* times{ sampler.times };
+
+	if (sampler.keyCount <= 1 || tick < times[0]) {
+		cursor = 0;
+		return 0;
+	}
+
+	uint32_t key{ cursor < sampler.keyCount ? cursor : 0 };
+	if (times[key] <= tick) {
+		for (uint32_t step = 0; step < CURSOR_STEPS; ++step, ++key) {
+			if (key + 1 == sampler.keyCount || times[key + 1] > tick) {
+				cursor = key;
+				return key;
+			}
+		}
+	}
+
+	// the answer lies between the keys of this bucket and the next one
+	uint32_t bucket{ std::min((uint32_t)tick >> sampler.shift, sampler.bucketCount - 1) };
+	uint32_t low{ _buckets[sampler.firstBucket + bucket] };
+	uint32_t high{ bucket + 1 < sampler.bucketCount ? _buckets[sampler.firstBucket + bucket + 1] + 1u : sampler.keyCount };
+
+	key = (uint32_t)(std::upper_bound(times + low, times + high, tick) - times) - 1;
+	cursor = key;
+	return key;
+}
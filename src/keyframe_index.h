@@ -0,0 +1,33 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+// Finds the key an animation sampler is at for a time in ticks, given the sampler's sorted key times.
+//
+// Every instance playing an animation keeps a cursor per sampler with the key it found last frame. Playback only moves
+// forward by about a key per frame, so the cursor is stepped forward a few keys. Anything further, like a loop back to
+// the start or a seek, falls back to the animation's KeyframeIndex: the ticks are split into buckets of about one key
+// each that point at the last key before them, which leaves a binary search over the few keys inside one bucket.
+class KeyframeIndex {
+public:
+	// Adds the next sampler of the animation, times has to stay valid for findKey
+	void addSampler(const uint16_t* times, uint32_t keyCount);
+
+	// Last key of sampler at or before tick, 0 before the first key. cursor is the key returned by the previous lookup
+	// of this sampler by the same instance, or any value when there is none
+	uint32_t findKey(uint32_t sampler, float tick, uint32_t& cursor) const;
+
+private:
+	struct SamplerBuckets {
+		const uint16_t* times;
+		uint32_t keyCount;
+		uint32_t firstBucket;
+		uint32_t bucketCount;
+		// bucket b starts at tick b << shift
+		uint32_t shift;
+	};
+
+	std::vector<SamplerBuckets> _samplers;
+	// key of every bucket of every sampler, keys of a sampler have distinct uint16_t ticks so there are at most 65536
+	std::vector<uint16_t> _buckets;
+};
@@ -737,8 +737,10 @@ void setupShadowDescriptorSetsGlobal(VulkanEngine& engine, ShadowFrameResources&
 }
 
 
-void initShadowPipelineInternal(VulkanEngine& engine, VkRenderPass& renderpass, VkPipelineLayout pipelineLayout, VkPipeline* pipeline, bool isSkinned)
+void initShadowPipelineInternal(VulkanEngine& engine, VkRenderPass& renderpass, VkPipelineLayout pipelineLayout, VkPipeline* pipeline, VertexFormat format)
 {
+	bool skinned{ isSkinned(format) };
+
 	VkPipelineInputAssemblyStateCreateInfo inputAssemblyStateCI{ vkinit::inputAssemblyCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST) };
 
 	VkPipelineRasterizationStateCreateInfo rasterizationStateCI{ vkinit::rasterizationStateCreateInfo(VK_POLYGON_MODE_FILL) };
@@ -772,7 +774,7 @@ void initShadowPipelineInternal(VulkanEngine& engine, VkRenderPass& renderpass,
 	std::vector<VkDynamicState> dynamicStateEnables = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR, VK_DYNAMIC_STATE_DEPTH_BIAS };
 
 	std::string prefix{ SHADER_PREFIX + "/spirv/" };
-	std::string vertPath{ prefix + (isSkinned ? "skinned_depth.vert.spv" : "depth.vert.spv") };
+	std::string vertPath{ prefix + (skinned ? "skinned_depth.vert.spv" : "depth.vert.spv") };
 	VkShaderModule vertShader;
 	if (!engine.loadShaderModule(vertPath, &vertShader)) {
 		std::cout << "Error when building vertex shader module: " << vertPath << "\n";
@@ -783,12 +785,10 @@ void initShadowPipelineInternal(VulkanEngine& engine, VkRenderPass& renderpass,
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo{ vkinit::vertexInputStateCreateInfo() };
 
 	VertexInputDescription vertexDescription{};
-	if (isSkinned) {
-		uint32_t stride{ sizeof(VertexSkinned) };
-		vertexDescription = getVertexDescription(ATTR_POSITION | ATTR_JOINT_INDICES | ATTR_JOINT_WEIGHTS, stride);
+	if (skinned) {
+		vertexDescription = getVertexDescription(ATTR_POSITION | ATTR_JOINT_INDICES | ATTR_JOINT_WEIGHTS, format);
 	} else {
-		uint32_t stride{ sizeof(Vertex) };
-		vertexDescription = getVertexDescription(ATTR_POSITION, stride);
+		vertexDescription = getVertexDescription(ATTR_POSITION, format);
 	}
 
 	vertexInputInfo.vertexAttributeDescriptionCount = vertexDescription.attributes.size();
@@ -833,12 +833,12 @@ void initShadowPipelineInternal(VulkanEngine& engine, VkRenderPass& renderpass,
 	vkDestroyShaderModule(engine._device, vertShader, nullptr);
 }
 
-void initShadowPipeline(VulkanEngine& engine, VkRenderPass& renderpass, VkPipelineLayout pipelineLayout, VkPipeline* pipeline)
+void initShadowPipeline(VulkanEngine& engine, VkRenderPass& renderpass, VkPipelineLayout pipelineLayout, VkPipeline* pipeline, bool quantized)
 {
-	initShadowPipelineInternal(engine, renderpass, pipelineLayout, pipeline, false);
+	initShadowPipelineInternal(engine, renderpass, pipelineLayout, pipeline, quantized ? VertexFormat::QUANTIZED : VertexFormat::DEFAULT);
 }
 
-void initShadowPipelineSkinned(VulkanEngine& engine, VkRenderPass& renderpass, VkPipelineLayout pipelineLayout, VkPipeline* pipeline)
+void initShadowPipelineSkinned(VulkanEngine& engine, VkRenderPass& renderpass, VkPipelineLayout pipelineLayout, VkPipeline* pipeline, bool quantized)
 {
-	initShadowPipelineInternal(engine, renderpass, pipelineLayout, pipeline, true);
+	initShadowPipelineInternal(engine, renderpass, pipelineLayout, pipeline, quantized ? VertexFormat::SKINNED_QUANTIZED : VertexFormat::SKINNED);
 }
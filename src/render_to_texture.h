@@ -10,9 +10,10 @@ void prepareShadowMapFramebuffer(VulkanEngine& engine, const ShadowGlobalResourc
 
 void prepareShadowMapRenderpass(VulkanEngine& engine, VkRenderPass* renderpass);
 
-void initShadowPipeline(VulkanEngine& engine, VkRenderPass& renderpass, VkPipelineLayout pipelineLayout, VkPipeline* pipeline);
+// quantized pipelines read the vertex layout of meshes baked with quantized vertices
+void initShadowPipeline(VulkanEngine& engine, VkRenderPass& renderpass, VkPipelineLayout pipelineLayout, VkPipeline* pipeline, bool quantized = false);
 
-void initShadowPipelineSkinned(VulkanEngine& engine, VkRenderPass& renderpass, VkPipelineLayout pipelineLayout, VkPipeline* pipeline);
+void initShadowPipelineSkinned(VulkanEngine& engine, VkRenderPass& renderpass, VkPipelineLayout pipelineLayout, VkPipeline* pipeline, bool quantized = false);
 
 void setupShadowDescriptorSetLayouts(VulkanEngine& engine, std::vector<VkDescriptorSetLayout>& setLayoutsOut, VkPipelineLayout* pipelineLayout);
 
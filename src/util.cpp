@@ -1,5 +1,14 @@
 #include "util.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
 /*
 * Derivation:
 * since -z is in front of camera and depth is in range [0, 1]
@@ -45,3 +54,19 @@ glm::vec3 vkutil::toGLM(const physx::PxVec3& v)
 {
 	return glm::vec3{ v.x, v.y, v.z };
 }
+
+size_t vkutil::peakResidentSetSize()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters{};
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return 0;
+	}
+	return (size_t)counters.PeakWorkingSetSize;
+#else
+	struct rusage usage {};
+	getrusage(RUSAGE_SELF, &usage);
+	// ru_maxrss is in kilobytes
+	return (size_t)usage.ru_maxrss * 1024;
+#endif
+}
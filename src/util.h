@@ -23,4 +23,7 @@ namespace vkutil {
 
 	glm::vec3 toGLM(const physx::PxVec3& v);
 
+	// peak resident memory of this process in bytes
+	size_t peakResidentSetSize();
+
 }
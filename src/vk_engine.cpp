@@ -29,9 +29,6 @@
 #include "SDL_mixer.h"
 #include "util.h"
 #include "texture_asset.h"
-#include "cereal/archives/binary.hpp"
-#include "cereal/types/vector.hpp"
-#include "cereal/types/string.hpp"
 
 #define VMA_IMPLEMENTATION
 #include "vk_mem_alloc.h"
@@ -93,7 +90,15 @@ physx::PxTransform Transform::toPhysx()
 
 void GameObject::playAnimation(const std::string& name)
 {
-	_renderObject->activeAnimation = _renderObject->mesh->skel.animNameToIndex[name];
+	int animation{ _renderObject->mesh->skel.findAnimation(name) };
+	if (animation < 0) {
+		std::cout << "Animation " << name << " not found\n";
+		return;
+	}
+
+	_renderObject->activeAnimation = animation;
+	_renderObject->animationTime = 0.0f;
+	_renderObject->keyCursors.assign(_renderObject->mesh->skel.animations[animation].samplerCount, 0);
 }
 
 void GameObject::setRenderObject(const RenderObject* ro)
@@ -324,8 +329,18 @@ void VulkanEngine::init(Application* app)
 	initObjectBuffers();
 	initShadowPass();
 	initDescriptors(); // descriptors are needed at pipeline create, so before materials
-	loadMeshes();
-	loadMaterials();
+	{
+		// report asset I/O cost so the mapped and streamed load paths can be compared on the same assets
+		auto loadStart{ std::chrono::high_resolution_clock::now() };
+		loadMeshes();
+		loadMaterials();
+		releaseQueuedAssets();
+		auto loadEnd{ std::chrono::high_resolution_clock::now() };
+
+		std::cout << "Loading assets (" << (USE_MAPPED_ASSET_FILES ? "mapped" : "streamed") << ") took "
+			<< std::chrono::duration_cast<std::chrono::nanoseconds>(loadEnd - loadStart).count() / 1000000.0 << "ms, peak RSS "
+			<< vkutil::peakResidentSetSize() / (1024.0 * 1024.0) << "MB\n";
+	}
 	initScene();
 	initBoundingSphere();
 	initImgui();
@@ -530,73 +545,112 @@ void VulkanEngine::immediateSubmit(std::function<void(VkCommandBuffer cmd)>&& fu
 	vkResetCommandPool(_device, _uploadContext._commandPool, 0);
 }
 
-void VulkanEngine::uploadMesh(Mesh* mesh)
+void VulkanEngine::uploadMesh(Mesh* mesh, const AllocatedBuffer& stagingBuffer, size_t vertexBufferSize, size_t indexBufferSize)
 {
-	uploadBuffer(mesh->vertices, mesh->vertexBuffer, true);
-	uploadBuffer(mesh->indices, mesh->indexBuffer, false);
-}
+	ZoneScoped;
+	mesh->vertexBuffer = createBuffer(vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	mesh->indexBuffer = createBuffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+
+	AllocatedBuffer vertexBuffer{ mesh->vertexBuffer };
+	AllocatedBuffer indexBuffer{ mesh->indexBuffer };
+
+	immediateSubmit([=](VkCommandBuffer cmd) {
+		VkBufferCopy vertexCopy{};
+		vertexCopy.srcOffset = 0;
+		vertexCopy.dstOffset = 0;
+		vertexCopy.size = vertexBufferSize;
+		vkCmdCopyBuffer(cmd, stagingBuffer._buffer, vertexBuffer._buffer, 1, &vertexCopy);
+
+		VkBufferCopy indexCopy{};
+		indexCopy.srcOffset = vertexBufferSize;
+		indexCopy.dstOffset = 0;
+		indexCopy.size = indexBufferSize;
+		vkCmdCopyBuffer(cmd, stagingBuffer._buffer, indexBuffer._buffer, 1, &indexCopy);
+	});
 
-void VulkanEngine::uploadMeshSkinned(Mesh* mesh)
-{
-	uploadBuffer(mesh->verticesSkinned, mesh->vertexBuffer, true);
-	uploadBuffer(mesh->indices, mesh->indexBuffer, false);
+	_mainDeletionQueue.pushFunction([=]() {
+		vmaDestroyBuffer(_allocator, vertexBuffer._buffer, vertexBuffer._allocation);
+		vmaDestroyBuffer(_allocator, indexBuffer._buffer, indexBuffer._allocation);
+	});
 }
 
 void VulkanEngine::loadSkeletalAnimation(const std::string& name, const std::string& path)
 {
 	std::cout << "Loading skeletal animation...\n";
 
-	assets::SkeletalAnimationDataAsset skelAsset;
-
-	{
-		std::ifstream ifs{ path, std::ios::binary };
-		cereal::BinaryInputArchive iarchive(ifs);
-
-		iarchive(skelAsset);
+	SkeletalAnimationData& skel{ _meshes[name]->skel };
+	if (!skel.mapping.open(path.c_str())) {
+		std::cout << "Error when loading skeleton " << path << '\n';
+		return;
 	}
 
+	loadSkeletalAnimation(name, skel.mapping.data(), skel.mapping.size(), false);
+}
+
+void VulkanEngine::loadSkeletalAnimation(const std::string& name, const char* data, size_t size, bool copy)
+{
 	SkeletalAnimationData& skel{ _meshes[name]->skel };
-	skel.nodes.resize(skelAsset.nodes.size());
-	skel.skins.resize(skelAsset.skins.size());
-	skel.animations.resize(skelAsset.animations.size());
 
-	// convert assets to real thing
+	// archives baked before their entries were aligned can't be used in place either
+	if (copy || reinterpret_cast<uintptr_t>(data) % assets::SKELETON_ALIGNMENT != 0) {
+		skel.fileData.assign(data, data + size);
+		data = skel.fileData.data();
+	}
 
-	for (int i = 0; i < skelAsset.nodes.size(); ++i) {
-		if (skelAsset.nodes[i].parentIdx > -1) {
-			skel.nodes[i].parent = &skel.nodes[skelAsset.nodes[i].parentIdx];
-		} else {
-			skel.nodes[i].parent = nullptr;
-		}
+	assets::SkeletonView view{};
+	if (!assets::viewSkeleton(data, size, view)) {
+		std::cout << "Error when loading skeleton " << name << '\n';
+		return;
+	}
 
-		for (int32_t childIdx : skelAsset.nodes[i].children) {
-			skel.nodes[i].children.push_back(&skel.nodes[childIdx]);
+	// animations are read straight out of the file
+	skel.animations = view.animations;
+	skel.animationCount = (uint32_t)view.header->animations.count;
+	skel.samplers = view.samplers;
+	skel.channels = view.channels;
+	skel.times = view.times;
+	skel.keys = view.keys;
+	skel.strings = view.strings;
+
+	skel.keyIndices.resize(skel.animationCount);
+	for (uint32_t i = 0; i < skel.animationCount; ++i) {
+		const Animation& animation{ skel.animations[i] };
+		for (uint32_t s = 0; s < animation.samplerCount; ++s) {
+			const AnimationSampler& sampler{ skel.samplers[animation.firstSampler + s] };
+			skel.keyIndices[i].addSampler(skel.times + sampler.firstKey, sampler.keyCount);
 		}
-
-		skel.nodes[i].matrix = skelAsset.nodes[i].matrix;
-		skel.nodes[i].cachedMatrix = glm::mat4(1.0f);
-		skel.nodes[i].name = skelAsset.nodes[i].name;
-		skel.nodes[i].translation = skelAsset.nodes[i].translation;
-		skel.nodes[i].scale = skelAsset.nodes[i].scale;
-		skel.nodes[i].rotation = skelAsset.nodes[i].rotation;
 	}
 
-	for (int i = 0; i < skelAsset.skins.size(); ++i) {
-		skel.skins[i].name = skelAsset.skins[i].name;
-		skel.skins[i].skeletonRoot = &skel.nodes[skelAsset.skins[i].skeletonRootIdx];
-		skel.skins[i].inverseBindMatrices = skelAsset.skins[i].inverseBindMatrices;
+	// nodes are copied once since animating them changes their pose
+	skel.nodes.resize(view.header->nodes.count);
+	for (size_t i = 0; i < skel.nodes.size(); ++i) {
+		const assets::SkeletonNode& source{ view.nodes[i] };
+		Node& node{ skel.nodes[i] };
+		node.parent = view.parents[i] < 0 ? nullptr : &skel.nodes[view.parents[i]];
+		node.matrix = source.matrix;
+		node.cachedMatrix = glm::mat4(1.0f);
+		node.translation = glm::vec3{ source.translation[0], source.translation[1], source.translation[2] };
+		node.scale = glm::vec3{ source.scale[0], source.scale[1], source.scale[2] };
+		node.rotation = glm::quat{ source.rotation[3], source.rotation[0], source.rotation[1], source.rotation[2] };
+	}
 
-		for (int32_t idx : skelAsset.skins[i].joints) {
-			skel.skins[i].joints.push_back(&skel.nodes[idx]);
-		}
+	skel.skins.resize(view.header->skins.count);
+	for (size_t i = 0; i < skel.skins.size(); ++i) {
+		const assets::SkeletonSkin& source{ view.skins[i] };
+		skel.skins[i].nodes = skel.nodes.data();
+		skel.skins[i].root = source.root;
+		skel.skins[i].nodeEnd = source.nodeEnd;
+		skel.skins[i].joints = view.joints + source.firstJoint;
+		skel.skins[i].inverseBindMatrices = view.inverseBindMatrices + source.firstJoint;
 
-		skel.skins[i].uniformBlock.jointCount = (float)std::min((uint32_t)skel.skins[i].joints.size(), MAX_NUM_JOINTS);
+		skel.skins[i].uniformBlock.jointCount = (float)std::min(source.jointCount, MAX_NUM_JOINTS);
 		skel.skins[i].allocator = &_allocator;
 
 		skel.skins[i].ubo = createBuffer(sizeof(Skin::UniformBlockSkinned), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
 
+		AllocatedBuffer ubo{ skel.skins[i].ubo };
 		_mainDeletionQueue.pushFunction([=]() {
-			vmaDestroyBuffer(_allocator, skel.skins[i].ubo._buffer, skel.skins[i].ubo._allocation);
+			vmaDestroyBuffer(_allocator, ubo._buffer, ubo._allocation);
 		});
 
 		VkDescriptorSetAllocateInfo skinAllocInfo{};
@@ -620,52 +674,262 @@ void VulkanEngine::loadSkeletalAnimation(const std::string& name, const std::str
 		setupShadowDescriptorSetsSkinned(*this, skel.skins[i].ubo._buffer, _shadowGlobal.shadowJointSetLayout, skel.skins[i].jointsShadowDescriptorSet);
 	}
 
-	// skelAsset and skelPool both use same animation struct
-	skel.animations = skelAsset.animations;
-
-	for (int i = 0; i < skelAsset.animations.size(); ++i) {
-		skel.animNameToIndex[skelAsset.animations[i].name] = i;
-	}
 }
 
 
 // load mesh onto CPU then upload it to the GPU
 void VulkanEngine::loadMesh(const std::string& name, const std::string& path)
 {
-	assets::AssetFile assetFile;
-	nlohmann::json metadata;
+	ZoneScoped;
+	assets::AssetFileView assetView;
+	assets::AssetMetadata metadata;
+	assets::IoHandle read;
+
+	if (!acquireAsset(path, assetView, metadata, read)) {
+		std::cout << "Error when loading mesh " << path << '\n';
+		return;
+	}
 
-	assets::loadBinaryFile(path.c_str(), assetFile, metadata);
+	loadMesh(name, path, assetView, metadata);
+}
+
+void VulkanEngine::loadMesh(const std::string& name, const std::string& path, const assets::AssetFileView& assetView, const assets::AssetMetadata& metadata)
+{
+	ZoneScoped;
 	assets::MeshInfo info{ assets::readMeshInfo(metadata) };
 
+	if (info.vertexFormat != VertexFormat::DEFAULT && info.vertexFormat != VertexFormat::SKINNED
+		&& info.vertexFormat != VertexFormat::QUANTIZED && info.vertexFormat != VertexFormat::SKINNED_QUANTIZED) {
+		std::cout << "Error: unrecognized vertex format in VulkanEngine::loadMesh\n";
+		return;
+	}
+
+	// the blob stores the vertex buffer followed by the index buffer, which is exactly the staging layout, then the
+	// meshlet, level of detail and submesh tables
+	size_t blobSize{ info.vertexBufferSize + info.indexBufferSize + info.meshletBufferSize + info.lodBufferSize + info.submeshBufferSize };
+	if (assetView.uncompressedBlobSize != blobSize) {
+		std::cout << "Error: mesh blob size does not match its metadata " << path << '\n';
+		return;
+	}
+
+	AllocatedBuffer stagingBuffer{ createBuffer(blobSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY) };
+
+	void* data;
+	vmaMapMemory(_allocator, stagingBuffer._allocation, &data);
+
+	bool unpacked{ true };
+	{
+		ZoneScopedN("unpack_mesh");
+		// decompressed straight into the staging buffer, without an intermediate copy
+		unpacked = assets::readBlob(assetView, info.compressionMode, data);
+	}
+
+	// the tables stay on the CPU, the GPU only needs the vertex and index buffers in front of them
+	std::vector<Meshlet> meshlets(info.meshletBufferSize / sizeof(Meshlet));
+	std::vector<MeshLod> lods(info.lodBufferSize / sizeof(MeshLod));
+	std::vector<Submesh> submeshes(info.submeshBufferSize / sizeof(Submesh));
+	if (unpacked) {
+		const char* tail{ (const char*)data + info.vertexBufferSize + info.indexBufferSize };
+		memcpy(meshlets.data(), tail, meshlets.size() * sizeof(Meshlet));
+		memcpy(lods.data(), tail + info.meshletBufferSize, lods.size() * sizeof(MeshLod));
+		memcpy(submeshes.data(), tail + info.meshletBufferSize + info.lodBufferSize, submeshes.size() * sizeof(Submesh));
+	}
+
+	vmaUnmapMemory(_allocator, stagingBuffer._allocation);
+
+	if (!unpacked) {
+		std::cout << "Error when decompressing mesh " << path << '\n';
+		vmaDestroyBuffer(_allocator, stagingBuffer._buffer, stagingBuffer._allocation);
+		return;
+	}
+
 	Mesh* mesh{ new Mesh{} };
-	mesh->indices.resize(info.indexBufferSize / info.indexSize);
 	mesh->vertexFormat = info.vertexFormat;
+	mesh->indexType = info.indexSize == sizeof(uint32_t) ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16;
+	mesh->meshlets = std::move(meshlets);
+	mesh->lods = std::move(lods);
+	mesh->submeshes = std::move(submeshes);
+
+	// meshes baked one primitive per file are a single submesh covering every table
+	if (mesh->submeshes.empty()) {
+		if (mesh->lods.empty()) {
+			mesh->lods.push_back(MeshLod{ 0, (uint32_t)(info.indexBufferSize / info.indexSize), 0.0f });
+		}
+
+		Submesh submesh{};
+		submesh.materialSlot = -1;
+		submesh.lodCount = (uint32_t)mesh->lods.size();
+		submesh.meshletCount = (uint32_t)mesh->meshlets.size();
+		for (int i = 0; i < 3; ++i) {
+			submesh.center[i] = info.bounds.origin[i];
+		}
+		submesh.radius = info.bounds.radius;
+		mesh->submeshes.push_back(submesh);
+	}
 
+	if (isQuantized(info.vertexFormat)) {
+		glm::vec3 origin{ info.bounds.origin[0], info.bounds.origin[1], info.bounds.origin[2] };
+		mesh->positionTransform = glm::translate(glm::mat4{ 1.0f }, origin) * glm::scale(glm::mat4{ 1.0f }, glm::vec3{ positionQuantizationScale(info.bounds) });
+	}
 
-	if (info.vertexFormat == VertexFormat::DEFAULT) {
+	uploadMesh(mesh, stagingBuffer, info.vertexBufferSize, info.indexBufferSize);
 
-		mesh->vertices.resize(info.vertexBufferSize / sizeof(Vertex));
-		assets::unpackMesh(&info, assetFile.binaryBlob.data(), (char*)mesh->vertices.data(), (char*)mesh->indices.data());
-		uploadMesh(mesh);
+	vmaDestroyBuffer(_allocator, stagingBuffer._buffer, stagingBuffer._allocation);
 
-	} else if (info.vertexFormat == VertexFormat::SKINNED) {
+	_meshes[name] = mesh;
+}
 
-		mesh->verticesSkinned.resize(info.vertexBufferSize / sizeof(VertexSkinned));
-		assets::unpackMesh(&info, assetFile.binaryBlob.data(), (char*)mesh->verticesSkinned.data(), (char*)mesh->indices.data());
-		uploadMeshSkinned(mesh);
+bool VulkanEngine::mapAsset(const std::string& path, assets::AssetFileView& asset, assets::AssetMetadata& metadataOut)
+{
+	const std::string exportPrefix{ ASSET_PREFIX + "/assets_export/" };
 
+	if (_assetArchive.isOpen() && path.compare(0, exportPrefix.size(), exportPrefix) == 0) {
+		const assets::ArchiveEntry* entry{ _assetArchive.find(path.substr(exportPrefix.size())) };
+		if (entry) {
+			return _assetArchive.viewEntry(*entry, asset, metadataOut);
+		}
+	}
+
+	return assets::mapBinaryFile(path.c_str(), asset, metadataOut);
+}
+
+void VulkanEngine::queueAssetRead(const std::string& path, assets::IoPriority priority)
+{
+	if (_queuedAssets.count(path) != 0) {
+		return;
+	}
+
+	QueuedAsset queued{};
+	queued.mapped = USE_MAPPED_ASSET_FILES;
+
+	if (USE_MAPPED_ASSET_FILES) {
+		// an asset that can't be mapped is left for acquireAsset to report
+		if (!mapAsset(path, queued.view, queued.metadata)) {
+			return;
+		}
+
+		assets::IoRead read{};
+		read.path = path;
+		read.source = queued.view.blob;
+		read.size = queued.view.blobSize;
+		queued.read = _ioService.read(std::move(read), priority);
 	} else {
-		std::cout << "Error: unrecognized vertex format in VulkanEngine::loadMesh\n";
+		queued.read = _ioService.readFile(path, priority);
 	}
 
-	_meshes[name] = mesh;
+	_queuedAssets.emplace(path, std::move(queued));
+}
+
+bool VulkanEngine::acquireAsset(const std::string& path, assets::AssetFileView& asset, assets::AssetMetadata& metadataOut, assets::IoHandle& readOut)
+{
+	auto queued{ _queuedAssets.find(path) };
+	if (queued == _queuedAssets.end()) {
+		queueAssetRead(path, assets::IoPriority::High);
+		queued = _queuedAssets.find(path);
+		if (queued == _queuedAssets.end()) {
+			return false;
+		}
+	}
+
+	QueuedAsset entry{ std::move(queued->second) };
+	_queuedAssets.erase(queued);
+	readOut = entry.read;
+
+	{
+		ZoneScopedN("wait_for_read");
+		if (!readOut.wait()) {
+			return false;
+		}
+	}
+
+	if (entry.mapped) {
+		asset = std::move(entry.view);
+		metadataOut = std::move(entry.metadata);
+		return true;
+	}
+
+	return assets::viewBinaryFile(readOut.data(), readOut.size(), asset, metadataOut);
+}
+
+void VulkanEngine::releaseQueuedAssets()
+{
+	for (auto& [path, queued] : _queuedAssets) {
+		queued.read.wait();
+	}
+	_queuedAssets.clear();
 }
 
 void VulkanEngine::loadMeshes()
 {
 	namespace fs = std::filesystem;
-	std::string modelsPath{ ASSET_PREFIX + "/assets_export/models/" };
+	std::string exportPath{ ASSET_PREFIX + "/assets_export/" };
+
+	if (USE_MAPPED_ASSET_FILES && _assetArchive.open((exportPath + assets::ASSET_ARCHIVE_NAME).c_str())) {
+		// The archive replaces the directory walk below. Entries are named models/<model>/<name>_GLTF/<file>
+		std::vector<fs::path> meshFiles;
+		std::vector<fs::path> skelFiles;
+
+		for (const assets::ArchiveEntry& entry : _assetArchive.entries()) {
+			// dictionaries have to be registered before any mesh compressed with them is loaded
+			if (memcmp(entry.type, "DICT", 4) == 0) {
+				const char* data{ _assetArchive.entryData(entry) };
+				assets::registerDictionary(std::vector<char>{ data, data + entry.size });
+				continue;
+			}
+
+			fs::path entryPath{ _assetArchive.entryName(entry) };
+			std::string folder{ entryPath.parent_path().filename().generic_string() };
+
+			if (entryPath.parent_path().parent_path().parent_path() != "models" || folder.size() < 5 || folder.substr(folder.size() - 5) != "_GLTF") {
+				continue;
+			}
+
+			if (entryPath.extension() == ".mesh") {
+				meshFiles.push_back(entryPath);
+			} else if (entryPath.extension() == ".skel") {
+				skelFiles.push_back(entryPath);
+			}
+		}
+
+		// the table of contents is sorted by hash, so restore a stable load order
+		std::sort(meshFiles.begin(), meshFiles.end());
+		std::sort(skelFiles.begin(), skelFiles.end());
+
+		// queue every read up front, so the disk keeps working while earlier meshes are decompressed and uploaded
+		for (const fs::path& meshFile : meshFiles) {
+			queueAssetRead(exportPath + meshFile.generic_string());
+		}
+
+		for (const fs::path& meshFile : meshFiles) {
+			std::string folder{ meshFile.parent_path().filename().generic_string() };
+			loadMesh(folder.substr(0, folder.size() - 5), exportPath + meshFile.generic_string());
+		}
+
+		// skeletons are attached to meshes, so they are loaded after all meshes
+		for (const fs::path& skelFile : skelFiles) {
+			std::string folder{ skelFile.parent_path().filename().generic_string() };
+			const assets::ArchiveEntry* entry{ _assetArchive.find(skelFile.generic_string()) };
+
+			loadSkeletalAnimation(folder.substr(0, folder.size() - 5), _assetArchive.entryData(*entry), (size_t)entry->size, false);
+		}
+
+		return;
+	}
+
+	std::string modelsPath{ exportPath + "models/" };
+
+	// the meshes share one dictionary, which has to be registered before any of them is loaded
+	std::string dictionaryPath{ exportPath + assets::MESH_DICTIONARY_NAME };
+	if (fs::exists(dictionaryPath)) {
+		assets::loadDictionaryFile(dictionaryPath.c_str());
+	}
+
+	struct AssetPath {
+		std::string name;
+		std::string path;
+	};
+	std::vector<AssetPath> meshFiles;
+	std::vector<AssetPath> skelFiles;
 
 	for (const auto& modelDir : fs::directory_iterator(modelsPath)) {
 		if (modelDir.is_directory()) {
@@ -678,21 +942,60 @@ void VulkanEngine::loadMeshes()
 					std::string name{ filename.substr(0, filename.size() - 5) };
 					std::cout << "Loading mesh '" << name << "'\n";
 
-					for (const auto& meshFile : fs::directory_iterator(file)) {
-						if (meshFile.path().extension() == ".mesh") {
-							loadMesh(name, meshFile.path().generic_string());
-						}
-					}
+					for (const auto& assetFile : fs::directory_iterator(file)) {
+						fs::path extension{ assetFile.path().extension() };
 
-					for (const auto& skelFile : fs::directory_iterator(file)) {
-						if (skelFile.path().extension() == ".skel") {
-							loadSkeletalAnimation(name, skelFile.path().generic_string());
+						if (extension == ".mesh") {
+							meshFiles.push_back(AssetPath{ name, assetFile.path().generic_string() });
+						} else if (extension == ".skel") {
+							skelFiles.push_back(AssetPath{ name, assetFile.path().generic_string() });
 						}
 					}
 				}
 			}
 		}
 	}
+
+	// queue every read up front, so the disk keeps working while earlier meshes are decompressed and uploaded
+	for (const AssetPath& meshFile : meshFiles) {
+		queueAssetRead(meshFile.path);
+	}
+
+	// skeletons are small and only needed once every mesh is loaded, so they are read as one low priority batch.
+	// Mapped skeletons are used in place instead
+	assets::IoHandle skelReads;
+	if (!USE_MAPPED_ASSET_FILES) {
+		std::vector<assets::IoRead> skelReadList;
+		for (const AssetPath& skelFile : skelFiles) {
+			assets::IoRead read{};
+			read.path = skelFile.path;
+			skelReadList.push_back(std::move(read));
+		}
+		skelReads = _ioService.readBatch(std::move(skelReadList), assets::IoPriority::Low);
+	}
+
+	for (const AssetPath& meshFile : meshFiles) {
+		loadMesh(meshFile.name, meshFile.path);
+	}
+
+	if (USE_MAPPED_ASSET_FILES) {
+		for (const AssetPath& skelFile : skelFiles) {
+			loadSkeletalAnimation(skelFile.name, skelFile.path);
+		}
+		return;
+	}
+
+	bool skelsRead{ skelReads.wait() };
+	for (size_t i = 0; i < skelFiles.size(); ++i) {
+		if (!skelsRead) {
+			// one of the reads failed, go through the files one by one so the error points at the right one
+			loadSkeletalAnimation(skelFiles[i].name, skelFiles[i].path);
+			continue;
+		}
+
+		// the batch is released when loading is done, so the skeleton keeps its own copy
+		loadSkeletalAnimation(skelFiles[i].name, skelReads.data(i), skelReads.size(i), true);
+	}
 }
 
 void VulkanEngine::loadTexture(const std::string& path, VkFormat format)
@@ -714,6 +1017,7 @@ void VulkanEngine::loadTexture(const std::string& path, VkFormat format)
 	}
 
 	VkImageViewCreateInfo imageInfo{ vkinit::imageviewCreateInfo(format, texture.image._image, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels) };
+	imageInfo.components = vkutil::textureSwizzle(format);
 	vkCreateImageView(_device, &imageInfo, nullptr, &texture.imageView);
 
 	_mainDeletionQueue.pushFunction([=]() {
@@ -742,6 +1046,29 @@ void VulkanEngine::loadMaterials()
 	stringToFormat["R8G8B8A8_UNORM"] = VK_FORMAT_R8G8B8A8_UNORM;
 	stringToFormat["R32G32B32A32_SFLOAT"] = VK_FORMAT_R32G32B32A32_SFLOAT; // hdri
 
+	// queue the reads of every baked texture the materials bind up front, so later textures are read while earlier ones
+	// are decompressed and uploaded
+	{
+		std::ifstream scan{ loadFile };
+		std::string texturePath;
+		while (std::getline(scan, line)) {
+			std::stringstream ss{ line };
+			std::string field;
+			ss >> field;
+
+			if (field == "path:") {
+				ss >> texturePath;
+			} else if (field == "format:" && !texturePath.empty()) {
+				std::string format;
+				ss >> format;
+				if (stringToFormat[format] != VK_FORMAT_R32G32B32A32_SFLOAT) {
+					queueAssetRead(ASSET_PREFIX + "/assets_export/models/" + texturePath);
+				}
+				texturePath.clear();
+			}
+		}
+	}
+
 
 	while (file) {
 
@@ -865,20 +1192,6 @@ void VulkanEngine::loadMaterials()
 	file.close();
 }
 
-// determine vertex stride from the vertex attributes
-uint32_t strideFromAttributes(uint32_t attr) {
-	uint32_t sum{ 0 };
-	if (attr & ATTR_POSITION) sum += sizeof(Vertex::position);
-	if (attr & ATTR_NORMAL) sum += sizeof(Vertex::normal);
-	if (attr & ATTR_TANGENT) sum += sizeof(Vertex::tangent);
-	if (attr & ATTR_UV) sum += sizeof(Vertex::uv);
-	if (attr & ATTR_JOINT_INDICES) sum += sizeof(VertexSkinned::jointIndices);
-	if (attr & ATTR_JOINT_WEIGHTS) sum += sizeof(VertexSkinned::jointWeights);
-
-	// Hacky, but we don't want to screw up cubemap atm
-	return std::max(sum, (uint32_t)sizeof(Vertex));
-}
-
 void VulkanEngine::initPipeline(const MaterialCreateInfo& info, const std::string& prefix)
 {
 	VkShaderModule vertShader;
@@ -950,7 +1263,9 @@ void VulkanEngine::initPipeline(const MaterialCreateInfo& info, const std::strin
 	pipelineBuilder._colorBlendAttachment = vkinit::colorBlendAttachmentState();
 	pipelineBuilder._depthStencil = vkinit::depthStencilCreateInfo(true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
 
-	VertexInputDescription vertexDescription{ getVertexDescription(info.attributeFlags, strideFromAttributes(info.attributeFlags)) };
+	// materials with joint attributes are only used by skinned meshes
+	bool skinned{ (info.attributeFlags & ATTR_JOINT_INDICES) != 0 };
+	VertexInputDescription vertexDescription{ getVertexDescription(info.attributeFlags, skinned ? VertexFormat::SKINNED : VertexFormat::DEFAULT) };
 
 	// connect the pipeline builder vertex input info to the one we get from Vertex
 	pipelineBuilder._vertexInputInfo.vertexAttributeDescriptionCount = vertexDescription.attributes.size();
@@ -969,13 +1284,23 @@ void VulkanEngine::initPipeline(const MaterialCreateInfo& info, const std::strin
 
 	VkPipeline pipeline{ pipelineBuilder.buildPipeline(_device, _renderPass, true) };
 
-	createMaterial(info, pipeline, layout, materialSetLayout);
+	// same pipeline again, for meshes baked with quantized vertices
+	VertexInputDescription quantizedDescription{ getVertexDescription(info.attributeFlags, skinned ? VertexFormat::SKINNED_QUANTIZED : VertexFormat::QUANTIZED) };
+	pipelineBuilder._vertexInputInfo.vertexAttributeDescriptionCount = quantizedDescription.attributes.size();
+	pipelineBuilder._vertexInputInfo.pVertexAttributeDescriptions = quantizedDescription.attributes.data();
+	pipelineBuilder._vertexInputInfo.vertexBindingDescriptionCount = quantizedDescription.bindings.size();
+	pipelineBuilder._vertexInputInfo.pVertexBindingDescriptions = quantizedDescription.bindings.data();
+
+	VkPipeline pipelineQuantized{ pipelineBuilder.buildPipeline(_device, _renderPass, true) };
+
+	createMaterial(info, pipeline, pipelineQuantized, layout, materialSetLayout);
 
 	vkDestroyShaderModule(_device, vertShader, nullptr);
 	vkDestroyShaderModule(_device, fragShader, nullptr);
 
 	_mainDeletionQueue.pushFunction([=]() {
 		vkDestroyPipeline(_device, pipeline, nullptr);
+		vkDestroyPipeline(_device, pipelineQuantized, nullptr);
 		vkDestroyPipelineLayout(_device, layout, nullptr);
 	});
 }
@@ -1441,6 +1766,15 @@ void VulkanEngine::initVulkan()
 		.select()
 		.value() };
 
+	// block compressed textures are optional, without them the assets have to be baked with -no-texture-compression
+	VkPhysicalDeviceFeatures supportedFeatures{};
+	vkGetPhysicalDeviceFeatures(physicalDevice.physical_device, &supportedFeatures);
+	_textureCompressionBC = supportedFeatures.textureCompressionBC == VK_TRUE;
+	if (_textureCompressionBC) {
+		physicalDevice.features.textureCompressionBC = VK_TRUE;
+	} else {
+		std::cout << "Warning: the GPU does not support BC texture compression, only textures baked with -no-texture-compression can be loaded\n";
+	}
 
 	// create the final Vulkan device
 	vkb::DeviceBuilder deviceBuilder{ physicalDevice };
@@ -1562,10 +1896,11 @@ AllocatedBuffer VulkanEngine::createBuffer(size_t allocSize, VkBufferUsageFlags
 	return newBuffer;
 }
 
-Material* VulkanEngine::createMaterial(const MaterialCreateInfo& info, VkPipeline pipeline, VkPipelineLayout layout, VkDescriptorSetLayout materialSetLayout)
+Material* VulkanEngine::createMaterial(const MaterialCreateInfo& info, VkPipeline pipeline, VkPipeline pipelineQuantized, VkPipelineLayout layout, VkDescriptorSetLayout materialSetLayout)
 {
 	Material mat{};
 	mat.pipeline = pipeline;
+	mat.pipelineQuantized = pipelineQuantized;
 	mat.pipelineLayout = layout;
 
 	VkDescriptorSetAllocateInfo allocInfo{};
@@ -1656,6 +1991,8 @@ void VulkanEngine::initShadowPass()
 
 	initShadowPipeline(*this, _shadowGlobal.renderPass, _shadowGlobal.shadowPipelineLayout, &_shadowGlobal.shadowPipeline);
 	initShadowPipelineSkinned(*this, _shadowGlobal.renderPass, _shadowGlobal.shadowPipelineLayoutSkinned, &_shadowGlobal.shadowPipelineSkinned);
+	initShadowPipeline(*this, _shadowGlobal.renderPass, _shadowGlobal.shadowPipelineLayout, &_shadowGlobal.shadowPipelineQuantized, true);
+	initShadowPipelineSkinned(*this, _shadowGlobal.renderPass, _shadowGlobal.shadowPipelineLayoutSkinned, &_shadowGlobal.shadowPipelineSkinnedQuantized, true);
 
 	for (auto i{ 0 }; i < FRAME_OVERLAP; ++i) {
 		ShadowFrameResources& shadowFrame{ _frames[i % FRAME_OVERLAP].shadow };
@@ -1765,23 +2102,26 @@ void VulkanEngine::shadowPass(VkCommandBuffer& cmd)
 	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _shadowGlobal.shadowPipelineLayout, 1, 1, &getCurrentFrame().shadow.shadowDescriptorSetObjects, 0, nullptr);
 
 	Mesh* lastMesh{ nullptr };
-	bool lastSkinned{ false };
+	VertexFormat lastFormat{ VertexFormat::DEFAULT };
 
 	uint32_t idx{ 0 };
 	for (const RenderObject& object : _renderables) {
 
 		// DO NOT change this to continue if !object.castShadow, because we need to increment idx still
 		if (object.castShadow) {
-			bool isSkinned{ object.mesh->vertexFormat == VertexFormat::SKINNED };
+			VertexFormat format{ object.mesh->vertexFormat };
+			bool skinned{ isSkinned(format) };
 
-			if (lastSkinned != isSkinned) {
-				VkPipeline pipeline{ isSkinned ? _shadowGlobal.shadowPipelineSkinned : _shadowGlobal.shadowPipeline };
+			if (lastFormat != format) {
+				VkPipeline pipeline{ skinned
+					? (isQuantized(format) ? _shadowGlobal.shadowPipelineSkinnedQuantized : _shadowGlobal.shadowPipelineSkinned)
+					: (isQuantized(format) ? _shadowGlobal.shadowPipelineQuantized : _shadowGlobal.shadowPipeline) };
 				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 
-				lastSkinned = isSkinned;
+				lastFormat = format;
 			}
 
-			if (isSkinned) {
+			if (skinned) {
 				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _shadowGlobal.shadowPipelineLayoutSkinned, 2, 1, &object.mesh->skel.skins[0].jointsShadowDescriptorSet, 0, nullptr);
 			}
 
@@ -1790,13 +2130,17 @@ void VulkanEngine::shadowPass(VkCommandBuffer& cmd)
 				// bind the mesh vertex buffer with offset 0
 				VkDeviceSize offset{ 0 };
 				vkCmdBindVertexBuffers(cmd, 0, 1, &object.mesh->vertexBuffer._buffer, &offset);
-				vkCmdBindIndexBuffer(cmd, object.mesh->indexBuffer._buffer, 0, VK_INDEX_TYPE_UINT16);
+				vkCmdBindIndexBuffer(cmd, object.mesh->indexBuffer._buffer, 0, object.mesh->indexType);
 
 				lastMesh = object.mesh;
 			}
 
-			//vkCmdDraw(cmd, object.mesh->_vertices.size(), 1, 0, idx);
-			vkCmdDrawIndexed(cmd, object.mesh->indices.size(), 1, 0, 0, idx);
+			for (const Submesh& submesh : object.mesh->submeshes) {
+				// same level of detail as the main pass, so the shadow matches the surface casting it
+				const MeshLod& lod{ object.mesh->lods[submesh.firstLod + selectLod(object, submesh)] };
+				//vkCmdDraw(cmd, object.mesh->_vertices.size(), 1, 0, idx);
+				vkCmdDrawIndexed(cmd, lod.indexCount, 1, lod.firstIndex, submesh.vertexOffset, idx);
+			}
 		}
 
 		++idx;
@@ -1823,6 +2167,19 @@ void VulkanEngine::cameraTransformation()
 	camData.projection = projection;
 	camData.viewProj = projection * view;
 
+	// Gribb-Hartmann plane extraction from the rows of viewProj, normalized so distances to them are in world units
+	glm::mat4 rows{ glm::transpose(camData.viewProj) };
+	_cameraFrustum.planes[0] = rows[3] + rows[0]; // left
+	_cameraFrustum.planes[1] = rows[3] - rows[0]; // right
+	_cameraFrustum.planes[2] = rows[3] + rows[1]; // bottom
+	_cameraFrustum.planes[3] = rows[3] - rows[1]; // top
+	_cameraFrustum.planes[4] = rows[3] + rows[2]; // near
+	for (glm::vec4& plane : _cameraFrustum.planes) {
+		plane /= glm::length(glm::vec3{ plane });
+	}
+
+	_lodProjectionScale = _windowExtent.height / (2.0f * std::tan(glm::radians(FOV) / 2.0f));
+
 	// copy camera data to camera buffer
 	void* data;
 	vmaMapMemory(_allocator, getCurrentFrame().cameraBuffer._allocation, &data);
@@ -1867,6 +2224,10 @@ void VulkanEngine::draw()
 			object.updateAnimation(_delta);
 		}
 		objectSSBO[idx] = object.uniformBlock;
+		// skinned meshes apply positionTransform before their joints instead, see Skin::update
+		if (isQuantized(object.mesh->vertexFormat) && !isSkinned(object.mesh->vertexFormat)) {
+			objectSSBO[idx].transformMatrix = object.uniformBlock.transformMatrix * object.mesh->positionTransform;
+		}
 		++idx;
 	}
 	vmaUnmapMemory(_allocator, getCurrentFrame().objectBuffer._allocation);
@@ -1982,6 +2343,7 @@ void VulkanEngine::drawObjects(VkCommandBuffer cmd, const std::multiset<RenderOb
 
 	Mesh* lastMesh{ nullptr };
 	Material* lastMaterial{ nullptr };
+	VkPipeline lastPipeline{ VK_NULL_HANDLE };
 
 	uint32_t pipelineBinds{ 0 };
 	uint32_t vertexBufferBinds{ 0 };
@@ -1994,9 +2356,15 @@ void VulkanEngine::drawObjects(VkCommandBuffer cmd, const std::multiset<RenderOb
 		}
 
 		// only bind the pipeline if it doesn't match with the already bound one
+		VkPipeline pipeline{ object.material->pipelineFor(object.mesh->vertexFormat) };
+		if (pipeline != lastPipeline) {
+			// both pipelines of a material share its layout, so its descriptor sets stay bound when switching between them
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+			lastPipeline = pipeline;
+			++pipelineBinds;
+		}
+
 		if (object.material != lastMaterial) {
-			// if this material has the same descriptor set layout then the pipelines might be the same and we don't have to rebind??
-			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipeline);
 			lastMaterial = object.material;
 
 			// camera data descriptor
@@ -2014,8 +2382,6 @@ void VulkanEngine::drawObjects(VkCommandBuffer cmd, const std::multiset<RenderOb
 			if (!object.mesh->skel.skins.empty()) {
 				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipelineLayout, 3, 1, &object.mesh->skel.skins[0].jointsDescriptorSet, 0, nullptr);
 			}
-
-			++pipelineBinds;
 		}
 
 		//glm::mat4 model{ object.transformMatrix };
@@ -2032,20 +2398,97 @@ void VulkanEngine::drawObjects(VkCommandBuffer cmd, const std::multiset<RenderOb
 			// bind the mesh vertex buffer with offset 0
 			VkDeviceSize offset{ 0 };
 			vkCmdBindVertexBuffers(cmd, 0, 1, &object.mesh->vertexBuffer._buffer, &offset);
-			vkCmdBindIndexBuffer(cmd, object.mesh->indexBuffer._buffer, 0, VK_INDEX_TYPE_UINT16);
+			vkCmdBindIndexBuffer(cmd, object.mesh->indexBuffer._buffer, 0, object.mesh->indexType);
 
 			lastMesh = object.mesh;
 			++vertexBufferBinds;
 		}
 
-		//vkCmdDraw(cmd, object.mesh->_vertices.size(), 1, 0, idx);
-		vkCmdDrawIndexed(cmd, object.mesh->indices.size(), 1, 0, 0, idx);
+		for (const Submesh& submesh : object.mesh->submeshes) {
+			// meshlets only cover the full detail submesh
+			uint32_t lod{ selectLod(object, submesh) };
+			if (lod > 0 || submesh.meshletCount == 0 || isSkinned(object.mesh->vertexFormat)) {
+				const MeshLod& range{ object.mesh->lods[submesh.firstLod + lod] };
+				//vkCmdDraw(cmd, object.mesh->_vertices.size(), 1, 0, idx);
+				vkCmdDrawIndexed(cmd, range.indexCount, 1, range.firstIndex, submesh.vertexOffset, idx);
+			} else {
+				cullMeshlets(object, submesh);
+				for (const DrawRange& range : _visibleRanges) {
+					vkCmdDrawIndexed(cmd, range.indexCount, 1, range.firstIndex, submesh.vertexOffset, idx);
+				}
+			}
+		}
 		++idx;
 	}
 
 	//std::cout << "pipeline binds: " << pipelineBinds << "\nvertex buffer binds: " << vertexBufferBinds << "\n\n";
 }
 
+uint32_t VulkanEngine::selectLod(const RenderObject& object, const Submesh& submesh) const
+{
+	if (submesh.lodCount <= 1) return 0;
+
+	const glm::mat4& model{ object.uniformBlock.transformMatrix };
+	float scale{ std::max(glm::length(glm::vec3{ model[0] }), std::max(glm::length(glm::vec3{ model[1] }), glm::length(glm::vec3{ model[2] }))) };
+
+	// the closest point of the bounding sphere is where the error is largest on screen
+	glm::vec3 center{ model * glm::vec4{ submesh.center[0], submesh.center[1], submesh.center[2], 1.0f } };
+	float distance{ std::max(glm::length(center - _camTransform.pos) - submesh.radius * scale, NEAR_PLANE) };
+
+	// largest mesh space error that projects to at most LOD_MAX_SCREEN_ERROR pixels at that distance
+	float maxError{ LOD_MAX_SCREEN_ERROR * distance / (_lodProjectionScale * scale) };
+
+	const MeshLod* lods{ &object.mesh->lods[submesh.firstLod] };
+	uint32_t lod{ 0 };
+	for (uint32_t i = 1; i < submesh.lodCount && lods[i].error <= maxError; ++i) {
+		lod = i;
+	}
+	return lod;
+}
+
+void VulkanEngine::cullMeshlets(const RenderObject& object, const Submesh& submesh)
+{
+	ZoneScoped;
+	_visibleRanges.clear();
+
+	const glm::mat4& model{ object.uniformBlock.transformMatrix };
+	glm::vec3 scale{ glm::length(glm::vec3{ model[0] }), glm::length(glm::vec3{ model[1] }), glm::length(glm::vec3{ model[2] }) };
+	float maxScale{ std::max(scale.x, std::max(scale.y, scale.z)) };
+	float minScale{ std::min(scale.x, std::min(scale.y, scale.z)) };
+
+	// non-uniform scale bends the normals, so the baked cones no longer bound them
+	bool coneCulling{ maxScale - minScale <= 0.01f * maxScale };
+
+	for (uint32_t i = submesh.firstMeshlet; i < submesh.firstMeshlet + submesh.meshletCount; ++i) {
+		const Meshlet& meshlet{ object.mesh->meshlets[i] };
+		glm::vec3 center{ model * glm::vec4{ meshlet.center[0], meshlet.center[1], meshlet.center[2], 1.0f } };
+		float radius{ meshlet.radius * maxScale };
+
+		bool visible{ true };
+		for (const glm::vec4& plane : _cameraFrustum.planes) {
+			if (glm::dot(glm::vec3{ plane }, center) + plane.w < -radius) {
+				visible = false;
+				break;
+			}
+		}
+
+		if (visible && coneCulling && meshlet.coneCutoff < 1.0f) {
+			glm::vec3 axis{ glm::normalize(glm::vec3{ model * glm::vec4{ meshlet.coneAxis[0], meshlet.coneAxis[1], meshlet.coneAxis[2], 0.0f } }) };
+			glm::vec3 toCenter{ center - _camTransform.pos };
+			visible = glm::dot(toCenter, axis) < meshlet.coneCutoff * glm::length(toCenter) + radius;
+		}
+
+		if (!visible) continue;
+
+		// meshlets are consecutive in the index buffer, so a run of visible ones is drawn as one range
+		if (!_visibleRanges.empty() && _visibleRanges.back().firstIndex + _visibleRanges.back().indexCount == meshlet.firstIndex) {
+			_visibleRanges.back().indexCount += meshlet.indexCount;
+		} else {
+			_visibleRanges.push_back(DrawRange{ meshlet.firstIndex, meshlet.indexCount });
+		}
+	}
+}
+
 void VulkanEngine::showFPS() {
 	uint32_t currentTicks{ SDL_GetTicks() };
 	double currentTime{ currentTicks / 1000.0 };
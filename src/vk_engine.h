@@ -24,6 +24,8 @@
 #include "application.h"
 #include "physics.h"
 #include "asset_loader.h"
+#include "asset_archive.h"
+#include "io_service.h"
 
 #define VK_CHECK(x)\
 	do\
@@ -43,6 +45,9 @@ constexpr uint32_t MAX_OBJECTS{ 10000 };
 constexpr float FOV{ 70.0f }; // degrees
 constexpr float NEAR_PLANE{ 0.05f };
 constexpr float FAR_PLANE_SHADOW{ 25.0f }; // Rendering has an inf far plane, this is only used for shadow maps
+// Map asset files into memory instead of reading them through std::ifstream
+constexpr bool USE_MAPPED_ASSET_FILES{ true };
+constexpr float LOD_MAX_SCREEN_ERROR{ 1.0f }; // pixels a level of detail may move the surface on screen
 
 struct VulkanEngine;
 
@@ -69,6 +74,18 @@ struct GPUCameraData {
 	glm::mat4 viewProj;
 };
 
+// World space planes of the camera frustum as (normal, distance) with normals pointing inwards.
+// The projection is infinite, so there is no far plane
+struct Frustum {
+	glm::vec4 planes[5];
+};
+
+// Consecutive indices drawn with a single draw call
+struct DrawRange {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+};
+
 struct ShadowGlobalResources {
 	uint32_t width;
 	uint32_t height;
@@ -80,6 +97,8 @@ struct ShadowGlobalResources {
 	float depthBiasSlope{ 1.75f };
 	VkPipeline shadowPipeline;
 	VkPipeline shadowPipelineSkinned;
+	VkPipeline shadowPipelineQuantized;
+	VkPipeline shadowPipelineSkinnedQuantized;
 	VkPipelineLayout shadowPipelineLayout;
 	VkPipelineLayout shadowPipelineLayoutSkinned;
 	VkDescriptorSetLayout shadowJointSetLayout;
@@ -294,11 +313,19 @@ public:
 	std::unordered_map<std::string, Mesh*> _meshes;
 
 	Transform _camTransform{};
+	// updated by cameraTransformation for culling
+	Frustum _cameraFrustum;
+	// pixels covered by one world unit at a distance of one unit from the camera, used to pick levels of detail
+	float _lodProjectionScale{ 1.0f };
+	// meshlet ranges that survived culling for the object being drawn, reused between objects to avoid allocating
+	std::vector<DrawRange> _visibleRanges;
 
 	VkDescriptorSetLayout _globalSetLayout;
 	VkDescriptorPool _descriptorPool;
 
 	VkPhysicalDeviceProperties _gpuProperties;
+	// whether BC1-BC7 images can be sampled, textures baked with block compression can't be loaded otherwise
+	bool _textureCompressionBC{ false };
 
 	GPUSceneData _sceneParameters;
 	AllocatedBuffer _sceneParameterBuffer;
@@ -311,6 +338,22 @@ public:
 	//texture hashmap
 	std::unordered_map<std::string, Texture> _loadedTextures;
 
+	// baked assets packed by the baker, if present. Falls back to loose files otherwise
+	assets::AssetArchive _assetArchive;
+
+	// background reads of baked assets, so loading can decompress and upload one asset while the next is read
+	assets::IoService _ioService;
+
+	// an asset whose read was queued before it is needed. Mapped assets are viewed right away and the read only faults
+	// their blob in, read assets are viewed once the read is done
+	struct QueuedAsset {
+		assets::AssetFileView view;
+		assets::AssetMetadata metadata;
+		assets::IoHandle read;
+		bool mapped;
+	};
+	std::unordered_map<std::string, QueuedAsset> _queuedAssets;
+
 	GuiData _guiData;
 
 	// frame storage
@@ -364,10 +407,23 @@ public:
 
 	void loadTexture(const std::string& path, VkFormat format);
 
+	// maps a baked asset, from the asset archive when it contains path and from its own file otherwise
+	bool mapAsset(const std::string& path, assets::AssetFileView& asset, assets::AssetMetadata& metadataOut);
+
+	// starts reading a baked asset on the I/O service ahead of acquireAsset
+	void queueAssetRead(const std::string& path, assets::IoPriority priority = assets::IoPriority::Normal);
+
+	// waits for the queued read of path, or reads it now if it was never queued. readOut owns the data asset points
+	// into when assets are not mapped, so it has to outlive asset
+	bool acquireAsset(const std::string& path, assets::AssetFileView& asset, assets::AssetMetadata& metadataOut, assets::IoHandle& readOut);
+
+	// waits for queued reads nothing acquired, they still point into their mappings
+	void releaseQueuedAssets();
+
 	bool loadShaderModule(const std::string& filePath, VkShaderModule* outShaderModule);
 
 	// create material and add it to the map
-	Material* createMaterial(const MaterialCreateInfo& info, VkPipeline pipeline, VkPipelineLayout layout, VkDescriptorSetLayout materialSetLayout);
+	Material* createMaterial(const MaterialCreateInfo& info, VkPipeline pipeline, VkPipeline pipelineQuantized, VkPipelineLayout layout, VkDescriptorSetLayout materialSetLayout);
 
 	// returns nullptr if it can't be found
 	Mesh* getMesh(const std::string& name);
@@ -435,6 +491,12 @@ private:
 
 	void drawObjects(VkCommandBuffer cmd, const std::multiset<RenderObject>& renderables);
 
+	// Fills _visibleRanges with the meshlets of submesh that may be visible, merging neighbouring ones into a single range
+	void cullMeshlets(const RenderObject& object, const Submesh& submesh);
+
+	// Coarsest level of detail of submesh whose error stays within LOD_MAX_SCREEN_ERROR pixels, relative to its first one
+	uint32_t selectLod(const RenderObject& object, const Submesh& submesh) const;
+
 	void initDescriptors();
 
 	void initObjectBuffers();
@@ -467,70 +529,17 @@ private:
 
 	void loadMesh(const std::string& name, const std::string& path);
 
+	// Same as above for an asset file that is already in memory, path is only used for error messages
+	void loadMesh(const std::string& name, const std::string& path, const assets::AssetFileView& asset, const assets::AssetMetadata& metadata);
+
 	void loadSkeletalAnimation(const std::string& name, const std::string& path);
 
-	void uploadMesh(Mesh* mesh);
-
-	void uploadMeshSkinned(Mesh* mesh);
-
-	// For use with vertex buffers or index buffers. If !isVertexBuffer, then index buffer is assumed
-	template <typename T>
-	void uploadBuffer(const std::vector<T>& vec, AllocatedBuffer& buffer, bool isVertexBuffer)
-	{
-		const size_t bufferSize{ vec.size() * sizeof(T) };
-		// allocate staging buffer
-		VkBufferCreateInfo stagingBufferInfo{};
-		stagingBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		stagingBufferInfo.pNext = nullptr;
-		stagingBufferInfo.size = bufferSize;
-		stagingBufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-
-		// let the VMA library know that this data should be on CPU RAM
-		VmaAllocationCreateInfo vmaAllocInfo{};
-		vmaAllocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
-
-		AllocatedBuffer stagingBuffer{};
-		VK_CHECK(vmaCreateBuffer(_allocator, &stagingBufferInfo, &vmaAllocInfo,
-			&stagingBuffer._buffer,
-			&stagingBuffer._allocation,
-			nullptr));
-
-		// copy data
-		void* data;
-		vmaMapMemory(_allocator, stagingBuffer._allocation, &data);
-		std::memcpy(data, vec.data(), vec.size() * sizeof(T));
-		vmaUnmapMemory(_allocator, stagingBuffer._allocation);
-
-		VkBufferUsageFlags bufferUsage = isVertexBuffer ? VK_BUFFER_USAGE_VERTEX_BUFFER_BIT : VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-
-		// now we need the GPU-side buffer since we've populated the staging buffer
-		VkBufferCreateInfo bufferInfo{};
-		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		bufferInfo.pNext = nullptr;
-		bufferInfo.size = bufferSize;
-		bufferInfo.usage = bufferUsage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-
-		// let the VMA library know that this data should be GPU native
-		vmaAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-
-		VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaAllocInfo,
-			&buffer._buffer,
-			&buffer._allocation,
-			nullptr));
-
-		immediateSubmit([=](VkCommandBuffer cmd) {
-			VkBufferCopy copy;
-			copy.dstOffset = 0;
-			copy.srcOffset = 0;
-			copy.size = bufferSize;
-			vkCmdCopyBuffer(cmd, stagingBuffer._buffer, buffer._buffer, 1, &copy);
-		});
-
-		_mainDeletionQueue.pushFunction([=]() {
-			vmaDestroyBuffer(_allocator, buffer._buffer, buffer._allocation);
-		});
-		vmaDestroyBuffer(_allocator, stagingBuffer._buffer, stagingBuffer._allocation);
-	}
+	// Same as above for a skeleton file that is already in memory. The skeleton reads its animations straight out of
+	// data, so data has to outlive the mesh unless copy is set
+	void loadSkeletalAnimation(const std::string& name, const char* data, size_t size, bool copy);
+
+	// Copies vertex data followed by index data from stagingBuffer into new GPU buffers with a single submit
+	void uploadMesh(Mesh* mesh, const AllocatedBuffer& stagingBuffer, size_t vertexBufferSize, size_t indexBufferSize);
 };
 
 class PipelineBuilder {
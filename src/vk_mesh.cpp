@@ -7,28 +7,45 @@
 
 bool RenderObject::operator<(const RenderObject& other) const
 {
-	if (material->pipeline == other.material->pipeline) {
-		return mesh->vertexBuffer._buffer < other.mesh->vertexBuffer._buffer;
-	} else {
+	if (material->pipeline != other.material->pipeline) {
 		return material->pipeline < other.material->pipeline;
+	} else if (isQuantized(mesh->vertexFormat) != isQuantized(other.mesh->vertexFormat)) {
+		// keeps objects drawn with the same pipeline variant together
+		return isQuantized(other.mesh->vertexFormat);
+	} else {
+		return mesh->vertexBuffer._buffer < other.mesh->vertexBuffer._buffer;
 	}
 }
 
 void RenderObject::updateSkin() const
 {
-	for (Skin skin : mesh->skel.skins) {
-		skin.update(uniformBlock.transformMatrix);
+	for (Skin& skin : mesh->skel.skins) {
+		skin.update(uniformBlock.transformMatrix, mesh->positionTransform);
+	}
+}
+
+uint32_t vertexStride(VertexFormat format)
+{
+	switch (format) {
+	case VertexFormat::SKINNED:
+		return sizeof(VertexSkinned);
+	case VertexFormat::QUANTIZED:
+		return sizeof(VertexQuantized);
+	case VertexFormat::SKINNED_QUANTIZED:
+		return sizeof(VertexSkinnedQuantized);
+	default:
+		return sizeof(Vertex);
 	}
 }
 
-VertexInputDescription getVertexDescription(uint32_t attrFlags, uint32_t stride)
+VertexInputDescription getVertexDescription(uint32_t attrFlags, VertexFormat format)
 {
 	VertexInputDescription description;
 
 	// we will have just 1 vertex buffer binding, with a per-vertex rate
 	VkVertexInputBindingDescription mainBinding{};
 	mainBinding.binding = 0;
-	mainBinding.stride = stride;
+	mainBinding.stride = vertexStride(format);
 	mainBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
 	description.bindings.push_back(mainBinding);
@@ -36,38 +53,55 @@ VertexInputDescription getVertexDescription(uint32_t attrFlags, uint32_t stride)
 	VkVertexInputAttributeDescription positionAttribute{};
 	positionAttribute.binding = 0;
 	positionAttribute.location = 0;
-	positionAttribute.format = VK_FORMAT_R32G32B32A32_SFLOAT; // vec4
-	positionAttribute.offset = offsetof(Vertex, position);
 
 	VkVertexInputAttributeDescription normalAttribute{};
 	normalAttribute.binding = 0;
 	normalAttribute.location = 1;
-	normalAttribute.format = VK_FORMAT_R32G32B32A32_SFLOAT; // vec4
-	normalAttribute.offset = offsetof(Vertex, normal);
 
 	VkVertexInputAttributeDescription tangentAttribute{};
 	tangentAttribute.binding = 0;
 	tangentAttribute.location = 2;
-	tangentAttribute.format = VK_FORMAT_R32G32B32A32_SFLOAT; // vec4
-	tangentAttribute.offset = offsetof(Vertex, tangent);
 
 	VkVertexInputAttributeDescription uvAttribute{};
 	uvAttribute.binding = 0;
 	uvAttribute.location = 3;
-	uvAttribute.format = VK_FORMAT_R32G32_SFLOAT; // vec2
-	uvAttribute.offset = offsetof(Vertex, uv);
 
 	VkVertexInputAttributeDescription jointIndicesAttribute{};
 	jointIndicesAttribute.binding = 0;
 	jointIndicesAttribute.location = 4;
-	jointIndicesAttribute.format = VK_FORMAT_R32G32B32A32_SFLOAT; // vec4
-	jointIndicesAttribute.offset = offsetof(VertexSkinned, jointIndices);
 
 	VkVertexInputAttributeDescription jointWeightsAttribute{};
 	jointWeightsAttribute.binding = 0;
 	jointWeightsAttribute.location = 5;
-	jointWeightsAttribute.format = VK_FORMAT_R32G32B32A32_SFLOAT; // vec4
-	jointWeightsAttribute.offset = offsetof(VertexSkinned, jointWeights);
+
+	if (isQuantized(format)) {
+		// the shaders see the same floats as with the float formats
+		positionAttribute.format = VK_FORMAT_R16G16B16A16_SNORM;
+		positionAttribute.offset = offsetof(VertexSkinnedQuantized, position);
+		normalAttribute.format = VK_FORMAT_R8G8B8A8_SNORM;
+		normalAttribute.offset = offsetof(VertexSkinnedQuantized, normal);
+		tangentAttribute.format = VK_FORMAT_R8G8B8A8_SNORM;
+		tangentAttribute.offset = offsetof(VertexSkinnedQuantized, tangent);
+		uvAttribute.format = VK_FORMAT_R16G16_SFLOAT;
+		uvAttribute.offset = offsetof(VertexSkinnedQuantized, uv);
+		jointIndicesAttribute.format = VK_FORMAT_R8G8B8A8_USCALED;
+		jointIndicesAttribute.offset = offsetof(VertexSkinnedQuantized, jointIndices);
+		jointWeightsAttribute.format = VK_FORMAT_R8G8B8A8_UNORM;
+		jointWeightsAttribute.offset = offsetof(VertexSkinnedQuantized, jointWeights);
+	} else {
+		positionAttribute.format = VK_FORMAT_R32G32B32A32_SFLOAT; // vec4
+		positionAttribute.offset = offsetof(Vertex, position);
+		normalAttribute.format = VK_FORMAT_R32G32B32A32_SFLOAT; // vec4
+		normalAttribute.offset = offsetof(Vertex, normal);
+		tangentAttribute.format = VK_FORMAT_R32G32B32A32_SFLOAT; // vec4
+		tangentAttribute.offset = offsetof(Vertex, tangent);
+		uvAttribute.format = VK_FORMAT_R32G32_SFLOAT; // vec2
+		uvAttribute.offset = offsetof(Vertex, uv);
+		jointIndicesAttribute.format = VK_FORMAT_R32G32B32A32_SFLOAT; // vec4
+		jointIndicesAttribute.offset = offsetof(VertexSkinned, jointIndices);
+		jointWeightsAttribute.format = VK_FORMAT_R32G32B32A32_SFLOAT; // vec4
+		jointWeightsAttribute.offset = offsetof(VertexSkinned, jointWeights);
+	}
 
 	if (attrFlags & ATTR_POSITION) description.attributes.push_back(positionAttribute);
 	if (attrFlags & ATTR_NORMAL) description.attributes.push_back(normalAttribute);
@@ -79,27 +113,22 @@ VertexInputDescription getVertexDescription(uint32_t attrFlags, uint32_t stride)
 	return description;
 }
 
-void updateJointMatrices(Node* root, const glm::mat4& mat)
-{
-	root->cachedMatrix = mat * root->localMatrix();
-
-	for (Node* child : root->children) {
-		updateJointMatrices(child, root->cachedMatrix);
-	}
-}
-
 // m is the renderObject's transform.
 // Updates skin's joint matrices, as well as each bone's transform.
 // Also updates Skin's descriptor
-void Skin::update(const glm::mat4& m)
+void Skin::update(const glm::mat4& m, const glm::mat4& positionTransform)
 {
 	//glm::mat4 inverseTransform = glm::inverse(m);
 	size_t numJoints = (size_t)uniformBlock.jointCount;
 
-	updateJointMatrices(skeletonRoot, glm::mat4(1.0f));
+	// parents come before their children, so a single pass over the skeleton root's descendants updates them all
+	nodes[root].cachedMatrix = nodes[root].localMatrix();
+	for (uint32_t i = root + 1; i < nodeEnd; ++i) {
+		nodes[i].cachedMatrix = nodes[i].parent->cachedMatrix * nodes[i].localMatrix();
+	}
 
 	for (size_t i = 0; i < numJoints; ++i) {
-		glm::mat4 jointMat = joints[i]->getCachedMatrix() * inverseBindMatrices[i];
+		glm::mat4 jointMat = nodes[joints[i]].getCachedMatrix() * inverseBindMatrices[i] * positionTransform;
 		//glm::mat4 jointMat = joints[i]->getMatrix() * inverseBindMatrices[i];
 		//jointMat = inverseTransform * jointMat;
 		uniformBlock.jointMatrices[i] = jointMat;
@@ -114,56 +143,49 @@ void Skin::update(const glm::mat4& m)
 
 void RenderObject::updateAnimation(float deltaTime) const
 {
-	Animation& animation = mesh->skel.animations[activeAnimation];
-	animation.currentTime += deltaTime;
-	if (animation.currentTime > animation.end) {
-		animation.currentTime -= animation.end;
+	SkeletalAnimationData& skel{ mesh->skel };
+	const Animation& animation = skel.animations[activeAnimation];
+	animationTime += deltaTime;
+	if (animationTime > animation.end) {
+		animationTime -= animation.end;
 	}
 
-	for (AnimationChannel& channel : animation.channels) {
-
-		AnimationSampler& sampler = animation.samplers[channel.samplerIndex];
-		Node& node = mesh->skel.nodes[channel.nodeIdx];
+	// sampler times are in ticks of the animation's time step
+	float tick{ animationTime / animation.timeStep };
 
-		for (size_t i = 0; i < sampler.inputs.size() - 1; ++i) {
+	const KeyframeIndex& keyIndex{ skel.keyIndices[activeAnimation] };
+	keyCursors.resize(animation.samplerCount);
 
-			// Get the input keyframe values for the current time stamp
-			if ((animation.currentTime >= sampler.inputs[i]) && (animation.currentTime <= sampler.inputs[i + 1])) {
+	for (uint32_t c = 0; c < animation.channelCount; ++c) {
 
-				float a{};
+		const AnimationChannel& channel = skel.channels[animation.firstChannel + c];
+		const AnimationSampler& sampler = skel.samplers[animation.firstSampler + channel.samplerIndex];
+		const uint16_t* times{ skel.times + sampler.firstKey };
+		const uint16_t* keys{ skel.keys + (size_t)sampler.firstKey * 3 };
+		Node& node = skel.nodes[channel.nodeIdx];
 
-				if (sampler.interpolation == Interpolation::STEP || mesh->skel.forceStepInterpolation) {
+		// before the first key the track holds its first value, after the last key its last one. The baker reduces
+		// tracks that never change to a single key
+		size_t first{ keyIndex.findKey(channel.samplerIndex, tick, keyCursors[channel.samplerIndex]) };
+		size_t second{ first };
+		float a{};
 
-					a = 0.0f;
-
-				} else if (sampler.interpolation == Interpolation::LINEAR) {
-					// Calculate interpolation value based on timestamp
-					// at input1, a = 0, at input2 a=1, with linear interpolation
-					a = (animation.currentTime - sampler.inputs[i]) / (sampler.inputs[i + 1] - sampler.inputs[i]);
-				}
-
-				if (channel.path == AnimationChannel::TRANSLATION) {
-					node.translation = glm::mix(sampler.outputsVec4[i], sampler.outputsVec4[i + 1], a);
-				} else if (channel.path == AnimationChannel::ROTATION) {
-					glm::quat q1;
-					q1.x = sampler.outputsVec4[i].x;
-					q1.y = sampler.outputsVec4[i].y;
-					q1.z = sampler.outputsVec4[i].z;
-					q1.w = sampler.outputsVec4[i].w;
-
-					glm::quat q2;
-					q2.x = sampler.outputsVec4[i + 1].x;
-					q2.y = sampler.outputsVec4[i + 1].y;
-					q2.z = sampler.outputsVec4[i + 1].z;
-					q2.w = sampler.outputsVec4[i + 1].w;
-
-					node.rotation = glm::normalize(glm::slerp(q1, q2, a));
-				} else if (channel.path == AnimationChannel::SCALE) {
-					node.scale = glm::mix(sampler.outputsVec4[i], sampler.outputsVec4[i + 1], a);
-				}
+		if (first + 1 < sampler.keyCount && tick >= times[first]) {
+			second = first + 1;
 
+			if (sampler.interpolation != Interpolation::STEP && !skel.forceStepInterpolation) {
+				// at input1, a = 0, at input2 a=1, with linear interpolation
+				a = (tick - times[first]) / (times[second] - times[first]);
 			}
 		}
+
+		if (channel.path == AnimationChannel::TRANSLATION) {
+			node.translation = glm::mix(sampler.vectorKey(keys + first * 3), sampler.vectorKey(keys + second * 3), a);
+		} else if (channel.path == AnimationChannel::ROTATION) {
+			node.rotation = glm::normalize(glm::slerp(AnimationSampler::rotationKey(keys + first * 3), AnimationSampler::rotationKey(keys + second * 3), a));
+		} else if (channel.path == AnimationChannel::SCALE) {
+			node.scale = glm::mix(sampler.vectorKey(keys + first * 3), sampler.vectorKey(keys + second * 3), a);
+		}
 	}
 
 	updateSkin();
@@ -171,7 +193,7 @@ void RenderObject::updateAnimation(float deltaTime) const
 
 bool RenderObject::animated() const
 {
-	return !mesh->skel.animations.empty();
+	return mesh->skel.animationCount > 0;
 }
 
 // Node
@@ -5,6 +5,9 @@
 #include <limits>
 #include <cstdint>
 #include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <string_view>
 
 #include "vk_types.h"
 #include "glm/vec3.hpp"
@@ -12,6 +15,8 @@
 #include "glm/gtc/quaternion.hpp"
 #include "glm/gtx/quaternion.hpp"
 #include "json.hpp"
+#include "mapped_file.h"
+#include "keyframe_index.h"
 
 // Changing this value here also requires changing it in the vertex shader
 constexpr uint32_t MAX_NUM_JOINTS{ 128 };
@@ -52,14 +57,94 @@ struct VertexSkinned {
 	glm::vec4 jointWeights;
 };
 
+/*
+	Quantized vertices, read by the same shaders as the float formats since the vertex fetch converts them back to floats:
+
+	position       snorm16, relative to the mesh bounds. Mesh::positionTransform maps it back to mesh space
+	normal         snorm8
+	tangent        snorm8, w is sign
+	uv             half floats
+	jointIndices   uint8, read as floats (USCALED)
+	jointWeights   unorm8, summing to exactly 255
+*/
+struct VertexQuantized {
+	int16_t position[4]; // w is unused
+	int8_t normal[4]; // w is unused
+	int8_t tangent[4];
+	uint16_t uv[2];
+};
+
+struct VertexSkinnedQuantized {
+	int16_t position[4]; // w is unused
+	int8_t normal[4]; // w is unused
+	int8_t tangent[4];
+	uint16_t uv[2];
+	uint8_t jointIndices[4];
+	uint8_t jointWeights[4];
+};
+
+// Consecutive triangles of a mesh's index buffer with the bounds needed to cull them on their own
+struct Meshlet {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	// bounding sphere in mesh space
+	float center[3];
+	float radius;
+	// every triangle faces away from a viewer at p if dot(center - p, coneAxis) >= coneCutoff * length(center - p) + radius.
+	// A cutoff of 1 means the triangles face too many directions to ever be culled this way
+	float coneAxis[3];
+	float coneCutoff;
+};
+
+// Range of a mesh's index buffer drawing a whole submesh at a level of detail. Level 0 is the full submesh,
+// each following level has about half the triangles of the previous one
+struct MeshLod {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	// furthest the simplified surface is from the full mesh, in mesh space units
+	float error;
+};
+
+// Part of a mesh with its own ranges of the mesh's buffers and tables, one per glTF primitive
+struct Submesh {
+	// added to every index, so each submesh's indices start at 0 and usually fit in 16 bits
+	int32_t vertexOffset;
+	// index of the primitive's material in the source model, -1 if it has none
+	int32_t materialSlot;
+	// levels of detail in Mesh::lods, the first one is the full detail submesh
+	uint32_t firstLod;
+	uint32_t lodCount;
+	// meshlets in Mesh::meshlets covering the full detail submesh
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;
+	// mesh space bounding sphere
+	float center[3];
+	float radius;
+};
+
 enum class VertexFormat : uint32_t
 {
 	Unknown = 0,
 	DEFAULT,
 	SKINNED,
+	QUANTIZED,
+	SKINNED_QUANTIZED,
 };
 
-VertexInputDescription getVertexDescription(uint32_t attrFlags, uint32_t stride);
+inline bool isSkinned(VertexFormat format)
+{
+	return format == VertexFormat::SKINNED || format == VertexFormat::SKINNED_QUANTIZED;
+}
+
+inline bool isQuantized(VertexFormat format)
+{
+	return format == VertexFormat::QUANTIZED || format == VertexFormat::SKINNED_QUANTIZED;
+}
+
+uint32_t vertexStride(VertexFormat format);
+
+// Attribute formats and offsets follow the vertex struct of format, attrFlags picks which attributes the shader reads
+VertexInputDescription getVertexDescription(uint32_t attrFlags, VertexFormat format);
 
 // ------------------------------------------------------------------------------------------ //
 //                                         Skeleton                                           //
@@ -68,11 +153,13 @@ VertexInputDescription getVertexDescription(uint32_t attrFlags, uint32_t stride)
 struct Node;
 
 struct Skin {
-	std::string name;
-	Node* skeletonRoot{}; // node which is root of skeleton
-	//Node* meshNode{}; // node which has a pointer to the mesh
-	std::vector<glm::mat4> inverseBindMatrices;
-	std::vector<Node*> joints;
+	// nodes[root] is the root of the skeleton and nodes[root + 1] to nodes[nodeEnd - 1] its descendants
+	Node* nodes{};
+	uint32_t root{};
+	uint32_t nodeEnd{};
+	// node index and inverse bind matrix of every joint, pointing into the skeleton file
+	const uint32_t* joints{};
+	const glm::mat4* inverseBindMatrices{};
 	AllocatedBuffer ubo; // pass actual joint matrices for current animation frame using ubo
 	VkDescriptorSet jointsDescriptorSet;
 	VkDescriptorSet jointsShadowDescriptorSet;
@@ -83,10 +170,13 @@ struct Skin {
 		float jointCount{ 0 };
 	} uniformBlock;
 
-	void update(const glm::mat4& m);
+	// positionTransform is the skinned mesh's Mesh::positionTransform, applied before the joints
+	void update(const glm::mat4& m, const glm::mat4& positionTransform);
 };
 
-enum class Interpolation {
+// Interpolation, AnimationChannel, AnimationSampler and Animation are stored as they are in .skel files
+// (see assets::SkeletonHeader) and used in place
+enum class Interpolation : uint32_t {
 	LINEAR,
 	STEP,
 	CUBICSPLINE
@@ -100,54 +190,71 @@ enum class NodeProperty {
 };
 
 struct AnimationChannel {
-	enum PathType { TRANSLATION, ROTATION, SCALE };
+	enum PathType : uint32_t { TRANSLATION, ROTATION, SCALE };
 	PathType path;
 	uint32_t nodeIdx;
+	// relative to the animation's firstSampler
 	uint32_t samplerIndex;
-
-	template<class Archive>
-	void serialize(Archive& archive)
-	{
-		archive(path, nodeIdx, samplerIndex); // serialize things by passing them to the archive
-	}
 };
 
+// Keys are stored as three uint16_t each. Rotations use smallest-three: the largest quaternion component is dropped
+// and rebuilt from the other three, which are 15 bit fixed point in [-1/sqrt(2), 1/sqrt(2)], with its index in the top
+// bits of the first two. Translations and scales are 16 bit fixed point between rangeMin and rangeMin + rangeExtent
 struct AnimationSampler {
 	Interpolation interpolation;
-	std::vector<float> inputs;
-	std::vector<glm::vec4> outputsVec4;
+	// first key in the skeleton's time and key arrays, times are in ticks of Animation::timeStep
+	uint32_t firstKey;
+	uint32_t keyCount;
+	float rangeMin[3];
+	float rangeExtent[3];
+
+	// key points at the three uint16_t of a key
+	static glm::quat rotationKey(const uint16_t* key)
+	{
+		uint32_t largest{ (uint32_t)(key[0] >> 15) | (uint32_t)(key[1] >> 15) << 1 };
+
+		float q[4];
+		float sum{ 0.0f };
+		for (uint32_t i = 0, k = 0; i < 4; ++i) {
+			if (i == largest) continue;
+			q[i] = ((float)(key[k++] & 0x7fff) - 16383.0f) * (0.70710678f / 16383.0f);
+			sum += q[i] * q[i];
+		}
+		q[largest] = std::sqrt(std::max(0.0f, 1.0f - sum));
+
+		return glm::quat{ q[3], q[0], q[1], q[2] };
+	}
 
-	template<class Archive>
-	void serialize(Archive& archive)
+	glm::vec3 vectorKey(const uint16_t* key) const
 	{
-		archive(interpolation, inputs, outputsVec4); // serialize things by passing them to the archive
+		return glm::vec3{ rangeMin[0], rangeMin[1], rangeMin[2] }
+			+ glm::vec3{ rangeExtent[0], rangeExtent[1], rangeExtent[2] } * (glm::vec3{ key[0], key[1], key[2] } * (1.0f / 65535.0f));
 	}
 };
 
 struct Animation {
-	std::string name;
-	std::vector<AnimationSampler> samplers;
-	std::vector<AnimationChannel> channels;
-	float start = std::numeric_limits<float>::max();
-	float end = std::numeric_limits<float>::min();
-	float currentTime{ 0.0f };
-
-	template<class Archive>
-	void serialize(Archive& archive)
-	{
-		archive(name, samplers, channels, start, end); // serialize things by passing them to the archive
-	}
+	// name in the skeleton's string table
+	uint32_t nameOffset;
+	uint32_t nameLength;
+	float start;
+	float end;
+	// seconds per tick of the sampler times, the frame rate the animation was sampled at when it has one
+	float timeStep;
+	// ranges of the skeleton's samplers and channels
+	uint32_t firstSampler;
+	uint32_t samplerCount;
+	uint32_t firstChannel;
+	uint32_t channelCount;
 };
 
 struct Mesh;
 struct RenderObject;
 
 struct Node {
+	// nullptr for roots. Nodes are ordered so a node's descendants directly follow it, parents first
 	Node* parent;
-	std::vector<Node*> children;
 	glm::mat4 matrix;
 	glm::mat4 cachedMatrix;
-	std::string name;
 	glm::vec3 translation{};
 	glm::vec3 scale{ 1.0f };
 	glm::quat rotation{};
@@ -161,15 +268,43 @@ struct Node {
 };
 
 struct SkeletalAnimationData {
+	// the .skel file the pointers below point into, when it isn't used in place out of the asset archive
+	assets::MappedFile mapping;
+	std::vector<char> fileData;
+
+	const Animation* animations{};
+	uint32_t animationCount{ 0 };
+	const AnimationSampler* samplers{};
+	const AnimationChannel* channels{};
+	const uint16_t* times{};
+	const uint16_t* keys{};
+	const char* strings{};
+
+	// one per animation, shared by every instance playing it
+	std::vector<KeyframeIndex> keyIndices;
+
+	// pose of every node of the skeleton, which the active animation writes to
 	std::vector<Node> nodes;
-	std::vector<Animation> animations;
 	std::vector<Skin> skins;
-	std::unordered_map<std::string, uint32_t> animNameToIndex;
 
 	// Blender sets all interpolation to linear when "always sample animation" is enabled
 	// so this option allows step interpolation even when you need to sample animation in Blender
 	// (for example, when using bone constraints)
 	bool forceStepInterpolation{ false };
+
+	std::string_view animationName(uint32_t index) const
+	{
+		return std::string_view{ strings + animations[index].nameOffset, animations[index].nameLength };
+	}
+
+	// -1 if there is no animation called name
+	int32_t findAnimation(std::string_view name) const
+	{
+		for (uint32_t i = 0; i < animationCount; ++i) {
+			if (animationName(i) == name) return (int32_t)i;
+		}
+		return -1;
+	}
 };
 
 // ------------------------------------------------------------------------------------------ //
@@ -178,13 +313,18 @@ struct SkeletalAnimationData {
 
 struct Mesh {
 	VertexFormat vertexFormat;
-	// vertex data on CPU
-	std::vector<Vertex> vertices;
-	std::vector<VertexSkinned> verticesSkinned;
-	std::vector<uint16_t> indices;
-	// vertex data on GPU
+	// vertex data only lives on the GPU, it's decompressed straight into the staging buffer
+	VkIndexType indexType;
+	// maps quantized positions back to mesh space. Folded into the object matrix, or into the joint matrices of skinned meshes
+	glm::mat4 positionTransform{ 1.0f };
 	AllocatedBuffer vertexBuffer;
 	AllocatedBuffer indexBuffer;
+	// every submesh is drawn from the same vertex and index buffer, so a whole model needs a single bind
+	std::vector<Submesh> submeshes;
+	// levels of detail of all submeshes, each submesh has at least one
+	std::vector<MeshLod> lods;
+	// empty unless the mesh was baked with -meshlets. Kept on the CPU, which culls them before drawing
+	std::vector<Meshlet> meshlets;
 
 	SkeletalAnimationData skel;
 };
@@ -196,6 +336,14 @@ struct MeshBounds {
 	float extents[3];
 };
 
+// Quantized positions are stored as (position - origin) / scale, which keeps every component within [-1, 1].
+// The scale is the same on every axis so the dequantization doesn't skew normals
+inline float positionQuantizationScale(const MeshBounds& bounds)
+{
+	float scale{ std::max(bounds.extents[0], std::max(bounds.extents[1], bounds.extents[2])) };
+	return scale > 0.0f ? scale : 1.0f;
+}
+
 // ------------------------------------------------------------------------------------------ //
 //                                         Material                                           //
 // ------------------------------------------------------------------------------------------ //
@@ -213,7 +361,11 @@ struct Material {
 	// analogous to instance of descriptor set layout, which is why it's per material
 	VkDescriptorSet textureSet;
 	VkPipeline pipeline;
+	// same shaders and layout as pipeline, reading the quantized vertex formats
+	VkPipeline pipelineQuantized;
 	VkPipelineLayout pipelineLayout;
+
+	VkPipeline pipelineFor(VertexFormat format) const { return isQuantized(format) ? pipelineQuantized : pipeline; }
 };
 
 struct MaterialCreateInfo {
@@ -231,6 +383,10 @@ struct RenderObject {
 	mutable bool castShadow;
 	mutable bool visible;
 	mutable int32_t activeAnimation;
+	// seconds into the active animation
+	mutable float animationTime;
+	// key each sampler of the active animation was at last update, see KeyframeIndex
+	mutable std::vector<uint32_t> keyCursors;
 
 	struct RenderObjectUB {
 		mutable glm::mat4 transformMatrix;
@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 
 #include "vk_initializers.h"
 #include "asset_loader.h"
@@ -16,6 +17,24 @@ uint32_t vkutil::getMipLevels(uint32_t width, uint32_t height)
 	return static_cast<uint32_t>(std::floor(std::log2((std::max(width, height))))) + 1;
 }
 
+VkComponentMapping vkutil::textureSwizzle(VkFormat format)
+{
+	VkComponentMapping mapping{};
+
+	switch (format) {
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+		mapping.r = VK_COMPONENT_SWIZZLE_R;
+		mapping.g = VK_COMPONENT_SWIZZLE_R;
+		mapping.b = VK_COMPONENT_SWIZZLE_R;
+		mapping.a = VK_COMPONENT_SWIZZLE_ONE;
+		break;
+	default:
+		break;
+	}
+
+	return mapping;
+}
+
 VkExtent2D vkutil::nextMipLevelExtent(VkExtent2D extent)
 {
 	extent.width = extent.width > 1 ? extent.width / 2 : 1;
@@ -144,7 +163,7 @@ void uploadImage(VulkanEngine& engine, assets::TextureInfo info, VkFormat format
 
 		for (int i{ 0 }; i < info.miplevels; ++i) {
 			VkBufferImageCopy copyRegion{};
-			copyRegion.bufferOffset = offset * 4; // multiply by 4 since texel is 4 bytes
+			copyRegion.bufferOffset = offset;
 			copyRegion.bufferRowLength = 0;
 			copyRegion.bufferImageHeight = 0;
 			copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -156,9 +175,9 @@ void uploadImage(VulkanEngine& engine, assets::TextureInfo info, VkFormat format
 			copyRegions.push_back(copyRegion);
 
 			// halve dimensions of image for each mipmap level
-			offset += (VkDeviceSize)extent.width * extent.height;
-			extent.width >>= 1;
-			extent.height >>= 1;
+			offset += assets::textureLevelSize(info.textureFormat, extent.width, extent.height);
+			extent.width = std::max(1u, extent.width >> 1);
+			extent.height = std::max(1u, extent.height >> 1);
 		}
 
 		// copy the buffer into the image
@@ -190,17 +209,16 @@ void uploadImage(VulkanEngine& engine, assets::TextureInfo info, VkFormat format
 	outImage = newImage;
 }
 
-bool vkutil::loadImageFromAsset(VulkanEngine& engine, const char* path, VkFormat format, uint32_t* outMipLevels, AllocatedImage& outImage)
+bool vkutil::loadImageFromAsset(VulkanEngine& engine, const char* path, VkFormat& format, uint32_t* outMipLevels, AllocatedImage& outImage)
 {
 	ZoneScoped;
-	assets::AssetFile file;
-	nlohmann::json metadata;
+	assets::AssetFileView fileView;
+	assets::AssetMetadata metadata;
+	assets::IoHandle read;
 
 	{
 		ZoneScopedN("load_binaryfile");
-		bool loaded{ assets::loadBinaryFile(path, file, metadata) };
-
-		if (!loaded) {
+		if (!engine.acquireAsset(path, fileView, metadata, read)) {
 			std::cout << "Error when loading image\n";
 			return false;
 		}
@@ -214,6 +232,14 @@ bool vkutil::loadImageFromAsset(VulkanEngine& engine, const char* path, VkFormat
 
 	*outMipLevels = (uint32_t)texInfo.miplevels;
 
+	// the baker decided between sRGB and linear when it encoded the texture and generated its mips, so the image is
+	// always created in the format it was baked in
+	bool srgb{ assets::isSrgb(texInfo.textureFormat) };
+	if (srgb != (format == VK_FORMAT_R8G8B8A8_SRGB)) {
+		std::cout << "Warning: material reads " << path << " as " << (srgb ? "linear" : "sRGB") << " but it was baked as "
+			<< (srgb ? "sRGB" : "linear") << ", using the baked format\n";
+	}
+
 	VkFormat image_format;
 	switch (texInfo.textureFormat) {
 
@@ -223,23 +249,64 @@ bool vkutil::loadImageFromAsset(VulkanEngine& engine, const char* path, VkFormat
 	case assets::TextureFormat::SRGBA8:
 		image_format = VK_FORMAT_R8G8B8A8_SRGB;
 		break;
+	case assets::TextureFormat::BC1:
+		image_format = VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+		break;
+	case assets::TextureFormat::BC1_SRGB:
+		image_format = VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+		break;
+	case assets::TextureFormat::BC3:
+		image_format = VK_FORMAT_BC3_UNORM_BLOCK;
+		break;
+	case assets::TextureFormat::BC3_SRGB:
+		image_format = VK_FORMAT_BC3_SRGB_BLOCK;
+		break;
+	case assets::TextureFormat::BC4:
+		image_format = VK_FORMAT_BC4_UNORM_BLOCK;
+		break;
+	case assets::TextureFormat::BC5:
+		image_format = VK_FORMAT_BC5_UNORM_BLOCK;
+		break;
+	case assets::TextureFormat::BC7:
+		image_format = VK_FORMAT_BC7_UNORM_BLOCK;
+		break;
+	case assets::TextureFormat::BC7_SRGB:
+		image_format = VK_FORMAT_BC7_SRGB_BLOCK;
+		break;
 	default:
 		return false;
 	}
+	format = image_format;
+
+	if (assets::isBlockCompressed(texInfo.textureFormat) && !engine._textureCompressionBC) {
+		std::cout << "Error: " << path << " is block compressed but the GPU does not support BC textures, bake it with -no-texture-compression\n";
+		return false;
+	}
+
+	if (fileView.uncompressedBlobSize > texInfo.originalSize) {
+		std::cout << "Error: texture blob is larger than the texture " << path << '\n';
+		return false;
+	}
 
 	AllocatedBuffer stagingBuffer{ engine.createBuffer(texInfo.originalSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY) };
 
 	void* data;
 	vmaMapMemory(engine._allocator, stagingBuffer._allocation, &data);
 
+	bool unpacked{ true };
 	{
 		ZoneScopedN("unpack_texture");
-		//assets::unpackTexture(file.binaryBlob.data(), (char*)data, texInfo.compressedSize, texInfo.originalSize);
-		assets::unpackTexture(file.binaryBlob.data(), file.binaryBlob.size(), data);
+		// decompressed straight into the staging buffer, without an intermediate copy
+		unpacked = assets::readBlob(fileView, texInfo.compressionMode, data);
 	}
 
 	vmaUnmapMemory(engine._allocator, stagingBuffer._allocation);
 
+	if (!unpacked) {
+		std::cout << "Error when decompressing image " << path << '\n';
+		vmaDestroyBuffer(engine._allocator, stagingBuffer._buffer, stagingBuffer._allocation);
+		return false;
+	}
 
 	//outImage = upload_image(textureInfo.pixelsize[0], textureInfo.pixelsize[1], image_format, engine, stagingBuffer);
 	uploadImage(engine, texInfo, format, stagingBuffer, outImage);
@@ -5,7 +5,8 @@
 
 namespace vkutil {
 
-	bool loadImageFromAsset(VulkanEngine& engine, const char* filename, VkFormat format, uint32_t* outMipLevels, AllocatedImage& outImage);
+	// format is the one the material asks for, block compressed textures replace it with the format they were baked in
+	bool loadImageFromAsset(VulkanEngine& engine, const char* filename, VkFormat& format, uint32_t* outMipLevels, AllocatedImage& outImage);
 
 	bool loadImageFromFile(VulkanEngine& engine, const char* file, AllocatedImage& outImage, uint32_t* outMipLevels, VkFormat format);
 
@@ -14,4 +15,8 @@ namespace vkutil {
 	uint32_t getMipLevels(uint32_t width, uint32_t height);
 
 	VkExtent2D nextMipLevelExtent(VkExtent2D extent);
+
+	// BC4 textures only store one channel, which would leave the others reading as 0. Broadcast BC4 masks to rgb so
+	// shaders written for RGBA8 textures keep working
+	VkComponentMapping textureSwizzle(VkFormat format);
 }
\ No newline at end of file